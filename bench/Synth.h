@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// which alphabet generated identifiers are spelled in. both spell the same number
+// of characters per name, so the only difference is utf-8 width
+enum class IdentStyle { ASCII, ARABIC };
+
+// the shapes a corpus can stress
+enum class Shape {
+    CHAINS,  // long operator chains
+    NESTING, // deeply nested scopes and ifs
+    ELIF,    // long اذا / واذا chains
+    DECLS,   // thousands of functions and globals calling and reading each other
+};
+
+inline constexpr std::string_view shapeName(Shape shape) {
+    switch (shape) {
+        case Shape::CHAINS:  return "chains";
+        case Shape::NESTING: return "nesting";
+        case Shape::ELIF:    return "elif";
+        case Shape::DECLS:   return "decls";
+    }
+    return "";
+}
+
+// writes valid .dhad programs whose size grows linearly with scale. the output
+// only depends on the arguments, so corpora compare across commits
+class Synth {
+public:
+    Synth(Shape shape, IdentStyle style, unsigned scale)
+        : m_shape(shape), m_style(style), m_scale(scale == 0 ? 1 : scale) {}
+
+    std::string generate() {
+        m_out.clear();
+        m_seed = 0x9E3779B97F4A7C15;
+        switch (m_shape) {
+            case Shape::CHAINS:  chains(); break;
+            case Shape::NESTING: nesting(); break;
+            case Shape::ELIF:    elif(); break;
+            case Shape::DECLS:   decls(); break;
+        }
+        return std::move(m_out);
+    }
+
+private:
+    static constexpr unsigned INPUTS = 16;
+
+    // inputs come from اقرأ so nothing folds away before the generator sees it
+    void inputs() {
+        for (unsigned i = 0; i < INPUTS; ++i) {
+            m_out += "دع " + name("in", i) + " = اقرأ();\n";
+        }
+    }
+
+    void chains() {
+        inputs();
+        static constexpr std::string_view OPS[] = {" + ", " - ", " * ", " / ", " % ", " + ", " - "};
+        for (unsigned s = 0; s < 200 * m_scale; ++s) {
+            m_out += "دع " + name("acc", s) + " = ";
+            for (unsigned i = 0; i < 64; ++i) {
+                if (i > 0) {
+                    m_out += OPS[next() % std::size(OPS)];
+                }
+                operand(s);
+            }
+            m_out += ";\n";
+        }
+        m_out += "خروج(" + name("acc", 200 * m_scale - 1) + ");\n";
+    }
+
+    // a divisor is always a nonzero literal, everything else an input or an earlier result
+    void operand(unsigned stmt) {
+        bool divisor = m_out.ends_with(" / ") || m_out.ends_with(" % ");
+        uint64_t pick = next() % 4;
+        if (divisor || pick == 0) {
+            m_out += std::to_string(1 + next() % 97);
+        }
+        else if (pick == 1 && stmt > 0) {
+            m_out += name("acc", static_cast<unsigned>(next() % stmt));
+        }
+        else if (pick == 2) {
+            m_out += "(" + name("in", next() % INPUTS) + " - " + std::to_string(next() % 10) + ")";
+        }
+        else {
+            m_out += name("in", next() % INPUTS);
+        }
+    }
+
+    void nesting() {
+        inputs();
+        static constexpr unsigned DEPTH = 48;
+        m_out += "دع " + name("sum", 0) + " = 0;\n";
+        for (unsigned b = 0; b < 40 * m_scale; ++b) {
+            for (unsigned d = 0; d < DEPTH; ++d) {
+                indent(d);
+                if (d % 3 == 0) {
+                    m_out += "{\n";
+                }
+                else if (d % 3 == 1) {
+                    m_out += "اذا (" + name("in", d % INPUTS) + " > " + std::to_string(d) + ") {\n";
+                }
+                else {
+                    m_out += "بينما (" + name("in", d % INPUTS) + " < 0) {\n";
+                }
+                indent(d + 1);
+                m_out += "دع " + name("lv", d) + " = " + name("in", (d + b) % INPUTS) + " + " + std::to_string(d) + ";\n";
+                indent(d + 1);
+                m_out += name("sum", 0) + " = " + name("sum", 0) + " + " + name("lv", d) + ";\n";
+            }
+            for (unsigned d = DEPTH; d-- > 0;) {
+                indent(d);
+                m_out += "}\n";
+            }
+        }
+        m_out += "خروج(" + name("sum", 0) + ");\n";
+    }
+
+    void elif() {
+        inputs();
+        m_out += "دع " + name("out", 0) + " = 0;\n";
+        for (unsigned c = 0; c < 8 * m_scale; ++c) {
+            for (unsigned i = 0; i < 100; ++i) {
+                m_out += i == 0 ? "اذا" : "} واذا";
+                m_out += " (" + name("in", c % INPUTS) + " == " + std::to_string(i) + ") {\n";
+                m_out += "    " + name("out", 0) + " = " + name("out", 0) + " * " + std::to_string(i + 3) + " + " + name("in", i % INPUTS) + ";\n";
+            }
+            m_out += "} وإلا {\n    " + name("out", 0) + " = " + name("out", 0) + " - 1;\n}\n";
+        }
+        m_out += "خروج(" + name("out", 0) + ");\n";
+    }
+
+    // every function reads a few globals and calls one declared before it
+    void decls() {
+        inputs();
+        unsigned globals = 1000 * m_scale;
+        unsigned funcs = 1000 * m_scale;
+        for (unsigned g = 0; g < globals; ++g) {
+            m_out += "دع " + name("glob", g) + " = " + (g % 2 == 0 ? std::to_string(g) : name("in", g % INPUTS)) + ";\n";
+        }
+        for (unsigned f = 0; f < funcs; ++f) {
+            m_out += name("fn", f) + "(" + name("p", 0) + ", " + name("p", 1) + ") {\n";
+            m_out += "    دع " + name("t", 0) + " = " + name("p", 0) + " * " + name("glob", next() % globals) +
+                     " + " + name("p", 1) + " - " + name("glob", next() % globals) + ";\n";
+            if (f > 0) {
+                m_out += "    اذا (" + name("t", 0) + " > " + name("glob", next() % globals) + ") {\n";
+                m_out += "        ارجع " + name("fn", next() % f) + "(" + name("t", 0) + ", " + name("p", 0) + ");\n";
+                m_out += "    }\n";
+            }
+            m_out += "    ارجع " + name("t", 0) + " + " + std::to_string(f) + ";\n}\n";
+        }
+        m_out += "اطبع(" + name("fn", funcs - 1) + "(" + name("in", 0) + ", " + name("in", 1) + "));\n";
+    }
+
+    // prefix then the number in base 26, the same characters either way
+    std::string name(std::string_view prefix, uint64_t n) const {
+        static constexpr std::string_view ARABIC[] = {
+            "ب", "ت", "ث", "ج", "ح", "خ", "د", "ذ", "ر", "ز", "س", "ش", "ص",
+            "ض", "ط", "ظ", "ع", "غ", "ف", "ق", "ك", "ل", "م", "ن", "ه", "ي",
+        };
+        std::string out;
+        for (char c : prefix) {
+            appendLetter(out, static_cast<unsigned>(c - 'a') % 26, ARABIC);
+        }
+        do {
+            appendLetter(out, static_cast<unsigned>(n % 26), ARABIC);
+            n /= 26;
+        } while (n > 0);
+        return out;
+    }
+
+    void appendLetter(std::string& out, unsigned letter, const std::string_view (&arabic)[26]) const {
+        if (m_style == IdentStyle::ARABIC) {
+            out += arabic[letter];
+        }
+        else {
+            out.push_back(static_cast<char>('a' + letter));
+        }
+    }
+
+    void indent(unsigned depth) {
+        m_out.append(depth * 4, ' ');
+    }
+
+    // splitmix64, so corpora don't depend on the standard library's engines
+    uint64_t next() {
+        uint64_t z = (m_seed += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        return z ^ (z >> 31);
+    }
+
+private:
+    Shape m_shape;
+    IdentStyle m_style;
+    unsigned m_scale;
+    uint64_t m_seed = 0;
+    std::string m_out;
+};
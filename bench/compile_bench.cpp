@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../src/NodeCounter.h"
+#include "../src/Project.h"
+#include "Synth.h"
+
+// compiler throughput on generated corpora: tokenizer, parser and generator timed
+// apart, each the median of --reps runs. prints one json document on stdout whose
+// keys and their order only change together with "schema"
+
+struct PhaseTimes {
+    double median;
+    double min;
+};
+
+// ms of fn over reps runs, after one untimed warm up
+template<typename Fn>
+PhaseTimes timeReps(unsigned reps, Fn fn) {
+    fn();
+    std::vector<double> ms;
+    for (unsigned i = 0; i < reps; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+        ms.push_back(took.count());
+    }
+    std::sort(ms.begin(), ms.end());
+    return {ms[ms.size() / 2], ms.front()};
+}
+
+struct Corpus {
+    Shape shape;
+    IdentStyle style;
+    std::string source;
+};
+
+struct BenchOptions {
+    unsigned scale = 4;
+    unsigned reps = 5;
+    std::string emitDir;
+    std::vector<std::string> only;
+};
+
+std::string corpusName(const Corpus& corpus) {
+    return std::string(shapeName(corpus.shape)) + (corpus.style == IdentStyle::ARABIC ? "-arabic" : "-ascii");
+}
+
+void printPhase(const char* name, PhaseTimes t, double mb, size_t items, const char* unit, bool last) {
+    std::printf("      \"%s\": {\"ms_median\": %.3f, \"ms_min\": %.3f, \"mb_per_s\": %.2f, \"%s_per_s\": %.0f}%s\n",
+                name, t.median, t.min, mb / (t.median / 1000), unit, static_cast<double>(items) / (t.median / 1000), last ? "" : ",");
+}
+
+void bench(const Corpus& corpus, unsigned reps, bool last) {
+    const std::string& source = corpus.source;
+    double mb = static_cast<double>(source.size()) / (1024 * 1024);
+
+    std::vector<Token> tokens;
+    PhaseTimes tokenize = timeReps(reps, [&]() {
+        std::u32string contents = utf8ToU32(source);
+        tokens = Tokenizer(contents, contents.size()).tokenize();
+    });
+
+    // each run parses a fresh copy, made outside the timing
+    std::vector<std::unique_ptr<Parser>> parsers;
+    for (unsigned i = 0; i <= reps; ++i) {
+        parsers.push_back(std::make_unique<Parser>(tokens));
+    }
+    NodeProg prog;
+    size_t run = 0;
+    PhaseTimes parse = timeReps(reps, [&]() {
+        auto parsed = parsers[run++]->parseProg();
+        if (!parsed) {
+            std::cerr << corpusName(corpus) << ": invalid program\n";
+            exit(1);
+        }
+        prog = parsed.value();
+    });
+    size_t nodes = NodeCounter().count(prog);
+
+    GenOptions options = Pipeline().gen();
+    size_t insts = 0;
+    PhaseTimes generate = timeReps(reps, [&]() {
+        insts = Generator(prog, options).genProg().text.size();
+    });
+
+    size_t lines = static_cast<size_t>(std::count(source.begin(), source.end(), '\n'));
+    std::printf("    {\n");
+    std::printf("      \"name\": \"%s\",\n", corpusName(corpus).c_str());
+    std::printf("      \"bytes\": %zu, \"lines\": %zu, \"tokens\": %zu, \"nodes\": %zu, \"insts\": %zu,\n",
+                source.size(), lines, tokens.size(), nodes, insts);
+    printPhase("tokenizer", tokenize, mb, tokens.size(), "tokens", false);
+    printPhase("parser", parse, mb, nodes, "nodes", false);
+    printPhase("generator", generate, mb, nodes, "nodes", true);
+    std::printf("    }%s\n", last ? "" : ",");
+}
+
+BenchOptions parseBenchArgs(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.starts_with("--scale=")) {
+            options.scale = static_cast<unsigned>(std::stoul(arg.substr(8)));
+        }
+        else if (arg.starts_with("--reps=")) {
+            options.reps = std::max(1u, static_cast<unsigned>(std::stoul(arg.substr(7))));
+        }
+        else if (arg.starts_with("--emit-corpus=")) {
+            options.emitDir = arg.substr(14);
+        }
+        else if (arg.starts_with("--only=")) {
+            options.only.push_back(arg.substr(7));
+        }
+        else {
+            std::cerr << "usage: compile_bench [--scale=N] [--reps=N] [--only=NAME]... [--emit-corpus=DIR]\n";
+            exit(1);
+        }
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options = parseBenchArgs(argc, argv);
+
+    std::vector<Corpus> corpora;
+    for (Shape shape : {Shape::CHAINS, Shape::NESTING, Shape::ELIF, Shape::DECLS}) {
+        for (IdentStyle style : {IdentStyle::ASCII, IdentStyle::ARABIC}) {
+            Corpus corpus{shape, style, {}};
+            std::string name = corpusName(corpus);
+            bool wanted = options.only.empty() || std::any_of(options.only.begin(), options.only.end(), [&name](const std::string& only) {
+                return name.starts_with(only);
+            });
+            if (wanted) {
+                corpus.source = Synth(shape, style, options.scale).generate();
+                corpora.push_back(std::move(corpus));
+            }
+        }
+    }
+
+    // the same programs as .dhad files, to time the whole compiler on
+    if (!options.emitDir.empty()) {
+        std::filesystem::create_directories(options.emitDir);
+        for (const Corpus& corpus : corpora) {
+            std::ofstream(std::filesystem::path(options.emitDir) / (corpusName(corpus) + ".dhad")) << corpus.source;
+        }
+        return 0;
+    }
+
+    std::printf("{\n  \"schema\": 1,\n  \"scale\": %u,\n  \"reps\": %u,\n  \"corpora\": [\n", options.scale, options.reps);
+    for (size_t i = 0; i < corpora.size(); ++i) {
+        bench(corpora[i], options.reps, i + 1 == corpora.size());
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,252 @@
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+// how fast the executables dhad writes run: every kernel in bench/kernels is built
+// at each -O level, run --reps times and measured for wall time and, where the
+// kernel lets us, cycles, instructions and branch misses of the program alone.
+// exits 1 if a kernel's exit status differs between levels. prints one json
+// document on stdout whose keys and their order only change together with "schema"
+
+static constexpr std::array<const char*, 4> LEVELS = {"-O0", "-O1", "-O2", "-Os"};
+
+// the hardware counters, in the order they're reported
+static constexpr std::array<std::pair<const char*, uint64_t>, 3> COUNTERS = {{
+    {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch_misses", PERF_COUNT_HW_BRANCH_MISSES},
+}};
+
+struct RunResult {
+    int status;
+    double ms;
+    std::optional<std::array<uint64_t, COUNTERS.size()>> counters;
+};
+
+// user space counts of one process and the worker threads it starts, enabled as
+// it execs so the fork and the runner itself aren't in them. empty when the
+// kernel or the machine has no pmu
+class PerfGroup {
+public:
+    explicit PerfGroup(pid_t pid) {
+        for (size_t i = 0; i < COUNTERS.size(); ++i) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = COUNTERS[i].second;
+            attr.disabled = i == 0;
+            attr.enable_on_exec = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.inherit = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+
+            int group = m_fds.empty() ? -1 : m_fds.front();
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1, group, 0));
+            if (fd < 0) {
+                close();
+                return;
+            }
+            m_fds.push_back(fd);
+        }
+    }
+
+    ~PerfGroup() {
+        close();
+    }
+
+    std::optional<std::array<uint64_t, COUNTERS.size()>> read() const {
+        if (m_fds.empty()) {
+            return {};
+        }
+        uint64_t buf[1 + COUNTERS.size()];
+        if (::read(m_fds.front(), buf, sizeof(buf)) != static_cast<ssize_t>(sizeof(buf)) || buf[0] != COUNTERS.size()) {
+            return {};
+        }
+        std::array<uint64_t, COUNTERS.size()> values;
+        std::copy(buf + 1, buf + 1 + COUNTERS.size(), values.begin());
+        return values;
+    }
+
+private:
+    void close() {
+        for (int fd : m_fds) {
+            ::close(fd);
+        }
+        m_fds.clear();
+    }
+
+    std::vector<int> m_fds;
+};
+
+// runs argv with stdin and stdout on /dev/null, returning its exit status, or
+// 128 + the signal that ended it like a shell reports it
+RunResult execute(const std::vector<std::string>& argv, bool count) {
+    int go[2];
+    if (pipe(go) != 0) {
+        std::cerr << "pipe failed: " << std::strerror(errno) << "\n";
+        exit(1);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // waits until the counters are attached
+        ::close(go[1]);
+        char c;
+        while (::read(go[0], &c, 1) < 0 && errno == EINTR) {}
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+
+        std::vector<char*> args;
+        for (const std::string& arg : argv) {
+            args.push_back(const_cast<char*>(arg.c_str()));
+        }
+        args.push_back(nullptr);
+        execv(args[0], args.data());
+        _exit(127);
+    }
+
+    ::close(go[0]);
+    std::optional<PerfGroup> perf;
+    if (count) {
+        perf.emplace(pid);
+    }
+    auto start = std::chrono::steady_clock::now();
+    ::close(go[1]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+
+    RunResult result{WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status), took.count(), {}};
+    if (perf) {
+        result.counters = perf->read();
+    }
+    return result;
+}
+
+template<typename T>
+T median(std::vector<T> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+struct BenchOptions {
+    std::string dhad = "./dhad";
+    std::string kernels = "bench/kernels";
+    unsigned reps = 5;
+    std::vector<std::string> only;
+};
+
+BenchOptions parseBenchArgs(int argc, char* argv[]) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.starts_with("--dhad=")) {
+            options.dhad = arg.substr(7);
+        }
+        else if (arg.starts_with("--kernels=")) {
+            options.kernels = arg.substr(10);
+        }
+        else if (arg.starts_with("--reps=")) {
+            options.reps = std::max(1u, static_cast<unsigned>(std::stoul(arg.substr(7))));
+        }
+        else if (arg.starts_with("--only=")) {
+            options.only.push_back(arg.substr(7));
+        }
+        else {
+            std::cerr << "usage: run_bench [--dhad=PATH] [--kernels=DIR] [--reps=N] [--only=NAME]...\n";
+            exit(1);
+        }
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options = parseBenchArgs(argc, argv);
+    std::string dhad = std::filesystem::absolute(options.dhad).string();
+
+    std::vector<std::filesystem::path> kernels;
+    for (const auto& entry : std::filesystem::directory_iterator(options.kernels)) {
+        std::string name = entry.path().stem().string();
+        bool wanted = options.only.empty() || std::find(options.only.begin(), options.only.end(), name) != options.only.end();
+        if (entry.path().extension() == ".dhad" && wanted) {
+            kernels.push_back(entry.path());
+        }
+    }
+    std::sort(kernels.begin(), kernels.end());
+
+    auto exe = std::filesystem::temp_directory_path() / ("dhad-bench-" + std::to_string(getpid()));
+    bool mismatch = false;
+
+    std::printf("{\n  \"schema\": 1,\n  \"reps\": %u,\n  \"kernels\": [\n", options.reps);
+    for (size_t k = 0; k < kernels.size(); ++k) {
+        std::string name = kernels[k].stem().string();
+        std::printf("    {\n      \"name\": \"%s\",\n", name.c_str());
+
+        std::optional<int> expected;
+        for (size_t l = 0; l < LEVELS.size(); ++l) {
+            RunResult built = execute({dhad, kernels[k].string(), LEVELS[l], "--no-cache", "-o", exe.string()}, false);
+            if (built.status != 0) {
+                std::cerr << name << ": dhad " << LEVELS[l] << " failed\n";
+                exit(1);
+            }
+
+            std::vector<int> statuses;
+            std::vector<double> ms;
+            std::vector<std::vector<uint64_t>> counts(COUNTERS.size());
+            bool counted = true;
+            execute({exe.string()}, false); // warm up
+            for (unsigned r = 0; r < options.reps; ++r) {
+                RunResult run = execute({exe.string()}, true);
+                statuses.push_back(run.status);
+                ms.push_back(run.ms);
+                counted = counted && run.counters;
+                for (size_t c = 0; counted && c < COUNTERS.size(); ++c) {
+                    counts[c].push_back(run.counters.value()[c]);
+                }
+            }
+
+            bool stable = std::all_of(statuses.begin(), statuses.end(), [&statuses](int s) { return s == statuses.front(); });
+            if (!expected) {
+                expected = statuses.front();
+            }
+            if (!stable || statuses.front() != expected) {
+                std::cerr << name << ": exit status " << statuses.front() << " at " << LEVELS[l] << ", expected " << expected.value() << "\n";
+                mismatch = true;
+            }
+
+            std::printf("      \"%s\": {\"exit\": %d, \"ms_median\": %.3f, \"ms_min\": %.3f", LEVELS[l] + 1, statuses.front(),
+                        median(ms), *std::min_element(ms.begin(), ms.end()));
+            for (size_t c = 0; c < COUNTERS.size(); ++c) {
+                if (counted) {
+                    std::printf(", \"%s\": %llu", COUNTERS[c].first, static_cast<unsigned long long>(median(counts[c])));
+                }
+                else {
+                    std::printf(", \"%s\": null", COUNTERS[c].first);
+                }
+            }
+            std::printf("}%s\n", l + 1 == LEVELS.size() ? "" : ",");
+        }
+        std::printf("    }%s\n", k + 1 == kernels.size() ? "" : ",");
+    }
+    std::printf("  ],\n  \"exit_codes_match\": %s\n}\n", mismatch ? "false" : "true");
+
+    std::filesystem::remove(exe);
+    return mismatch ? 1 : 0;
+}
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <string_view>
+
+#include "TextBuffer.h"
+
+enum class Reg : uint8_t {
+    RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// same numbering as the x86 condition code nibble
+enum class Cond : uint8_t {
+    O = 0, NO, B, AE, E, NE, BE, A,
+    S, NS, P, NP, L, GE, LE, G
+};
+
+// pairs differ only in the low bit
+inline Cond negate(Cond cc) {
+    return static_cast<Cond>(static_cast<uint8_t>(cc) ^ 1);
+}
+
+struct Label {
+    uint32_t id;
+};
+
+struct Imm {
+    int64_t val;
+};
+
+struct Operand {
+    enum class Kind : uint8_t { NONE, REG, IMM, MEM, LABEL };
+
+    Kind kind = Kind::NONE;
+    uint8_t size = 8;      // bytes, REG and MEM: 1, 2, 4 or 8. 16 is an xmm register or a 128 bit MEM
+    Reg reg{};             // REG, or MEM base
+    bool ripRel = false;   // MEM addressed as [rel label + val]
+    bool gs = false;       // MEM addressed as [gs:val], a field of the running thread's block
+    bool hasIndex = false; // MEM addressed as [reg + index * scale + val]
+    Reg index{};
+    uint8_t scale = 1;
+    int64_t val = 0;       // IMM, or MEM displacement
+    Label label{};         // LABEL, or rip relative MEM
+
+    Operand() = default;
+    Operand(Reg r) : kind(Kind::REG), reg(r) {}
+    Operand(Imm imm) : kind(Kind::IMM), val(imm.val) {}
+    Operand(Label l) : kind(Kind::LABEL), label(l) {}
+
+    bool isReg() const { return kind == Kind::REG; }
+    bool isImm() const { return kind == Kind::IMM; }
+    bool isMem() const { return kind == Kind::MEM; }
+};
+
+inline Operand qword(Reg base, int32_t disp = 0) {
+    Operand op;
+    op.kind = Operand::Kind::MEM;
+    op.reg = base;
+    op.val = disp;
+    return op;
+}
+
+inline Operand qword(Label label) {
+    Operand op;
+    op.kind = Operand::Kind::MEM;
+    op.ripRel = true;
+    op.label = label;
+    return op;
+}
+
+inline Operand gsQword(int32_t disp) {
+    Operand op;
+    op.kind = Operand::Kind::MEM;
+    op.gs = true;
+    op.val = disp;
+    return op;
+}
+
+inline Operand mem(uint8_t size, Reg base, int32_t disp = 0) {
+    Operand op = qword(base, disp);
+    op.size = size;
+    return op;
+}
+
+inline Operand mem(uint8_t size, Reg base, Reg index, uint8_t scale, int32_t disp = 0) {
+    Operand op = mem(size, base, disp);
+    op.hasIndex = true;
+    op.index = index;
+    op.scale = scale;
+    return op;
+}
+
+inline Operand low8(Reg r) {
+    Operand op(r);
+    op.size = 1;
+    return op;
+}
+
+inline Operand low16(Reg r) {
+    Operand op(r);
+    op.size = 2;
+    return op;
+}
+
+inline Operand low32(Reg r) {
+    Operand op(r);
+    op.size = 4;
+    return op;
+}
+
+inline Operand xmm(uint8_t n) {
+    Operand op(static_cast<Reg>(n));
+    op.size = 16;
+    return op;
+}
+
+inline Operand oword(Reg base, Reg index, uint8_t scale, int32_t disp = 0) {
+    return mem(16, base, index, scale, disp);
+}
+
+enum class Op : uint8_t {
+    LABEL, // binds dst.label here
+    ALIGN, // pads with nops up to a multiple of dst.val
+    LOC,   // what follows comes from source line dst.val, column src.val. 0 is no line
+    MOV,
+    MOVZX,
+    MOVSX, // movsxd from a dword
+    LEA,
+    PUSH,
+    POP,
+    ADD,
+    SUB,
+    AND,
+    OR,
+    XOR,
+    CMP,
+    TEST,
+    IMUL,
+    IMUL3, // dst = src * imm
+    MUL,
+    DIV,
+    IDIV,
+    NEG,
+    SHL,
+    SHR,
+    SAR,
+    CQO,
+    CDQ,
+    SETCC,
+    CMOVCC,
+    JMP,
+    JCC,
+    CALL, // a label, or a register or qword holding the address
+    RET,
+    LEAVE,
+    SYSCALL,
+    REP_STOSQ,
+    REP_STOSB,
+    // atomics, qwords in memory. xchg with memory is locked on its own
+    XCHG,
+    LOCK_ADD,
+    LOCK_XADD,
+    LOCK_CMPXCHG, // compares rax
+    PAUSE,
+    // sse2, two qword lanes
+    MOVDQU,
+    MOVQ,
+    PADDQ,
+    PSUBQ,
+    PXOR,
+    PUNPCKLQDQ,
+    PUNPCKHQDQ
+};
+
+struct Inst {
+    Op op;
+    Operand dst{};
+    Operand src{};
+    Cond cc = Cond::O; // SETCC, CMOVCC, JCC
+    int32_t imm = 0;   // IMUL3
+};
+
+struct BssDef {
+    Label label;
+    uint64_t qwords;
+};
+
+struct DataDef {
+    Label label;
+    std::vector<int64_t> qwords;
+};
+
+struct AsmProg {
+    std::vector<std::string> labels; // names, indexed by Label::id
+    std::vector<Inst> text;
+    std::vector<DataDef> rodata;
+    std::vector<DataDef> data;
+    std::vector<BssDef> bss;
+    Label entry;
+    std::vector<Label> globals; // visible to other modules at link time
+    std::vector<Label> externs; // bound by another module
+    std::vector<Label> funcs;   // code labels that start a function symbol, which runs to the next one
+    std::string debugFile;      // the source LOCs refer to, empty without debug info
+};
+
+// nasm syntax, for --emit=asm
+class AsmPrinter {
+public:
+    explicit AsmPrinter(const AsmProg& prog)
+        : m_prog(prog) {}
+
+    [[nodiscard]] TextBuffer print() {
+        TextBuffer out;
+
+        dataSection(out, ".rodata", m_prog.rodata);
+        dataSection(out, ".data", m_prog.data);
+
+        out << "section .bss\n";
+        for (const BssDef& def : m_prog.bss) {
+            out << name(def.label) << ":\n";
+            out << "    resq " << def.qwords << '\n';
+        }
+
+        out << "\nsection .text\n";
+        for (Label label : m_prog.externs) {
+            out << "extern " << name(label) << '\n';
+        }
+        for (const Inst& inst : m_prog.text) {
+            if (inst.op == Op::LABEL) {
+                if (isGlobal(inst.dst.label)) {
+                    out << "\nglobal " << name(inst.dst.label) << '\n';
+                }
+                out << name(inst.dst.label) << ":\n";
+                continue;
+            }
+            if (inst.op == Op::ALIGN) {
+                out << "align " << inst.dst.val << '\n';
+                continue;
+            }
+            if (inst.op == Op::LOC) {
+                out << "   ; line " << inst.dst.val << ':' << inst.src.val << '\n';
+                continue;
+            }
+
+            out << "   " << (inst.op == Op::MOVSX && inst.src.size == 4 ? "movsxd" : mnemonic(inst.op));
+            if (inst.op == Op::SETCC || inst.op == Op::CMOVCC || inst.op == Op::JCC) {
+                out << condName(inst.cc);
+            }
+            if (inst.dst.kind != Operand::Kind::NONE) {
+                out << ' ';
+                operand(out, inst.dst, inst.op);
+            }
+            if (inst.src.kind != Operand::Kind::NONE) {
+                out << ", ";
+                operand(out, inst.src, inst.op);
+            }
+            if (inst.op == Op::IMUL3) {
+                out << ", " << static_cast<int64_t>(inst.imm);
+            }
+            out << '\n';
+        }
+
+        return out;
+    }
+
+private:
+    void dataSection(TextBuffer& out, std::string_view section, const std::vector<DataDef>& defs) const {
+        if (defs.empty()) {
+            return;
+        }
+        out << "section " << section << '\n';
+        for (const DataDef& def : defs) {
+            out << name(def.label) << ":\n";
+            out << "    dq ";
+            for (size_t i = 0; i < def.qwords.size(); ++i) {
+                out << (i == 0 ? "" : ", ") << def.qwords[i];
+            }
+            out << '\n';
+        }
+        out << '\n';
+    }
+
+    bool isGlobal(Label label) const {
+        return std::any_of(m_prog.globals.begin(), m_prog.globals.end(),
+                           [label](Label global) { return global.id == label.id; });
+    }
+
+    std::string_view name(Label label) const {
+        return m_prog.labels.at(label.id);
+    }
+
+    static std::string_view regName(Reg reg, uint8_t size) {
+        static constexpr std::string_view q[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                                  "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+        static constexpr std::string_view d[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                                  "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+        static constexpr std::string_view w[] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+                                                  "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };
+        static constexpr std::string_view b[] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+                                                  "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
+        static constexpr std::string_view x[] = { "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",
+                                                  "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15" };
+        auto idx = static_cast<size_t>(reg);
+        return size == 1 ? b[idx] : size == 2 ? w[idx] : size == 4 ? d[idx] : size == 16 ? x[idx] : q[idx];
+    }
+
+    static std::string_view condName(Cond cc) {
+        static constexpr std::string_view names[] = { "o", "no", "b", "ae", "e", "ne", "be", "a",
+                                                      "s", "ns", "p", "np", "l", "ge", "le", "g" };
+        return names[static_cast<size_t>(cc)];
+    }
+
+    static std::string_view mnemonic(Op op) {
+        switch (op) {
+            case Op::MOV:     return "mov";
+            case Op::MOVZX:   return "movzx";
+            case Op::MOVSX:   return "movsx";
+            case Op::LEA:     return "lea";
+            case Op::PUSH:    return "push";
+            case Op::POP:     return "pop";
+            case Op::ADD:     return "add";
+            case Op::SUB:     return "sub";
+            case Op::AND:     return "and";
+            case Op::OR:      return "or";
+            case Op::XOR:     return "xor";
+            case Op::CMP:     return "cmp";
+            case Op::TEST:    return "test";
+            case Op::IMUL:
+            case Op::IMUL3:   return "imul";
+            case Op::MUL:     return "mul";
+            case Op::DIV:     return "div";
+            case Op::IDIV:    return "idiv";
+            case Op::NEG:     return "neg";
+            case Op::SHL:     return "shl";
+            case Op::SHR:     return "shr";
+            case Op::SAR:     return "sar";
+            case Op::CQO:     return "cqo";
+            case Op::CDQ:     return "cdq";
+            case Op::SETCC:   return "set";
+            case Op::CMOVCC:  return "cmov";
+            case Op::JMP:     return "jmp";
+            case Op::JCC:     return "j";
+            case Op::CALL:    return "call";
+            case Op::RET:     return "ret";
+            case Op::LEAVE:   return "leave";
+            case Op::SYSCALL: return "syscall";
+            case Op::REP_STOSQ: return "rep stosq";
+            case Op::REP_STOSB: return "rep stosb";
+            case Op::XCHG:    return "xchg";
+            case Op::LOCK_ADD:  return "lock add";
+            case Op::LOCK_XADD: return "lock xadd";
+            case Op::LOCK_CMPXCHG: return "lock cmpxchg";
+            case Op::PAUSE:   return "pause";
+            case Op::MOVDQU:  return "movdqu";
+            case Op::MOVQ:    return "movq";
+            case Op::PADDQ:   return "paddq";
+            case Op::PSUBQ:   return "psubq";
+            case Op::PXOR:    return "pxor";
+            case Op::PUNPCKLQDQ: return "punpcklqdq";
+            case Op::PUNPCKHQDQ: return "punpckhqdq";
+            case Op::LABEL:
+            case Op::ALIGN:
+            case Op::LOC:     break;
+        }
+        return "";
+    }
+
+    void operand(TextBuffer& out, const Operand& op, Op inst) const {
+        switch (op.kind) {
+            case Operand::Kind::REG:
+                out << regName(op.reg, op.size);
+                break;
+
+            case Operand::Kind::IMM:
+                out << op.val;
+                break;
+
+            case Operand::Kind::LABEL:
+                out << name(op.label);
+                break;
+
+            case Operand::Kind::MEM:
+                if (inst != Op::LEA && op.size != 16) {
+                    out << (op.size == 1 ? "BYTE " : op.size == 2 ? "WORD " : op.size == 4 ? "DWORD " : "QWORD ");
+                }
+                out << '[';
+                if (op.gs) {
+                    out << "gs:" << op.val << ']';
+                    break;
+                }
+                if (op.ripRel) {
+                    out << "rel " << name(op.label);
+                }
+                else {
+                    out << regName(op.reg, 8);
+                }
+                if (op.hasIndex) {
+                    out << " + " << regName(op.index, 8) << '*' << static_cast<int64_t>(op.scale);
+                }
+                if (op.val > 0) {
+                    out << " + " << op.val;
+                }
+                else if (op.val < 0) {
+                    out << " - " << -op.val;
+                }
+                out << ']';
+                break;
+
+            case Operand::Kind::NONE:
+                break;
+        }
+    }
+
+private:
+    const AsmProg& m_prog;
+};
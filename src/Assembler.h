@@ -0,0 +1,633 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Asm.h"
+
+// EXTERN symbols are bound by another object, the linker resolves them by name
+enum class SectionId : uint8_t { TEXT, RODATA, DATA, BSS, EXTERN };
+
+struct Symbol {
+    std::string name;
+    SectionId section;
+    uint64_t offset;
+    bool global = false;
+    bool func = false; // code of size bytes, see AsmProg::funcs
+    uint64_t size = 0;
+};
+
+// pc relative 32 bit reference from .text into another section or object
+struct Reloc {
+    uint64_t offset;
+    uint32_t symbol;
+    int64_t addend;
+};
+
+// source position of the code from offset on, one per Op::LOC that code follows
+struct LineRow {
+    uint64_t offset;
+    uint32_t line;
+    uint32_t col;
+};
+
+// a module's stretch of .text and its line table, what ElfWriter turns into dwarf
+struct DebugUnit {
+    std::string file;
+    uint64_t begin;
+    uint64_t end;
+    std::vector<LineRow> rows;
+};
+
+struct Object {
+    std::vector<uint8_t> text;
+    std::vector<uint8_t> rodata;
+    std::vector<uint8_t> data;
+    uint64_t bssSize = 0;
+    std::vector<Symbol> symbols; // indexed by Label::id
+    std::vector<Reloc> relocs;
+    uint32_t entry = 0;
+    std::vector<DebugUnit> debug;
+};
+
+class Assembler {
+public:
+    explicit Assembler(const AsmProg& prog)
+        : m_prog(prog) {}
+
+    [[nodiscard]] Object assemble() {
+
+        m_obj.symbols.resize(m_prog.labels.size());
+        m_bound.assign(m_prog.labels.size(), false);
+
+        for (const DataDef& def : m_prog.rodata) {
+            bind(def.label, SectionId::RODATA, m_obj.rodata.size());
+            appendQwords(m_obj.rodata, def.qwords);
+        }
+
+        for (const DataDef& def : m_prog.data) {
+            bind(def.label, SectionId::DATA, m_obj.data.size());
+            appendQwords(m_obj.data, def.qwords);
+        }
+
+        for (const BssDef& def : m_prog.bss) {
+            bind(def.label, SectionId::BSS, m_obj.bssSize);
+            m_obj.bssSize += def.qwords * 8;
+        }
+
+        for (Label label : m_prog.externs) {
+            bind(label, SectionId::EXTERN, 0);
+        }
+
+        for (const Inst& inst : m_prog.text) {
+            encode(inst);
+        }
+        sizeFuncs();
+        if (!m_prog.debugFile.empty()) {
+            m_obj.debug.push_back({m_prog.debugFile, 0, m_obj.text.size(), std::move(m_rows)});
+        }
+
+        for (const Fixup& fix : m_fixups) {
+            if (!m_bound.at(fix.label.id)) {
+                std::cerr << "Undefined label: " << m_prog.labels.at(fix.label.id) << "\n";
+                exit(1);
+            }
+
+            const Symbol& sym = m_obj.symbols.at(fix.label.id);
+            if (sym.section == SectionId::TEXT) {
+                int64_t rel = static_cast<int64_t>(sym.offset) + fix.addend - static_cast<int64_t>(fix.offset);
+                patch32(fix.offset, static_cast<int32_t>(rel));
+            }
+            else {
+                m_obj.relocs.push_back({fix.offset, fix.label.id, fix.addend});
+            }
+        }
+
+        for (Label label : m_prog.globals) {
+            m_obj.symbols.at(label.id).global = true;
+        }
+        for (Label label : m_prog.externs) {
+            m_obj.symbols.at(label.id).global = true;
+        }
+
+        m_obj.entry = m_prog.entry.id;
+        return std::move(m_obj);
+    }
+
+private:
+    struct Fixup {
+        uint64_t offset;
+        Label label;
+        int64_t addend;
+    };
+
+    void bind(Label label, SectionId section, uint64_t offset) {
+        if (m_bound.at(label.id)) {
+            std::cerr << "Label bound twice: " << m_prog.labels.at(label.id) << "\n";
+            exit(1);
+        }
+        m_bound.at(label.id) = true;
+        m_obj.symbols.at(label.id) = {m_prog.labels.at(label.id), section, offset};
+    }
+
+    // each function symbol runs up to the next one, the last to the end of .text
+    void sizeFuncs() {
+        std::vector<Symbol*> funcs;
+        for (Label label : m_prog.funcs) {
+            Symbol& sym = m_obj.symbols.at(label.id);
+            if (sym.section == SectionId::TEXT) {
+                sym.func = true;
+                funcs.push_back(&sym);
+            }
+        }
+        std::sort(funcs.begin(), funcs.end(), [](const Symbol* a, const Symbol* b) { return a->offset < b->offset; });
+        for (size_t i = 0; i < funcs.size(); ++i) {
+            uint64_t end = i + 1 < funcs.size() ? funcs[i + 1]->offset : m_obj.text.size();
+            funcs[i]->size = end - funcs[i]->offset;
+        }
+    }
+
+    void encode(const Inst& inst) {
+        const Operand& dst = inst.dst;
+        const Operand& src = inst.src;
+
+        if (dst.gs || src.gs) {
+            emit8(0x65);
+        }
+
+        switch (inst.op) {
+            case Op::LABEL:
+                bind(dst.label, SectionId::TEXT, m_obj.text.size());
+                break;
+
+            // a later position for the same code replaces the earlier one
+            case Op::LOC: {
+                LineRow row{m_obj.text.size(), static_cast<uint32_t>(dst.val), static_cast<uint32_t>(src.val)};
+                if (!m_rows.empty() && m_rows.back().offset == row.offset) {
+                    m_rows.back() = row;
+                }
+                else if (m_rows.empty() || m_rows.back().line != row.line || m_rows.back().col != row.col) {
+                    m_rows.push_back(row);
+                }
+                break;
+            }
+
+            case Op::ALIGN: {
+                auto align = static_cast<uint64_t>(dst.val);
+                nops((align - m_obj.text.size() % align) % align);
+                break;
+            }
+
+            case Op::MOV:
+                if (dst.isReg() && src.isImm() && dst.size == 4) {
+                    rex(false, 0, dst.reg);
+                    emit8(0xB8 + regBits(dst.reg) % 8);
+                    emit32(static_cast<int32_t>(src.val));
+                }
+                else if (dst.isReg() && src.isImm()) {
+                    movImm(dst.reg, src.val);
+                }
+                else if (dst.isMem() && src.isImm() && dst.size == 1) {
+                    rm(0xC6, 0, dst, 1, false);
+                    emit8(static_cast<uint8_t>(src.val));
+                }
+                else if (dst.isMem() && src.isImm() && dst.size == 2) {
+                    emit8(0x66);
+                    rm(0xC7, 0, dst, 2, false);
+                    emit16(static_cast<uint16_t>(src.val));
+                }
+                else if (dst.isMem() && src.isImm()) {
+                    rm(0xC7, 0, dst, 4, wide(dst));
+                    emit32(static_cast<int32_t>(src.val));
+                }
+                else if (src.isReg() && src.size == 1) {
+                    rm(0x88, regBits(src.reg), dst, 0, false, byteReg(src.reg));
+                }
+                else if (src.isReg() && src.size == 2) {
+                    emit8(0x66);
+                    rm(0x89, regBits(src.reg), dst, 0, false);
+                }
+                else if (src.isReg()) {
+                    rm(0x89, regBits(src.reg), dst, 0, wide(src));
+                }
+                else {
+                    rm(0x8B, regBits(dst.reg), src, 0, wide(dst));
+                }
+                break;
+
+            case Op::MOVZX:
+                rm(src.size == 2 ? 0x0FB7 : 0x0FB6, regBits(dst.reg), src, 0, wide(dst),
+                   src.isReg() && src.size == 1 && byteReg(src.reg));
+                break;
+
+            case Op::MOVSX:
+                if (src.size == 4) {
+                    rm(0x63, regBits(dst.reg), src);
+                }
+                else {
+                    rm(src.size == 2 ? 0x0FBF : 0x0FBE, regBits(dst.reg), src, 0, wide(dst),
+                       src.isReg() && src.size == 1 && byteReg(src.reg));
+                }
+                break;
+
+            case Op::LEA:
+                rm(0x8D, regBits(dst.reg), src, 0, wide(dst));
+                break;
+
+            case Op::PUSH:
+                if (dst.isReg()) {
+                    rex(false, 0, dst.reg);
+                    emit8(0x50 + regBits(dst.reg) % 8);
+                }
+                else if (dst.isImm()) {
+                    emit8(0x68);
+                    emit32(static_cast<int32_t>(dst.val));
+                }
+                else {
+                    rm(0xFF, 6, dst, 0, false);
+                }
+                break;
+
+            case Op::POP:
+                rex(false, 0, dst.reg);
+                emit8(0x58 + regBits(dst.reg) % 8);
+                break;
+
+            case Op::ADD: alu(0, dst, src); break;
+            case Op::OR:  alu(1, dst, src); break;
+            case Op::AND: alu(4, dst, src); break;
+            case Op::SUB: alu(5, dst, src); break;
+            case Op::XOR: alu(6, dst, src); break;
+            case Op::CMP: alu(7, dst, src); break;
+
+            case Op::TEST:
+                if (src.isImm()) {
+                    rm(0xF7, 0, dst, 4, wide(dst));
+                    emit32(static_cast<int32_t>(src.val));
+                }
+                else {
+                    rm(0x85, regBits(src.reg), dst, 0, wide(dst));
+                }
+                break;
+
+            case Op::IMUL:
+                rm(0x0FAF, regBits(dst.reg), src, 0, wide(dst));
+                break;
+
+            case Op::IMUL3:
+                if (fits8(inst.imm)) {
+                    rm(0x6B, regBits(dst.reg), src, 1, wide(dst));
+                    emit8(static_cast<uint8_t>(inst.imm));
+                }
+                else {
+                    rm(0x69, regBits(dst.reg), src, 4, wide(dst));
+                    emit32(inst.imm);
+                }
+                break;
+
+            case Op::MUL:
+                rm(0xF7, 4, dst, 0, wide(dst));
+                break;
+
+            case Op::DIV:
+                rm(0xF7, 6, dst, 0, wide(dst));
+                break;
+
+            case Op::IDIV:
+                rm(0xF7, 7, dst, 0, wide(dst));
+                break;
+
+            case Op::NEG:
+                rm(0xF7, 3, dst, 0, wide(dst));
+                break;
+
+            case Op::SHL: shift(4, dst, src); break;
+            case Op::SHR: shift(5, dst, src); break;
+            case Op::SAR: shift(7, dst, src); break;
+
+            case Op::CQO:
+                emit8(0x48);
+                emit8(0x99);
+                break;
+
+            case Op::CDQ:
+                emit8(0x99);
+                break;
+
+            case Op::CMOVCC:
+                rm(0x0F40 + static_cast<uint8_t>(inst.cc), regBits(dst.reg), src, 0, wide(dst));
+                break;
+
+            case Op::SETCC:
+                rm(0x0F90 + static_cast<uint8_t>(inst.cc), 0, dst, 0, false, dst.isReg() && byteReg(dst.reg));
+                break;
+
+            case Op::JMP:
+                emit8(0xE9);
+                rel32(dst.label);
+                break;
+
+            case Op::JCC:
+                emit8(0x0F);
+                emit8(0x80 + static_cast<uint8_t>(inst.cc));
+                rel32(dst.label);
+                break;
+
+            case Op::CALL:
+                if (dst.kind != Operand::Kind::LABEL) {
+                    rm(0xFF, 2, dst, 0, false);
+                    break;
+                }
+                emit8(0xE8);
+                rel32(dst.label);
+                break;
+
+            case Op::RET:
+                emit8(0xC3);
+                break;
+
+            case Op::LEAVE:
+                emit8(0xC9);
+                break;
+
+            case Op::SYSCALL:
+                emit8(0x0F);
+                emit8(0x05);
+                break;
+
+            case Op::REP_STOSQ:
+                emit8(0xF3);
+                emit8(0x48);
+                emit8(0xAB);
+                break;
+
+            case Op::REP_STOSB:
+                emit8(0xF3);
+                emit8(0xAA);
+                break;
+
+            case Op::XCHG:
+                rm(0x87, regBits(src.reg), dst);
+                break;
+
+            case Op::LOCK_ADD:
+                emit8(0xF0);
+                alu(0, dst, src);
+                break;
+
+            case Op::LOCK_XADD:
+                emit8(0xF0);
+                rm(0x0FC1, regBits(src.reg), dst);
+                break;
+
+            case Op::LOCK_CMPXCHG:
+                emit8(0xF0);
+                rm(0x0FB1, regBits(src.reg), dst);
+                break;
+
+            case Op::PAUSE:
+                emit8(0xF3);
+                emit8(0x90);
+                break;
+
+            case Op::MOVDQU:
+                emit8(0xF3);
+                if (dst.isMem()) {
+                    rm(0x0F7F, regBits(src.reg), dst, 0, false);
+                }
+                else {
+                    rm(0x0F6F, regBits(dst.reg), src, 0, false);
+                }
+                break;
+
+            // xmm always sits in the reg field, the gpr in r/m
+            case Op::MOVQ:
+                emit8(0x66);
+                if (dst.size == 16) {
+                    rm(0x0F6E, regBits(dst.reg), src);
+                }
+                else {
+                    rm(0x0F7E, regBits(src.reg), dst);
+                }
+                break;
+
+            case Op::PADDQ:      sse(0x0FD4, dst, src); break;
+            case Op::PSUBQ:      sse(0x0FFB, dst, src); break;
+            case Op::PXOR:       sse(0x0FEF, dst, src); break;
+            case Op::PUNPCKLQDQ: sse(0x0F6C, dst, src); break;
+            case Op::PUNPCKHQDQ: sse(0x0F6D, dst, src); break;
+        }
+    }
+
+    // add/or/and/sub/xor/cmp share one layout, ext is the /digit of the imm form.
+    // dword or qword, as wide as dst
+    void alu(uint8_t ext, const Operand& dst, const Operand& src) {
+        if (src.isImm()) {
+            if (fits8(src.val)) {
+                rm(0x83, ext, dst, 1, wide(dst));
+                emit8(static_cast<uint8_t>(src.val));
+            }
+            else {
+                rm(0x81, ext, dst, 4, wide(dst));
+                emit32(static_cast<int32_t>(src.val));
+            }
+        }
+        else if (src.isReg()) {
+            rm(ext * 8 + 1, regBits(src.reg), dst, 0, wide(dst));
+        }
+        else {
+            rm(ext * 8 + 3, regBits(dst.reg), src, 0, wide(dst));
+        }
+    }
+
+    // 66 prefixed packed integer ops, xmm destination
+    void sse(uint16_t opcode, const Operand& dst, const Operand& src) {
+        emit8(0x66);
+        rm(opcode, regBits(dst.reg), src, 0, false);
+    }
+
+    void shift(uint8_t ext, const Operand& dst, const Operand& src) {
+        if (src.val == 1) {
+            rm(0xD1, ext, dst, 0, wide(dst));
+            return;
+        }
+        rm(0xC1, ext, dst, 1, wide(dst));
+        emit8(static_cast<uint8_t>(src.val));
+    }
+
+    void movImm(Reg dst, int64_t val) {
+        if (val >= 0 && val <= UINT32_MAX) {
+            rex(false, 0, dst);
+            emit8(0xB8 + regBits(dst) % 8);
+            emit32(static_cast<int32_t>(val));
+        }
+        else if (val >= INT32_MIN && val <= INT32_MAX) {
+            rm(0xC7, 0, Operand(dst), 4);
+            emit32(static_cast<int32_t>(val));
+        }
+        else {
+            rex(true, 0, dst);
+            emit8(0xB8 + regBits(dst) % 8);
+            emit64(val);
+        }
+    }
+
+    // opcode (one or two bytes) followed by modrm/sib/disp for operand r/m. trailing is
+    // the number of immediate bytes after the displacement (rip relative addends),
+    // byteRegs forces a rex so spl/bpl/sil/dil aren't read as ah/ch/dh/bh
+    void rm(uint16_t opcode, uint8_t reg, const Operand& op, int trailing = 0, bool w = true, bool byteRegs = false) {
+
+        Reg base = op.isMem() && !op.ripRel ? op.reg : (op.isReg() ? op.reg : Reg::RAX);
+        uint8_t index = op.isMem() && op.hasIndex ? regBits(op.index) : 0;
+        rex(w, reg, base, byteRegs || (op.isReg() && op.size == 1 && byteReg(op.reg)), index);
+
+        if (opcode > 0xFF) {
+            emit8(static_cast<uint8_t>(opcode >> 8));
+        }
+        emit8(static_cast<uint8_t>(opcode));
+
+        uint8_t regField = static_cast<uint8_t>((reg & 7) << 3);
+
+        if (op.isReg()) {
+            emit8(0xC0 | regField | (regBits(op.reg) & 7));
+            return;
+        }
+
+        // sib with neither base nor index, an absolute disp32 in the gs segment
+        if (op.gs) {
+            emit8(0x04 | regField);
+            emit8(0x25);
+            emit32(static_cast<int32_t>(op.val));
+            return;
+        }
+
+        if (op.ripRel) {
+            emit8(0x05 | regField);
+            m_fixups.push_back({m_obj.text.size(), op.label, op.val - 4 - trailing});
+            emit32(0);
+            return;
+        }
+
+        uint8_t b = regBits(op.reg) & 7;
+        int64_t disp = op.val;
+        uint8_t mod = (disp == 0 && b != 5) ? 0x00 : (fits8(disp) ? 0x40 : 0x80);
+
+        if (op.hasIndex) {
+            uint8_t scale = op.scale == 8 ? 3 : op.scale == 4 ? 2 : op.scale == 2 ? 1 : 0;
+            emit8(mod | regField | 4);
+            emit8(static_cast<uint8_t>(scale << 6 | (index & 7) << 3 | b));
+        }
+        else {
+            emit8(mod | regField | (b == 4 ? 4 : b));
+            if (b == 4) {
+                emit8(0x24); // sib: no index, base rsp/r12
+            }
+        }
+
+        if (mod == 0x40) {
+            emit8(static_cast<uint8_t>(disp));
+        }
+        else if (mod == 0x80) {
+            emit32(static_cast<int32_t>(disp));
+        }
+    }
+
+    void rex(bool w, uint8_t reg, Reg base, bool force = false, uint8_t index = 0) {
+        uint8_t byte = 0x40;
+        if (w) byte |= 0x08;
+        if (reg & 8) byte |= 0x04;
+        if (index & 8) byte |= 0x02;
+        if (regBits(base) & 8) byte |= 0x01;
+        if (byte != 0x40 || force) {
+            emit8(byte);
+        }
+    }
+
+    // rex.w, for a qword operand
+    static bool wide(const Operand& op) {
+        return op.size == 8;
+    }
+
+    static bool byteReg(Reg reg) {
+        return reg >= Reg::RSP && reg <= Reg::RDI;
+    }
+
+    // recommended multi-byte nop forms, longest first
+    void nops(uint64_t count) {
+        static constexpr uint8_t forms[9][9] = {
+            {0x90},
+            {0x66, 0x90},
+            {0x0F, 0x1F, 0x00},
+            {0x0F, 0x1F, 0x40, 0x00},
+            {0x0F, 0x1F, 0x44, 0x00, 0x00},
+            {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+            {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+            {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+            {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+        };
+        while (count > 0) {
+            uint64_t len = count < 9 ? count : 9;
+            m_obj.text.insert(m_obj.text.end(), forms[len - 1], forms[len - 1] + len);
+            count -= len;
+        }
+    }
+
+    void rel32(Label label) {
+        m_fixups.push_back({m_obj.text.size(), label, -4});
+        emit32(0);
+    }
+
+    static uint8_t regBits(Reg reg) {
+        return static_cast<uint8_t>(reg);
+    }
+
+    static bool fits8(int64_t val) {
+        return val >= -128 && val <= 127;
+    }
+
+    void emit8(uint8_t byte) {
+        m_obj.text.push_back(byte);
+    }
+
+    void emit16(uint16_t val) {
+        emit8(static_cast<uint8_t>(val));
+        emit8(static_cast<uint8_t>(val >> 8));
+    }
+
+    void emit32(int32_t val) {
+        for (int i = 0; i < 4; ++i) {
+            m_obj.text.push_back(static_cast<uint8_t>(static_cast<uint32_t>(val) >> (i * 8)));
+        }
+    }
+
+    void emit64(int64_t val) {
+        for (int i = 0; i < 8; ++i) {
+            m_obj.text.push_back(static_cast<uint8_t>(static_cast<uint64_t>(val) >> (i * 8)));
+        }
+    }
+
+    static void appendQwords(std::vector<uint8_t>& out, const std::vector<int64_t>& qwords) {
+        for (int64_t q : qwords) {
+            for (int i = 0; i < 8; ++i) {
+                out.push_back(static_cast<uint8_t>(static_cast<uint64_t>(q) >> (i * 8)));
+            }
+        }
+    }
+
+    void patch32(uint64_t offset, int32_t val) {
+        for (int i = 0; i < 4; ++i) {
+            m_obj.text.at(offset + i) = static_cast<uint8_t>(static_cast<uint32_t>(val) >> (i * 8));
+        }
+    }
+
+private:
+    const AsmProg& m_prog;
+    Object m_obj;
+    std::vector<bool> m_bound;
+    std::vector<LineRow> m_rows;
+    std::vector<Fixup> m_fixups;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vector>
+
+#include "Asm.h"
+
+// straightens the branches codegen leaves behind: code after an unconditional
+// jump is dropped up to the next label, a jump to the very next label goes away
+// and "jcc over; jmp target; over:" becomes a single inverted jcc to target
+class BlockLayout {
+public:
+    explicit BlockLayout(std::vector<Inst>& text)
+        : m_text(text) {}
+
+    void run() {
+        bool changed = true;
+        while (changed) {
+            changed = dropUnreachable();
+            changed |= invertSkips();
+            changed |= dropFallthroughJumps();
+        }
+    }
+
+private:
+    static bool isTerminator(const Inst& inst) {
+        return inst.op == Op::JMP || inst.op == Op::RET;
+    }
+
+    // labels, padding and source positions don't move the next executed instruction
+    static bool isMarker(const Inst& inst) {
+        return inst.op == Op::LABEL || inst.op == Op::ALIGN || inst.op == Op::LOC;
+    }
+
+    bool dropUnreachable() {
+        std::vector<Inst> out;
+        out.reserve(m_text.size());
+
+        bool reachable = true;
+        for (const Inst& inst : m_text) {
+            if (inst.op == Op::LABEL) {
+                reachable = true;
+            }
+            if (reachable || isMarker(inst)) {
+                out.push_back(inst);
+            }
+            if (isTerminator(inst)) {
+                reachable = false;
+            }
+        }
+
+        bool changed = out.size() != m_text.size();
+        m_text = std::move(out);
+        return changed;
+    }
+
+    // true if label is bound in the run of markers starting at from
+    bool boundAhead(size_t from, Label label) const {
+        for (size_t i = from; i < m_text.size() && isMarker(m_text[i]); ++i) {
+            if (m_text[i].op == Op::LABEL && m_text[i].dst.label.id == label.id) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool invertSkips() {
+        bool changed = false;
+        for (size_t i = 0; i + 1 < m_text.size(); ++i) {
+            size_t j = i + 1;
+            while (j + 1 < m_text.size() && m_text[j].op == Op::LOC) {
+                ++j;
+            }
+            Inst& jcc = m_text[i];
+            Inst& jmp = m_text[j];
+            if (jcc.op == Op::JCC && jmp.op == Op::JMP && boundAhead(j + 1, jcc.dst.label)) {
+                jcc.cc = negate(jcc.cc);
+                jcc.dst = jmp.dst;
+                m_text.erase(m_text.begin() + static_cast<std::ptrdiff_t>(j));
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    bool dropFallthroughJumps() {
+        std::vector<Inst> out;
+        out.reserve(m_text.size());
+
+        for (size_t i = 0; i < m_text.size(); ++i) {
+            const Inst& inst = m_text[i];
+            if ((inst.op == Op::JMP || inst.op == Op::JCC) && boundAhead(i + 1, inst.dst.label)) {
+                continue;
+            }
+            out.push_back(inst);
+        }
+
+        bool changed = out.size() != m_text.size();
+        m_text = std::move(out);
+        return changed;
+    }
+
+private:
+    std::vector<Inst>& m_text;
+};
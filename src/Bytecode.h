@@ -0,0 +1,1109 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "Parser.h"
+#include "Project.h"
+
+// register bytecode for dhad run --vm. an instruction is its opcode word followed
+// by its operands inline: r a register of the current frame, g a global slot, imm
+// a 32 bit immediate, k a constant pool index, t a word index into the function
+enum class Bc : int32_t {
+    MOVI,   // rd imm
+    LOADK,  // rd k
+    MOV,    // rd rs
+    LOADG,  // rd g
+    STOREG, // g rs
+    ADD,    // rd ra rb, and the same for the next eight
+    SUB,
+    MUL,
+    DIV,
+    MOD,
+    EQ,
+    NE,
+    LT,
+    GT,
+    ADDI,   // rd ra imm
+    MULI,
+    SEXT,   // rd shift, rd's low 64 - shift bits extended back to 64 by their sign
+    ZEXT,   // rd shift, by zeros
+    DIVU,   // rd ra rb, unsigned
+    MODU,
+    DIV32,  // rd ra rb, traps like a 32 bit idiv
+    MOD32,
+    LTU,    // rd ra rb, unsigned
+    GTU,
+    JMP,    // t
+    JZ,     // ra t
+    JNZ,
+    JEQ,    // ra rb t, compare and branch in one
+    JNE,
+    JLT,
+    JGE,
+    JGT,
+    JLE,
+    JEQI,   // ra imm t
+    JNEI,
+    JLTI,
+    JGEI,
+    JGTI,
+    JLEI,
+    LOADX,  // rd rbase ridx len, bounds checked
+    STOREX, // rbase ridx rs len
+    GLOADX, // rd g ridx len
+    GSTOREX,// g ridx rs len
+    ZERO,   // rbase len
+    ALLOC,  // rd rn: rd = a heap block of rn zeroed elements, rd + 1 = rn, rd + 2 = the heap's top before it
+    HLOADX, // rd rarr ridx, rarr and rarr + 1 as ALLOC left them, bounds checked
+    HSTOREX,// rarr ridx rs
+    RELEASE,// rs, the heap's top back to rs
+    CALL,   // rd f rargs. the callee's frame starts at rargs, its params already there
+    RET,    // rs
+    PRINT,  // rs
+    READ,   // rd
+    EXIT    // rs
+};
+
+struct BcFunction {
+    std::string name;
+    std::vector<int32_t> code;
+    uint32_t frameSize = 0; // registers, params first
+};
+
+struct BcProgram {
+    std::vector<BcFunction> funcs; // the main program's top level is funcs[0]
+    std::vector<int64_t> consts;
+    uint32_t globals = 0;
+};
+
+// lowers one module into a shared BcProgram. locals and temporaries are registers
+// allocated like a stack: a scope or an expression gives back what it took when
+// it ends. checks and their messages follow Generator so both backends reject the
+// same programs. a register holds a value of a narrower type as its 64 bit sign or
+// zero extension, so widening is free and only arithmetic that can leave the type
+// wraps back into it
+class BytecodeGen {
+public:
+    BytecodeGen(BcProgram& out, NodeProg prog, const std::unordered_map<const NodeStmtFuncDecl*, uint32_t>& funcIndex)
+        : m_out(out), m_prog(std::move(prog)), m_funcIndex(funcIndex) {}
+
+    void importFunc(const NodeStmtFuncDecl* funcDecl) {
+        if (m_funcs.contains(funcDecl->ident.val)) {
+            std::cerr << "Function imported twice: " << funcDecl->ident.val << "\n";
+            exit(1);
+        }
+        m_funcs.insert({funcDecl->ident.val, {funcDecl, m_funcIndex.at(funcDecl)}});
+    }
+
+    void genProg() {
+        collectAssigned(m_prog.stmts);
+        begin(0);
+        for (const NodeStmt* stmt : m_prog.stmts) {
+            genStmt(stmt);
+        }
+        uint32_t status = temp();
+        emit(Bc::MOVI, status, 0);
+        emit(Bc::EXIT, status);
+        end(0);
+    }
+
+    void genModule() {
+        collectAssigned(m_prog.stmts);
+        for (const NodeStmt* stmt : m_prog.stmts) {
+            if (!std::holds_alternative<NodeStmtFuncDecl*>(stmt->var) &&
+                !std::holds_alternative<NodeStmtImport*>(stmt->var)) {
+                std::cerr << "Only functions and imports may be at the top level of a module\n";
+                exit(1);
+            }
+            genStmt(stmt);
+        }
+    }
+
+private:
+    static constexpr int64_t MAX_ARRAY_LENGTH = int64_t{1} << 28;
+
+    struct Var {
+        bool isGlobal = false;
+        uint32_t slot = 0;                // register, or global slot. arrays: element 0
+        std::optional<int64_t> constVal; // read-only global with a constant initializer
+        int64_t length = 0;
+        bool heap = false;    // run-time length: slot is the block, slot + 1 its length, + 2 the heap's top before it
+        bool counter = false; // of a لكل, read-only
+
+        bool isArray() const {
+            return length > 0 || heap;
+        }
+    };
+
+    struct Func {
+        const NodeStmtFuncDecl* decl;
+        uint32_t index;
+    };
+
+    void genStmt(const NodeStmt* stmt) {
+
+        struct StmtVisitor {
+            BytecodeGen* gen;
+
+            void operator()(const NodeStmtExit* stmtExit) {
+                uint32_t mark = gen->m_next;
+                gen->emit(Bc::EXIT, gen->value(stmtExit->expr));
+                gen->m_next = mark;
+            }
+
+            void operator()(const NodeStmtPrint* stmtPrint) {
+                uint32_t mark = gen->m_next;
+                gen->emit(Bc::PRINT, gen->value(stmtPrint->expr));
+                gen->m_next = mark;
+            }
+
+            void operator()(const NodeStmtLet* stmtLet) {
+                const std::string& name = stmtLet->ident.val;
+                if (gen->find(name)) {
+                    std::cerr << "Identifier already used: " << name << std::endl;
+                    exit(1);
+                }
+
+                if (gen->isGlobal()) {
+                    Var var{ .isGlobal = true, .slot = gen->m_out.globals++ };
+                    auto val = gen->fold(stmtLet->expr);
+                    if (val && !gen->m_assigned.contains(name)) {
+                        var.constVal = val;
+                    }
+                    uint32_t mark = gen->m_next;
+                    gen->emit(Bc::STOREG, var.slot, gen->value(stmtLet->expr));
+                    gen->m_next = mark;
+                    gen->m_scopes.back().insert({name, var});
+                    return;
+                }
+
+                uint32_t slot = gen->temp();
+                gen->into(stmtLet->expr, slot);
+                gen->m_scopes.back().insert({name, Var{ .slot = slot }});
+            }
+
+            void operator()(const NodeStmtLetArray* letArray) {
+                if (gen->find(letArray->ident.val)) {
+                    std::cerr << "Identifier already used: " << letArray->ident.val << std::endl;
+                    exit(1);
+                }
+                if (letArray->count) {
+                    gen->genHeapArray(letArray);
+                    return;
+                }
+
+                int64_t length = letArray->size.intVal;
+                if (length <= 0 || length > MAX_ARRAY_LENGTH) {
+                    std::cerr << "Invalid array size: " << letArray->ident.val << std::endl;
+                    exit(1);
+                }
+
+                Var var{ .isGlobal = gen->isGlobal(), .length = length };
+                if (var.isGlobal) {
+                    var.slot = gen->m_out.globals;
+                    gen->m_out.globals += static_cast<uint32_t>(length);
+                }
+                else {
+                    var.slot = gen->m_next;
+                    for (int64_t i = 0; i < length; ++i) {
+                        gen->temp();
+                    }
+                    gen->emit(Bc::ZERO, var.slot, static_cast<int32_t>(length));
+                }
+                gen->m_scopes.back().insert({letArray->ident.val, var});
+            }
+
+            void operator()(const NodeStmtAssign* stmtAssign) {
+                const Var* var = gen->find(stmtAssign->ident.val);
+                if (!var) {
+                    std::cerr << "Identifier not declared: " << stmtAssign->ident.val << std::endl;
+                    exit(1);
+                }
+                if (var->isArray()) {
+                    std::cerr << "Cannot assign to array: " << stmtAssign->ident.val << std::endl;
+                    exit(1);
+                }
+                if (var->counter) {
+                    std::cerr << "Cannot assign to loop counter: " << stmtAssign->ident.val << std::endl;
+                    exit(1);
+                }
+
+                uint32_t mark = gen->m_next;
+                if (var->isGlobal) {
+                    gen->emit(Bc::STOREG, var->slot, gen->value(stmtAssign->expr));
+                }
+                else {
+                    gen->into(stmtAssign->expr, var->slot);
+                }
+                gen->m_next = mark;
+            }
+
+            void operator()(const NodeStmtIndexAssign* indexAssign) {
+                const Var& arr = gen->arrayVar(indexAssign->ident.val);
+                uint32_t mark = gen->m_next;
+
+                if (arr.heap) {
+                    uint32_t block = gen->heapBlock(arr);
+                    uint32_t index = gen->heapIndex(indexAssign->index, indexAssign->ident.val);
+                    gen->emit(Bc::HSTOREX, block, index, gen->value(indexAssign->expr));
+                }
+                else if (auto constIndex = gen->fold(indexAssign->index)) {
+                    int64_t index = gen->checkedIndex(arr, indexAssign->ident.val, constIndex.value());
+                    uint32_t slot = arr.slot + static_cast<uint32_t>(index);
+                    if (arr.isGlobal) {
+                        gen->emit(Bc::STOREG, slot, gen->value(indexAssign->expr));
+                    }
+                    else {
+                        gen->into(indexAssign->expr, slot);
+                    }
+                }
+                else {
+                    uint32_t index = gen->value(indexAssign->index);
+                    uint32_t value = gen->value(indexAssign->expr);
+                    gen->emit(arr.isGlobal ? Bc::GSTOREX : Bc::STOREX, arr.slot, index, value, static_cast<int32_t>(arr.length));
+                }
+                gen->m_next = mark;
+            }
+
+            void operator()(const NodeStmtFuncDecl* funcDecl) {
+                if (gen->m_funcs.contains(funcDecl->ident.val)) {
+                    std::cerr << "Function already declared\n";
+                    exit(1);
+                }
+                if (!gen->isGlobal()) {
+                    std::cerr << "Functions must be declared in global scope\n";
+                    exit(1);
+                }
+
+                uint32_t index = gen->m_funcIndex.at(funcDecl);
+                gen->m_funcs.insert({funcDecl->ident.val, {funcDecl, index}});
+
+                // the enclosing code is the main program's, whose state is set aside
+                auto outer = gen->save();
+                gen->begin(index);
+                gen->m_inFunc = true;
+                gen->m_returned = false;
+                gen->m_scopes.emplace_back();
+
+                for (const auto& param : funcDecl->params) {
+                    if (gen->m_scopes.back().contains(param->ident.val)) {
+                        std::cerr << "Parameter already used\n";
+                        exit(1);
+                    }
+                    gen->m_scopes.back().insert({param->ident.val, Var{ .slot = gen->temp() }});
+                }
+
+                gen->genScope(funcDecl->scope);
+                if (!gen->m_returned) {
+                    std::cerr << "No return statement in " << funcDecl->ident.val << "\n";
+                    exit(1);
+                }
+                const auto& stmts = funcDecl->scope->stmts;
+                if (stmts.empty() || !std::holds_alternative<NodeStmtReturn*>(stmts.back()->var)) {
+                    uint32_t zero = gen->temp();
+                    gen->emit(Bc::MOVI, zero, 0);
+                    gen->emit(Bc::RET, zero);
+                }
+
+                gen->m_scopes.pop_back();
+                gen->end(index);
+                gen->restore(outer);
+            }
+
+            void operator()(const NodeStmtReturn* stmtRet) {
+                if (!gen->m_inFunc) {
+                    std::cerr << "Return outside of function\n";
+                    exit(1);
+                }
+                gen->m_returned = true;
+
+                uint32_t mark = gen->m_next;
+                uint32_t result = 0;
+                if (stmtRet->expr) {
+                    result = gen->value(stmtRet->expr.value());
+                }
+                else {
+                    result = gen->temp();
+                    gen->emit(Bc::MOVI, result, 0);
+                }
+                // the value is out before the scopes give their heap arrays back
+                for (const auto& heapMark : gen->m_heapMarks) {
+                    if (heapMark) {
+                        gen->emit(Bc::RELEASE, heapMark.value());
+                        break;
+                    }
+                }
+                gen->emit(Bc::RET, result);
+                gen->m_next = mark;
+            }
+
+            void operator()(const NodeScope* scope) {
+                gen->genScope(scope);
+            }
+
+            void operator()(const NodeStmtImport*) {
+                if (!gen->isGlobal() || gen->m_inFunc) {
+                    std::cerr << "Imports must be at the top level\n";
+                    exit(1);
+                }
+            }
+
+            void operator()(const NodeStmtIf* stmtIf) {
+                size_t elseLabel = gen->createLabel();
+                size_t endLabel = gen->createLabel();
+
+                gen->genCond(stmtIf->expr, elseLabel, false);
+                gen->genScope(stmtIf->scope);
+                gen->emit(Bc::JMP, gen->target(endLabel));
+                gen->bind(elseLabel);
+
+                std::optional<NodeIfPred*> pred = stmtIf->pred;
+                while (pred.has_value()) {
+                    if (auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+                        size_t next = gen->createLabel();
+                        gen->genCond((*predElif)->expr, next, false);
+                        gen->genScope((*predElif)->scope);
+                        gen->emit(Bc::JMP, gen->target(endLabel));
+                        gen->bind(next);
+                        pred = (*predElif)->pred;
+                    }
+                    else {
+                        gen->genScope(std::get<NodeIfPredElse*>(pred.value()->var)->scope);
+                        pred = {};
+                    }
+                }
+                gen->bind(endLabel);
+            }
+
+            // rotated like the native loop, one compare and branch per iteration
+            void operator()(const NodeStmtWhile* stmtWhile) {
+                size_t bodyLabel = gen->createLabel();
+                size_t endLabel = gen->createLabel();
+
+                gen->genCond(stmtWhile->expr, endLabel, false);
+                gen->bind(bodyLabel);
+                gen->genScope(stmtWhile->scope);
+                gen->genCond(stmtWhile->expr, bodyLabel, true);
+                gen->bind(endLabel);
+            }
+
+            // the counter and the end live in registers of their own, the end as
+            // an immediate when it is a small constant. a parallel one runs in order
+            void operator()(const NodeStmtFor* stmtFor) {
+                if (gen->find(stmtFor->ident.val)) {
+                    std::cerr << "Identifier already used: " << stmtFor->ident.val << std::endl;
+                    exit(1);
+                }
+                size_t bodyLabel = gen->createLabel();
+                size_t endLabel = gen->createLabel();
+                uint32_t mark = gen->m_next;
+
+                uint32_t counter = gen->temp();
+                gen->into(stmtFor->from, counter);
+                auto imm = gen->imm32(stmtFor->to);
+                uint32_t end = 0;
+                if (!imm) {
+                    end = gen->temp();
+                    gen->into(stmtFor->to, end);
+                }
+                auto branch = [this, counter, end, imm](Bc op, size_t label) {
+                    if (imm) {
+                        gen->emit(immBranch(op), counter, imm.value(), gen->target(label));
+                    }
+                    else {
+                        gen->emit(op, counter, end, gen->target(label));
+                    }
+                };
+
+                branch(Bc::JGE, endLabel);
+                gen->bind(bodyLabel);
+                gen->m_scopes.push_back({{stmtFor->ident.val, Var{ .slot = counter, .counter = true }}});
+                gen->genScope(stmtFor->scope);
+                gen->m_scopes.pop_back();
+                gen->emit(Bc::ADDI, counter, counter, 1);
+                branch(Bc::JLT, bodyLabel);
+                gen->bind(endLabel);
+                gen->m_next = mark;
+            }
+
+            // one thread: a spawned call runs right away, its result dropped, and
+            // there is never anything to wait for
+            void operator()(const NodeStmtSpawn* stmtSpawn) {
+                uint32_t mark = gen->m_next;
+                NodeTerm term{ .var = stmtSpawn->call };
+                gen->genTerm(&term, gen->temp());
+                gen->m_next = mark;
+            }
+
+            void operator()(const NodeStmtJoin*) {}
+        };
+
+        StmtVisitor visitor{this};
+        std::visit(visitor, stmt->var);
+    }
+
+    void genScope(const NodeScope* scope) {
+        uint32_t mark = m_next;
+        m_scopes.emplace_back();
+        m_heapMarks.push_back({});
+        for (const NodeStmt* stmt : scope->stmts) {
+            genStmt(stmt);
+        }
+        if (m_heapMarks.back()) {
+            emit(Bc::RELEASE, m_heapMarks.back().value());
+        }
+        m_heapMarks.pop_back();
+        m_scopes.pop_back();
+        m_next = mark;
+    }
+
+    // as the native code does, the scope gives the block back when it ends and
+    // global ones stay
+    void genHeapArray(const NodeStmtLetArray* letArray) {
+        uint32_t mark = m_next;
+        uint32_t block = temp();
+        temp();
+        temp();
+        emit(Bc::ALLOC, block, value(letArray->count));
+
+        Var var{ .isGlobal = isGlobal(), .slot = block, .heap = true };
+        if (var.isGlobal) {
+            var.slot = m_out.globals;
+            m_out.globals += 2;
+            emit(Bc::STOREG, var.slot, block);
+            emit(Bc::STOREG, var.slot + 1, block + 1);
+            m_next = mark;
+        }
+        else {
+            m_next = block + 3;
+            if (!m_heapMarks.back()) {
+                m_heapMarks.back() = block + 2;
+            }
+        }
+        m_scopes.back().insert({letArray->ident.val, var});
+    }
+
+    // a register pair holding a heap array's block and length, copied out of the
+    // globals for a global one
+    uint32_t heapBlock(const Var& arr) {
+        if (!arr.isGlobal) {
+            return arr.slot;
+        }
+        uint32_t block = temp();
+        temp();
+        emit(Bc::LOADG, block, arr.slot);
+        emit(Bc::LOADG, block + 1, arr.slot + 1);
+        return block;
+    }
+
+    // a constant index that can't be in range of any length is rejected as the
+    // native code does
+    uint32_t heapIndex(const NodeExpr* index, const std::string& name) {
+        if (auto val = fold(index); val && (val.value() < 0 || val.value() >= MAX_ARRAY_LENGTH)) {
+            std::cerr << "Array index out of range: " << name << std::endl;
+            exit(1);
+        }
+        return value(index);
+    }
+
+    // jumps to label when expr's truth is jumpIf. comparisons against a small
+    // constant become one compare-immediate-and-branch, logical operators chains
+    // of branches that stop at the first operand deciding the result
+    void genCond(const NodeExpr* expr, size_t label, bool jumpIf) {
+        if (auto val = fold(expr)) {
+            if ((val.value() != 0) == jumpIf) {
+                emit(Bc::JMP, target(label));
+            }
+            return;
+        }
+
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                genCond((*paren)->expr, label, jumpIf);
+                return;
+            }
+            if (auto termNot = std::get_if<NodeTermNot*>(&(*term)->var)) {
+                genCond((*termNot)->expr, label, !jumpIf);
+                return;
+            }
+        }
+        if (auto binExpr = std::get_if<BinExpr*>(&expr->var)) {
+            if (auto exprAnd = std::get_if<BinExprAnd*>(&(*binExpr)->var)) {
+                genShortCircuit((*exprAnd)->lhs, (*exprAnd)->rhs, true, label, jumpIf);
+                return;
+            }
+            if (auto exprOr = std::get_if<BinExprOr*>(&(*binExpr)->var)) {
+                genShortCircuit((*exprOr)->lhs, (*exprOr)->rhs, false, label, jumpIf);
+                return;
+            }
+        }
+
+        uint32_t mark = m_next;
+        auto binExpr = std::get_if<BinExpr*>(&expr->var);
+        std::optional<Bc> branch;
+        // u64 orders through LTU or GTU, the narrower unsigned types are never negative
+        bool unsigned64 = binExpr && std::visit([](const auto* bin) {
+            return !isSigned(bin->lhs->usedAs) && typeSize(bin->lhs->usedAs) == 8;
+        }, (*binExpr)->var);
+        if (binExpr) {
+            if (std::holds_alternative<BinExprEqTo*>((*binExpr)->var)) branch = jumpIf ? Bc::JEQ : Bc::JNE;
+            if (std::holds_alternative<BinExprNotEqTo*>((*binExpr)->var)) branch = jumpIf ? Bc::JNE : Bc::JEQ;
+            if (std::holds_alternative<BinExprLsThan*>((*binExpr)->var) && !unsigned64) branch = jumpIf ? Bc::JLT : Bc::JGE;
+            if (std::holds_alternative<BinExprGrThan*>((*binExpr)->var) && !unsigned64) branch = jumpIf ? Bc::JGT : Bc::JLE;
+        }
+
+        if (branch) {
+            auto [lhs, rhs] = std::visit([](const auto* bin) { return std::pair{bin->lhs, bin->rhs}; }, (*binExpr)->var);
+            uint32_t a = value(lhs);
+            if (auto imm = imm32(rhs)) {
+                emit(immBranch(branch.value()), a, imm.value(), target(label));
+            }
+            else {
+                emit(branch.value(), a, value(rhs), target(label));
+            }
+        }
+        else {
+            emit(jumpIf ? Bc::JNZ : Bc::JZ, value(expr), target(label));
+        }
+        m_next = mark;
+    }
+
+    // as Generator::genShortCircuit
+    void genShortCircuit(const NodeExpr* lhs, const NodeExpr* rhs, bool isAnd, size_t label, bool jumpIf) {
+        if (isAnd != jumpIf) {
+            genCond(lhs, label, jumpIf);
+            genCond(rhs, label, jumpIf);
+            return;
+        }
+        size_t skip = createLabel();
+        genCond(lhs, skip, !jumpIf);
+        genCond(rhs, label, jumpIf);
+        bind(skip);
+    }
+
+    // dst = 1 when expr's truth is truth, else 0
+    void boolInto(const NodeExpr* expr, bool truth, uint32_t dst) {
+        size_t isFalse = createLabel();
+        size_t end = createLabel();
+        genCond(expr, isFalse, !truth);
+        emit(Bc::MOVI, dst, 1);
+        emit(Bc::JMP, target(end));
+        bind(isFalse);
+        emit(Bc::MOVI, dst, 0);
+        bind(end);
+    }
+
+    static Bc immBranch(Bc branch) {
+        return static_cast<Bc>(static_cast<int32_t>(branch) + (static_cast<int32_t>(Bc::JEQI) - static_cast<int32_t>(Bc::JEQ)));
+    }
+
+    // a register holding expr: a local's own when expr is just that local, else a
+    // new temporary. nothing a later operand runs can change a local of this frame
+    uint32_t value(const NodeExpr* expr) {
+        if (auto var = localScalar(expr)) {
+            return var->slot;
+        }
+        uint32_t dst = temp();
+        into(expr, dst);
+        return dst;
+    }
+
+    void into(const NodeExpr* expr, uint32_t dst) {
+        if (auto val = fold(expr)) {
+            loadConst(dst, val.value());
+            return;
+        }
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            genTerm(*term, dst);
+            return;
+        }
+
+        uint32_t mark = m_next;
+        const BinExpr* binExpr = std::get<BinExpr*>(expr->var);
+        std::visit([this, expr, dst](const auto* bin) {
+            using T = std::remove_cvref_t<decltype(*bin)>;
+            if constexpr (std::is_same_v<T, BinExprAnd> || std::is_same_v<T, BinExprOr>) {
+                boolInto(expr, true, dst);
+            }
+            else {
+                constexpr bool additive = std::is_same_v<T, BinExprAdd> || std::is_same_v<T, BinExprSub> || std::is_same_v<T, BinExprMult>;
+                IntType type = bin->lhs->usedAs;
+                uint32_t a = value(bin->lhs);
+
+                auto imm = imm32(bin->rhs);
+                if (additive && imm && !(std::is_same_v<T, BinExprSub> && imm.value() == INT32_MIN)) {
+                    if constexpr (std::is_same_v<T, BinExprMult>) {
+                        emit(Bc::MULI, dst, a, imm.value());
+                    }
+                    else {
+                        emit(Bc::ADDI, dst, a, std::is_same_v<T, BinExprSub> ? -imm.value() : imm.value());
+                    }
+                }
+                else {
+                    emit(opOf(bin, type), dst, a, value(bin->rhs));
+                }
+
+                // i8 and i16 divide like the native code, in 32 bits, so MIN / -1 wraps
+                if (additive || (std::is_same_v<T, BinExprDiv> && isSigned(type) && typeSize(type) < 4)) {
+                    wrap(dst, type);
+                }
+            }
+        }, binExpr->var);
+        m_next = mark;
+    }
+
+    static Bc opOf(const BinExprAdd*, IntType) { return Bc::ADD; }
+    static Bc opOf(const BinExprSub*, IntType) { return Bc::SUB; }
+    static Bc opOf(const BinExprMult*, IntType) { return Bc::MUL; }
+    static Bc opOf(const BinExprDiv*, IntType type) {
+        return !isSigned(type) ? Bc::DIVU : typeSize(type) == 4 ? Bc::DIV32 : Bc::DIV;
+    }
+    static Bc opOf(const BinExprMod*, IntType type) {
+        return !isSigned(type) ? Bc::MODU : typeSize(type) == 4 ? Bc::MOD32 : Bc::MOD;
+    }
+    static Bc opOf(const BinExprEqTo*, IntType) { return Bc::EQ; }
+    static Bc opOf(const BinExprNotEqTo*, IntType) { return Bc::NE; }
+    static Bc opOf(const BinExprLsThan*, IntType type) { return isSigned(type) ? Bc::LT : Bc::LTU; }
+    static Bc opOf(const BinExprGrThan*, IntType type) { return isSigned(type) ? Bc::GT : Bc::GTU; }
+
+    // reg back to a value of type after arithmetic that may have carried out of it
+    void wrap(uint32_t reg, IntType type) {
+        if (typeSize(type) < 8) {
+            emit(isSigned(type) ? Bc::SEXT : Bc::ZEXT, reg, 64 - typeSize(type) * 8);
+        }
+    }
+
+    void genTerm(const NodeTerm* term, uint32_t dst) {
+
+        struct TermVisitor {
+            BytecodeGen* gen;
+            uint32_t dst;
+
+            void operator()(const NodeTermIntLit* intLit) const {
+                gen->loadConst(dst, intLit->int_lit.intVal);
+            }
+
+            void operator()(const NodeTermIdent* ident) const {
+                const Var* var = gen->find(ident->ident.val);
+                if (!var) {
+                    std::cerr << "Undeclared Identifier: " << ident->ident.val << std::endl;
+                    exit(1);
+                }
+                if (var->isArray()) {
+                    std::cerr << "Array used as a value: " << ident->ident.val << std::endl;
+                    exit(1);
+                }
+                if (var->isGlobal) {
+                    gen->emit(Bc::LOADG, dst, var->slot);
+                }
+                else if (var->slot != dst) {
+                    gen->emit(Bc::MOV, dst, var->slot);
+                }
+            }
+
+            void operator()(const NodeTermParen* termParen) const {
+                gen->into(termParen->expr, dst);
+            }
+
+            // args land in consecutive registers on top, where the callee's frame begins
+            void operator()(const NodeTermFuncCall* funcCall) const {
+                auto it = gen->m_funcs.find(funcCall->ident.val);
+                if (it == gen->m_funcs.end()) {
+                    std::cerr << "Function not declared: " << funcCall->ident.val << "\n";
+                    exit(1);
+                }
+                if (funcCall->args.size() != it->second.decl->params.size()) {
+                    std::cerr << "# Args don't match function # Params: " << funcCall->ident.val << "\n";
+                    exit(1);
+                }
+
+                uint32_t mark = gen->m_next;
+                uint32_t args = gen->m_next;
+                for (const NodeExpr* arg : funcCall->args) {
+                    uint32_t reg = gen->temp();
+                    gen->into(arg, reg);
+                    gen->m_next = reg + 1;
+                }
+                gen->emit(Bc::CALL, dst, it->second.index, args);
+                gen->m_next = mark;
+            }
+
+            void operator()(const NodeTermRead*) const {
+                gen->emit(Bc::READ, dst);
+            }
+
+            void operator()(const NodeTermIndex* termIndex) const {
+                const Var& arr = gen->arrayVar(termIndex->ident.val);
+                if (arr.heap) {
+                    uint32_t mark = gen->m_next;
+                    uint32_t block = gen->heapBlock(arr);
+                    gen->emit(Bc::HLOADX, dst, block, gen->heapIndex(termIndex->index, termIndex->ident.val));
+                    gen->m_next = mark;
+                    return;
+                }
+                if (auto constIndex = gen->fold(termIndex->index)) {
+                    int64_t index = gen->checkedIndex(arr, termIndex->ident.val, constIndex.value());
+                    uint32_t slot = arr.slot + static_cast<uint32_t>(index);
+                    if (arr.isGlobal) {
+                        gen->emit(Bc::LOADG, dst, slot);
+                    }
+                    else if (slot != dst) {
+                        gen->emit(Bc::MOV, dst, slot);
+                    }
+                    return;
+                }
+
+                uint32_t mark = gen->m_next;
+                uint32_t index = gen->value(termIndex->index);
+                gen->emit(arr.isGlobal ? Bc::GLOADX : Bc::LOADX, dst, arr.slot, index, static_cast<int32_t>(arr.length));
+                gen->m_next = mark;
+            }
+
+            void operator()(const NodeTermCast* termCast) const {
+                gen->into(termCast->expr, dst);
+                if (!widens(termCast->expr->usedAs, termCast->type)) {
+                    gen->wrap(dst, termCast->type);
+                }
+            }
+
+            void operator()(const NodeTermNot* termNot) const {
+                gen->boolInto(termNot->expr, false, dst);
+            }
+        };
+
+        TermVisitor visitor{this, dst};
+        std::visit(visitor, term->var);
+    }
+
+    // literals, casts and read-only constant globals, wrapping like the hardware in
+    // their type. traps (div by 0, MIN / -1) are left to run time, as in
+    // Generator::constEval
+    std::optional<int64_t> fold(const NodeExpr* expr) {
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (auto intLit = std::get_if<NodeTermIntLit*>(&(*term)->var)) {
+                return (*intLit)->int_lit.intVal;
+            }
+            if (auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                return fold((*paren)->expr);
+            }
+            if (auto ident = std::get_if<NodeTermIdent*>(&(*term)->var)) {
+                if (const Var* var = find((*ident)->ident.val)) {
+                    return var->constVal;
+                }
+            }
+            if (auto termCast = std::get_if<NodeTermCast*>(&(*term)->var)) {
+                auto val = fold((*termCast)->expr);
+                return val ? std::optional<int64_t>(wrapTo((*termCast)->type, val.value())) : std::nullopt;
+            }
+            if (auto termNot = std::get_if<NodeTermNot*>(&(*term)->var)) {
+                auto val = fold((*termNot)->expr);
+                return val ? std::optional<int64_t>(val.value() == 0) : std::nullopt;
+            }
+            return {};
+        }
+
+        return std::visit([this](const auto* bin) -> std::optional<int64_t> {
+            using T = std::remove_cvref_t<decltype(*bin)>;
+            auto lhs = fold(bin->lhs);
+            // a constant lhs that settles the result, rhs never runs
+            if constexpr (std::is_same_v<T, BinExprAnd>) {
+                if (lhs == 0) return 0;
+            }
+            if constexpr (std::is_same_v<T, BinExprOr>) {
+                if (lhs && lhs != 0) return 1;
+            }
+            auto rhs = lhs ? fold(bin->rhs) : std::nullopt;
+            if (!lhs || !rhs) {
+                return {};
+            }
+            IntType type = bin->lhs->usedAs;
+            auto a = static_cast<uint64_t>(lhs.value());
+            auto b = static_cast<uint64_t>(rhs.value());
+            if constexpr (std::is_same_v<T, BinExprAdd>) return wrapTo(type, static_cast<int64_t>(a + b));
+            if constexpr (std::is_same_v<T, BinExprSub>) return wrapTo(type, static_cast<int64_t>(a - b));
+            if constexpr (std::is_same_v<T, BinExprMult>) return wrapTo(type, static_cast<int64_t>(a * b));
+            if constexpr (std::is_same_v<T, BinExprDiv> || std::is_same_v<T, BinExprMod>) {
+                return divideAs(type, lhs.value(), rhs.value(), std::is_same_v<T, BinExprMod>);
+            }
+            if constexpr (std::is_same_v<T, BinExprEqTo>) return lhs.value() == rhs.value();
+            if constexpr (std::is_same_v<T, BinExprNotEqTo>) return lhs.value() != rhs.value();
+            if constexpr (std::is_same_v<T, BinExprLsThan>) return lessThan(type, lhs.value(), rhs.value());
+            if constexpr (std::is_same_v<T, BinExprGrThan>) return lessThan(type, rhs.value(), lhs.value());
+            if constexpr (std::is_same_v<T, BinExprAnd>) return lhs.value() != 0 && rhs.value() != 0;
+            if constexpr (std::is_same_v<T, BinExprOr>) return lhs.value() != 0 || rhs.value() != 0;
+        }, std::get<BinExpr*>(expr->var)->var);
+    }
+
+    std::optional<int32_t> imm32(const NodeExpr* expr) {
+        auto val = fold(expr);
+        if (!val || val.value() < INT32_MIN || val.value() > INT32_MAX) {
+            return {};
+        }
+        return static_cast<int32_t>(val.value());
+    }
+
+    void loadConst(uint32_t dst, int64_t val) {
+        if (val >= INT32_MIN && val <= INT32_MAX) {
+            emit(Bc::MOVI, dst, static_cast<int32_t>(val));
+            return;
+        }
+        m_out.consts.push_back(val);
+        emit(Bc::LOADK, dst, m_out.consts.size() - 1);
+    }
+
+    // globals are always copied into a temporary, so a call in a later operand
+    // can't change a value already read
+    const Var* localScalar(const NodeExpr* expr) {
+        auto term = std::get_if<NodeTerm*>(&expr->var);
+        if (!term) {
+            return nullptr;
+        }
+        auto ident = std::get_if<NodeTermIdent*>(&(*term)->var);
+        if (!ident) {
+            return nullptr;
+        }
+        const Var* var = find((*ident)->ident.val);
+        return var && !var->isGlobal && !var->isArray() ? var : nullptr;
+    }
+
+    const Var& arrayVar(const std::string& name) {
+        const Var* var = find(name);
+        if (!var) {
+            std::cerr << "Undeclared Identifier: " << name << std::endl;
+            exit(1);
+        }
+        if (!var->isArray()) {
+            std::cerr << "Not an array: " << name << std::endl;
+            exit(1);
+        }
+        return *var;
+    }
+
+    static int64_t checkedIndex(const Var& arr, const std::string& name, int64_t index) {
+        if (index < 0 || index >= arr.length) {
+            std::cerr << "Array index out of range: " << name << std::endl;
+            exit(1);
+        }
+        return index;
+    }
+
+    const Var* find(const std::string& name) const {
+        for (auto it = m_scopes.rbegin(); it != m_scopes.rend(); ++it) {
+            auto var = it->find(name);
+            if (var != it->end()) {
+                return &var->second;
+            }
+        }
+        return nullptr;
+    }
+
+    bool isGlobal() const {
+        return m_scopes.size() == 1;
+    }
+
+    // names ever assigned anywhere, which keeps a global from being a constant
+    void collectAssigned(const std::vector<NodeStmt*>& stmts) {
+
+        struct AssignVisitor {
+            BytecodeGen* gen;
+
+            void operator()(const NodeStmtAssign* stmtAssign) {
+                gen->m_assigned.insert(stmtAssign->ident.val);
+            }
+            void operator()(const NodeScope* scope) {
+                gen->collectAssigned(scope->stmts);
+            }
+            void operator()(const NodeStmtIf* stmtIf) {
+                gen->collectAssigned(stmtIf->scope->stmts);
+
+                std::optional<NodeIfPred*> pred = stmtIf->pred;
+                while (pred.has_value()) {
+                    if (auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+                        gen->collectAssigned((*predElif)->scope->stmts);
+                        pred = (*predElif)->pred;
+                    }
+                    else {
+                        gen->collectAssigned(std::get<NodeIfPredElse*>(pred.value()->var)->scope->stmts);
+                        pred = {};
+                    }
+                }
+            }
+            void operator()(const NodeStmtWhile* stmtWhile) {
+                gen->collectAssigned(stmtWhile->scope->stmts);
+            }
+            void operator()(const NodeStmtFor* stmtFor) {
+                gen->collectAssigned(stmtFor->scope->stmts);
+            }
+            void operator()(const NodeStmtFuncDecl* funcDecl) {
+                gen->collectAssigned(funcDecl->scope->stmts);
+            }
+            void operator()(const NodeStmtExit*) {}
+            void operator()(const NodeStmtPrint*) {}
+            void operator()(const NodeStmtLet*) {}
+            void operator()(const NodeStmtLetArray*) {}
+            void operator()(const NodeStmtIndexAssign*) {}
+            void operator()(const NodeStmtReturn*) {}
+            void operator()(const NodeStmtImport*) {}
+            void operator()(const NodeStmtSpawn*) {}
+            void operator()(const NodeStmtJoin*) {}
+        };
+
+        AssignVisitor visitor{this};
+        for (const NodeStmt* stmt : stmts) {
+            std::visit(visitor, stmt->var);
+        }
+    }
+
+    uint32_t temp() {
+        uint32_t reg = m_next++;
+        m_frameSize = std::max(m_frameSize, m_next);
+        return reg;
+    }
+
+    // what lowering a function body replaces
+    struct Outer {
+        std::vector<int32_t> code;
+        std::vector<int32_t> labels;
+        std::vector<std::pair<size_t, size_t>> fixups;
+        uint32_t next;
+        uint32_t frameSize;
+        bool inFunc;
+        bool returned;
+    };
+
+    Outer save() {
+        return {std::move(m_code), std::move(m_labels), std::move(m_fixups), m_next, m_frameSize, m_inFunc, m_returned};
+    }
+
+    void restore(Outer& outer) {
+        m_code = std::move(outer.code);
+        m_labels = std::move(outer.labels);
+        m_fixups = std::move(outer.fixups);
+        m_next = outer.next;
+        m_frameSize = outer.frameSize;
+        m_inFunc = outer.inFunc;
+        m_returned = outer.returned;
+    }
+
+    void begin(uint32_t index) {
+        m_code.clear();
+        m_labels.clear();
+        m_fixups.clear();
+        m_next = 0;
+        m_frameSize = 0;
+        if (m_out.funcs.size() <= index) {
+            m_out.funcs.resize(index + 1);
+        }
+    }
+
+    void end(uint32_t index) {
+        for (auto [pos, label] : m_fixups) {
+            m_code[pos] = m_labels[label];
+        }
+        BcFunction& func = m_out.funcs[index];
+        func.code = std::move(m_code);
+        func.frameSize = m_frameSize;
+        m_code.clear();
+    }
+
+    size_t createLabel() {
+        m_labels.push_back(-1);
+        return m_labels.size() - 1;
+    }
+
+    void bind(size_t label) {
+        m_labels[label] = static_cast<int32_t>(m_code.size());
+    }
+
+    // a jump operand, patched once the function is done
+    struct Target {
+        size_t label;
+    };
+
+    Target target(size_t label) {
+        return {label};
+    }
+
+    template<typename... Args>
+    void emit(Bc op, Args... args) {
+        m_code.push_back(static_cast<int32_t>(op));
+        (operand(args), ...);
+    }
+
+    void operand(Target t) {
+        m_fixups.push_back({m_code.size(), t.label});
+        m_code.push_back(-1);
+    }
+
+    template<typename T>
+    void operand(T val) {
+        m_code.push_back(static_cast<int32_t>(val));
+    }
+
+private:
+    BcProgram& m_out;
+    NodeProg m_prog;
+    const std::unordered_map<const NodeStmtFuncDecl*, uint32_t>& m_funcIndex;
+    std::unordered_map<std::string, Func> m_funcs;
+    std::vector<std::unordered_map<std::string, Var>> m_scopes{1};
+    std::unordered_set<std::string> m_assigned;
+    std::vector<std::optional<uint32_t>> m_heapMarks; // per genScope, the register of the heap's top as it began, once it allocated
+
+    std::vector<int32_t> m_code;
+    std::vector<int32_t> m_labels;                     // code positions
+    std::vector<std::pair<size_t, size_t>> m_fixups;  // operand position, label
+    uint32_t m_next = 0;
+    uint32_t m_frameSize = 0;
+    bool m_inFunc = false;
+    bool m_returned = false;
+};
+
+// every module's functions get an index up front so calls across modules resolve
+// before the callee is lowered. module functions share one namespace, as at link time
+inline BcProgram lowerModules(const std::vector<Module>& modules) {
+    BcProgram out;
+    out.funcs.resize(1);
+    out.funcs[0].name = modules.front().path.filename().string();
+
+    std::unordered_map<const NodeStmtFuncDecl*, uint32_t> funcIndex;
+    std::unordered_set<std::string> exported;
+    for (size_t m = 0; m < modules.size(); ++m) {
+        for (const NodeStmt* stmt : modules[m].prog.stmts) {
+            if (auto funcDecl = std::get_if<NodeStmtFuncDecl*>(&stmt->var)) {
+                if (m > 0 && !exported.insert((*funcDecl)->ident.val).second) {
+                    std::cerr << "Duplicate symbol: " << (*funcDecl)->ident.val << "\n";
+                    exit(1);
+                }
+                funcIndex.insert({*funcDecl, static_cast<uint32_t>(out.funcs.size())});
+                out.funcs.push_back({ .name = (*funcDecl)->ident.val });
+            }
+        }
+    }
+
+    for (size_t m = 0; m < modules.size(); ++m) {
+        BytecodeGen gen(out, modules[m].prog, funcIndex);
+        for (size_t dep : modules[m].imports) {
+            for (const NodeStmt* stmt : modules[dep].prog.stmts) {
+                if (auto funcDecl = std::get_if<NodeStmtFuncDecl*>(&stmt->var)) {
+                    gen.importFunc(*funcDecl);
+                }
+            }
+        }
+        if (m == 0) {
+            gen.genProg();
+        }
+        else {
+            gen.genModule();
+        }
+    }
+    return out;
+}
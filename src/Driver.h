@@ -0,0 +1,281 @@
+#pragma once
+
+#include <charconv>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Project.h"
+#include "Elf.h"
+#include "Jit.h"
+#include "Vm.h"
+
+// one build's command line
+struct BuildOptions {
+    std::string fileName;
+    std::string outName = "out";
+    bool emitAsm = false;
+    bool report = false;
+    bool useCache = true;
+    OptLevel optLevel = OptLevel::O2;
+    std::vector<std::string> disabledPasses;
+    std::string printAfter;
+    bool timePasses = false;
+    std::string tracePath; // chrome trace of the build's phases
+    std::string profileGenerate; // where the instrumented program writes its counts
+    std::string profileUse;
+    bool debugInfo = false;
+    unsigned unrollFactor = 4;
+    bool run = false; // dhad run: execute in process instead of writing a file
+    bool vm = false;  // dhad run --vm: interpret bytecode instead of native code
+    unsigned jobs = std::thread::hardware_concurrency();
+};
+
+inline BuildOptions parseArgs(const std::vector<std::string>& args) {
+    BuildOptions options;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "--emit=asm") {
+            options.emitAsm = true;
+        }
+        else if (arg == "--emit=exe") {
+            options.emitAsm = false;
+        }
+        else if (arg == "-O0" || arg == "-O1" || arg == "-O2" || arg == "-Os") {
+            options.optLevel = arg == "-O0" ? OptLevel::O0 : arg == "-O1" ? OptLevel::O1 : arg == "-O2" ? OptLevel::O2 : OptLevel::Os;
+        }
+        else if (arg.starts_with("--disable-pass=")) {
+            std::string names = arg.substr(arg.find('=') + 1);
+            for (size_t pos = 0; pos <= names.size();) {
+                size_t end = std::min(names.find(',', pos), names.size());
+                options.disabledPasses.push_back(names.substr(pos, end - pos));
+                pos = end + 1;
+            }
+        }
+        else if (arg == "--no-if-convert") {
+            options.disabledPasses.push_back("if-convert");
+        }
+        else if (arg.starts_with("--print-after=")) {
+            options.printAfter = arg.substr(arg.find('=') + 1);
+            const PassInfo* pass = findPass(options.printAfter);
+            if (options.printAfter != "codegen" && (!pass || !pass->run)) {
+                std::cerr << "Not an instruction pass: " << options.printAfter << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "--profile-generate" || arg.starts_with("--profile-generate=")) {
+            options.profileGenerate = arg.size() > 18 ? arg.substr(19) : "dhad.profile";
+            if (options.profileGenerate.empty()) {
+                std::cerr << "Expected a file after --profile-generate=" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg.starts_with("--profile-use=")) {
+            options.profileUse = arg.substr(arg.find('=') + 1);
+            if (options.profileUse.empty()) {
+                std::cerr << "Expected a file after --profile-use=" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg.starts_with("--unroll=")) {
+            std::string_view value = std::string_view(arg).substr(9);
+            auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), options.unrollFactor);
+            if (ec != std::errc() || end != value.data() + value.size() || options.unrollFactor < 1 || options.unrollFactor > 16) {
+                std::cerr << "Unroll factor must be 1 to 16" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == "-g") {
+            options.debugInfo = true;
+        }
+        else if (arg == "--time-passes") {
+            options.timePasses = true;
+        }
+        else if (arg.starts_with("--trace=")) {
+            options.tracePath = arg.substr(arg.find('=') + 1);
+        }
+        else if (arg == "--report") {
+            options.report = true;
+        }
+        else if (arg == "--vm") {
+            options.vm = true;
+        }
+        else if (arg == "--no-cache") {
+            options.useCache = false;
+        }
+        else if (arg == "-o" && i + 1 < args.size()) {
+            options.outName = args[++i];
+        }
+        else if (arg == "-j" && i + 1 < args.size()) {
+            std::string_view value = args[++i];
+            auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), options.jobs);
+            if (ec != std::errc() || end != value.data() + value.size() || options.jobs < 1) {
+                std::cerr << "Job count must be a positive number" << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg.starts_with("-")) {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            exit(1);
+        }
+        else {
+            options.fileName = arg;
+        }
+    }
+
+    if (options.fileName.empty()) {
+        std::cerr << "Too few inputs" << std::endl;
+        exit(1);
+    }
+    return options;
+}
+
+// --print-after needs every module to go through the passes again, as a whole like
+// --emit=asm prints it
+inline Project loadProject(const BuildOptions& options, WarmState* warm, Trace* trace = nullptr) {
+    Project project(options.fileName, Pipeline(options.optLevel, options.disabledPasses), options.jobs);
+    bool reuse = !options.emitAsm && options.printAfter.empty();
+    if (options.useCache && reuse) {
+        project.useCache(std::filesystem::path(options.fileName).parent_path() / ".dhad-cache");
+    }
+    if (warm && reuse) {
+        project.useWarmState(*warm);
+    }
+    if (!reuse) {
+        project.wholeModules();
+    }
+    project.printAfter(options.printAfter);
+    project.unrollFactor(options.unrollFactor);
+    if (options.run) {
+        project.hosted();
+    }
+    if (!options.profileGenerate.empty()) {
+        project.profileGenerate(options.profileGenerate);
+    }
+    if (!options.profileUse.empty()) {
+        project.profileUse(Profile::read(options.profileUse));
+    }
+    if (options.debugInfo) {
+        project.debugInfo();
+    }
+    if (trace) {
+        project.useTrace(*trace);
+    }
+    {
+        Trace::Span span(trace, "load", "build");
+        project.load();
+        span.arg("modules", project.modules().size());
+    }
+    if (!options.vm) {
+        Trace::Span span(trace, "compile", "build");
+        project.compile();
+    }
+    return project;
+}
+
+// --trace, once the compiler is done
+inline void writeTrace(const BuildOptions& options, const std::optional<Trace>& trace) {
+    if (trace && !trace->write(options.tracePath)) {
+        std::cerr << "Failed to write " << options.tracePath << std::endl;
+        exit(1);
+    }
+}
+
+// --report and --time-passes, on stderr
+inline void printReports(const BuildOptions& options, const Project& project) {
+    if (options.report) {
+        for (const Module& module : project.modules()) {
+            std::cerr << module.path.string() << ": ";
+            if (module.cached) {
+                std::cerr << "cached object reused\n";
+            }
+            else if (module.reusedFuncs) {
+                std::cerr << "compiled, " << module.reusedFuncs << " of " << module.funcs << " functions reused\n";
+            }
+            else {
+                std::cerr << "compiled\n";
+            }
+            for (const Remark& remark : module.remarks) {
+                std::cerr << module.path.string() << ':' << remark.line << ": " << remark.msg << '\n';
+            }
+        }
+    }
+
+    if (options.timePasses) {
+        for (const Module& module : project.modules()) {
+            if (module.cached) {
+                std::cerr << module.path.string() << ": cached, no passes run\n";
+            }
+            for (const PassStat& stat : module.passStats) {
+                char line[128];
+                std::snprintf(line, sizeof(line), ": %-18.*s %9.3f ms  %7zu -> %zu insts\n",
+                              static_cast<int>(stat.name.size()), stat.name.data(), stat.ms, stat.before, stat.after);
+                std::cerr << module.path.string() << line;
+            }
+        }
+    }
+}
+
+// compiles and writes the executable or the assembly, errors exit the process
+inline int build(const BuildOptions& options, WarmState* warm = nullptr) {
+    std::optional<Trace> trace;
+    if (!options.tracePath.empty()) {
+        trace.emplace();
+    }
+    Trace* tracing = trace ? &trace.value() : nullptr;
+
+    Project project = loadProject(options, warm, tracing);
+    printReports(options, project);
+
+    if (options.emitAsm) {
+        std::string asmName = options.outName == "out" ? "out.asm" : options.outName;
+        if (!AsmPrinter(project.modules().front().asmProg).print().writeFile(asmName)) {
+            std::cerr << "Failed to write " << asmName << std::endl;
+            return 1;
+        }
+        writeTrace(options, trace);
+        return 0;
+    }
+
+    Object linked = project.link();
+    {
+        Trace::Span span(tracing, "write", "build");
+        ElfWriter(std::move(linked)).writeExecutable(options.outName);
+    }
+
+    writeTrace(options, trace);
+    return 0;
+}
+
+// compiles and runs the program inside this process, returning its exit status.
+// with --vm it's lowered to bytecode and interpreted instead
+inline int run(BuildOptions options, WarmState* warm = nullptr) {
+    options.run = true;
+    options.emitAsm = false;
+
+    std::optional<Trace> trace;
+    if (!options.tracePath.empty()) {
+        trace.emplace();
+    }
+    Trace* tracing = trace ? &trace.value() : nullptr;
+
+    Project project = loadProject(options, warm, tracing);
+    if (options.vm) {
+        std::optional<Trace::Span> lower(std::in_place, tracing, "lower", "build");
+        BcProgram prog = lowerModules(project.modules());
+        lower->arg("functions", prog.funcs.size());
+        lower.reset();
+        writeTrace(options, trace);
+        return Vm(std::move(prog)).run();
+    }
+    printReports(options, project);
+
+    Object linked = project.link({jitHostObject()});
+    writeTrace(options, trace);
+    return Jit(std::move(linked)).run();
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Assembler.h"
+
+// the debug sections of an executable, version 4, 32 bit offsets
+struct DwarfSections {
+    std::vector<uint8_t> abbrev;
+    std::vector<uint8_t> info;
+    std::vector<uint8_t> line;
+    std::vector<uint8_t> aranges;
+};
+
+// one compile unit per module with just enough for a debugger or a profiler to map
+// an address to its source line: the unit's name, its code range and the line
+// table. function names come from the symbol table
+class DwarfWriter {
+public:
+    DwarfWriter(const std::vector<DebugUnit>& units, uint64_t textAddr)
+        : m_units(units), m_textAddr(textAddr) {}
+
+    [[nodiscard]] DwarfSections write() {
+        abbrev();
+        for (const DebugUnit& unit : m_units) {
+            uint64_t lineOffset = m_out.line.size();
+            uint64_t infoOffset = m_out.info.size();
+            lineProgram(unit);
+            compileUnit(unit, lineOffset);
+            arange(unit, infoOffset);
+        }
+        return std::move(m_out);
+    }
+
+private:
+    static constexpr uint16_t VERSION = 4;
+    static constexpr int8_t LINE_BASE = -5;
+    static constexpr uint8_t LINE_RANGE = 14;
+    static constexpr uint8_t OPCODE_BASE = 13;
+
+    enum : uint8_t {
+        DW_TAG_compile_unit = 0x11,
+        DW_AT_name = 0x03, DW_AT_stmt_list = 0x10, DW_AT_low_pc = 0x11, DW_AT_high_pc = 0x12,
+        DW_AT_producer = 0x25, DW_AT_comp_dir = 0x1b,
+        DW_FORM_addr = 0x01, DW_FORM_data8 = 0x07, DW_FORM_string = 0x08, DW_FORM_sec_offset = 0x17,
+        DW_LNS_copy = 0x01, DW_LNS_advance_pc = 0x02, DW_LNS_advance_line = 0x03, DW_LNS_set_column = 0x05,
+        DW_LNE_end_sequence = 0x01, DW_LNE_set_address = 0x02,
+    };
+
+    void abbrev() {
+        std::vector<uint8_t>& out = m_out.abbrev;
+        uleb(out, 1);
+        uleb(out, DW_TAG_compile_unit);
+        out.push_back(0); // no children
+        for (uint8_t attr : {DW_AT_producer, DW_FORM_string, DW_AT_name, DW_FORM_string, DW_AT_comp_dir, DW_FORM_string,
+                             DW_AT_stmt_list, DW_FORM_sec_offset, DW_AT_low_pc, DW_FORM_addr, DW_AT_high_pc, DW_FORM_data8}) {
+            uleb(out, attr);
+        }
+        uleb(out, 0);
+        uleb(out, 0);
+        uleb(out, 0);
+    }
+
+    void compileUnit(const DebugUnit& unit, uint64_t lineOffset) {
+        std::vector<uint8_t>& out = m_out.info;
+        size_t start = beginLength(out);
+        u16(out, VERSION);
+        u32(out, 0); // the one abbreviation table
+        out.push_back(8);
+
+        uleb(out, 1);
+        str(out, "dhad");
+        str(out, unit.file);
+        str(out, std::filesystem::path(unit.file).parent_path().string());
+        u32(out, static_cast<uint32_t>(lineOffset));
+        u64(out, m_textAddr + unit.begin);
+        u64(out, unit.end - unit.begin);
+        endLength(out, start);
+    }
+
+    // rows are in address order. only standard opcodes, one row per source
+    // position, which keeps this short at the cost of a few bytes per row
+    void lineProgram(const DebugUnit& unit) {
+        std::vector<uint8_t>& out = m_out.line;
+        size_t start = beginLength(out);
+        u16(out, VERSION);
+        size_t headerStart = out.size();
+        u32(out, 0); // header_length, patched below
+        out.push_back(1); // minimum_instruction_length
+        out.push_back(1); // maximum_operations_per_instruction
+        out.push_back(1); // default_is_stmt
+        out.push_back(static_cast<uint8_t>(LINE_BASE));
+        out.push_back(LINE_RANGE);
+        out.push_back(OPCODE_BASE);
+        for (uint8_t args : {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1}) {
+            out.push_back(args);
+        }
+        std::filesystem::path file(unit.file);
+        str(out, file.parent_path().string());
+        out.push_back(0);
+        str(out, file.filename().string());
+        uleb(out, 1); // directory
+        uleb(out, 0); // mtime
+        uleb(out, 0); // length
+        out.push_back(0);
+        patch32(out, headerStart, static_cast<uint32_t>(out.size() - headerStart - 4));
+
+        out.push_back(0);
+        uleb(out, 9);
+        out.push_back(DW_LNE_set_address);
+        u64(out, m_textAddr + unit.begin);
+
+        uint64_t addr = unit.begin;
+        int64_t line = 1;
+        for (const LineRow& row : unit.rows) {
+            if (row.offset != addr) {
+                out.push_back(DW_LNS_advance_pc);
+                uleb(out, row.offset - addr);
+                addr = row.offset;
+            }
+            if (row.line != line) {
+                out.push_back(DW_LNS_advance_line);
+                sleb(out, static_cast<int64_t>(row.line) - line);
+                line = row.line;
+            }
+            out.push_back(DW_LNS_set_column);
+            uleb(out, row.col);
+            out.push_back(DW_LNS_copy);
+        }
+
+        if (unit.end != addr) {
+            out.push_back(DW_LNS_advance_pc);
+            uleb(out, unit.end - addr);
+        }
+        out.push_back(0);
+        uleb(out, 1);
+        out.push_back(DW_LNE_end_sequence);
+        endLength(out, start);
+    }
+
+    void arange(const DebugUnit& unit, uint64_t infoOffset) {
+        std::vector<uint8_t>& out = m_out.aranges;
+        size_t start = beginLength(out);
+        u16(out, 2);
+        u32(out, static_cast<uint32_t>(infoOffset));
+        out.push_back(8); // address_size
+        out.push_back(0); // segment_selector_size
+        u32(out, 0);      // pads the header to a multiple of two addresses
+        u64(out, m_textAddr + unit.begin);
+        u64(out, unit.end - unit.begin);
+        u64(out, 0);
+        u64(out, 0);
+        endLength(out, start);
+    }
+
+    // a unit_length to fill in once the unit is written
+    static size_t beginLength(std::vector<uint8_t>& out) {
+        size_t at = out.size();
+        u32(out, 0);
+        return at;
+    }
+
+    static void endLength(std::vector<uint8_t>& out, size_t at) {
+        patch32(out, at, static_cast<uint32_t>(out.size() - at - 4));
+    }
+
+    static void uleb(std::vector<uint8_t>& out, uint64_t val) {
+        do {
+            uint8_t byte = val & 0x7F;
+            val >>= 7;
+            out.push_back(val != 0 ? byte | 0x80 : byte);
+        } while (val != 0);
+    }
+
+    static void sleb(std::vector<uint8_t>& out, int64_t val) {
+        bool more = true;
+        while (more) {
+            uint8_t byte = val & 0x7F;
+            val >>= 7;
+            more = !((val == 0 && !(byte & 0x40)) || (val == -1 && (byte & 0x40)));
+            out.push_back(more ? byte | 0x80 : byte);
+        }
+    }
+
+    static void u16(std::vector<uint8_t>& out, uint16_t val) {
+        out.push_back(static_cast<uint8_t>(val));
+        out.push_back(static_cast<uint8_t>(val >> 8));
+    }
+
+    static void u32(std::vector<uint8_t>& out, uint32_t val) {
+        for (int i = 0; i < 4; ++i) {
+            out.push_back(static_cast<uint8_t>(val >> (i * 8)));
+        }
+    }
+
+    static void u64(std::vector<uint8_t>& out, uint64_t val) {
+        for (int i = 0; i < 8; ++i) {
+            out.push_back(static_cast<uint8_t>(val >> (i * 8)));
+        }
+    }
+
+    static void str(std::vector<uint8_t>& out, std::string_view s) {
+        out.insert(out.end(), s.begin(), s.end());
+        out.push_back(0);
+    }
+
+    static void patch32(std::vector<uint8_t>& out, size_t at, uint32_t val) {
+        for (int i = 0; i < 4; ++i) {
+            out.at(at + i) = static_cast<uint8_t>(val >> (i * 8));
+        }
+    }
+
+private:
+    const std::vector<DebugUnit>& m_units;
+    uint64_t m_textAddr;
+    DwarfSections m_out;
+};
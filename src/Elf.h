@@ -0,0 +1,259 @@
+#pragma once
+
+#include <elf.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Assembler.h"
+#include "Dwarf.h"
+
+// static, non-pie x86-64 executable: headers + .text (R+X), .rodata (R), .data + .bss (RW).
+// objects built with debug info also get the dwarf sections, which aren't loaded
+class ElfWriter {
+public:
+    explicit ElfWriter(Object obj)
+        : m_obj(std::move(obj)) {}
+
+    void writeExecutable(const std::string& path) {
+
+        layout();
+        relocate();
+
+        std::vector<uint8_t> file(m_textOff, 0);
+        append(file, m_obj.text.data(), m_obj.text.size());
+        file.resize(m_rodataOff, 0);
+        append(file, m_obj.rodata.data(), m_obj.rodata.size());
+        file.resize(m_dataOff, 0);
+        append(file, m_obj.data.data(), m_obj.data.size());
+
+        // symbols, locals must come before globals
+        std::string strtab(1, '\0');
+        std::vector<Elf64_Sym> syms(1, Elf64_Sym{});
+        for (int pass = 0; pass < 2; ++pass) {
+            for (const Symbol& sym : m_obj.symbols) {
+                if (sym.global != (pass == 1) || sym.name.empty()) {
+                    continue;
+                }
+                Elf64_Sym es{};
+                es.st_name = static_cast<Elf64_Word>(strtab.size());
+                es.st_info = ELF64_ST_INFO(sym.global ? STB_GLOBAL : STB_LOCAL,
+                                           sym.func ? STT_FUNC : sym.section == SectionId::TEXT ? STT_NOTYPE : STT_OBJECT);
+                es.st_shndx = sectionIndex(sym.section);
+                es.st_value = address(sym);
+                es.st_size = sym.size;
+                syms.push_back(es);
+                strtab += sym.name;
+                strtab.push_back('\0');
+            }
+            if (pass == 0) {
+                m_firstGlobal = syms.size();
+            }
+        }
+
+        uint16_t sectionCount = m_obj.debug.empty() ? SECTION_COUNT : DEBUG_SECTION_COUNT;
+        std::string shstrtab(1, '\0');
+        std::vector<Elf64_Shdr> shdrs(sectionCount, Elf64_Shdr{});
+        auto section = [&](uint16_t idx, const char* name, Elf64_Word type, uint64_t flags,
+                           uint64_t addr, uint64_t offset, uint64_t size, uint64_t align) -> Elf64_Shdr& {
+            Elf64_Shdr& sh = shdrs.at(idx);
+            sh.sh_name = static_cast<Elf64_Word>(shstrtab.size());
+            shstrtab += name;
+            shstrtab.push_back('\0');
+            sh.sh_type = type;
+            sh.sh_flags = flags;
+            sh.sh_addr = addr;
+            sh.sh_offset = offset;
+            sh.sh_size = size;
+            sh.sh_addralign = align;
+            return sh;
+        };
+
+        section(TEXT_IDX, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+                m_textAddr, m_textOff, m_obj.text.size(), 16);
+        section(RODATA_IDX, ".rodata", SHT_PROGBITS, SHF_ALLOC,
+                m_rodataAddr, m_rodataOff, m_obj.rodata.size(), 8);
+        section(DATA_IDX, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE,
+                m_dataAddr, m_dataOff, m_obj.data.size(), 8);
+        section(BSS_IDX, ".bss", SHT_NOBITS, SHF_ALLOC | SHF_WRITE,
+                m_bssAddr, m_dataOff + (m_bssAddr - m_dataAddr), m_obj.bssSize, 8);
+
+        align(file, 8);
+        Elf64_Shdr& symtab = section(SYMTAB_IDX, ".symtab", SHT_SYMTAB, 0,
+                                     0, file.size(), syms.size() * sizeof(Elf64_Sym), 8);
+        symtab.sh_link = STRTAB_IDX;
+        symtab.sh_info = static_cast<Elf64_Word>(m_firstGlobal);
+        symtab.sh_entsize = sizeof(Elf64_Sym);
+        append(file, syms.data(), syms.size() * sizeof(Elf64_Sym));
+
+        section(STRTAB_IDX, ".strtab", SHT_STRTAB, 0, 0, file.size(), strtab.size(), 1);
+        append(file, strtab.data(), strtab.size());
+
+        if (!m_obj.debug.empty()) {
+            DwarfSections dwarf = DwarfWriter(m_obj.debug, m_textAddr).write();
+            auto debug = [&](uint16_t idx, const char* name, const std::vector<uint8_t>& bytes) {
+                section(idx, name, SHT_PROGBITS, 0, 0, file.size(), bytes.size(), 1);
+                append(file, bytes.data(), bytes.size());
+            };
+            debug(DEBUG_ABBREV_IDX, ".debug_abbrev", dwarf.abbrev);
+            debug(DEBUG_INFO_IDX, ".debug_info", dwarf.info);
+            debug(DEBUG_LINE_IDX, ".debug_line", dwarf.line);
+            debug(DEBUG_ARANGES_IDX, ".debug_aranges", dwarf.aranges);
+        }
+
+        section(SHSTRTAB_IDX, ".shstrtab", SHT_STRTAB, 0, 0, file.size(), 0, 1);
+        shdrs.at(SHSTRTAB_IDX).sh_size = shstrtab.size();
+        append(file, shstrtab.data(), shstrtab.size());
+
+        align(file, 8);
+        uint64_t shOff = file.size();
+        append(file, shdrs.data(), shdrs.size() * sizeof(Elf64_Shdr));
+
+        std::vector<Elf64_Phdr> phdrs;
+        auto segment = [&](Elf64_Word flags, uint64_t offset, uint64_t addr, uint64_t filesz, uint64_t memsz) {
+            Elf64_Phdr ph{};
+            ph.p_type = PT_LOAD;
+            ph.p_flags = flags;
+            ph.p_offset = offset;
+            ph.p_vaddr = ph.p_paddr = addr;
+            ph.p_filesz = filesz;
+            ph.p_memsz = memsz;
+            ph.p_align = PAGE;
+            phdrs.push_back(ph);
+        };
+
+        segment(PF_R | PF_X, 0, BASE, m_textOff + m_obj.text.size(), m_textOff + m_obj.text.size());
+        if (!m_obj.rodata.empty()) {
+            segment(PF_R, m_rodataOff, m_rodataAddr, m_obj.rodata.size(), m_obj.rodata.size());
+        }
+        uint64_t rwSize = (m_bssAddr - m_dataAddr) + m_obj.bssSize;
+        if (rwSize > 0) {
+            segment(PF_R | PF_W, m_dataOff, m_dataAddr, m_obj.data.size(), rwSize);
+        }
+
+        Elf64_Ehdr eh{};
+        std::memcpy(eh.e_ident, ELFMAG, SELFMAG);
+        eh.e_ident[EI_CLASS] = ELFCLASS64;
+        eh.e_ident[EI_DATA] = ELFDATA2LSB;
+        eh.e_ident[EI_VERSION] = EV_CURRENT;
+        eh.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+        eh.e_type = ET_EXEC;
+        eh.e_machine = EM_X86_64;
+        eh.e_version = EV_CURRENT;
+        eh.e_entry = address(m_obj.symbols.at(m_obj.entry));
+        eh.e_phoff = sizeof(Elf64_Ehdr);
+        eh.e_shoff = shOff;
+        eh.e_ehsize = sizeof(Elf64_Ehdr);
+        eh.e_phentsize = sizeof(Elf64_Phdr);
+        eh.e_phnum = static_cast<Elf64_Half>(phdrs.size());
+        eh.e_shentsize = sizeof(Elf64_Shdr);
+        eh.e_shnum = sectionCount;
+        eh.e_shstrndx = SHSTRTAB_IDX;
+        std::memcpy(file.data(), &eh, sizeof(eh));
+        std::memcpy(file.data() + sizeof(eh), phdrs.data(), phdrs.size() * sizeof(Elf64_Phdr));
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "Failed to write " << path << "\n";
+            exit(1);
+        }
+        out.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+        out.close();
+
+        std::filesystem::permissions(path,
+            std::filesystem::perms::owner_all | std::filesystem::perms::group_read |
+            std::filesystem::perms::group_exec | std::filesystem::perms::others_read |
+            std::filesystem::perms::others_exec);
+    }
+
+private:
+    static constexpr uint64_t BASE = 0x400000;
+    static constexpr uint64_t PAGE = 0x1000;
+
+    enum : uint16_t {
+        TEXT_IDX = 1, RODATA_IDX, DATA_IDX, BSS_IDX,
+        SYMTAB_IDX, STRTAB_IDX, SHSTRTAB_IDX, SECTION_COUNT,
+        DEBUG_ABBREV_IDX = SECTION_COUNT, DEBUG_INFO_IDX, DEBUG_LINE_IDX, DEBUG_ARANGES_IDX, DEBUG_SECTION_COUNT
+    };
+
+    // every segment starts on its own page, file offsets mirror the addresses
+    void layout() {
+        m_textOff = PAGE;
+        m_textAddr = BASE + m_textOff;
+
+        m_rodataOff = alignUp(m_textOff + m_obj.text.size(), PAGE);
+        m_rodataAddr = BASE + m_rodataOff;
+
+        m_dataOff = alignUp(m_rodataOff + m_obj.rodata.size(), PAGE);
+        m_dataAddr = BASE + m_dataOff;
+
+        // bss takes no file space, it follows .data in the same segment
+        m_bssAddr = m_dataAddr + alignUp(m_obj.data.size(), 8);
+    }
+
+    void relocate() {
+        for (const Reloc& rel : m_obj.relocs) {
+            int64_t s = static_cast<int64_t>(address(m_obj.symbols.at(rel.symbol)));
+            int64_t p = static_cast<int64_t>(m_textAddr + rel.offset);
+            int64_t val = s + rel.addend - p;
+            if (val < INT32_MIN || val > INT32_MAX) {
+                std::cerr << "Relocation out of range: " << m_obj.symbols.at(rel.symbol).name << "\n";
+                exit(1);
+            }
+            auto v = static_cast<uint32_t>(val);
+            for (int i = 0; i < 4; ++i) {
+                m_obj.text.at(rel.offset + i) = static_cast<uint8_t>(v >> (i * 8));
+            }
+        }
+    }
+
+    uint64_t address(const Symbol& sym) const {
+        switch (sym.section) {
+            case SectionId::TEXT:   return m_textAddr + sym.offset;
+            case SectionId::RODATA: return m_rodataAddr + sym.offset;
+            case SectionId::DATA:   return m_dataAddr + sym.offset;
+            case SectionId::BSS:    return m_bssAddr + sym.offset;
+            case SectionId::EXTERN: break;
+        }
+        return 0;
+    }
+
+    static uint16_t sectionIndex(SectionId section) {
+        switch (section) {
+            case SectionId::TEXT:   return TEXT_IDX;
+            case SectionId::RODATA: return RODATA_IDX;
+            case SectionId::DATA:   return DATA_IDX;
+            case SectionId::BSS:    return BSS_IDX;
+            case SectionId::EXTERN: break;
+        }
+        return 0;
+    }
+
+    static uint64_t alignUp(uint64_t val, uint64_t to) {
+        return (val + to - 1) & ~(to - 1);
+    }
+
+    static void align(std::vector<uint8_t>& buf, size_t to) {
+        buf.resize(alignUp(buf.size(), to), 0);
+    }
+
+    static void append(std::vector<uint8_t>& buf, const void* data, size_t len) {
+        auto bytes = static_cast<const uint8_t*>(data);
+        buf.insert(buf.end(), bytes, bytes + len);
+    }
+
+private:
+    Object m_obj;
+    uint64_t m_textOff = 0;
+    uint64_t m_textAddr = 0;
+    uint64_t m_rodataOff = 0;
+    uint64_t m_rodataAddr = 0;
+    uint64_t m_dataOff = 0;
+    uint64_t m_dataAddr = 0;
+    uint64_t m_bssAddr = 0;
+    size_t m_firstGlobal = 0;
+};
@@ -1,24 +1,109 @@
 #pragma once
 
-#include <sstream>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <functional>
 #include <unordered_map>
+#include <unordered_set>
 #include <variant>
 
 #include "Parser.h"
+#include "Asm.h"
+#include "Hasher.h"
+#include "NodeCounter.h"
+#include "Profile.h"
+#include "Runtime.h"
+#include "Trace.h"
+
+// lowering choices, set by the -O level's Pipeline
+struct GenOptions {
+    bool ifConvert = true;
+    bool boundsCheckElim = true;
+    bool vectorize = true;
+    bool unroll = true;
+    bool alignLoops = true;
+    unsigned unrollFactor = 4; // --unroll: copies of a لكل body per test of its counter
+    bool hosted = false; // runtime exits back into the compiler, for dhad run
+
+    // --profile-generate: count this module's ProfileSites in the array named
+    // profileSymbol. the main module writes every module's array to profileOut
+    std::string profileSymbol;
+    std::string profileOut;
+    std::vector<ProfileModule> profileModules;
+    // --profile-use: what each site counted, empty without a profile for this module
+    std::vector<uint64_t> profileCounts;
+    // -g: mark each statement's code with its position in this file
+    std::string debugFile;
+};
+
+// note about an optimization applied at a source line, for --report
+struct Remark {
+    size_t line;
+    std::string msg;
+};
+
+// one function's code on its own, or with an empty name the rest of its module:
+// top level code, globals and the runtime. see Generator::genUnits
+struct GenUnit {
+    std::string name;
+    uint64_t key = 0;    // see Generator::funcKey, 0 for the rest
+    size_t line = 0;     // of the function's name
+    bool reused = false; // not generated, the caller kept its object
+    AsmProg prog;
+    std::vector<Remark> remarks;
+};
 
 class Generator {
 public:
-    Generator(NodeProg root)
-        : m_prog(std::move(root)) {}
+    Generator(NodeProg root, GenOptions options = {})
+        : m_prog(std::move(root)), m_options(options)
+    {
+        m_asm.debugFile = m_options.debugFile;
+        if (!m_options.profileSymbol.empty() || !m_options.profileCounts.empty()) {
+            m_sites.emplace(m_prog);
+        }
+        // every arm and every iteration has to run through its counter
+        if (!m_options.profileSymbol.empty()) {
+            m_options.ifConvert = false;
+            m_options.vectorize = false;
+            m_profCounters = namedLabel(m_options.profileSymbol);
+            m_asm.bss.push_back({m_profCounters, std::max<size_t>(m_sites->count(), 1)});
+            m_asm.globals.push_back(m_profCounters);
+        }
+        if (!m_options.profileCounts.empty()) {
+            m_hottest = *std::max_element(m_options.profileCounts.begin(), m_options.profileCounts.end());
+        }
+    }
+
+    const std::vector<Remark>& remarks() const {
+        return m_remarks;
+    }
+
+    // one span per function's codegen, see Trace
+    void useTrace(Trace& trace) {
+        m_trace = &trace;
+    }
 
+    // a function another module exports, called through an extern symbol
+    void importFunc(const NodeStmtFuncDecl* funcDecl) {
+        if (m_funcs.contains(funcDecl->ident.val)) {
+            std::cerr << "Function imported twice: " << funcDecl->ident.val << "\n";
+            exit(1);
+        }
+        Label label = namedLabel(funcDecl->ident.val);
+        m_asm.externs.push_back(label);
+        m_funcs.insert({funcDecl->ident.val, {funcDecl, label}});
+    }
 
+
+    // terms and binary expressions leave their value in rax, genExpr pushes it
     void genTerm(const NodeTerm* term) {
 
         struct TermVisitor {
             Generator* gen;
             void operator()(const NodeTermIntLit* intLit) const {
-                gen->m_output << "   mov rax, " << intLit->int_lit.val << "\n";
-                gen->push("rax");
+                gen->emit(Op::MOV, Reg::RAX, Imm{intLit->int_lit.intVal});
             }
 
             void operator()(const NodeTermIdent* ident) const {
@@ -27,18 +112,20 @@ public:
                     exit(1);
                 }
                 const auto& var = gen->m_vars.at(ident->ident.val);
-                if (var.isGlobal) {
-                    gen->push("QWORD [" + var.label + "]");
+                if (var.isArray()) {
+                    std::cerr << "Array used as a value: " << ident->ident.val << std::endl;
+                    exit(1);
+                }
+                if (var.constVal.has_value()) {
+                    gen->emit(Op::MOV, Reg::RAX, Imm{var.constVal.value()});
                 }
                 else {
-                    std::stringstream offset;
-                    offset << "QWORD [rsp + " << (gen->m_stackSize - var.m_stackLoc) * 8 << "]";
-                    gen->push(offset.str());
+                    gen->emitLoad(Reg::RAX, gen->varOperand(var), var.type, var.type);
                 }
             }
 
             void operator()(const NodeTermParen* termParen) const {
-                gen->genExpr(termParen->expr);
+                gen->genValue(termParen->expr);
             }
 
             void operator()(const NodeTermFuncCall* funcCall) const {
@@ -54,13 +141,55 @@ public:
                     exit(1);
                 }
 
+                // keep rsp 16-byte aligned at the call, pad below the args
+                size_t argCount = funcCall->args.size();
+                size_t pad = (gen->m_stackSize + argCount) % 2 == 0 ? 0 : 1;
+                if (pad) {
+                    gen->emit(Op::SUB, Reg::RSP, Imm{8});
+                    gen->m_stackSize++;
+                }
+
                 for (const auto& arg : funcCall->args) {
                     gen->genExpr(arg);
                 }
 
-                gen->m_output << "   call " << func.label << "\n";
-                gen->m_output << "   add rsp, " << (funcCall->args.size() * 8) << "\n";
-                gen->push("rax");
+                gen->emit(Op::CALL, func.label);
+                gen->killGlobalInductions();
+                gen->emit(Op::ADD, Reg::RSP, Imm{static_cast<int64_t>((argCount + pad) * 8)});
+                gen->m_stackSize -= argCount + pad;
+            }
+
+            void operator()(const NodeTermRead*) const {
+                gen->emit(Op::CALL, gen->m_runtime.readInt());
+            }
+
+            void operator()(const NodeTermIndex* termIndex) const {
+                const Var& arr = gen->arrayVar(termIndex->ident.val);
+                auto constIndex = gen->constEval(termIndex->index);
+                if (!constIndex && !gen->counterReg(termIndex->index)) {
+                    gen->genValue(termIndex->index);
+                }
+                gen->emitLoad(Reg::RAX, gen->element(arr, termIndex->ident.val, termIndex->index, constIndex), arr.type, arr.type);
+            }
+
+            void operator()(const NodeTermCast* termCast) const {
+                gen->genValue(termCast->expr);
+                gen->convert(termCast->expr->usedAs, termCast->type);
+            }
+
+            void operator()(const NodeTermNot* termNot) const {
+                Cond cc = Cond::E;
+                if (auto cmp = gen->compareOf(termNot->expr)) {
+                    gen->genCmp(cmp->lhs, cmp->rhs);
+                    cc = negate(cmp->cc);
+                }
+                else {
+                    gen->genValue(termNot->expr);
+                    Operand acc = sized(Reg::RAX, termNot->expr->usedAs);
+                    gen->emit(Op::TEST, acc, acc);
+                }
+                gen->emit(Op::SETCC, low8(Reg::RAX), {}, cc);
+                gen->emit(Op::MOVZX, Reg::RAX, low8(Reg::RAX));
             }
         };
 
@@ -68,129 +197,409 @@ public:
         std::visit(visitor, term->var);
     }
 
+    // operands arrive as the operation's type, so the lhs's usedAs is the type it runs in
     void genBinExpr(const BinExpr* binExpr) {
 
         struct BinExprVisitor {
             Generator* gen;
             void operator()(const BinExprAdd* exprAdd) {
-                gen->genExpr(exprAdd->lhs);
-                gen->genExpr(exprAdd->rhs);
-
-                gen->pop("rbx");
-                gen->pop("rax");
-
-                gen->m_output << "   add rax, rbx\n";
-                
-                gen->push("rax");
+                if (gen->genScaledAdd(exprAdd->lhs, exprAdd->rhs, false) ||
+                    gen->genScaledAdd(exprAdd->rhs, exprAdd->lhs, true)) {
+                    return;
+                }
+                IntType type = exprAdd->lhs->usedAs;
+                Operand src = gen->genOperands(exprAdd->lhs, exprAdd->rhs, true);
+                gen->emit(Op::ADD, sized(Reg::RAX, type), src);
+                gen->narrow(type);
             }
 
             void operator()(const BinExprSub* exprSub) {
-                gen->genExpr(exprSub->lhs);
-                gen->genExpr(exprSub->rhs);
-
-                gen->pop("rbx");
-                gen->pop("rax");
-
-                gen->m_output << "   sub rax, rbx\n";
-                
-                gen->push("rax");
+                IntType type = exprSub->lhs->usedAs;
+                Operand src = gen->genOperands(exprSub->lhs, exprSub->rhs, false);
+                gen->emit(Op::SUB, sized(Reg::RAX, type), src);
+                gen->narrow(type);
             }
 
             void operator()(const BinExprMult* exprMulti) {
-                gen->genExpr(exprMulti->lhs);
-                gen->genExpr(exprMulti->rhs);
+                if (gen->genMultConst(exprMulti->lhs, exprMulti->rhs) ||
+                    gen->genMultConst(exprMulti->rhs, exprMulti->lhs)) {
+                    return;
+                }
+                IntType type = exprMulti->lhs->usedAs;
+                Operand src = gen->genOperands(exprMulti->lhs, exprMulti->rhs, true);
+                gen->emit(Op::IMUL, sized(Reg::RAX, type), src);
+                gen->narrow(type);
+            }
 
-                gen->pop("rbx");
-                gen->pop("rax");
+            // only i8 and i16 can overflow, MIN / -1
+            void operator()(const BinExprDiv* exprDiv) {
+                IntType type = exprDiv->lhs->usedAs;
+                gen->genDivide(exprDiv->lhs, exprDiv->rhs);
+                if (isSigned(type)) {
+                    gen->narrow(type);
+                }
+            }
 
-                gen->m_output << "   imul rax, rbx\n";
-                
-                gen->push("rax");
+            void operator()(const BinExprMod* exprMod) {
+                IntType type = exprMod->lhs->usedAs;
+                gen->genDivide(exprMod->lhs, exprMod->rhs);
+                gen->emit(Op::MOV, sized(Reg::RAX, type), sized(Reg::RDX, type));
             }
 
-            void operator()(const BinExprDiv* exprDiv) {
-                gen->genExpr(exprDiv->lhs);
-                gen->genExpr(exprDiv->rhs);
+            void operator()(const BinExprEqTo* exprEq) {
+                gen->genCompare(exprEq->lhs, exprEq->rhs, Cond::E);
+            }
 
-                gen->pop("rbx");
-                gen->pop("rax");
+            void operator()(const BinExprNotEqTo* exprNeq) {
+                gen->genCompare(exprNeq->lhs, exprNeq->rhs, Cond::NE);
+            }
 
-                gen->m_output << "   cqo\n";
-                gen->m_output << "   idiv rbx\n";
-                
-                gen->push("rax");
+            void operator()(const BinExprAnd* exprAnd) {
+                gen->genBool(exprAnd->lhs, exprAnd->rhs, true);
             }
 
-            void operator()(const BinExprMod* exprMod) {
-                gen->genExpr(exprMod->lhs);
-                gen->genExpr(exprMod->rhs);
+            void operator()(const BinExprOr* exprOr) {
+                gen->genBool(exprOr->lhs, exprOr->rhs, false);
+            }
 
-                gen->pop("rbx");
-                gen->pop("rax");
+            void operator()(const BinExprLsThan* exprLt) {
+                gen->genCompare(exprLt->lhs, exprLt->rhs, Cond::L);
+            }
 
-                gen->m_output << "   idiv rbx\n";
-                
-                gen->push("rdx");
+            void operator()(const BinExprGrThan* exprGt) {
+                gen->genCompare(exprGt->lhs, exprGt->rhs, Cond::G);
             }
+        };
 
-            void operator()(const BinExprEqTo* exprEq) {
-                gen->genExpr(exprEq->lhs);
-                gen->genExpr(exprEq->rhs);
+        BinExprVisitor visitor{this};
+        std::visit(visitor, binExpr->var);
+    }
 
-                gen->pop("rbx");
-                gen->pop("rax");
+    // an imm32 constant, a scalar's memory or a constant index element, usable as a
+    // source operand as is. memory only when it is a dword or a qword already in the
+    // type expr is used as
+    std::optional<Operand> simpleOperand(const NodeExpr* expr) {
+        if (auto val = constEval(expr)) {
+            return immediate(val.value(), expr->usedAs);
+        }
 
-                gen->m_output << "   cmp rax, rbx\n";
-                gen->m_output << "   sete al\n";
-                gen->m_output << "   movzx rax, al\n";
-                gen->push("rax");
+        auto term = std::get_if<NodeTerm*>(&expr->var);
+        if (!term || typeSize(expr->type) < 4 || typeSize(expr->type) != typeSize(expr->usedAs)) {
+            return {};
+        }
+        if (auto termIndex = std::get_if<NodeTermIndex*>(&(*term)->var)) {
+            auto constIndex = constEval((*termIndex)->index);
+            if (!constIndex || arrayVar((*termIndex)->ident.val).heap) {
+                return {};
             }
+            return element(arrayVar((*termIndex)->ident.val), (*termIndex)->ident.val, (*termIndex)->index, constIndex);
+        }
 
-            void operator()(const BinExprNotEqTo* exprNeq) {
-                gen->genExpr(exprNeq->lhs);
-                gen->genExpr(exprNeq->rhs);
+        auto ident = std::get_if<NodeTermIdent*>(&(*term)->var);
+        if (!ident || !m_vars.contains((*ident)->ident.val)) {
+            return {};
+        }
+        const Var& var = m_vars.at((*ident)->ident.val);
+        if (var.isArray()) {
+            return {};
+        }
+        return varOperand(var);
+    }
 
-                gen->pop("rbx");
-                gen->pop("rax");
+    // a dword operation only sees the low half, any value converts to its imm32
+    static std::optional<Operand> immediate(int64_t val, IntType type) {
+        if (typeSize(type) < 8) {
+            return Operand(Imm{static_cast<int32_t>(val)});
+        }
+        if (val < INT32_MIN || val > INT32_MAX) {
+            return {};
+        }
+        return Operand(Imm{val});
+    }
 
-                gen->m_output << "   cmp rax, rbx\n";
-                gen->m_output << "   setne al\n";
-                gen->m_output << "   movzx rax, al\n";
-                gen->push("rax");
-            }
+    // no call can write it, it may be read after a later operand is computed
+    static bool stable(const Operand& op) {
+        return op.isImm() || !op.ripRel;
+    }
 
-            void operator()(const BinExprLsThan* exprLt) {
-                gen->genExpr(exprLt->lhs);
-                gen->genExpr(exprLt->rhs);
+    // no call in expr, so computing it can't write a variable another operand reads
+    bool callFree(const NodeExpr* expr) {
+        if (auto binExpr = std::get_if<BinExpr*>(&expr->var)) {
+            return std::visit([this](const auto* bin) {
+                return callFree(bin->lhs) && callFree(bin->rhs);
+            }, (*binExpr)->var);
+        }
+
+        const NodeTerm* term = std::get<NodeTerm*>(expr->var);
+        if (auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+            return callFree((*paren)->expr);
+        }
+        if (auto termIndex = std::get_if<NodeTermIndex*>(&term->var)) {
+            return callFree((*termIndex)->index);
+        }
+        if (auto termCast = std::get_if<NodeTermCast*>(&term->var)) {
+            return callFree((*termCast)->expr);
+        }
+        if (auto termNot = std::get_if<NodeTermNot*>(&term->var)) {
+            return callFree((*termNot)->expr);
+        }
+        return !std::holds_alternative<NodeTermFuncCall*>(term->var);
+    }
+
+    // the variables and arrays expr reads
+    void collectNames(const NodeExpr* expr, std::unordered_set<std::string>& names) {
+        if (auto binExpr = std::get_if<BinExpr*>(&expr->var)) {
+            std::visit([this, &names](const auto* bin) {
+                collectNames(bin->lhs, names);
+                collectNames(bin->rhs, names);
+            }, (*binExpr)->var);
+            return;
+        }
+
+        const NodeTerm* term = std::get<NodeTerm*>(expr->var);
+        if (auto ident = std::get_if<NodeTermIdent*>(&term->var)) {
+            names.insert((*ident)->ident.val);
+        }
+        else if (auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+            collectNames((*paren)->expr, names);
+        }
+        else if (auto termIndex = std::get_if<NodeTermIndex*>(&term->var)) {
+            names.insert((*termIndex)->ident.val);
+            collectNames((*termIndex)->index, names);
+        }
+        else if (auto termCast = std::get_if<NodeTermCast*>(&term->var)) {
+            collectNames((*termCast)->expr, names);
+        }
+        else if (auto termNot = std::get_if<NodeTermNot*>(&term->var)) {
+            collectNames((*termNot)->expr, names);
+        }
+        else if (auto funcCall = std::get_if<NodeTermFuncCall*>(&term->var)) {
+            for (const NodeExpr* arg : (*funcCall)->args) {
+                collectNames(arg, names);
+            }
+        }
+    }
 
-                gen->pop("rbx");
-                gen->pop("rax");
+    // lhs into rax and rhs as a source operand beside it: an immediate, the variable's
+    // memory, or rbx once computed. only a spill when both sides need real work
+    Operand genOperands(const NodeExpr* lhs, const NodeExpr* rhs, bool commutative) {
+        IntType type = lhs->usedAs;
+        if (auto src = simpleOperand(rhs)) {
+            genValue(lhs);
+            return src.value();
+        }
+        if (const Var* var = scalarVar(rhs)) {
+            genValue(lhs);
+            emitLoad(Reg::RBX, varOperand(*var), rhs->type, rhs->usedAs);
+            return sized(Reg::RBX, type);
+        }
 
-                gen->m_output << "   cmp rax, rbx\n";
-                gen->m_output << "   setl al\n";
-                gen->m_output << "   movzx rax, al\n";
-                gen->push("rax");
+        if (auto first = simpleOperand(lhs); first && (stable(first.value()) || callFree(rhs))) {
+            genValue(rhs);
+            if (commutative && first->isMem()) {
+                return first.value();
             }
+            emit(Op::MOV, Reg::RBX, Reg::RAX);
+            emit(Op::MOV, sized(Reg::RAX, type), first.value());
+            return sized(Reg::RBX, type);
+        }
 
-            void operator()(const BinExprGrThan* exprGt) {
-                gen->genExpr(exprGt->lhs);
-                gen->genExpr(exprGt->rhs);
+        genExpr(lhs);
+        genValue(rhs);
+        emit(Op::MOV, Reg::RBX, Reg::RAX);
+        pop(Reg::RAX);
+        return sized(Reg::RBX, type);
+    }
+
+    // base + x * 2|4|8 as one lea once base is in rax
+    bool genScaledAdd(const NodeExpr* base, const NodeExpr* scaled, bool scaledFirst) {
+        auto binExpr = std::get_if<BinExpr*>(&scaled->var);
+        if (!binExpr) {
+            return false;
+        }
+        auto exprMulti = std::get_if<BinExprMult*>(&(*binExpr)->var);
+        if (!exprMulti) {
+            return false;
+        }
+
+        const NodeExpr* x = (*exprMulti)->lhs;
+        auto scale = constEval((*exprMulti)->rhs);
+        if (!scale) {
+            x = (*exprMulti)->rhs;
+            scale = constEval((*exprMulti)->lhs);
+        }
+        if (scale != 2 && scale != 4 && scale != 8) {
+            return false;
+        }
+
+        auto index = simpleOperand(x);
+        if (!index || !index->isMem() || (scaledFirst && !stable(index.value()) && !callFree(base))) {
+            return false;
+        }
+
+        IntType type = base->usedAs;
+        genValue(base);
+        emit(Op::MOV, sized(Reg::RCX, type), index.value());
+        emit(Op::LEA, sized(Reg::RAX, type), mem(8, Reg::RAX, Reg::RCX, static_cast<uint8_t>(scale.value())));
+        narrow(type);
+        return true;
+    }
+
+    // x * c: a shift for powers of two, lea for 3, 5 and 9, else imul by the immediate
+    bool genMultConst(const NodeExpr* x, const NodeExpr* factor) {
+        IntType type = x->usedAs;
+        auto val = constEval(factor);
+        if (!val) {
+            return false;
+        }
+        int64_t c = typeSize(type) < 8 ? static_cast<int32_t>(val.value()) : val.value();
+        if (c < INT32_MIN || c > INT32_MAX) {
+            return false;
+        }
+
+        Operand acc = sized(Reg::RAX, type);
+        auto src = simpleOperand(x);
+        bool pow2 = c > 1 && std::has_single_bit(static_cast<uint64_t>(c));
+        if (src && src->isMem() && !pow2 && c != 1 && c != 3 && c != 5 && c != 9) {
+            emitImul3(acc, src.value(), c);
+            narrow(type);
+            return true;
+        }
+
+        genValue(x);
+        if (pow2) {
+            emit(Op::SHL, acc, Imm{std::countr_zero(static_cast<uint64_t>(c))});
+        }
+        else if (c == 3 || c == 5 || c == 9) {
+            emit(Op::LEA, acc, mem(8, Reg::RAX, Reg::RAX, static_cast<uint8_t>(c - 1)));
+        }
+        else if (c != 1) {
+            emitImul3(acc, acc, c);
+        }
+        if (c != 1) {
+            narrow(type);
+        }
+        return true;
+    }
+
+    // quotient in rax, remainder in rdx. 32 bit division for the small types, whose
+    // values are already extended to 32 bits
+    void genDivide(const NodeExpr* lhs, const NodeExpr* rhs) {
+        IntType type = lhs->usedAs;
+        Operand divisor = genOperands(lhs, rhs, false);
+        if (divisor.isImm()) {
+            emit(Op::MOV, sized(Reg::RBX, type), divisor);
+            divisor = sized(Reg::RBX, type);
+        }
+        if (!isSigned(type)) {
+            emit(Op::XOR, low32(Reg::RDX), low32(Reg::RDX));
+            emit(Op::DIV, divisor);
+            return;
+        }
+        emit(typeSize(type) < 8 ? Op::CDQ : Op::CQO);
+        emit(Op::IDIV, divisor);
+    }
 
-                gen->pop("rbx");
-                gen->pop("rax");
+    // flags for lhs against rhs, a test when rhs is zero
+    void genCmp(const NodeExpr* lhs, const NodeExpr* rhs) {
+        Operand acc = sized(Reg::RAX, lhs->usedAs);
+        if (constEval(rhs) == 0) {
+            genValue(lhs);
+            emit(Op::TEST, acc, acc);
+            return;
+        }
+
+        Operand src = genOperands(lhs, rhs, false);
+        emit(Op::CMP, acc, src);
+    }
+
+    void genCompare(const NodeExpr* lhs, const NodeExpr* rhs, Cond cc) {
+        genCmp(lhs, rhs);
+        emit(Op::SETCC, low8(Reg::RAX), {}, orderIn(cc, lhs->usedAs));
+        emit(Op::MOVZX, Reg::RAX, low8(Reg::RAX));
+    }
+
+    // jumps to target when expr is truthy == jumpIf, comparisons branch on their own flags
+    // and logical operators become chains of such jumps
+    void genCond(const NodeExpr* expr, Label target, bool jumpIf) {
 
-                gen->m_output << "   cmp rax, rbx\n";
-                gen->m_output << "   setg al\n";
-                gen->m_output << "   movzx rax, al\n";
-                gen->push("rax");
+        if (auto val = constEval(expr)) {
+            if ((val.value() != 0) == jumpIf) {
+                emit(Op::JMP, target);
             }
-        };
+            return;
+        }
 
-        BinExprVisitor visitor{this};
-        std::visit(visitor, binExpr->var);
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                genCond((*paren)->expr, target, jumpIf);
+                return;
+            }
+            if (auto termNot = std::get_if<NodeTermNot*>(&(*term)->var)) {
+                genCond((*termNot)->expr, target, !jumpIf);
+                return;
+            }
+        }
+        if (auto binExpr = std::get_if<BinExpr*>(&expr->var)) {
+            if (auto exprAnd = std::get_if<BinExprAnd*>(&(*binExpr)->var)) {
+                genShortCircuit((*exprAnd)->lhs, (*exprAnd)->rhs, true, target, jumpIf);
+                return;
+            }
+            if (auto exprOr = std::get_if<BinExprOr*>(&(*binExpr)->var)) {
+                genShortCircuit((*exprOr)->lhs, (*exprOr)->rhs, false, target, jumpIf);
+                return;
+            }
+        }
+
+        if (auto cmp = compareOf(expr)) {
+            genCmp(cmp->lhs, cmp->rhs);
+            emit(Op::JCC, target, {}, jumpIf ? cmp->cc : negate(cmp->cc));
+            return;
+        }
+
+        genValue(expr);
+        Operand acc = sized(Reg::RAX, expr->usedAs);
+        emit(Op::TEST, acc, acc);
+        emit(Op::JCC, target, {}, jumpIf ? Cond::NE : Cond::E);
     }
 
-    void genExpr(const NodeExpr* expr)  {
+    // lhs && rhs or lhs || rhs. when either operand alone decides the jump both
+    // branch to target, otherwise lhs skips over rhs's test
+    void genShortCircuit(const NodeExpr* lhs, const NodeExpr* rhs, bool isAnd, Label target, bool jumpIf) {
+        if (isAnd != jumpIf) {
+            genCond(lhs, target, jumpIf);
+            genCond(rhs, target, jumpIf);
+            return;
+        }
+        Label skip = createLabel();
+        genCond(lhs, skip, !jumpIf);
+        genCond(rhs, target, jumpIf);
+        bind(skip);
+    }
+
+    // rax = lhs && rhs or lhs || rhs as 0 or 1, for a value rather than a branch
+    void genBool(const NodeExpr* lhs, const NodeExpr* rhs, bool isAnd) {
+        Label isFalse = createLabel();
+        Label end = createLabel();
+        genShortCircuit(lhs, rhs, isAnd, isFalse, false);
+        emit(Op::MOV, Reg::RAX, Imm{1});
+        emit(Op::JMP, end);
+        bind(isFalse);
+        emit(Op::MOV, Reg::RAX, Imm{0});
+        bind(end);
+    }
+
+    // rax = expr, as the type it is used as
+    void genValue(const NodeExpr* expr) {
+
+        if (auto val = constEval(expr)) {
+            emit(Op::MOV, sized(Reg::RAX, expr->usedAs), Imm{val.value()});
+            return;
+        }
+        if (const Var* var = scalarVar(expr)) {
+            emitLoad(Reg::RAX, varOperand(*var), expr->type, expr->usedAs);
+            return;
+        }
 
         struct ExprVisitor {
             Generator* gen;
@@ -205,6 +614,43 @@ public:
 
         ExprVisitor visitor{this};
         std::visit(visitor, expr->var);
+        convert(expr->type, expr->usedAs);
+    }
+
+    // pushes a qword whose low bytes are expr's value
+    void genExpr(const NodeExpr* expr)  {
+        if (auto src = simpleOperand(expr); src && (src->isImm() || src->size == 8)) {
+            push(src.value());
+            return;
+        }
+        genValue(expr);
+        push(Reg::RAX);
+    }
+
+    // reg = expr, without going through rax when expr is a plain operand
+    void genInto(Reg reg, const NodeExpr* expr) {
+        if (auto src = simpleOperand(expr)) {
+            emit(Op::MOV, sized(reg, expr->usedAs), src.value());
+            return;
+        }
+        if (const Var* var = scalarVar(expr)) {
+            emitLoad(reg, varOperand(*var), expr->type, expr->usedAs);
+            return;
+        }
+        genValue(expr);
+        if (reg != Reg::RAX) {
+            emit(Op::MOV, reg, Reg::RAX);
+        }
+    }
+
+    // dst is as wide as expr's type
+    void genStore(const Operand& dst, const NodeExpr* expr) {
+        if (auto src = simpleOperand(expr); src && src->isImm()) {
+            emit(Op::MOV, dst, src.value());
+            return;
+        }
+        genInto(Reg::RAX, expr);
+        emit(Op::MOV, dst, regOf(Reg::RAX, dst.size));
     }
 
     void genScope(const NodeScope* scope) {
@@ -217,132 +663,963 @@ public:
         scopeEnd();
     }
 
-    void genIfPred(const NodeIfPred* pred, std::string endLabel) {
+    // one way through an اذا: its condition, none for وإلا, and its body, none for
+    // the empty وإلا at the end of a chain without one
+    struct IfArm {
+        const NodeExpr* cond;
+        const NodeScope* scope;
+        const NodeIfPredElif* elif = nullptr;
+    };
 
-        struct PredVisitor {
-            Generator* gen;
-            std::string endLabel;
+    static std::vector<IfArm> ifArms(const NodeStmtIf* stmtIf) {
+        std::vector<IfArm> arms{{stmtIf->expr, stmtIf->scope}};
+        std::optional<NodeIfPred*> pred = stmtIf->pred;
+        while (pred.has_value()) {
+            if (auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+                arms.push_back({(*predElif)->expr, (*predElif)->scope, *predElif});
+                pred = (*predElif)->pred;
+            }
+            else {
+                arms.push_back({nullptr, std::get<NodeIfPredElse*>(pred.value()->var)->scope});
+                pred = {};
+            }
+        }
+        if (arms.back().cond) {
+            arms.push_back({nullptr, nullptr});
+        }
+        return arms;
+    }
 
-            void operator()(const NodeIfPredElif* predElif) {
-                gen->genExpr(predElif->expr);
-                gen->pop("rax");
-                gen->m_output << "   cmp rax, 0\n";
+    // each arm falls through from its test, later arms are reached by a taken
+    // branch. arms the profile shows cold move out of line, behind the hot path
+    void genIf(const NodeStmtIf* stmtIf) {
+        std::vector<IfArm> arms = ifArms(stmtIf);
+        size_t firstSite = m_sites ? m_sites->ifArms(stmtIf) : 0;
+        Label endLabel = createLabel("end");
 
-                std::string label = gen->createLabel();
-                gen->m_output << "   jz " << label << "\n";
-                
-                gen->genScope(predElif->scope);
+        for (size_t i = 0; i < arms.size(); ++i) {
+            const IfArm& arm = arms[i];
 
-                gen->m_output << "   jmp " << endLabel << "\n";
+            if (arm.elif) {
+                loc({arm.elif->line, arm.elif->col});
+            }
+            if (coldArm(stmtIf, arms, i)) {
+                Label coldLabel = namedLabel(m_funcName + ".cold" + std::to_string(labelCounter++));
+                m_asm.funcs.push_back(coldLabel);
+                if (arm.cond) {
+                    genCond(arm.cond, coldLabel, true);
+                }
+                else {
+                    emit(Op::JMP, coldLabel);
+                }
 
-                gen->m_output << label << ":\n";
+                Switch::Out out = m_output.current();
+                m_output.set(Switch::Out::COLD);
+                bind(coldLabel);
+                loc(m_loc);
+                countSite(firstSite + i);
+                genScope(arm.scope);
+                emit(Op::JMP, endLabel);
+                m_output.set(out);
+
+                m_remarks.push_back({stmtIf->line, "arm " + std::to_string(i + 1) + " of اذا moved out of line, ran " +
+                                     std::to_string(siteCount(firstSite + i)) + " times"});
+                continue;
+            }
 
-                if (predElif->pred.has_value()) {
-                    gen->genIfPred(predElif->pred.value(), endLabel);
-                }
+            Label next = createLabel();
+            if (arm.cond) {
+                genCond(arm.cond, next, false);
             }
-            void operator()(const NodeIfPredElse* predElse) {
-                gen->genScope(predElse->scope);
+            countSite(firstSite + i);
+            if (arm.scope) {
+                genScope(arm.scope);
             }
-        };
+            if (arm.cond) {
+                emit(Op::JMP, endLabel);
+                bind(next);
+            }
+        }
 
-        PredVisitor visitor{this, endLabel};
-        std::visit(visitor, pred->var);
+        bind(endLabel);
     }
 
-    void genStmt(const NodeStmt& stmt) {
-
-        struct StmtVisitor {
-            Generator* gen;
-            void operator()(const NodeStmtExit* stmtExit) {
-                gen->genExpr(stmtExit->expr);
+    // an arm that ran under 1/COLD_RATIO of the times the اذا did. code already
+    // out of line stays where it is
+    bool coldArm(const NodeStmtIf* stmtIf, const std::vector<IfArm>& arms, size_t arm) const {
+        if (m_options.profileCounts.empty() || !arms[arm].scope || m_output.current() == Switch::Out::COLD) {
+            return false;
+        }
+        size_t first = m_sites->ifArms(stmtIf);
+        uint64_t total = 0;
+        for (size_t i = 0; i < arms.size(); ++i) {
+            total += siteCount(first + i);
+        }
+        return total > 0 && siteCount(first + arm) * COLD_RATIO < total;
+    }
 
-                gen->m_output << "   mov rax, 60\n";
-                gen->pop("rdi");
-                gen->m_output << "   syscall\n";
-            }
+    // with a profile, a branch that almost always goes one way predicts well and
+    // beats computing both arms for a cmov
+    bool biasedBranch(const NodeStmtIf* stmtIf) const {
+        if (m_options.profileCounts.empty()) {
+            return false;
+        }
+        size_t first = m_sites->ifArms(stmtIf);
+        uint64_t taken = siteCount(first);
+        uint64_t other = siteCount(first + 1);
+        uint64_t total = taken + other;
+        return total > 0 && std::min(taken, other) * BIASED_RATIO < total;
+    }
 
-            void operator()(const NodeStmtLet* stmtLet) {
-                bool isGlobal = gen->m_vars.isGlobal();
+    // --profile-generate: one more run through the site. outside the top level the
+    // code may run on several workers at once, a function as a spawned task or
+    // called from a parallel body, so the count there is locked
+    void countSite(size_t site) {
+        if (m_options.profileSymbol.empty()) {
+            return;
+        }
+        Operand counter = qword(m_profCounters);
+        counter.val = static_cast<int64_t>(site * 8);
+        emit(m_funcName == "_start" ? Op::ADD : Op::LOCK_ADD, counter, Imm{1});
+    }
 
-                if (gen->m_vars.contains(stmtLet->ident.val)) {
-                    std::cerr << "Identifier already used: " << stmtLet->ident.val << std::endl;
-                    exit(1);
-                }
+    uint64_t siteCount(size_t site) const {
+        return m_options.profileCounts.empty() ? 0 : m_options.profileCounts.at(site);
+    }
 
-                gen->genExpr(stmtLet->expr);
+    // without a profile every loop counts as hot
+    template<typename Loop>
+    bool hotLoop(const Loop* loop) const {
+        if (m_options.profileCounts.empty()) {
+            return true;
+        }
+        uint64_t count = siteCount(m_sites->backEdge(loop));
+        return count > 0 && count * HOT_RATIO >= m_hottest;
+    }
 
-                if (isGlobal) {
-                    gen->pop("rax");
+    // اذا with an optional وإلا whose arms only assign cheap, non-trapping values to
+    // at most two scalars: both values are computed and cmov picks one, no branch
+    bool genIfConvert(const NodeStmtIf* stmtIf) {
 
-                    std::string lab = "_g_" + gen->createLabel();
-                    gen->m_output.set(Switch::Out::GLOBALS);
-                    gen->m_output << lab << ":\n";
-                    gen->m_output << "    resq 1\n";
+        if (!m_options.ifConvert || constEval(stmtIf->expr)) {
+            return false;
+        }
 
-                    gen->m_output.set(Switch::Out::PROG);
-                    gen->m_output << "   mov QWORD [" << lab << "], rax\n";
+        std::vector<const NodeStmtAssign*> thenArm;
+        std::vector<const NodeStmtAssign*> elseArm;
+        size_t cost = 0;
+        if (!convertibleArm(stmtIf->scope, thenArm, cost)) {
+            return false;
+        }
+        if (stmtIf->pred.has_value()) {
+            auto predElse = std::get_if<NodeIfPredElse*>(&stmtIf->pred.value()->var);
+            if (!predElse || !convertibleArm((*predElse)->scope, elseArm, cost)) {
+                return false;
+            }
+        }
+        if (cost > MAX_IF_CONVERT_COST) {
+            return false;
+        }
 
-                    gen->m_vars.insert({stmtLet->ident.val, Var{ .isGlobal = true, .label = lab }});
-                }
-                else {
-                    gen->m_vars.insert({stmtLet->ident.val, Var{ .m_stackLoc = gen->m_stackSize}});
+        // per target the value on each side, null keeps the current one
+        struct Pick {
+            std::string name;
+            const NodeExpr* thenExpr = nullptr;
+            const NodeExpr* elseExpr = nullptr;
+        };
+        std::vector<Pick> picks;
+        auto pickFor = [&picks](const std::string& name) -> Pick& {
+            for (Pick& pick : picks) {
+                if (pick.name == name) {
+                    return pick;
                 }
-
             }
+            return picks.emplace_back(Pick{name});
+        };
+        for (const NodeStmtAssign* assign : thenArm) {
+            pickFor(assign->ident.val).thenExpr = assign->expr;
+        }
+        for (const NodeStmtAssign* assign : elseArm) {
+            pickFor(assign->ident.val).elseExpr = assign->expr;
+        }
 
-            void operator()(const NodeStmtAssign* stmtAssign) {
+        if (picks.empty() || picks.size() > 2) {
+            return false;
+        }
+        for (const Pick& pick : picks) {
+            if (!m_vars.contains(pick.name) || m_vars.at(pick.name).isArray() || m_vars.at(pick.name).counter) {
+                return false;
+            }
+        }
 
-                if (!gen->m_vars.contains(stmtAssign->ident.val)) {
-                    std::cerr << "Identifier not declared: " << stmtAssign->ident.val << std::endl;
-                    exit(1);
-                }
-                gen->genExpr(stmtAssign->expr);
-                gen->pop("rax");
+        if (biasedBranch(stmtIf)) {
+            m_remarks.push_back({stmtIf->line, "kept as a branch, the profile shows it almost always goes one way"});
+            return false;
+        }
 
-                const auto& var = gen->m_vars.at(stmtAssign->ident.val);
+        // values go straight to their registers, temporaries stay in rax..rdx. a
+        // condition with a call runs first, the arms may read what it wrote
+        static constexpr Reg thenRegs[] = {Reg::R8, Reg::R10};
+        static constexpr Reg elseRegs[] = {Reg::R9, Reg::R11};
+        bool condFirst = !callFree(stmtIf->expr);
+        if (condFirst) {
+            genValue(stmtIf->expr);
+            push(Reg::RAX);
+        }
 
-                if (var.isGlobal) {
-                    gen->m_output << "   mov QWORD [" << var.label << "], rax\n";
+        for (size_t i = 0; i < picks.size(); ++i) {
+            const Var& var = m_vars.at(picks[i].name);
+            for (auto [expr, reg] : {std::pair{picks[i].thenExpr, thenRegs[i]}, std::pair{picks[i].elseExpr, elseRegs[i]}}) {
+                if (expr) {
+                    genInto(reg, expr);
                 }
                 else {
-                    gen->m_output << "   mov QWORD [rsp + " << (gen->m_stackSize - var.m_stackLoc) * 8 << "], rax\n";
+                    emitLoad(reg, varOperand(var), var.type, var.type);
                 }
             }
+        }
 
-            void operator()(const NodeStmtFuncDecl* funcDecl) {
+        Cond cc = Cond::NE;
+        auto cmp = compareOf(stmtIf->expr);
+        Operand acc = sized(Reg::RAX, stmtIf->expr->usedAs);
+        if (condFirst) {
+            pop(Reg::RAX);
+            emit(Op::TEST, acc, acc);
+        }
+        else if (cmp) {
+            genCmp(cmp->lhs, cmp->rhs);
+            cc = cmp->cc;
+        }
+        else {
+            genValue(stmtIf->expr);
+            emit(Op::TEST, acc, acc);
+        }
 
-                if (gen->m_funcs.contains(funcDecl->ident.val)) {
-                    std::cerr << "Function already declared\n";
-                    exit(1);
-                }
-                if (!gen->m_vars.isGlobal()) {
-                    std::cerr << "Functions must be declared in global scope\n";
-                    exit(1);
-                }
+        std::string names;
+        for (size_t i = 0; i < picks.size(); ++i) {
+            const Var& var = m_vars.at(picks[i].name);
+            emit(Op::CMOVCC, sized(thenRegs[i], var.type), sized(elseRegs[i], var.type), negate(cc));
+            emit(Op::MOV, varOperand(var), regOf(thenRegs[i], typeSize(var.type)));
+            killInduction(picks[i].name);
+            names += (i == 0 ? "" : ", ") + picks[i].name;
+        }
 
-                // states
-                gen->m_funcState = FuncState::IN_FUNC;
-                gen->m_output.set(Switch::Out::FUNCS);
+        m_remarks.push_back({stmtIf->line, "if converted to cmov (" + names + ")"});
+        return true;
+    }
 
-                std::string funcLabel = "func" + gen->createLabel();
-                gen->m_funcs.insert({funcDecl->ident.val, {funcDecl, funcLabel}});
-                gen->m_output << funcLabel << ":\n";
-                gen->m_funcBaseStack.push_back(gen->m_stackSize);
-                gen->m_vars.push_scope();
+    // only plain assignments to distinct names, none reading a name an earlier one
+    // in the arm wrote, so evaluating them all up front keeps their meaning
+    bool convertibleArm(const NodeScope* scope, std::vector<const NodeStmtAssign*>& arm, size_t& cost) {
+        std::unordered_set<std::string> written;
+        for (const NodeStmt* stmt : scope->stmts) {
+            auto assign = std::get_if<NodeStmtAssign*>(&stmt->var);
+            if (!assign) {
+                return false;
+            }
+            auto exprCost = pureCost((*assign)->expr, written);
+            if (!exprCost || !written.insert((*assign)->ident.val).second) {
+                return false;
+            }
+            cost += exprCost.value() + 1;
+            arm.push_back(*assign);
+        }
+        return true;
+    }
 
-                size_t paramCount = funcDecl->params.size();
-                for (size_t i = 0; i < paramCount; ++i) {
-                    const auto& param = funcDecl->params.at(i);
-                    if (gen->m_vars.back().contains(param->ident.val)) {
+    // operator count of an expression that can't trap or have side effects
+    std::optional<size_t> pureCost(const NodeExpr* expr, const std::unordered_set<std::string>& written) {
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (std::holds_alternative<NodeTermIntLit*>((*term)->var)) {
+                return 0;
+            }
+            if (auto ident = std::get_if<NodeTermIdent*>(&(*term)->var)) {
+                if (written.contains((*ident)->ident.val)) {
+                    return {};
+                }
+                return 0;
+            }
+            if (auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                return pureCost((*paren)->expr, written);
+            }
+            if (auto termCast = std::get_if<NodeTermCast*>(&(*term)->var)) {
+                auto inner = pureCost((*termCast)->expr, written);
+                return inner ? std::optional<size_t>(inner.value() + 1) : std::nullopt;
+            }
+            if (auto termNot = std::get_if<NodeTermNot*>(&(*term)->var)) {
+                auto inner = pureCost((*termNot)->expr, written);
+                return inner ? std::optional<size_t>(inner.value() + 1) : std::nullopt;
+            }
+            return {};
+        }
+
+        return std::visit([&](const auto* bin) -> std::optional<size_t> {
+            using T = std::remove_cvref_t<decltype(*bin)>;
+            if constexpr (std::is_same_v<T, BinExprDiv> || std::is_same_v<T, BinExprMod>) {
+                return {};
+            }
+            else {
+                auto lhs = pureCost(bin->lhs, written);
+                auto rhs = lhs ? pureCost(bin->rhs, written) : std::nullopt;
+                if (!rhs) {
+                    return {};
+                }
+                return lhs.value() + rhs.value() + 1;
+            }
+        }, std::get<BinExpr*>(expr->var)->var);
+    }
+
+    // لكل: from goes to the counter, then to, unless it's an imm32, to a frame slot.
+    // a loop with no loop inside unrolls: fully for a constant count of a few
+    // iterations, else the body runs unrollFactor copies per test while that many
+    // iterations are left, then the rest: straight line when the count is known,
+    // else a rolled loop. the counter lives in a register when the body calls nothing
+    void genFor(const NodeStmtFor* stmtFor) {
+        genFor(stmtFor, stmtFor->from, stmtFor->to, constEval(stmtFor->from), constEval(stmtFor->to));
+    }
+
+    // the loop over [fromExpr, toExpr), which a parallel loop's body runs over its
+    // range instead of the loop's ends. low and high are those ends when they are
+    // constants, the bounds a counter of any of its ranges stays within
+    void genFor(const NodeStmtFor* stmtFor, const NodeExpr* fromExpr, const NodeExpr* toExpr,
+                std::optional<int64_t> low, std::optional<int64_t> high) {
+        const std::string& name = stmtFor->ident.val;
+        if (m_vars.contains(name)) {
+            std::cerr << "Identifier already used: " << name << std::endl;
+            exit(1);
+        }
+        Loc head = m_loc;
+
+        // as for بينما, the back edge reruns the body's assignments
+        std::unordered_set<std::string> assigned;
+        collectAssigned(stmtFor->scope->stmts, assigned);
+        for (const auto& written : assigned) {
+            killInduction(written);
+        }
+        if (!m_funcs.back().empty()) {
+            killGlobalInductions();
+        }
+
+        scopeBegin();
+        Var counter{ .offset = allocLocal(8, 8), .counter = true };
+        Operand end = qword(Reg::RBP, static_cast<int32_t>(allocLocal(8, 8)));
+        auto from = constEval(fromExpr);
+        auto to = constEval(toExpr);
+
+        BodyScan body;
+        scanBody(stmtFor->scope->stmts, body);
+
+        // a call in to could clobber the register, from waits in the slot then
+        bool inReg = m_counterRegs < std::size(COUNTER_REGS) && !body.calls;
+        bool early = inReg && callFree(toExpr);
+        if (early) {
+            genInto(COUNTER_REGS[m_counterRegs], fromExpr);
+        }
+        else {
+            genStore(varOperand(counter), fromExpr);
+        }
+        if (auto imm = to ? immediate(to.value(), IntType::I64) : std::nullopt) {
+            end = imm.value();
+        }
+        else {
+            genStore(end, toExpr);
+        }
+        if (inReg) {
+            if (!early) {
+                emit(Op::MOV, COUNTER_REGS[m_counterRegs], varOperand(counter));
+            }
+            counter.reg = COUNTER_REGS[m_counterRegs++];
+        }
+        m_vars.insert({name, counter});
+
+        std::optional<uint64_t> trip;
+        if (from && to) {
+            trip = to.value() > from.value() ? static_cast<uint64_t>(to.value()) - static_cast<uint64_t>(from.value()) : 0;
+        }
+        bool induction = low >= 0 && high.has_value();
+        if (induction) {
+            m_inductions.push_back({name, high.value(), false, true});
+        }
+
+        // innermost loops only, copying a loop nest multiplies it. with a profile,
+        // only the hot ones: copies of a loop that hardly ran are just more code
+        bool cold = !hotLoop(stmtFor);
+        bool unroll = m_options.unroll && !body.loops && !cold;
+        if (m_options.unroll && !body.loops && cold) {
+            m_remarks.push_back({head.line, "loop " + name + " not unrolled, cold in the profile"});
+        }
+        size_t bodySize = std::max<size_t>(NodeCounter().count(stmtFor->scope), 1);
+        uint64_t factor = 1;
+        if (unroll && trip != 0) {
+            factor = std::clamp<uint64_t>(UNROLL_BUDGET / bodySize, 1, m_options.unrollFactor);
+        }
+        bool full = unroll && trip > 0 && trip <= MAX_FULL_UNROLL && trip.value() * bodySize <= UNROLL_BUDGET;
+
+        // one iteration. the step after the last one of a straight run is left out
+        auto iteration = [&](bool step) {
+            genScope(stmtFor->scope);
+            loc(head);
+            if (m_sites) {
+                countSite(m_sites->backEdge(stmtFor));
+            }
+            if (step) {
+                emit(Op::ADD, varOperand(counter), Imm{1});
+            }
+        };
+        auto compare = [&](const Operand& bound) {
+            Operand lhs = varOperand(counter);
+            if (lhs.isMem() && bound.isMem()) {
+                emit(Op::MOV, Reg::RAX, lhs);
+                lhs = Reg::RAX;
+            }
+            emit(Op::CMP, lhs, bound);
+        };
+        // iterations left, to - counter, against factor. to > counter when it runs
+        auto compareLeft = [&]() {
+            emit(Op::MOV, Reg::RAX, end);
+            emit(Op::SUB, Reg::RAX, varOperand(counter));
+            emit(Op::CMP, Reg::RAX, Imm{static_cast<int64_t>(factor)});
+        };
+        auto alignHead = [&]() {
+            if (m_options.alignLoops && hotLoop(stmtFor)) {
+                emit(Op::ALIGN, Imm{16});
+            }
+        };
+
+        Label done = createLabel();
+        std::optional<Operand> mainEnd;
+        if (factor > 1 && trip >= factor) {
+            uint64_t last = static_cast<uint64_t>(from.value()) + trip.value() / factor * factor;
+            mainEnd = immediate(static_cast<int64_t>(last), IntType::I64);
+        }
+
+        if (full) {
+            for (uint64_t i = 0; i < trip.value(); ++i) {
+                iteration(i + 1 < trip.value());
+            }
+        }
+        else if (mainEnd) {
+            // the count is known and at least factor
+            Label loop = createLabel();
+            alignHead();
+            bind(loop);
+            for (uint64_t i = 0; i < factor; ++i) {
+                iteration(true);
+            }
+            compare(mainEnd.value());
+            emit(Op::JCC, loop, {}, Cond::L);
+            for (uint64_t i = 0; i < trip.value() % factor; ++i) {
+                iteration(i + 1 < trip.value() % factor);
+            }
+        }
+        else {
+            Label rest = createLabel();
+            if (!trip || trip == 0) {
+                compare(end);
+                emit(Op::JCC, done, {}, Cond::GE);
+            }
+            if (factor > 1) {
+                Label loop = createLabel();
+                compareLeft();
+                emit(Op::JCC, rest, {}, Cond::B);
+                alignHead();
+                bind(loop);
+                for (uint64_t i = 0; i < factor; ++i) {
+                    iteration(true);
+                }
+                compareLeft();
+                emit(Op::JCC, loop, {}, Cond::AE);
+                compare(end);
+                emit(Op::JCC, done, {}, Cond::GE);
+            }
+            else {
+                alignHead();
+            }
+            bind(rest);
+            iteration(true);
+            compare(end);
+            emit(Op::JCC, rest, {}, Cond::L);
+        }
+        bind(done);
+
+        std::string how = full ? "fully unrolled, " + std::to_string(trip.value()) + " copies"
+                        : factor > 1 ? "unrolled " + std::to_string(factor) + " times" : "";
+        if (inReg) {
+            how += std::string(how.empty() ? "" : ", ") + "counter " + name + " in a register";
+        }
+        if (!how.empty()) {
+            m_remarks.push_back({head.line, "loop " + how});
+        }
+
+        if (induction) {
+            m_inductions.pop_back();
+        }
+        if (inReg) {
+            --m_counterRegs;
+        }
+        scopeEnd();
+    }
+
+    // لكل ... بالتوازي: the body becomes a function of its own, <function>.par<n>,
+    // which the runtime calls as body(lo, hi, captures) on ranges of the loop, on
+    // any thread. the locals it uses are copied to the stack for it, scalars by
+    // value and arrays as their address and length, so it reads them as heap arrays
+    void genParallelFor(const NodeStmtFor* stmtFor) {
+        const std::string& name = stmtFor->ident.val;
+        if (m_vars.contains(name)) {
+            std::cerr << "Identifier already used: " << name << std::endl;
+            exit(1);
+        }
+        Loc head = m_loc;
+
+        std::unordered_set<std::string> names;
+        BodyScan body{ .names = &names };
+        scanBody(stmtFor->scope->stmts, body);
+
+        // the innermost binding of each, in a fixed order so builds are reproducible
+        std::vector<std::pair<std::string, Var>> captures;
+        for (const auto& used : names) {
+            if (m_vars.contains(used) && !m_vars.at(used).isGlobal) {
+                captures.push_back({used, m_vars.at(used)});
+            }
+        }
+        std::sort(captures.begin(), captures.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        // pushed last to first, so the first capture is at the lowest address
+        size_t qwords = 0;
+        for (const auto& [_, var] : captures) {
+            qwords += var.isArray() ? 2 : 1;
+        }
+        size_t pad = (m_stackSize + qwords) % 2;
+        if (pad) {
+            emit(Op::SUB, Reg::RSP, Imm{8});
+            m_stackSize++;
+        }
+        for (auto it = captures.rbegin(); it != captures.rend(); ++it) {
+            const Var& var = it->second;
+            if (var.heap) {
+                push(heapSlot(var, 1));
+                push(heapSlot(var, 0));
+            }
+            else if (var.isArray()) {
+                push(Imm{var.length});
+                emit(Op::LEA, Reg::RAX, varOperand(var));
+                push(Reg::RAX);
+            }
+            else if (var.reg) {
+                push(var.reg.value());
+            }
+            else {
+                emitLoad(Reg::RAX, varOperand(var), var.type, var.type);
+                push(Reg::RAX);
+            }
+        }
+
+        Label bodyLabel = namedLabel(m_funcName + ".par" + std::to_string(labelCounter++));
+        auto low = constEval(stmtFor->from);
+        auto high = constEval(stmtFor->to);
+        genValue(stmtFor->from);
+        push(Reg::RAX);
+        genInto(Reg::RCX, stmtFor->to);
+        pop(Reg::RDX);
+        emit(Op::MOV, Reg::RSI, Reg::RSP);
+        emit(Op::LEA, Reg::RDI, qword(bodyLabel));
+        emit(Op::CALL, m_runtime.parallelFor());
+        emit(Op::ADD, Reg::RSP, Imm{static_cast<int64_t>((qwords + pad) * 8)});
+        m_stackSize -= qwords + pad;
+        killGlobalInductions();
+
+        genParallelBody(stmtFor, bodyLabel, captures, body.spawns, head, low, high);
+        m_loc = head;
+        m_remarks.push_back({head.line, "loop " + name + " runs in parallel, body outlined as " + m_asm.labels.at(bodyLabel.id)});
+    }
+
+    // شغل f(args): the arguments are pushed as for a call, the runtime copies them
+    // into a task that any thread may run, counted in the function's join slot
+    void genSpawn(const NodeStmtSpawn* stmtSpawn) {
+        const NodeTermFuncCall* funcCall = stmtSpawn->call;
+        if (!m_funcs.contains(funcCall->ident.val)) {
+            std::cerr << "Function not declared: " << funcCall->ident.val << "\n";
+            exit(1);
+        }
+        const auto& func = m_funcs.at(funcCall->ident.val);
+        if (funcCall->args.size() != func.funcPtr->params.size()) {
+            std::cerr << "# Args don't match function # Params: " << funcCall->ident.val << "\n";
+            exit(1);
+        }
+
+        size_t argCount = funcCall->args.size();
+        size_t pad = (m_stackSize + argCount) % 2 == 0 ? 0 : 1;
+        if (pad) {
+            emit(Op::SUB, Reg::RSP, Imm{8});
+            m_stackSize++;
+        }
+        for (const auto& arg : funcCall->args) {
+            genExpr(arg);
+        }
+
+        emit(Op::LEA, Reg::RDI, qword(Reg::RBP, static_cast<int32_t>(m_joinSlot.value())));
+        emit(Op::LEA, Reg::RSI, qword(func.label));
+        emit(Op::MOV, Reg::RDX, Imm{static_cast<int64_t>(argCount)});
+        emit(Op::MOV, Reg::RCX, Reg::RSP);
+        emit(Op::CALL, m_runtime.spawn());
+        killGlobalInductions();
+        emit(Op::ADD, Reg::RSP, Imm{static_cast<int64_t>((argCount + pad) * 8)});
+        m_stackSize -= argCount + pad;
+    }
+
+    // انتظر, and before the function returns or exits: the tasks it spawned have all run.
+    // this thread runs them, or others', while it waits
+    void genJoin() {
+        if (!m_joinSlot) {
+            return;
+        }
+        emit(Op::LEA, Reg::RDI, qword(Reg::RBP, static_cast<int32_t>(m_joinSlot.value())));
+        emit(Op::CALL, m_runtime.join());
+        killGlobalInductions();
+    }
+
+    // a frame slot for the count of spawned tasks, when stmts spawn any. it comes
+    // first in the frame, the lets after it
+    void joinSlotBegin(const std::vector<NodeStmt*>& stmts) {
+        BodyScan scan;
+        scanBody(stmts, scan);
+        m_joinSlot = std::nullopt;
+        if (scan.spawns) {
+            m_joinSlot = allocLocal(8, 8);
+        }
+    }
+
+    // what a loop body holds, nested statements included
+    struct BodyScan {
+        bool calls = false;
+        bool loops = false;
+        bool spawns = false; // a شغل or انتظر, which need a count of tasks
+        std::unordered_set<std::string>* names = nullptr; // when set, every name the body uses
+    };
+
+    void scanBody(const std::vector<NodeStmt*>& stmts, BodyScan& scan) {
+
+        struct ScanVisitor {
+            Generator* gen;
+            BodyScan& scan;
+
+            void expr(const NodeExpr* expr) {
+                scan.calls = scan.calls || !gen->callFree(expr);
+                if (scan.names) {
+                    gen->collectNames(expr, *scan.names);
+                }
+            }
+
+            void name(const std::string& ident) {
+                if (scan.names) {
+                    scan.names->insert(ident);
+                }
+            }
+
+            void operator()(const NodeStmtExit* stmtExit) { expr(stmtExit->expr); }
+            void operator()(const NodeStmtPrint* stmtPrint) { expr(stmtPrint->expr); }
+            void operator()(const NodeStmtLet* stmtLet) { expr(stmtLet->expr); }
+            void operator()(const NodeStmtAssign* stmtAssign) {
+                name(stmtAssign->ident.val);
+                expr(stmtAssign->expr);
+            }
+            void operator()(const NodeStmtIndexAssign* indexAssign) {
+                name(indexAssign->ident.val);
+                expr(indexAssign->index);
+                expr(indexAssign->expr);
+            }
+            void operator()(const NodeStmtReturn* stmtRet) {
+                if (stmtRet->expr) {
+                    expr(stmtRet->expr.value());
+                }
+            }
+            void operator()(const NodeScope* scope) { gen->scanBody(scope->stmts, scan); }
+            void operator()(const NodeStmtIf* stmtIf) {
+                expr(stmtIf->expr);
+                gen->scanBody(stmtIf->scope->stmts, scan);
+                std::optional<NodeIfPred*> pred = stmtIf->pred;
+                while (pred.has_value()) {
+                    if (auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+                        expr((*predElif)->expr);
+                        gen->scanBody((*predElif)->scope->stmts, scan);
+                        pred = (*predElif)->pred;
+                    }
+                    else {
+                        gen->scanBody(std::get<NodeIfPredElse*>(pred.value()->var)->scope->stmts, scan);
+                        pred = {};
+                    }
+                }
+            }
+            void operator()(const NodeStmtWhile* stmtWhile) {
+                scan.loops = true;
+                expr(stmtWhile->expr);
+                gen->scanBody(stmtWhile->scope->stmts, scan);
+            }
+            // a parallel one calls into the runtime
+            void operator()(const NodeStmtFor* stmtFor) {
+                scan.loops = true;
+                scan.calls = scan.calls || stmtFor->parallel;
+                expr(stmtFor->from);
+                expr(stmtFor->to);
+                gen->scanBody(stmtFor->scope->stmts, scan);
+            }
+            void operator()(const NodeStmtLetArray* letArray) {
+                if (letArray->count) {
+                    expr(letArray->count);
+                }
+            }
+            void operator()(const NodeStmtSpawn* stmtSpawn) {
+                scan.calls = true;
+                scan.spawns = true;
+                for (const NodeExpr* arg : stmtSpawn->call->args) {
+                    expr(arg);
+                }
+            }
+            void operator()(const NodeStmtJoin*) {
+                scan.calls = true;
+                scan.spawns = true;
+            }
+            void operator()(const NodeStmtFuncDecl*) {}
+            void operator()(const NodeStmtImport*) {}
+        };
+
+        ScanVisitor visitor{this, scan};
+        for (const NodeStmt* stmt : stmts) {
+            std::visit(visitor, stmt->var);
+        }
+    }
+
+    void genStmt(const NodeStmt& stmt) {
+
+        struct StmtVisitor {
+            Generator* gen;
+            // as a return does, it first waits for the tasks the function spawned.
+            // whatever else is running stops
+            void operator()(const NodeStmtExit* stmtExit) {
+                gen->genJoin();
+                gen->genInto(Reg::RDI, stmtExit->expr);
+                gen->emit(Op::CALL, gen->m_runtime.exit());
+            }
+
+            void operator()(const NodeStmtPrint* stmtPrint) {
+                gen->genInto(Reg::RDI, stmtPrint->expr);
+                gen->emit(Op::CALL, gen->m_runtime.printInt());
+            }
+
+            void operator()(const NodeStmtLet* stmtLet) {
+                bool isGlobal = gen->m_vars.isGlobal();
+
+                if (gen->m_vars.contains(stmtLet->ident.val)) {
+                    std::cerr << "Identifier already used: " << stmtLet->ident.val << std::endl;
+                    exit(1);
+                }
+
+                // constant globals are laid out statically, read-only ones also fold into their uses
+                if (isGlobal) {
+                    if (auto val = gen->constEval(stmtLet->expr)) {
+                        Label lab = gen->globalLabel();
+                        Var var{ .isGlobal = true, .label = lab, .type = stmtLet->type };
+
+                        if (gen->m_assigned.contains(stmtLet->ident.val)) {
+                            gen->m_asm.data.push_back({lab, {val.value()}});
+                        }
+                        else {
+                            gen->m_asm.rodata.push_back({lab, {val.value()}});
+                            var.constVal = val;
+                        }
+
+                        gen->m_vars.insert({stmtLet->ident.val, var});
+                        return;
+                    }
+                }
+
+                // globals of any type get a qword, its low bytes hold the value
+                if (isGlobal) {
+                    Label lab = gen->globalLabel();
+                    gen->m_asm.bss.push_back({lab, 1});
+                    Var var{ .isGlobal = true, .label = lab, .type = stmtLet->type };
+                    gen->genStore(gen->varOperand(var), stmtLet->expr);
+
+                    gen->m_vars.insert({stmtLet->ident.val, var});
+                }
+                else {
+                    uint8_t size = typeSize(stmtLet->type);
+                    Var var{ .offset = gen->allocLocal(size, size), .type = stmtLet->type };
+                    gen->genStore(gen->varOperand(var), stmtLet->expr);
+                    gen->m_vars.insert({stmtLet->ident.val, var});
+                }
+
+            }
+
+            void operator()(const NodeStmtLetArray* letArray) {
+                if (gen->m_vars.contains(letArray->ident.val)) {
+                    std::cerr << "Identifier already used: " << letArray->ident.val << std::endl;
+                    exit(1);
+                }
+
+                if (letArray->count) {
+                    gen->genHeapArray(letArray);
+                    return;
+                }
+
+                int64_t length = arrayLength(letArray);
+                uint8_t size = typeSize(letArray->type);
+                int64_t bytes = length * size;
+
+                if (gen->m_vars.isGlobal()) {
+                    Label lab = gen->globalLabel();
+                    gen->m_asm.bss.push_back({lab, static_cast<uint64_t>(bytes + 7) / 8});
+                    gen->m_vars.insert({letArray->ident.val, Var{ .isGlobal = true, .label = lab, .length = length, .type = letArray->type }});
+                    return;
+                }
+
+                Var var{ .offset = gen->allocLocal(static_cast<size_t>(bytes), size), .length = length, .type = letArray->type };
+
+                // qwords when the elements fill whole ones
+                gen->emit(Op::LEA, Reg::RDI, gen->varOperand(var));
+                gen->emit(Op::MOV, Reg::RCX, Imm{bytes % 8 == 0 ? bytes / 8 : bytes});
+                gen->emit(Op::MOV, Reg::RAX, Imm{0});
+                gen->emit(bytes % 8 == 0 ? Op::REP_STOSQ : Op::REP_STOSB);
+                gen->m_vars.insert({letArray->ident.val, var});
+            }
+
+            void operator()(const NodeStmtAssign* stmtAssign) {
+
+                if (!gen->m_vars.contains(stmtAssign->ident.val)) {
+                    std::cerr << "Identifier not declared: " << stmtAssign->ident.val << std::endl;
+                    exit(1);
+                }
+                const auto& var = gen->m_vars.at(stmtAssign->ident.val);
+                if (var.isArray()) {
+                    std::cerr << "Cannot assign to array: " << stmtAssign->ident.val << std::endl;
+                    exit(1);
+                }
+                if (var.counter) {
+                    std::cerr << "Cannot assign to loop counter: " << stmtAssign->ident.val << std::endl;
+                    exit(1);
+                }
+                if (!gen->genUpdate(var, stmtAssign)) {
+                    gen->genStore(gen->varOperand(var), stmtAssign->expr);
+                }
+                gen->killInduction(stmtAssign->ident.val);
+            }
+
+            void operator()(const NodeStmtIndexAssign* indexAssign) {
+                const Var& arr = gen->arrayVar(indexAssign->ident.val);
+                IntType type = arr.type;
+                auto constIndex = gen->constEval(indexAssign->index);
+                bool fixedIndex = constIndex || gen->counterReg(indexAssign->index);
+
+                // the index lands in rax for element(), the value in rbx unless it's an immediate
+                auto value = gen->simpleOperand(indexAssign->expr);
+                auto lateIndex = fixedIndex || value ? std::nullopt : gen->simpleOperand(indexAssign->index);
+                if (value) {
+                    if (!fixedIndex) {
+                        gen->genValue(indexAssign->index);
+                    }
+                    if (value->isMem()) {
+                        gen->emit(Op::MOV, sized(Reg::RBX, type), value.value());
+                        value = Reg::RBX;
+                    }
+                }
+                else if (lateIndex && (stable(lateIndex.value()) || gen->callFree(indexAssign->expr))) {
+                    gen->genValue(indexAssign->expr);
+                    gen->emit(Op::MOV, Reg::RBX, Reg::RAX);
+                    gen->emit(Op::MOV, Reg::RAX, lateIndex.value());
+                    value = Reg::RBX;
+                }
+                else {
+                    if (!fixedIndex) {
+                        gen->genValue(indexAssign->index);
+                        gen->push(Reg::RAX);
+                    }
+                    gen->genValue(indexAssign->expr);
+                    gen->emit(Op::MOV, Reg::RBX, Reg::RAX);
+                    if (!fixedIndex) {
+                        gen->pop(Reg::RAX);
+                    }
+                    value = Reg::RBX;
+                }
+
+                Operand elem = gen->element(arr, indexAssign->ident.val, indexAssign->index, constIndex);
+                gen->emit(Op::MOV, elem, value->isImm() ? value.value() : regOf(value->reg, elem.size));
+            }
+
+            void operator()(const NodeStmtFuncDecl* funcDecl) {
+                Trace::Span span(gen->m_trace, funcDecl->ident.val, "function");
+                size_t insts = gen->m_output.size();
+                size_t labels = gen->m_asm.labels.size();
+
+                if (gen->m_funcs.contains(funcDecl->ident.val)) {
+                    std::cerr << "Function already declared\n";
+                    exit(1);
+                }
+                if (!gen->m_vars.isGlobal()) {
+                    std::cerr << "Functions must be declared in global scope\n";
+                    exit(1);
+                }
+
+                // one the caller still has the unit of is only declared, see genUnits
+                FuncUnit unit{ .decl = funcDecl, .key = gen->m_reuse ? gen->funcKey(funcDecl) : 0 };
+                if (gen->m_reuse && gen->m_reuse(funcDecl, unit.key)) {
+                    Label funcLabel = gen->namedLabel(funcDecl->ident.val);
+                    gen->m_shared.push_back(funcLabel);
+                    gen->m_funcs.insert({funcDecl->ident.val, {funcDecl, funcLabel}});
+                    unit.reused = true;
+                    gen->m_units.push_back(unit);
+                    span.arg("reused", "yes");
+                    return;
+                }
+                unit.funcs.begin = gen->m_output.get(Switch::Out::FUNCS).size();
+                unit.cold.begin = gen->m_output.get(Switch::Out::COLD).size();
+                unit.outlined.begin = gen->m_outlined.size();
+                unit.remarks.begin = gen->m_remarks.size();
+
+                // states. a function the profile never saw called goes with the cold code
+                gen->m_funcState = FuncState::IN_FUNC;
+                bool cold = !gen->m_options.profileCounts.empty() && gen->siteCount(gen->m_sites->funcEntry(funcDecl)) == 0;
+                gen->m_output.set(cold ? Switch::Out::COLD : Switch::Out::FUNCS);
+                if (cold) {
+                    gen->m_remarks.push_back({funcDecl->ident.line, "function " + funcDecl->ident.val + " never ran in the profile, placed with the cold code"});
+                }
+
+                // named after the function, a module's are exported under that name
+                Label funcLabel = gen->namedLabel(funcDecl->ident.val);
+                gen->m_shared.push_back(funcLabel);
+                if (gen->m_module) {
+                    gen->m_asm.globals.push_back(funcLabel);
+                }
+                gen->m_asm.funcs.push_back(funcLabel);
+                gen->m_funcName = funcDecl->ident.val;
+                gen->m_funcs.insert({funcDecl->ident.val, {funcDecl, funcLabel}});
+                gen->bind(funcLabel);
+                gen->loc({funcDecl->ident.line, funcDecl->ident.col});
+                gen->emit(Op::PUSH, Reg::RBP);
+                gen->emit(Op::MOV, Reg::RBP, Reg::RSP);
+                size_t localBytes = std::exchange(gen->m_localBytes, 0);
+                auto joinSlot = gen->m_joinSlot;
+                gen->joinSlotBegin(funcDecl->scope->stmts);
+                gen->frameBegin(gen->frameBytes(funcDecl->scope->stmts, gen->m_localBytes));
+                if (gen->m_joinSlot) {
+                    gen->emit(Op::MOV, qword(Reg::RBP, static_cast<int32_t>(gen->m_joinSlot.value())), Imm{0});
+                }
+                gen->m_vars.push_scope();
+                if (gen->m_sites) {
+                    gen->countSite(gen->m_sites->funcEntry(funcDecl));
+                }
+
+                // args sit above the saved rbp and return address, first arg deepest
+                size_t paramCount = funcDecl->params.size();
+                for (size_t i = 0; i < paramCount; ++i) {
+                    const auto& param = funcDecl->params.at(i);
+                    if (gen->m_vars.back().contains(param->ident.val)) {
                         std::cerr << "Parameter already used\n";
                         exit(1);
                     }
 
-                    gen->m_output << "   mov rax, QWORD [rsp + " << (paramCount * 8) << "]\n";
-                    gen->push("rax");
-
-                    gen->m_vars.insert({param->ident.val, Var{ .m_stackLoc = gen->m_stackSize }});
+                    int64_t offset = static_cast<int64_t>(16 + (paramCount - 1 - i) * 8);
+                    gen->m_vars.insert({param->ident.val, Var{ .offset = offset, .type = param->type }});
                 }
 
                 gen->genScope(funcDecl->scope);
@@ -350,15 +1627,30 @@ public:
                     std::cerr << "No return statement in " << funcDecl->ident.val << "\n";
                     exit(1);
                 }
-                gen->retCleanup();
+                const auto& stmts = funcDecl->scope->stmts;
+                if (stmts.empty() || !std::holds_alternative<NodeStmtReturn*>(stmts.back()->var)) {
+                    gen->genJoin();
+                    gen->emit(Op::MOV, Reg::RAX, Imm{0});
+                    gen->retCleanup();
+                }
 
                 // exit func context
                 gen->m_vars.pop_scope();
-                gen->m_funcBaseStack.pop_back();
-                
+                gen->m_localBytes = localBytes;
+                gen->m_joinSlot = joinSlot;
+
                 // reset states
                 gen->m_output.set(Switch::Out::PROG);
                 gen->m_funcState = FuncState::NONE;
+                gen->m_funcName = "_start";
+
+                unit.funcs.end = gen->m_output.get(Switch::Out::FUNCS).size();
+                unit.cold.end = gen->m_output.get(Switch::Out::COLD).size();
+                unit.outlined.end = gen->m_outlined.size();
+                unit.remarks.end = gen->m_remarks.size();
+                gen->m_units.push_back(unit);
+
+                span.arg("insts", gen->m_output.size() - insts).arg("labels", gen->m_asm.labels.size() - labels);
             }
 
             void operator()(const NodeStmtReturn* stmtRet) {
@@ -369,139 +1661,772 @@ public:
                 }
                 gen->m_funcState = FuncState::RETURNED;
 
+                gen->genJoin();
                 if (stmtRet->expr) {
-                    gen->genExpr(stmtRet->expr.value());
-                    gen->pop("rax");
+                    gen->genInto(Reg::RAX, stmtRet->expr.value());
                 }
                 else {
-                    gen->m_output << "   mov rax, 0\n";
+                    gen->emit(Op::MOV, Reg::RAX, Imm{0});
                 }
 
                 gen->retCleanup();
-                gen->m_output << "   ret\n";
             }
 
             void operator()(const NodeScope* stmtScope) {
                 gen->genScope(stmtScope);
             }
 
+            // the modules themselves are loaded before generation
+            void operator()(const NodeStmtImport*) {
+                if (!gen->m_vars.isGlobal() || gen->m_funcState != FuncState::NONE) {
+                    std::cerr << "Imports must be at the top level\n";
+                    exit(1);
+                }
+            }
+
             void operator()(const NodeStmtIf* stmtIf) {
-                
-                gen->genExpr(stmtIf->expr);
-                gen->pop("rax");
-                gen->m_output << "   cmp rax, 0\n";
 
-                std::string label = gen->createLabel();
-                gen->m_output << "   jz " << label << "\n";
-                
-                gen->genScope(stmtIf->scope);
+                if (gen->genIfConvert(stmtIf)) {
+                    return;
+                }
+                gen->genIf(stmtIf);
+            }
 
-                std::string endLabel = "end" + gen->createLabel();
-                gen->m_output << "   jmp " << endLabel << "\n";
+            // rotated: the test is guarded once on entry and repeated at the bottom,
+            // so each iteration only runs the conditional back edge
+            void operator()(const NodeStmtWhile* stmtWhile) {
+                Loc head = gen->m_loc;
+                Label bodyLabel = gen->createLabel();
+                Label endLabel = gen->createLabel();
+
+                // the body's back edge reruns everything in it, so counters it
+                // touches are no longer known to be in range anywhere inside
+                std::unordered_set<std::string> assigned;
+                gen->collectAssigned(stmtWhile->scope->stmts, assigned);
+                for (const auto& name : assigned) {
+                    gen->killInduction(name);
+                }
+                if (!gen->m_funcs.back().empty()) {
+                    gen->killGlobalInductions();
+                }
 
-                gen->m_output << label << ":\n";
+                auto induction = gen->loopInduction(stmtWhile->expr);
 
-                if (stmtIf->pred.has_value()) {
-                    gen->genIfPred(stmtIf->pred.value(), endLabel);
+                gen->genCond(stmtWhile->expr, endLabel, false);
+
+                if (induction && gen->m_options.vectorize && gen->genVectorLoop(stmtWhile, induction.value())) {
+                    gen->genCond(stmtWhile->expr, endLabel, false);
                 }
 
-                gen->m_output << endLabel << ":\n";
-            }
+                if (induction) {
+                    gen->m_inductions.push_back(induction.value());
+                }
 
-            void operator()(const NodeStmtWhile* stmtWhile) {
-                std::string startLabel = gen->createLabel();
-                gen->m_output << startLabel << ":\n";
+                if (gen->m_options.alignLoops && gen->hotLoop(stmtWhile)) {
+                    gen->emit(Op::ALIGN, Imm{16});
+                }
+                gen->bind(bodyLabel);
+                gen->genScope(stmtWhile->scope);
+
+                if (induction) {
+                    gen->m_inductions.pop_back();
+                }
+                gen->loc(head);
+                if (gen->m_sites) {
+                    gen->countSite(gen->m_sites->backEdge(stmtWhile));
+                }
 
-                gen->genExpr(stmtWhile->expr);
-                gen->pop("rax");
+                gen->genCond(stmtWhile->expr, bodyLabel, true);
 
-                gen->m_output << "   cmp rax, 0\n";
+                gen->bind(endLabel);
+            }
 
-                std::string endLabel = gen->createLabel();
-                gen->m_output << "   jz " << endLabel << "\n";
+            void operator()(const NodeStmtFor* stmtFor) {
+                if (stmtFor->parallel) {
+                    gen->genParallelFor(stmtFor);
+                }
+                else {
+                    gen->genFor(stmtFor);
+                }
+            }
 
-                gen->genScope(stmtWhile->scope);
-                gen->m_output << "   jmp " << startLabel << "\n";
+            void operator()(const NodeStmtSpawn* stmtSpawn) {
+                gen->genSpawn(stmtSpawn);
+            }
 
-                gen->m_output << endLabel << ":\n";
+            void operator()(const NodeStmtJoin*) {
+                gen->genJoin();
             }
         };
 
+        // a function's code starts in its own output, it marks its position there
+        if (!std::holds_alternative<NodeStmtFuncDecl*>(stmt.var)) {
+            loc({stmt.line, stmt.col});
+        }
         StmtVisitor visitor{this};
         std::visit(visitor, stmt.var);
     }
 
-    [[nodiscard]] std::string genProg() {
+    [[nodiscard]] AsmProg genProg() {
+
+        collectAssigned(m_prog.stmts, m_assigned);
 
         m_output.set(Switch::Out::PROG);
+        m_asm.entry = namedLabel("_start");
+
+        if (!m_options.profileSymbol.empty()) {
+            std::vector<Runtime::ProfileOut> outs;
+            for (const ProfileModule& module : m_options.profileModules) {
+                Label counters = m_profCounters;
+                if (module.symbol != m_options.profileSymbol) {
+                    counters = namedLabel(module.symbol);
+                    m_asm.externs.push_back(counters);
+                }
+                outs.push_back({counters, module.tokenHash, module.sites});
+            }
+            m_runtime.writeProfile(m_options.profileOut, std::move(outs));
+        }
+
+        bind(m_asm.entry);
+        emit(Op::MOV, Reg::RBP, Reg::RSP);
+        emit(Op::CALL, m_runtime.init());
+        joinSlotBegin(m_prog.stmts);
+        frameBegin(frameBytes(m_prog.stmts, m_localBytes, false));
+        if (m_joinSlot) {
+            emit(Op::MOV, qword(Reg::RBP, static_cast<int32_t>(m_joinSlot.value())), Imm{0});
+        }
 
         for (const NodeStmt* stmt : m_prog.stmts) {
             genStmt(*stmt);
         }
 
-        std::stringstream out;
+        genJoin();
+        emit(Op::MOV, Reg::RDI, Imm{0});
+        emit(Op::CALL, m_runtime.exit());
+
+        m_asm.text = std::move(m_output.get(Switch::Out::FUNCS));
+        m_outlinedBase = m_asm.text.size();
+        m_asm.text.insert(m_asm.text.end(), m_outlined.begin(), m_outlined.end());
+        if (!m_options.debugFile.empty()) {
+            m_asm.text.push_back({Op::LOC, Imm{0}, Imm{0}});
+        }
+        m_runtime.emit(m_asm.text);
+
+        auto& prog = m_output.get(Switch::Out::PROG);
+        m_asm.text.insert(m_asm.text.end(), prog.begin(), prog.end());
+        auto& cold = m_output.get(Switch::Out::COLD);
+        m_coldBase = m_asm.text.size();
+        m_asm.text.insert(m_asm.text.end(), cold.begin(), cold.end());
+
+        m_asm.globals.push_back(m_asm.entry);
+        m_asm.funcs.push_back(m_asm.entry);
+        for (Label label : m_runtime.entryPoints()) {
+            m_asm.globals.push_back(label);
+        }
+        return std::move(m_asm);
+    }
+
+    // an imported module: only functions, linked against the main module's runtime
+    [[nodiscard]] AsmProg genModule() {
+
+        m_module = true;
+        collectAssigned(m_prog.stmts, m_assigned);
+
+        for (const NodeStmt* stmt : m_prog.stmts) {
+            if (!std::holds_alternative<NodeStmtFuncDecl*>(stmt->var) &&
+                !std::holds_alternative<NodeStmtImport*>(stmt->var)) {
+                std::cerr << "Only functions and imports may be at the top level of a module\n";
+                exit(1);
+            }
+            genStmt(*stmt);
+        }
+
+        m_asm.text = std::move(m_output.get(Switch::Out::FUNCS));
+        m_outlinedBase = m_asm.text.size();
+        m_asm.text.insert(m_asm.text.end(), m_outlined.begin(), m_outlined.end());
+        auto& cold = m_output.get(Switch::Out::COLD);
+        m_coldBase = m_asm.text.size();
+        m_asm.text.insert(m_asm.text.end(), cold.begin(), cold.end());
+
+        for (Label label : m_runtime.entryPoints()) {
+            m_asm.externs.push_back(label);
+        }
+        return std::move(m_asm);
+    }
+
+    // the module as genProg or genModule would, split in units linked by name: the
+    // rest first, then every function in order. a function reuse says yes to given
+    // its funcKey isn't generated, its unit comes back marked reused and empty
+    using Reuse = std::function<bool(const NodeStmtFuncDecl*, uint64_t key)>;
+    [[nodiscard]] std::vector<GenUnit> genUnits(bool main, Reuse reuse = {}) {
+        m_reuse = std::move(reuse);
+        AsmProg whole = main ? genProg() : genModule();
+
+        std::vector<bool> taken(whole.text.size());
+        std::vector<bool> remarked(m_remarks.size());
+        std::vector<GenUnit> units(1);
+        for (const FuncUnit& func : m_units) {
+            GenUnit unit{ .name = func.decl->ident.val, .key = func.key, .line = func.decl->ident.line, .reused = func.reused };
+            if (!func.reused) {
+                std::vector<Inst> text;
+                for (auto [range, base] : {std::pair{func.funcs, size_t{0}}, {func.outlined, m_outlinedBase}, {func.cold, m_coldBase}}) {
+                    for (size_t i = base + range.begin; i < base + range.end; ++i) {
+                        text.push_back(whole.text[i]);
+                        taken[i] = true;
+                    }
+                }
+                unit.prog = extract(whole, std::move(text), false);
+                for (size_t i = func.remarks.begin; i < func.remarks.end; ++i) {
+                    unit.remarks.push_back(m_remarks[i]);
+                    remarked[i] = true;
+                }
+            }
+            units.push_back(std::move(unit));
+        }
+
+        std::vector<Inst> rest;
+        for (size_t i = 0; i < whole.text.size(); ++i) {
+            if (!taken[i]) {
+                rest.push_back(whole.text[i]);
+            }
+        }
+        units[0].prog = extract(whole, std::move(rest), true);
+        for (size_t i = 0; i < m_remarks.size(); ++i) {
+            if (!remarked[i]) {
+                units[0].remarks.push_back(m_remarks[i]);
+            }
+        }
+        return units;
+    }
+
+private:
+
+    // a statement's source position, 0 for code that has none
+    struct Loc {
+        size_t line;
+        size_t col;
+    };
+
+    void emit(Op op, Operand dst = {}, Operand src = {}, Cond cc = Cond::O) {
+        m_output.emit({op, dst, src, cc});
+    }
+
+    void emitImul3(const Operand& dst, const Operand& src, int64_t imm) {
+        m_output.emit({Op::IMUL3, dst, src, Cond::O, static_cast<int32_t>(imm)});
+    }
+
+    void bind(Label label) {
+        emit(Op::LABEL, label);
+    }
+
+    // the code that follows is at this source position, with -g
+    void loc(Loc at) {
+        m_loc = at;
+        if (!m_options.debugFile.empty()) {
+            emit(Op::LOC, Imm{static_cast<int64_t>(at.line)}, Imm{static_cast<int64_t>(at.col)});
+        }
+    }
+
+    void push(const Operand& op) {
+        emit(Op::PUSH, op);
+        m_stackSize++;
+    }
+
+    void pop(Reg reg) {
+        emit(Op::POP, reg);
+        m_stackSize--;
+    }
+
+    void scopeBegin() {
+        m_vars.push_scope();
+        m_scopeMarks.push_back(m_localBytes);
+        m_heapMarks.push_back({});
+    }
+
+    // block locals keep their frame slot until the scope closes, rsp doesn't move.
+    // the heap goes back to where it was before the scope's first heap array
+    void scopeEnd() {
+        if (m_heapMarks.back()) {
+            emit(Op::MOV, Reg::RDI, qword(Reg::RBP, static_cast<int32_t>(m_heapMarks.back().value())));
+            emit(Op::CALL, m_runtime.release());
+        }
+        m_vars.pop_scope();
+        m_localBytes = m_scopeMarks.back();
+        m_scopeMarks.pop_back();
+        m_heapMarks.pop_back();
+    }
+
+    // دع a[n]: n elements from the runtime's heap, for as long as the scope lasts.
+    // global ones are never given back
+    void genHeapArray(const NodeStmtLetArray* letArray) {
+        Var var{ .isGlobal = m_vars.isGlobal(), .heap = true, .type = letArray->type };
+        if (var.isGlobal) {
+            var.label = globalLabel();
+            m_asm.bss.push_back({var.label, 2});
+        }
+        else {
+            var.offset = allocLocal(24, 8);
+        }
+
+        genInto(Reg::RAX, letArray->count);
+        emit(Op::MOV, heapSlot(var, 1), Reg::RAX);
+        emit(Op::MOV, Reg::RDI, Reg::RAX);
+        emit(Op::MOV, Reg::RSI, Imm{typeSize(letArray->type)});
+        emit(Op::CALL, m_runtime.alloc());
+        emit(Op::MOV, heapSlot(var, 0), Reg::RAX);
+        if (!var.isGlobal) {
+            emit(Op::MOV, heapSlot(var, 2), Reg::RDX);
+            if (!m_heapMarks.back()) {
+                m_heapMarks.back() = var.offset + 16;
+            }
+        }
+        m_vars.insert({letArray->ident.val, var});
+    }
+
+    // below everything in use, aligned to its size. the rbp relative offset
+    int64_t allocLocal(size_t bytes, size_t align) {
+        m_localBytes = alignUp(m_localBytes + bytes, align);
+        return -static_cast<int64_t>(m_localBytes);
+    }
+
+    static size_t alignUp(size_t bytes, size_t align) {
+        return (bytes + align - 1) / align * align;
+    }
+
+    void frameBegin(size_t bytes) {
+        size_t frameSize = (bytes + 15) & ~size_t{15};
+        if (frameSize > 0) {
+            emit(Op::SUB, Reg::RSP, Imm{static_cast<int64_t>(frameSize)});
+        }
+    }
+
+    // peak bytes of live lets in stmts laid out from live on, as allocLocal does.
+    // nested scopes reuse their siblings' bytes
+    size_t frameBytes(const std::vector<NodeStmt*>& stmts, size_t live = 0, bool countLets = true) const {
+
+        struct SlotVisitor {
+            const Generator* gen;
+            bool countLets;
+            size_t live;
+            size_t peak;
+
+            void nested(const NodeScope* scope) {
+                peak = std::max(peak, gen->frameBytes(scope->stmts, live));
+            }
+
+            void operator()(const NodeStmtLet* stmtLet) {
+                if (countLets) {
+                    live = alignUp(live + typeSize(stmtLet->type), typeSize(stmtLet->type));
+                    peak = std::max(peak, live);
+                }
+            }
+            void operator()(const NodeStmtLetArray* letArray) {
+                if (countLets && letArray->count) {
+                    live = alignUp(live + 24, 8);
+                    peak = std::max(peak, live);
+                }
+                else if (countLets) {
+                    size_t size = typeSize(letArray->type);
+                    live = alignUp(live + static_cast<size_t>(arrayLength(letArray)) * size, size);
+                    peak = std::max(peak, live);
+                }
+            }
+            void operator()(const NodeScope* scope) {
+                nested(scope);
+            }
+            void operator()(const NodeStmtIf* stmtIf) {
+                nested(stmtIf->scope);
+
+                std::optional<NodeIfPred*> pred = stmtIf->pred;
+                while (pred.has_value()) {
+                    if (auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+                        nested((*predElif)->scope);
+                        pred = (*predElif)->pred;
+                    }
+                    else {
+                        nested(std::get<NodeIfPredElse*>(pred.value()->var)->scope);
+                        pred = {};
+                    }
+                }
+            }
+            void operator()(const NodeStmtWhile* stmtWhile) {
+                nested(stmtWhile->scope);
+            }
+            // the counter's slot and the end's, as genFor takes them. a parallel
+            // loop's are in the frame of its body
+            void operator()(const NodeStmtFor* stmtFor) {
+                if (stmtFor->parallel) {
+                    return;
+                }
+                size_t slots = alignUp(alignUp(live + 8, 8) + 8, 8);
+                peak = std::max({peak, slots, gen->frameBytes(stmtFor->scope->stmts, slots)});
+            }
+            void operator()(const NodeStmtExit*) {}
+            void operator()(const NodeStmtPrint*) {}
+            void operator()(const NodeStmtAssign*) {}
+            void operator()(const NodeStmtIndexAssign*) {}
+            void operator()(const NodeStmtFuncDecl*) {}
+            void operator()(const NodeStmtReturn*) {}
+            void operator()(const NodeStmtImport*) {}
+            void operator()(const NodeStmtSpawn*) {}
+            void operator()(const NodeStmtJoin*) {}
+        };
+
+        SlotVisitor visitor{this, countLets, live, live};
+        for (const NodeStmt* stmt : stmts) {
+            std::visit(visitor, stmt->var);
+        }
+        return visitor.peak;
+    }
+
+    // value of expr if it only involves literals, casts and read-only constant globals
+    std::optional<int64_t> constEval(const NodeExpr* expr) {
+
+        struct ConstVisitor {
+            Generator* gen;
+
+            std::optional<int64_t> operator()(const NodeTerm* term) {
+                if (auto intLit = std::get_if<NodeTermIntLit*>(&term->var)) {
+                    return (*intLit)->int_lit.intVal;
+                }
+                if (auto paren = std::get_if<NodeTermParen*>(&term->var)) {
+                    return gen->constEval((*paren)->expr);
+                }
+                if (auto ident = std::get_if<NodeTermIdent*>(&term->var)) {
+                    if (gen->m_vars.contains((*ident)->ident.val)) {
+                        return gen->m_vars.at((*ident)->ident.val).constVal;
+                    }
+                }
+                if (auto termCast = std::get_if<NodeTermCast*>(&term->var)) {
+                    auto val = gen->constEval((*termCast)->expr);
+                    return val ? std::optional<int64_t>(wrapTo((*termCast)->type, val.value())) : std::nullopt;
+                }
+                if (auto termNot = std::get_if<NodeTermNot*>(&term->var)) {
+                    auto val = gen->constEval((*termNot)->expr);
+                    return val ? std::optional<int64_t>(val.value() == 0) : std::nullopt;
+                }
+                return {};
+            }
+
+            std::optional<int64_t> operator()(const BinExpr* binExpr) {
+                return std::visit([this](const auto* bin) -> std::optional<int64_t> {
+                    auto lhs = gen->constEval(bin->lhs);
+                    if (auto decided = decides(bin, lhs)) {
+                        return decided;
+                    }
+                    auto rhs = lhs ? gen->constEval(bin->rhs) : std::nullopt;
+                    if (!lhs || !rhs) {
+                        return {};
+                    }
+                    return fold(bin, lhs.value(), rhs.value(), bin->lhs->usedAs);
+                }, binExpr->var);
+            }
+
+            // wrap like the hardware does in type, leave traps (div by 0, MIN / -1) to runtime
+            static std::optional<int64_t> fold(const BinExprAdd*, int64_t a, int64_t b, IntType type) {
+                return wrapTo(type, static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b)));
+            }
+            static std::optional<int64_t> fold(const BinExprSub*, int64_t a, int64_t b, IntType type) {
+                return wrapTo(type, static_cast<int64_t>(static_cast<uint64_t>(a) - static_cast<uint64_t>(b)));
+            }
+            static std::optional<int64_t> fold(const BinExprMult*, int64_t a, int64_t b, IntType type) {
+                return wrapTo(type, static_cast<int64_t>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b)));
+            }
+            static std::optional<int64_t> fold(const BinExprDiv*, int64_t a, int64_t b, IntType type) {
+                return divideAs(type, a, b, false);
+            }
+            static std::optional<int64_t> fold(const BinExprMod*, int64_t a, int64_t b, IntType type) {
+                return divideAs(type, a, b, true);
+            }
+            static std::optional<int64_t> fold(const BinExprEqTo*, int64_t a, int64_t b, IntType) { return a == b; }
+            static std::optional<int64_t> fold(const BinExprNotEqTo*, int64_t a, int64_t b, IntType) { return a != b; }
+            static std::optional<int64_t> fold(const BinExprGrThan*, int64_t a, int64_t b, IntType type) { return lessThan(type, b, a); }
+            static std::optional<int64_t> fold(const BinExprLsThan*, int64_t a, int64_t b, IntType type) { return lessThan(type, a, b); }
+            static std::optional<int64_t> fold(const BinExprAnd*, int64_t a, int64_t b, IntType) { return a != 0 && b != 0; }
+            static std::optional<int64_t> fold(const BinExprOr*, int64_t a, int64_t b, IntType) { return a != 0 || b != 0; }
+
+            // a constant lhs that settles && or || whatever rhs is, which then never runs
+            static std::optional<int64_t> decides(const void*, std::optional<int64_t>) { return {}; }
+            static std::optional<int64_t> decides(const BinExprAnd*, std::optional<int64_t> lhs) {
+                return lhs == 0 ? std::optional<int64_t>(0) : std::nullopt;
+            }
+            static std::optional<int64_t> decides(const BinExprOr*, std::optional<int64_t> lhs) {
+                return lhs && lhs != 0 ? std::optional<int64_t>(1) : std::nullopt;
+            }
+        };
+
+        ConstVisitor visitor{this};
+        return std::visit(visitor, expr->var);
+    }
 
-        out << "section .bss\n"   << m_output.getStr(Switch::Out::GLOBALS) << "\n";
+    // names that are ever assigned to, by name only so shadowing errs on the safe side.
+    // also rules out loop counters: a name only counts as one if every let of it starts
+    // at a constant >= 0 and every assignment resets it to one or adds one to it. a
+    // signed counter narrower than i64 could wrap negative, it never counts
+    void collectAssigned(const std::vector<NodeStmt*>& stmts, std::unordered_set<std::string>& assigned) {
 
-        
-        out << "section .text\n" << m_output.getStr(Switch::Out::FUNCS) << "\n";
+        struct AssignVisitor {
+            Generator* gen;
+            std::unordered_set<std::string>& assigned;
+
+            void operator()(const NodeStmtAssign* stmtAssign) {
+                assigned.insert(stmtAssign->ident.val);
+                if (!gen->isCounterStep(stmtAssign)) {
+                    gen->m_nonCounters.insert(stmtAssign->ident.val);
+                }
+            }
+            void operator()(const NodeStmtLet* stmtLet) {
+                auto val = gen->constEval(stmtLet->expr);
+                bool narrowSigned = isSigned(stmtLet->type) && typeSize(stmtLet->type) < 8;
+                if (!val || val.value() < 0 || narrowSigned) {
+                    gen->m_nonCounters.insert(stmtLet->ident.val);
+                }
+            }
+            void operator()(const NodeStmtLetArray* letArray) {
+                gen->m_nonCounters.insert(letArray->ident.val);
+            }
+            void operator()(const NodeScope* scope) {
+                gen->collectAssigned(scope->stmts, assigned);
+            }
+            void operator()(const NodeStmtIf* stmtIf) {
+                gen->collectAssigned(stmtIf->scope->stmts, assigned);
+
+                std::optional<NodeIfPred*> pred = stmtIf->pred;
+                while (pred.has_value()) {
+                    if (auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+                        gen->collectAssigned((*predElif)->scope->stmts, assigned);
+                        pred = (*predElif)->pred;
+                    }
+                    else {
+                        gen->collectAssigned(std::get<NodeIfPredElse*>(pred.value()->var)->scope->stmts, assigned);
+                        pred = {};
+                    }
+                }
+            }
+            void operator()(const NodeStmtWhile* stmtWhile) {
+                gen->collectAssigned(stmtWhile->scope->stmts, assigned);
+            }
+            // a لكل counter is bounded by its own loop, not by a بينما around it
+            void operator()(const NodeStmtFor* stmtFor) {
+                gen->m_nonCounters.insert(stmtFor->ident.val);
+                gen->collectAssigned(stmtFor->scope->stmts, assigned);
+            }
+            void operator()(const NodeStmtFuncDecl* funcDecl) {
+                for (const auto& param : funcDecl->params) {
+                    gen->m_nonCounters.insert(param->ident.val);
+                }
+                gen->collectAssigned(funcDecl->scope->stmts, assigned);
+            }
+            void operator()(const NodeStmtExit*) {}
+            void operator()(const NodeStmtPrint*) {}
+            void operator()(const NodeStmtIndexAssign*) {}
+            void operator()(const NodeStmtReturn*) {}
+            void operator()(const NodeStmtImport*) {}
+            void operator()(const NodeStmtSpawn*) {}
+            void operator()(const NodeStmtJoin*) {}
+        };
 
-        out << "global _start\n_start:\n"
-            << m_output.getStr(Switch::Out::PROG)
-            << "   mov rax, 60\n"
-            << "   mov rdi, 0\n"
-            << "   syscall\n";
+        AssignVisitor visitor{this, assigned};
+        for (const NodeStmt* stmt : stmts) {
+            std::visit(visitor, stmt->var);
+        }
+    }
 
-        return out.str();
+    // what a function's code depends on besides the options: its tokens, with lines
+    // counted from its name's, and what each name among them means outside of it
+    uint64_t funcKey(const NodeStmtFuncDecl* funcDecl) {
+        Hasher hash;
+        hash.add(m_module);
+        std::vector<std::string_view> names;
+        for (const Token& token : funcDecl->tokens) {
+            hash.add(static_cast<uint64_t>(token.type)).add(token.val).add(token.line - funcDecl->ident.line).add(token.col);
+            if (token.type == TokenType::IDENT) {
+                names.push_back(token.val);
+            }
+        }
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+
+        for (std::string_view name : names) {
+            std::string ident(name);
+            hash.add(name).add(m_assigned.contains(ident)).add(m_nonCounters.contains(ident));
+            if (m_vars.contains(ident)) {
+                const Var& var = m_vars.at(ident);
+                hash.add(m_asm.labels.at(var.label.id))
+                    .add(var.constVal.has_value())
+                    .add(static_cast<uint64_t>(var.constVal.value_or(0)))
+                    .add(static_cast<uint64_t>(var.length))
+                    .add(var.heap)
+                    .add(static_cast<uint64_t>(var.type));
+            }
+            if (m_funcs.contains(ident)) {
+                const NodeStmtFuncDecl* callee = m_funcs.at(ident).funcPtr;
+                hash.add(callee->params.size());
+                for (const NodeFuncParam* param : callee->params) {
+                    hash.add(static_cast<uint64_t>(param->type));
+                }
+            }
+        }
+        return hash.value();
     }
 
-private:
+    // text out of whole, and for the rest its data too, with the labels they use
+    // numbered anew. what a unit uses and doesn't bind is an extern, what it binds
+    // that another unit may use is global
+    AsmProg extract(const AsmProg& whole, std::vector<Inst> text, bool rest) const {
+        AsmProg prog;
+        prog.debugFile = whole.debugFile;
+
+        std::vector<bool> bound(whole.labels.size());
+        std::vector<bool> shared(whole.labels.size());
+        for (const Inst& inst : text) {
+            if (inst.op == Op::LABEL) {
+                bound[inst.dst.label.id] = true;
+            }
+        }
+        for (Label label : whole.globals) {
+            shared[label.id] = true;
+        }
+        for (Label label : m_shared) {
+            shared[label.id] = true;
+        }
 
-    void push(const std::string& reg) {
-        m_output << "   push " << reg << "\n";
-        m_stackSize++;
-    }
+        std::vector<uint32_t> ids(whole.labels.size(), UINT32_MAX);
+        std::vector<uint32_t> olds;
+        auto use = [&](Label& label) {
+            if (ids[label.id] == UINT32_MAX) {
+                ids[label.id] = static_cast<uint32_t>(prog.labels.size());
+                prog.labels.push_back(whole.labels[label.id]);
+                olds.push_back(label.id);
+            }
+            label.id = ids[label.id];
+        };
 
-    void pop(const std::string& reg) {
-        m_output << "   pop " << reg << "\n";
-        m_stackSize--;
+        if (rest) {
+            prog.rodata = whole.rodata;
+            prog.data = whole.data;
+            prog.bss = whole.bss;
+            for (auto* defs : {&prog.rodata, &prog.data}) {
+                for (DataDef& def : *defs) {
+                    bound[def.label.id] = true;
+                    use(def.label);
+                }
+            }
+            for (BssDef& def : prog.bss) {
+                bound[def.label.id] = true;
+                use(def.label);
+            }
+            if (!m_module) {
+                prog.entry = whole.entry;
+                use(prog.entry);
+            }
+        }
+        for (Inst& inst : text) {
+            for (Operand* op : {&inst.dst, &inst.src}) {
+                if (op->kind == Operand::Kind::LABEL || (op->isMem() && op->ripRel)) {
+                    use(op->label);
+                }
+            }
+        }
+        prog.text = std::move(text);
+
+        for (uint32_t id = 0; id < olds.size(); ++id) {
+            if (!bound[olds[id]]) {
+                prog.externs.push_back(Label{id});
+            }
+            else if (shared[olds[id]]) {
+                prog.globals.push_back(Label{id});
+            }
+        }
+        for (Label label : whole.funcs) {
+            if (bound[label.id] && ids[label.id] != UINT32_MAX) {
+                prog.funcs.push_back(Label{ids[label.id]});
+            }
+        }
+        return prog;
     }
 
-    void scopeBegin() {
-        m_vars.push_scope();
+    // a global's storage. numbered apart from the other labels, so a function's unit
+    // refers to it by the same name for as long as the globals before it stay
+    Label globalLabel() {
+        Label label = namedLabel("_g_" + std::to_string(m_globalCount++));
+        m_shared.push_back(label);
+        return label;
     }
 
-    void scopeEnd() {
-        size_t scopeSize = m_vars.back().size();
-        m_vars.pop_scope();
-        m_output << "   add rsp, " << (scopeSize * 8) << "\n";
-        m_stackSize -= scopeSize;
+    Label createLabel(const std::string& prefix = "") {
+        return namedLabel(prefix + "label" + std::to_string(labelCounter++));
     }
 
-    std::string createLabel() {
-        return "label" + std::to_string(labelCounter++);
+    Label namedLabel(std::string name) {
+        m_asm.labels.push_back(std::move(name));
+        return Label{static_cast<uint32_t>(m_asm.labels.size() - 1)};
     }
 
+    // a return from inside scopes that took from the heap gives it all back
     void retCleanup() {
-        size_t funcBase = m_funcBaseStack.back();
-        size_t toPop = m_stackSize - funcBase;
-        if (toPop > 0) {
-            m_output << "   add rsp, " << (toPop * 8) << "\n";
-            m_stackSize = funcBase;
+        for (const auto& mark : m_heapMarks) {
+            if (mark) {
+                emit(Op::MOV, Reg::RDI, qword(Reg::RBP, static_cast<int32_t>(mark.value())));
+                emit(Op::CALL, m_runtime.release());
+                break;
+            }
         }
+        emit(Op::LEAVE);
+        emit(Op::RET);
     }
 
 private:
 
     struct Var {
         bool isGlobal{};
-        size_t m_stackLoc{}; // !Global
-        std::string label; // Global
+        int64_t offset{}; // !Global, rbp relative
+        Label label{}; // Global
+        std::optional<int64_t> constVal; // read-only global with a constant initializer
+        int64_t length{}; // arrays, element count. offset/label is element 0
+        bool heap{}; // array with a run-time length. offset/label holds element 0's address, then the length and the heap's top before it
+        IntType type = IntType::I64; // arrays, of the elements
+        bool counter{}; // of a لكل, only the loop writes it
+        std::optional<Reg> reg; // a counter held in a register instead of at offset
+
+        bool isArray() const {
+            return length > 0 || heap;
+        }
     };
 
+    struct Compare {
+        const NodeExpr* lhs;
+        const NodeExpr* rhs;
+        Cond cc; // holds when the comparison is true
+    };
+
+    struct Induction {
+        std::string name;
+        int64_t bound;
+        bool isGlobal;
+        bool live;
+    };
+
+    static constexpr int64_t MAX_ARRAY_LENGTH = int64_t{1} << 28;
+    static constexpr size_t MAX_IF_CONVERT_COST = 6;
+    // ast nodes a لكل may grow to by unrolling, and the most iterations a
+    // constant count unrolls fully
+    static constexpr size_t UNROLL_BUDGET = 64;
+    static constexpr uint64_t MAX_FULL_UNROLL = 16;
+    // where counters go, innermost لكل last. generated functions don't preserve
+    // them, so only a loop whose body calls none holds one. printing, reading and
+    // allocating don't count, see Runtime
+    static constexpr Reg COUNTER_REGS[] = {Reg::R13, Reg::R14, Reg::R15};
+    // profile thresholds: a cold arm ran under 1/32 of its اذا's runs, a biased
+    // branch went the other way under 1/20 of the time, a hot loop iterated at
+    // least 1/64 as often as the hottest site
+    static constexpr uint64_t COLD_RATIO = 32;
+    static constexpr uint64_t BIASED_RATIO = 20;
+    static constexpr uint64_t HOT_RATIO = 64;
+
     struct Func {
         const NodeStmtFuncDecl* funcPtr;
-        std::string label;
+        Label label;
     };
 
     enum class FuncState : uint8_t {
@@ -517,7 +2442,7 @@ private:
         void push_scope() { scopes.push_back({}); }
         void pop_scope() { scopes.pop_back(); }
         std::unordered_map<std::string, T>& back() { return scopes.back(); }
-        
+
         void insert(const std::pair<std::string, T>& pair) {
             scopes.back().insert(pair);
         }
@@ -549,46 +2474,751 @@ private:
         }
     };
 
+    // cold code goes after everything else, out of the way of the hot path
     struct Switch {
-        enum class Out : size_t { PROG, FUNCS, GLOBALS };
+        enum class Out : size_t { PROG, FUNCS, COLD };
     private:
-        std::array<std::stringstream, 3> buf{};
+        std::array<std::vector<Inst>, 3> buf{};
         Out curr = Out::PROG;
 
-        std::stringstream& ss(Out out) {
-            return buf.at(static_cast<std::size_t>(out));
-        }
-
     public:
         void set(Out out) {
             curr = out;
         }
 
-        template<typename T>
-        Switch& operator<<(const T& val) {
-            ss(curr) << val;
-            return *this;
+        Out current() const {
+            return curr;
+        }
+
+        void emit(const Inst& inst) {
+            buf.at(static_cast<std::size_t>(curr)).push_back(inst);
+        }
+
+        std::vector<Inst>& get(Out out) {
+            return buf.at(static_cast<std::size_t>(out));
+        }
+
+        // instructions emitted so far, into any output
+        size_t size() const {
+            return buf[0].size() + buf[1].size() + buf[2].size();
+        }
+    };
+
+    static std::optional<Compare> compareOf(const NodeExpr* expr) {
+
+        struct CompareVisitor {
+            std::optional<Compare> operator()(const BinExprEqTo* exprEq) {
+                return Compare{exprEq->lhs, exprEq->rhs, Cond::E};
+            }
+            std::optional<Compare> operator()(const BinExprNotEqTo* exprNeq) {
+                return Compare{exprNeq->lhs, exprNeq->rhs, Cond::NE};
+            }
+            std::optional<Compare> operator()(const BinExprLsThan* exprLt) {
+                return Compare{exprLt->lhs, exprLt->rhs, Cond::L};
+            }
+            std::optional<Compare> operator()(const BinExprGrThan* exprGt) {
+                return Compare{exprGt->lhs, exprGt->rhs, Cond::G};
+            }
+            std::optional<Compare> operator()(const BinExprAdd*) { return {}; }
+            std::optional<Compare> operator()(const BinExprSub*) { return {}; }
+            std::optional<Compare> operator()(const BinExprMult*) { return {}; }
+            std::optional<Compare> operator()(const BinExprDiv*) { return {}; }
+            std::optional<Compare> operator()(const BinExprMod*) { return {}; }
+            std::optional<Compare> operator()(const BinExprAnd*) { return {}; }
+            std::optional<Compare> operator()(const BinExprOr*) { return {}; }
+        };
+
+        if (auto binExpr = std::get_if<BinExpr*>(&expr->var)) {
+            auto cmp = std::visit(CompareVisitor{}, (*binExpr)->var);
+            if (cmp) {
+                cmp->cc = orderIn(cmp->cc, cmp->lhs->usedAs);
+            }
+            return cmp;
+        }
+        return {};
+    }
+
+    // unsigned types order by below and above
+    static Cond orderIn(Cond cc, IntType type) {
+        if (isSigned(type)) {
+            return cc;
+        }
+        return cc == Cond::L ? Cond::B : cc == Cond::G ? Cond::A : cc;
+    }
+
+    static const NodeTermIdent* asIdent(const NodeExpr* expr) {
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (auto ident = std::get_if<NodeTermIdent*>(&(*term)->var)) {
+                return *ident;
+            }
+        }
+        return nullptr;
+    }
+
+    // name = c, name = name + c or name = c + name, with 0 <= c <= INT32_MAX
+    bool isCounterStep(const NodeStmtAssign* stmtAssign) {
+        if (auto val = constEval(stmtAssign->expr)) {
+            return val.value() >= 0;
+        }
+
+        auto binExpr = std::get_if<BinExpr*>(&stmtAssign->expr->var);
+        if (!binExpr) {
+            return false;
+        }
+        auto exprAdd = std::get_if<BinExprAdd*>(&(*binExpr)->var);
+        if (!exprAdd) {
+            return false;
+        }
+
+        const NodeExpr* step = nullptr;
+        if (auto ident = asIdent((*exprAdd)->lhs); ident && ident->ident.val == stmtAssign->ident.val) {
+            step = (*exprAdd)->rhs;
+        }
+        else if (auto ident = asIdent((*exprAdd)->rhs); ident && ident->ident.val == stmtAssign->ident.val) {
+            step = (*exprAdd)->lhs;
+        }
+
+        auto val = step ? constEval(step) : std::nullopt;
+        return val && val.value() >= 0 && val.value() <= INT32_MAX;
+    }
+
+    static int64_t arrayLength(const NodeStmtLetArray* letArray) {
+        int64_t length = letArray->size.intVal;
+        if (length <= 0 || length > MAX_ARRAY_LENGTH) {
+            std::cerr << "Invalid array size: " << letArray->ident.val << std::endl;
+            exit(1);
+        }
+        return length;
+    }
+
+    const Var& arrayVar(const std::string& name) {
+        if (!m_vars.contains(name)) {
+            std::cerr << "Undeclared Identifier: " << name << std::endl;
+            exit(1);
+        }
+        const Var& var = m_vars.at(name);
+        if (!var.isArray()) {
+            std::cerr << "Not an array: " << name << std::endl;
+            exit(1);
+        }
+        return var;
+    }
+
+    // operand for arr[index]. a non constant index is already in rax, or is a counter
+    // in its register. it is checked unless a live loop counter proves it in range
+    Operand element(const Var& arr, const std::string& name, const NodeExpr* index, std::optional<int64_t> constIndex) {
+        uint8_t size = typeSize(arr.type);
+        if (arr.heap) {
+            return heapElement(arr, name, index, constIndex);
+        }
+        if (constIndex) {
+            if (constIndex.value() < 0 || constIndex.value() >= arr.length) {
+                std::cerr << "Array index out of range: " << name << std::endl;
+                exit(1);
+            }
+            Operand op = varOperand(arr);
+            op.val += constIndex.value() * size;
+            return op;
+        }
+
+        Reg reg = counterReg(index).value_or(Reg::RAX);
+        if (!m_options.boundsCheckElim || !inductionCovers(index, arr.length)) {
+            emit(Op::CMP, reg, Imm{arr.length});
+            emit(Op::JCC, m_runtime.boundsFail(), {}, Cond::AE);
+        }
+
+        if (arr.isGlobal) {
+            emit(Op::LEA, Reg::RCX, varOperand(arr));
+            return mem(size, Reg::RCX, reg, size);
+        }
+        return mem(size, Reg::RBP, reg, size, static_cast<int32_t>(arr.offset));
+    }
+
+    // the address is loaded into rcx and the index checked against the stored length
+    Operand heapElement(const Var& arr, const std::string& name, const NodeExpr* index, std::optional<int64_t> constIndex) {
+        uint8_t size = typeSize(arr.type);
+        if (constIndex) {
+            if (constIndex.value() < 0 || constIndex.value() >= MAX_ARRAY_LENGTH) {
+                std::cerr << "Array index out of range: " << name << std::endl;
+                exit(1);
+            }
+            emit(Op::CMP, heapSlot(arr, 1), Imm{constIndex.value()});
+            emit(Op::JCC, m_runtime.boundsFail(), {}, Cond::BE);
+            emit(Op::MOV, Reg::RCX, heapSlot(arr, 0));
+            return mem(size, Reg::RCX, static_cast<int32_t>(constIndex.value() * size));
+        }
+
+        Reg reg = counterReg(index).value_or(Reg::RAX);
+        emit(Op::CMP, reg, heapSlot(arr, 1));
+        emit(Op::JCC, m_runtime.boundsFail(), {}, Cond::AE);
+        emit(Op::MOV, Reg::RCX, heapSlot(arr, 0));
+        return mem(size, Reg::RCX, reg, size);
+    }
+
+    // a heap array's qwords: its address, its length and the heap's top before it
+    static Operand heapSlot(const Var& arr, int32_t slot) {
+        Operand op = arr.isGlobal ? qword(arr.label) : qword(Reg::RBP, static_cast<int32_t>(arr.offset));
+        op.val += slot * 8;
+        return op;
+    }
+
+    // the register of a لكل counter that index names
+    std::optional<Reg> counterReg(const NodeExpr* index) {
+        const Var* var = scalarVar(index);
+        return var ? var->reg : std::nullopt;
+    }
+
+    // بينما (i < bound) where i is a counter: inside the body, until i is written
+    // again, 0 <= i < bound holds
+    std::optional<Induction> loopInduction(const NodeExpr* cond) {
+        auto binExpr = std::get_if<BinExpr*>(&cond->var);
+        if (!binExpr) {
+            return {};
+        }
+        auto exprLt = std::get_if<BinExprLsThan*>(&(*binExpr)->var);
+        if (!exprLt) {
+            return {};
+        }
+
+        auto ident = asIdent((*exprLt)->lhs);
+        if (!ident || !m_vars.contains(ident->ident.val) || m_nonCounters.contains(ident->ident.val)) {
+            return {};
+        }
+        const Var& var = m_vars.at(ident->ident.val);
+        if (var.isArray() || var.constVal.has_value()) {
+            return {};
+        }
+
+        // an unsigned bound above INT64_MAX bounds nothing an index can use
+        auto bound = constEval((*exprLt)->rhs);
+        if (!bound || (!isSigned(var.type) && bound.value() < 0)) {
+            return {};
         }
+        return Induction{ident->ident.val, bound.value(), var.isGlobal, true};
+    }
+
+    bool inductionCovers(const NodeExpr* index, int64_t length) const {
+        auto ident = asIdent(index);
+        if (!ident) {
+            return false;
+        }
+        for (const Induction& ind : m_inductions) {
+            if (ind.live && ind.name == ident->ident.val && ind.bound <= length) {
+                return true;
+            }
+        }
+        return false;
+    }
 
-        std::string getStr(Out out) {
-            return ss(out).str();
+    void killInduction(const std::string& name) {
+        for (Induction& ind : m_inductions) {
+            if (ind.name == name) {
+                ind.live = false;
+            }
         }
+    }
 
-        friend void operator<<(std::stringstream& os, Switch& sw) {
-            os << sw.getStr(sw.curr);
+    // a call may step any global counter
+    void killGlobalInductions() {
+        for (Induction& ind : m_inductions) {
+            if (ind.isGlobal) {
+                ind.live = false;
+            }
         }
+    }
+
+    struct VecTerm {
+        const Var* arr = nullptr; // arr[i], or the constant val when null
+        int64_t val = 0;
     };
 
+    std::optional<VecTerm> vecTerm(const NodeExpr* expr, const Induction& ind) {
+        if (auto val = constEval(expr)) {
+            return VecTerm{ .val = val.value() };
+        }
+
+        auto term = std::get_if<NodeTerm*>(&expr->var);
+        if (!term) {
+            return {};
+        }
+        if (auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+            return vecTerm((*paren)->expr, ind);
+        }
+        auto termIndex = std::get_if<NodeTermIndex*>(&(*term)->var);
+        if (!termIndex) {
+            return {};
+        }
+
+        auto ident = asIdent((*termIndex)->index);
+        if (!ident || ident->ident.val != ind.name) {
+            return {};
+        }
+        const Var& arr = arrayVar((*termIndex)->ident.val);
+        if (arr.length < ind.bound || typeSize(arr.type) != 8) {
+            return {};
+        }
+        return VecTerm{ .arr = &arr };
+    }
+
+    // x, x + y or x - y
+    bool vecBinary(const NodeExpr* expr, const Induction& ind, VecTerm& x, std::optional<VecTerm>& y, bool& sub) {
+        if (auto binExpr = std::get_if<BinExpr*>(&expr->var)) {
+            const NodeExpr* lhs = nullptr;
+            const NodeExpr* rhs = nullptr;
+            if (auto exprAdd = std::get_if<BinExprAdd*>(&(*binExpr)->var)) {
+                lhs = (*exprAdd)->lhs;
+                rhs = (*exprAdd)->rhs;
+            }
+            else if (auto exprSub = std::get_if<BinExprSub*>(&(*binExpr)->var)) {
+                lhs = (*exprSub)->lhs;
+                rhs = (*exprSub)->rhs;
+                sub = true;
+            }
+            auto lt = lhs ? vecTerm(lhs, ind) : std::nullopt;
+            auto rt = rhs ? vecTerm(rhs, ind) : std::nullopt;
+            if (lt && rt) {
+                x = lt.value();
+                y = rt;
+                return true;
+            }
+        }
+
+        if (auto term = vecTerm(expr, ind)) {
+            x = term.value();
+            return true;
+        }
+        return false;
+    }
+
+    void broadcast(uint8_t reg, int64_t val) {
+        emit(Op::MOV, Reg::RAX, Imm{val});
+        emit(Op::MOVQ, xmm(reg), Reg::RAX);
+        emit(Op::PUNPCKLQDQ, xmm(reg), xmm(reg));
+    }
+
+    // bodies of exactly "c[i] = x (+|-) y; i = i + 1;" over arrays indexed by i and
+    // constants, or "s = s (+|-) a[i]; i = i + 1;", run two qword lanes per sse2 step
+    // while i + 2 <= bound. the scalar loop that follows picks up the remainder. every
+    // value involved is 64 bits wide
+    bool genVectorLoop(const NodeStmtWhile* stmtWhile, const Induction& ind) {
+        const auto& stmts = stmtWhile->scope->stmts;
+        if (stmts.size() != 2 || ind.bound < 2 || typeSize(m_vars.at(ind.name).type) != 8) {
+            return false;
+        }
+        auto step = std::get_if<NodeStmtAssign*>(&stmts[1]->var);
+        if (!step || (*step)->ident.val != ind.name || !isUnitStep(*step)) {
+            return false;
+        }
+
+        const Var* dst = nullptr;
+        const Var* sum = nullptr;
+        VecTerm x;
+        std::optional<VecTerm> y;
+        bool sub = false;
+
+        if (auto indexAssign = std::get_if<NodeStmtIndexAssign*>(&stmts[0]->var)) {
+            auto ident = asIdent((*indexAssign)->index);
+            if (!ident || ident->ident.val != ind.name) {
+                return false;
+            }
+            dst = &arrayVar((*indexAssign)->ident.val);
+            if (dst->length < ind.bound || typeSize(dst->type) != 8 || !vecBinary((*indexAssign)->expr, ind, x, y, sub)) {
+                return false;
+            }
+        }
+        else if (auto stmtAssign = std::get_if<NodeStmtAssign*>(&stmts[0]->var)) {
+            const std::string& name = (*stmtAssign)->ident.val;
+            if (name == ind.name || !m_vars.contains(name)) {
+                return false;
+            }
+            sum = &m_vars.at(name);
+            if (sum->isArray() || sum->counter || typeSize(sum->type) != 8) {
+                return false;
+            }
+
+            // s + a[i], a[i] + s or s - a[i]
+            auto binExpr = std::get_if<BinExpr*>(&(*stmtAssign)->expr->var);
+            if (!binExpr) {
+                return false;
+            }
+            const NodeExpr* lhs = nullptr;
+            const NodeExpr* rhs = nullptr;
+            if (auto exprAdd = std::get_if<BinExprAdd*>(&(*binExpr)->var)) {
+                lhs = (*exprAdd)->lhs;
+                rhs = (*exprAdd)->rhs;
+            }
+            else if (auto exprSub = std::get_if<BinExprSub*>(&(*binExpr)->var)) {
+                lhs = (*exprSub)->lhs;
+                rhs = (*exprSub)->rhs;
+                sub = true;
+            }
+            else {
+                return false;
+            }
+
+            auto isSum = [&name](const NodeExpr* expr) {
+                auto ident = asIdent(expr);
+                return ident && ident->ident.val == name;
+            };
+            const NodeExpr* other = isSum(lhs) ? rhs : (!sub && isSum(rhs)) ? lhs : nullptr;
+            auto term = other ? vecTerm(other, ind) : std::nullopt;
+            if (!term || !term->arr) {
+                return false;
+            }
+            x = term.value();
+        }
+        else {
+            return false;
+        }
+
+        Label loop = createLabel();
+        Label done = createLabel();
+        const Var& counter = m_vars.at(ind.name);
+
+        emit(Op::MOV, Reg::RCX, varOperand(counter));
+        if (dst) {
+            emit(Op::LEA, Reg::R8, varOperand(*dst));
+        }
+        if (x.arr) {
+            emit(Op::LEA, Reg::R9, varOperand(*x.arr));
+        }
+        else {
+            broadcast(2, x.val);
+        }
+        if (y && y->arr) {
+            emit(Op::LEA, Reg::R10, varOperand(*y->arr));
+        }
+        else if (y) {
+            broadcast(3, y->val);
+        }
+        if (sum) {
+            emit(Op::PXOR, xmm(1), xmm(1));
+        }
+
+        emit(Op::LEA, Reg::RDX, qword(Reg::RCX, 2));
+        emit(Op::CMP, Reg::RDX, Imm{ind.bound});
+        emit(Op::JCC, done, {}, Cond::G);
+
+        emit(Op::ALIGN, Imm{16});
+        bind(loop);
+        if (x.arr) {
+            emit(Op::MOVDQU, xmm(0), oword(Reg::R9, Reg::RCX, 8));
+        }
+        else {
+            emit(Op::MOVDQU, xmm(0), xmm(2));
+        }
+        if (y) {
+            Op op = sub ? Op::PSUBQ : Op::PADDQ;
+            if (y->arr) {
+                emit(Op::MOVDQU, xmm(1), oword(Reg::R10, Reg::RCX, 8));
+                emit(op, xmm(0), xmm(1));
+            }
+            else {
+                emit(op, xmm(0), xmm(3));
+            }
+        }
+        if (dst) {
+            emit(Op::MOVDQU, oword(Reg::R8, Reg::RCX, 8), xmm(0));
+        }
+        else {
+            emit(sub ? Op::PSUBQ : Op::PADDQ, xmm(1), xmm(0));
+        }
+        emit(Op::MOV, Reg::RCX, Reg::RDX);
+        emit(Op::LEA, Reg::RDX, qword(Reg::RCX, 2));
+        emit(Op::CMP, Reg::RDX, Imm{ind.bound});
+        emit(Op::JCC, loop, {}, Cond::LE);
+
+        bind(done);
+        emit(Op::MOV, varOperand(counter), Reg::RCX);
+        if (sum) {
+            emit(Op::MOVDQU, xmm(0), xmm(1));
+            emit(Op::PUNPCKHQDQ, xmm(0), xmm(0));
+            emit(Op::PADDQ, xmm(1), xmm(0));
+            emit(Op::MOVQ, Reg::RAX, xmm(1));
+            emit(Op::ADD, varOperand(*sum), Reg::RAX);
+        }
+        return true;
+    }
+
+    // name = name + 1 or name = 1 + name
+    bool isUnitStep(const NodeStmtAssign* stmtAssign) {
+        auto binExpr = std::get_if<BinExpr*>(&stmtAssign->expr->var);
+        if (!binExpr) {
+            return false;
+        }
+        auto exprAdd = std::get_if<BinExprAdd*>(&(*binExpr)->var);
+        if (!exprAdd) {
+            return false;
+        }
+
+        const std::string& name = stmtAssign->ident.val;
+        if (auto ident = asIdent((*exprAdd)->lhs); ident && ident->ident.val == name) {
+            return constEval((*exprAdd)->rhs) == 1;
+        }
+        if (auto ident = asIdent((*exprAdd)->rhs); ident && ident->ident.val == name) {
+            return constEval((*exprAdd)->lhs) == 1;
+        }
+        return false;
+    }
+
+    // name = name (+|-) s or s + name, with s an immediate or a variable, as one
+    // read-modify-write of name's memory. dwords and qwords, the rest need narrowing
+    bool genUpdate(const Var& var, const NodeStmtAssign* stmtAssign) {
+        auto binExpr = std::get_if<BinExpr*>(&stmtAssign->expr->var);
+        if (!binExpr || typeSize(var.type) < 4) {
+            return false;
+        }
+
+        Op op = Op::ADD;
+        const NodeExpr* lhs = nullptr;
+        const NodeExpr* rhs = nullptr;
+        if (auto exprAdd = std::get_if<BinExprAdd*>(&(*binExpr)->var)) {
+            lhs = (*exprAdd)->lhs;
+            rhs = (*exprAdd)->rhs;
+        }
+        else if (auto exprSub = std::get_if<BinExprSub*>(&(*binExpr)->var)) {
+            op = Op::SUB;
+            lhs = (*exprSub)->lhs;
+            rhs = (*exprSub)->rhs;
+        }
+        else {
+            return false;
+        }
+
+        auto isTarget = [stmtAssign](const NodeExpr* expr) {
+            auto ident = asIdent(expr);
+            return ident && ident->ident.val == stmtAssign->ident.val;
+        };
+        const NodeExpr* other = isTarget(lhs) ? rhs : (op == Op::ADD && isTarget(rhs)) ? lhs : nullptr;
+        auto src = other ? simpleOperand(other) : std::nullopt;
+        if (!src) {
+            return false;
+        }
+
+        if (src->isMem()) {
+            emit(Op::MOV, sized(Reg::RAX, var.type), src.value());
+            src = sized(Reg::RAX, var.type);
+        }
+        emit(op, varOperand(var), src.value());
+        return true;
+    }
+
+    // a variable that reading is one load, with whatever conversion its use needs
+    const Var* scalarVar(const NodeExpr* expr) {
+        auto ident = asIdent(expr);
+        if (!ident || !m_vars.contains(ident->ident.val)) {
+            return nullptr;
+        }
+        const Var& var = m_vars.at(ident->ident.val);
+        return !var.isArray() && !var.constVal ? &var : nullptr;
+    }
+
+    // as wide as the variable's type, an array's element 0
+    Operand varOperand(const Var& var) const {
+        if (var.reg) {
+            return var.reg.value();
+        }
+        Operand op = var.isGlobal ? qword(var.label) : qword(Reg::RBP, static_cast<int32_t>(var.offset));
+        op.size = typeSize(var.type);
+        return op;
+    }
+
+    // a value of a type narrower than 64 bits lives in the low dword of its register,
+    // extended to 32 bits by its sign. the high dword is undefined
+    static Operand sized(Reg reg, IntType type) {
+        return typeSize(type) == 8 ? Operand(reg) : low32(reg);
+    }
+
+    static Operand regOf(Reg reg, uint8_t size) {
+        return size == 1 ? low8(reg) : size == 2 ? low16(reg) : size == 4 ? low32(reg) : Operand(reg);
+    }
+
+    // back to an 8 or 16 bit type after a dword operation
+    void narrow(IntType type) {
+        if (typeSize(type) < 4) {
+            emit(isSigned(type) ? Op::MOVSX : Op::MOVZX, low32(Reg::RAX), regOf(Reg::RAX, typeSize(type)));
+        }
+    }
+
+    // rax from a value of type from to one of type to: a widening or a cast
+    void convert(IntType from, IntType to) {
+        if (typeSize(to) == 8 && typeSize(from) < 8) {
+            if (isSigned(from)) {
+                emit(Op::MOVSX, Reg::RAX, low32(Reg::RAX));
+            }
+            else {
+                emit(Op::MOV, low32(Reg::RAX), low32(Reg::RAX));
+            }
+        }
+        else if (typeSize(to) < 4 && !widens(from, to)) {
+            narrow(to);
+        }
+    }
+
+    // reg = the value of type from at src, as type to, in one load
+    void emitLoad(Reg reg, const Operand& src, IntType from, IntType to) {
+        Operand dst = typeSize(to) == 8 && isSigned(from) ? Operand(reg) : low32(reg);
+        if (typeSize(from) == 8) {
+            emit(Op::MOV, reg, src);
+        }
+        else if (typeSize(from) == 4 && dst.size == 4) {
+            emit(Op::MOV, dst, src);
+        }
+        else {
+            emit(isSigned(from) ? Op::MOVSX : Op::MOVZX, dst, src);
+        }
+    }
+
+    // the body's code goes to m_outlined, out of the way of the function around
+    // it, with nothing of that function's state but its globals and the captures
+    void genParallelBody(const NodeStmtFor* stmtFor, Label bodyLabel, const std::vector<std::pair<std::string, Var>>& captures,
+                         bool spawns, Loc head, std::optional<int64_t> low, std::optional<int64_t> high) {
+        Switch::Out out = m_output.current();
+        std::vector<Inst> funcs = std::move(m_output.get(Switch::Out::FUNCS));
+        m_output.get(Switch::Out::FUNCS).clear();
+        m_output.set(Switch::Out::FUNCS);
+
+        ScopeStack<Var> vars = std::move(m_vars);
+        m_vars = {};
+        m_vars.scopes.front() = vars.scopes.front();
+        size_t localBytes = std::exchange(m_localBytes, 0);
+        auto scopeMarks = std::exchange(m_scopeMarks, {});
+        auto heapMarks = std::exchange(m_heapMarks, {});
+        auto inductions = std::exchange(m_inductions, {});
+        size_t counterRegs = std::exchange(m_counterRegs, 0);
+        size_t stackSize = std::exchange(m_stackSize, 0);
+        auto joinSlot = std::exchange(m_joinSlot, std::nullopt);
+        std::string funcName = std::exchange(m_funcName, m_asm.labels.at(bodyLabel.id));
+
+        // the frame: the task count, the captures, lo and hi, then the loop's own
+        scopeBegin();
+        if (spawns) {
+            m_joinSlot = allocLocal(8, 8);
+        }
+        std::vector<Var> copies;
+        for (const auto& [capName, var] : captures) {
+            Var copy{ .type = var.type, .counter = var.counter };
+            if (var.isArray()) {
+                copy.heap = true;
+                copy.offset = allocLocal(24, 8);
+            }
+            else {
+                copy.offset = allocLocal(typeSize(var.type), typeSize(var.type));
+            }
+            copies.push_back(copy);
+            m_vars.insert({capName, copy});
+        }
+        // not names a program can use
+        Var lo{ .offset = allocLocal(8, 8) };
+        Var hi{ .offset = allocLocal(8, 8) };
+        m_vars.insert({" lo", lo});
+        m_vars.insert({" hi", hi});
+        size_t loopSlots = alignUp(m_localBytes + 16, 8);
+
+        m_asm.funcs.push_back(bodyLabel);
+        bind(bodyLabel);
+        loc(head);
+        emit(Op::PUSH, Reg::RBP);
+        emit(Op::MOV, Reg::RBP, Reg::RSP);
+        frameBegin(std::max(loopSlots, frameBytes(stmtFor->scope->stmts, loopSlots)));
+        if (m_joinSlot) {
+            emit(Op::MOV, qword(Reg::RBP, static_cast<int32_t>(m_joinSlot.value())), Imm{0});
+        }
+        emit(Op::MOV, varOperand(lo), Reg::RDI);
+        emit(Op::MOV, varOperand(hi), Reg::RSI);
+        int32_t at = 0;
+        for (const Var& copy : copies) {
+            emit(Op::MOV, Reg::RAX, qword(Reg::RDX, at));
+            if (copy.heap) {
+                emit(Op::MOV, heapSlot(copy, 0), Reg::RAX);
+                emit(Op::MOV, Reg::RAX, qword(Reg::RDX, at + 8));
+                emit(Op::MOV, heapSlot(copy, 1), Reg::RAX);
+                at += 16;
+            }
+            else {
+                Operand dst = varOperand(copy);
+                emit(Op::MOV, dst, regOf(Reg::RAX, dst.size));
+                at += 8;
+            }
+        }
+
+        NodeTermIdent loIdent{ .ident = {TokenType::IDENT, " lo", head.line, head.col} };
+        NodeTermIdent hiIdent{ .ident = {TokenType::IDENT, " hi", head.line, head.col} };
+        NodeTerm loTerm{ .var = &loIdent };
+        NodeTerm hiTerm{ .var = &hiIdent };
+        NodeExpr loExpr{ .var = &loTerm };
+        NodeExpr hiExpr{ .var = &hiTerm };
+        genFor(stmtFor, &loExpr, &hiExpr, low, high);
+        genJoin();
+        scopeEnd();
+        emit(Op::LEAVE);
+        emit(Op::RET);
+
+        std::vector<Inst>& code = m_output.get(Switch::Out::FUNCS);
+        m_outlined.insert(m_outlined.end(), code.begin(), code.end());
+        m_output.get(Switch::Out::FUNCS) = std::move(funcs);
+        m_output.set(out);
+
+        m_vars = std::move(vars);
+        m_localBytes = localBytes;
+        m_scopeMarks = std::move(scopeMarks);
+        m_heapMarks = std::move(heapMarks);
+        m_inductions = std::move(inductions);
+        m_counterRegs = counterRegs;
+        m_stackSize = stackSize;
+        m_joinSlot = joinSlot;
+        m_funcName = std::move(funcName);
+    }
 
     const NodeProg m_prog;
+    GenOptions m_options;
+    bool m_module = false;
+    std::vector<Remark> m_remarks;
     Switch m_output;
-    size_t m_stackSize = 0;
+    AsmProg m_asm;
+    Runtime m_runtime{m_asm, m_options.hosted};
+    std::optional<ProfileSites> m_sites; // with either profile option
+    Label m_profCounters;
+    uint64_t m_hottest = 0;
+    std::unordered_set<std::string> m_assigned;
+    std::unordered_set<std::string> m_nonCounters;
+    std::vector<Induction> m_inductions; // enclosing loop counters, innermost last
+    size_t m_counterRegs = 0; // of COUNTER_REGS, taken by the enclosing لكل
+    size_t m_stackSize = 0; // temporaries pushed above the frame
+    size_t m_localBytes = 0; // of the frame, in use by the enclosing scopes' lets
+    std::vector<size_t> m_scopeMarks; // m_localBytes as each enclosing scope began
+    std::vector<std::optional<int64_t>> m_heapMarks; // per enclosing scope, the slot of the heap's top as it began, once it allocated
     ScopeStack<Var> m_vars{};
+    std::optional<int64_t> m_joinSlot; // rbp relative, the count of the tasks the function spawned, when it spawns any
+    std::vector<Inst> m_outlined; // parallel loop bodies, functions of their own
+
+    // where a function's code and remarks went, for genUnits to take them out
+    struct Range {
+        size_t begin = 0;
+        size_t end = 0;
+    };
+    struct FuncUnit {
+        const NodeStmtFuncDecl* decl;
+        uint64_t key = 0;
+        bool reused = false;
+        Range funcs; // of the FUNCS output
+        Range cold;
+        Range outlined;
+        Range remarks;
+    };
+    std::vector<FuncUnit> m_units;
+    Reuse m_reuse;
+    std::vector<Label> m_shared; // functions and globals, what a unit may use of another's
+    size_t m_globalCount = 0;
+    size_t m_outlinedBase = 0; // where m_outlined and the COLD output start in the text
+    size_t m_coldBase = 0;     // genProg and genModule return
 
     ScopeStack<Func> m_funcs{};
-    std::vector<size_t> m_funcBaseStack;
     FuncState m_funcState = FuncState::NONE;
+    std::string m_funcName = "_start"; // what a cold arm's symbol is named after
+    Loc m_loc{0, 0};
+    Trace* m_trace = nullptr;
 
 
     size_t labelCounter = 0;
-};
\ No newline at end of file
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// 64 bit fnv-1a, fed field by field
+class Hasher {
+public:
+    Hasher& add(uint64_t val) {
+        for (int i = 0; i < 8; ++i) {
+            byte(static_cast<uint8_t>(val >> (i * 8)));
+        }
+        return *this;
+    }
+
+    Hasher& add(std::string_view str) {
+        add(str.size());
+        for (char c : str) {
+            byte(static_cast<uint8_t>(c));
+        }
+        return *this;
+    }
+
+    uint64_t value() const {
+        return m_hash;
+    }
+
+private:
+    void byte(uint8_t b) {
+        m_hash ^= b;
+        m_hash *= 0x100000001b3;
+    }
+
+    uint64_t m_hash = 0xcbf29ce484222325;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <sys/mman.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Asm.h"
+#include "Assembler.h"
+
+// what a hosted runtime links against: __dhad_jit_enter(stack top) saves the
+// compiler's callee saved registers and stack pointer, switches to the program's
+// stack and jumps to _start. __dhad_host_exit, where the runtime goes instead of
+// the exit syscall, puts them back and returns the status in rdi to the caller
+inline Object jitHostObject() {
+    AsmProg prog;
+    auto label = [&prog](const std::string& name) {
+        prog.labels.push_back(name);
+        return Label{static_cast<uint32_t>(prog.labels.size() - 1)};
+    };
+    Label enter = label("__dhad_jit_enter");
+    Label leave = label("__dhad_host_exit");
+    Label start = label("_start");
+    Label hostSp = label("__dhad_host_sp");
+
+    const Reg saved[] = {Reg::RBX, Reg::RBP, Reg::R12, Reg::R13, Reg::R14, Reg::R15};
+    auto& text = prog.text;
+
+    text.push_back({Op::LABEL, enter});
+    for (Reg reg : saved) {
+        text.push_back({Op::PUSH, reg});
+    }
+    text.push_back({Op::MOV, qword(hostSp), Reg::RSP});
+    text.push_back({Op::MOV, Reg::RSP, Reg::RDI});
+    text.push_back({Op::JMP, start});
+
+    text.push_back({Op::LABEL, leave});
+    text.push_back({Op::MOV, Reg::RSP, qword(hostSp)});
+    text.push_back({Op::MOV, Reg::RAX, Reg::RDI});
+    for (auto it = std::rbegin(saved); it != std::rend(saved); ++it) {
+        text.push_back({Op::POP, *it});
+    }
+    text.push_back({Op::RET});
+
+    prog.bss.push_back({hostSp, 1});
+    prog.entry = enter;
+    prog.globals = {enter, leave};
+    prog.externs = {start};
+    return Assembler(prog).assemble();
+}
+
+// loads a linked program into this process and runs it on a stack of its own.
+// sections get their own pages, text ends up read/execute and rodata read only
+class Jit {
+public:
+    static constexpr uint64_t STACK_SIZE = 8 * 1024 * 1024;
+
+    explicit Jit(Object obj)
+        : m_obj(std::move(obj)) {}
+
+    // the program's exit status
+    int run() {
+        layout();
+
+        auto image = static_cast<uint8_t*>(map(m_size));
+        m_base = reinterpret_cast<uint64_t>(image);
+        relocate();
+        std::memcpy(image, m_obj.text.data(), m_obj.text.size());
+        std::memcpy(image + m_rodataOff, m_obj.rodata.data(), m_obj.rodata.size());
+        std::memcpy(image + m_dataOff, m_obj.data.data(), m_obj.data.size());
+        protect(image, m_rodataOff, PROT_READ | PROT_EXEC);
+        protect(image + m_rodataOff, m_dataOff - m_rodataOff, PROT_READ);
+
+        // the lowest page stays unmapped so running off the stack faults
+        auto stack = static_cast<uint8_t*>(map(STACK_SIZE + PAGE));
+        protect(stack, PAGE, PROT_NONE);
+
+        using Enter = int64_t (*)(uint8_t* stackTop);
+        auto enter = reinterpret_cast<Enter>(m_base + symbolOffset("__dhad_jit_enter"));
+        int64_t status = enter(stack + STACK_SIZE + PAGE);
+
+        munmap(stack, STACK_SIZE + PAGE);
+        munmap(image, m_size);
+        return static_cast<int>(status & 0xFF);
+    }
+
+private:
+    static constexpr uint64_t PAGE = 0x1000;
+
+    void layout() {
+        m_rodataOff = alignUp(m_obj.text.size(), PAGE);
+        m_dataOff = alignUp(m_rodataOff + m_obj.rodata.size(), PAGE);
+        m_bssOff = m_dataOff + alignUp(m_obj.data.size(), 8);
+        m_size = alignUp(m_bssOff + m_obj.bssSize, PAGE);
+    }
+
+    void relocate() {
+        for (const Reloc& rel : m_obj.relocs) {
+            int64_t val = static_cast<int64_t>(offset(m_obj.symbols.at(rel.symbol))) + rel.addend - static_cast<int64_t>(rel.offset);
+            auto v = static_cast<uint32_t>(val);
+            for (int i = 0; i < 4; ++i) {
+                m_obj.text.at(rel.offset + i) = static_cast<uint8_t>(v >> (i * 8));
+            }
+        }
+    }
+
+    // from the start of the image
+    uint64_t offset(const Symbol& sym) const {
+        switch (sym.section) {
+            case SectionId::TEXT:   return sym.offset;
+            case SectionId::RODATA: return m_rodataOff + sym.offset;
+            case SectionId::DATA:   return m_dataOff + sym.offset;
+            case SectionId::BSS:    return m_bssOff + sym.offset;
+            case SectionId::EXTERN: break;
+        }
+        return 0;
+    }
+
+    uint64_t symbolOffset(const std::string& name) const {
+        for (const Symbol& sym : m_obj.symbols) {
+            if (sym.global && sym.name == name) {
+                return offset(sym);
+            }
+        }
+        std::cerr << "Undefined symbol: " << name << "\n";
+        exit(1);
+    }
+
+    static void* map(uint64_t size) {
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            std::cerr << "Failed to map " << size << " bytes\n";
+            exit(1);
+        }
+        return mem;
+    }
+
+    static void protect(void* mem, uint64_t size, int prot) {
+        if (size > 0 && mprotect(mem, size, prot) != 0) {
+            std::cerr << "Failed to protect the program's memory\n";
+            exit(1);
+        }
+    }
+
+    static uint64_t alignUp(uint64_t val, uint64_t to) {
+        return (val + to - 1) & ~(to - 1);
+    }
+
+private:
+    Object m_obj;
+    uint64_t m_base = 0;
+    uint64_t m_rodataOff = 0;
+    uint64_t m_dataOff = 0;
+    uint64_t m_bssOff = 0;
+    uint64_t m_size = 0;
+};
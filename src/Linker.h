@@ -0,0 +1,116 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Assembler.h"
+
+// merges the objects of every module into a single one for ElfWriter. sections are
+// concatenated in order and EXTERN symbols resolve, by name, to the global
+// one another object binds. the first object supplies the entry point
+class Linker {
+public:
+    explicit Linker(std::vector<Object> objects)
+        : m_objects(std::move(objects)) {}
+
+    [[nodiscard]] Object link() {
+
+        std::vector<std::vector<uint32_t>> symbolMap(m_objects.size());
+        std::unordered_map<std::string, uint32_t> globals;
+
+        for (size_t i = 0; i < m_objects.size(); ++i) {
+            Object& obj = m_objects[i];
+
+            // functions start on 16 bytes like within a module, int3 in between
+            m_out.text.resize(alignUp(m_out.text.size(), 16), 0xCC);
+            m_out.rodata.resize(alignUp(m_out.rodata.size(), 8), 0);
+            m_out.data.resize(alignUp(m_out.data.size(), 8), 0);
+
+            uint64_t bases[] = { m_out.text.size(), m_out.rodata.size(), m_out.data.size(), m_out.bssSize, 0 };
+            m_out.text.insert(m_out.text.end(), obj.text.begin(), obj.text.end());
+            m_out.rodata.insert(m_out.rodata.end(), obj.rodata.begin(), obj.rodata.end());
+            m_out.data.insert(m_out.data.end(), obj.data.begin(), obj.data.end());
+            m_out.bssSize += alignUp(obj.bssSize, 8);
+
+            for (const Symbol& sym : obj.symbols) {
+                if (sym.section == SectionId::EXTERN) {
+                    symbolMap[i].push_back(UNRESOLVED);
+                    continue;
+                }
+
+                auto idx = static_cast<uint32_t>(m_out.symbols.size());
+                m_out.symbols.push_back(sym);
+                m_out.symbols.back().offset += bases[static_cast<size_t>(sym.section)];
+                symbolMap[i].push_back(idx);
+
+                if (sym.global && !globals.insert({sym.name, idx}).second) {
+                    std::cerr << "Duplicate symbol: " << sym.name << "\n";
+                    exit(1);
+                }
+            }
+
+            for (Reloc rel : obj.relocs) {
+                rel.offset += bases[0];
+                m_pending.push_back({i, rel});
+            }
+
+            // a module comes in one object per function, its units join back into one
+            for (DebugUnit unit : obj.debug) {
+                unit.begin += bases[0];
+                unit.end += bases[0];
+                for (LineRow& row : unit.rows) {
+                    row.offset += bases[0];
+                }
+                if (!m_out.debug.empty() && m_out.debug.back().file == unit.file &&
+                    m_out.debug.back().end <= unit.begin && unit.begin - m_out.debug.back().end < 16) {
+                    DebugUnit& last = m_out.debug.back();
+                    last.end = unit.end;
+                    last.rows.insert(last.rows.end(), unit.rows.begin(), unit.rows.end());
+                    continue;
+                }
+                m_out.debug.push_back(std::move(unit));
+            }
+        }
+
+        for (size_t i = 0; i < m_objects.size(); ++i) {
+            const auto& symbols = m_objects[i].symbols;
+            for (size_t s = 0; s < symbols.size(); ++s) {
+                if (symbolMap[i][s] != UNRESOLVED) {
+                    continue;
+                }
+                auto it = globals.find(symbols[s].name);
+                if (it == globals.end()) {
+                    std::cerr << "Undefined symbol: " << symbols[s].name << "\n";
+                    exit(1);
+                }
+                symbolMap[i][s] = it->second;
+            }
+        }
+
+        for (const auto& [obj, rel] : m_pending) {
+            m_out.relocs.push_back({rel.offset, symbolMap[obj].at(rel.symbol), rel.addend});
+        }
+
+        m_out.entry = symbolMap.at(0).at(m_objects.at(0).entry);
+        return std::move(m_out);
+    }
+
+private:
+    static constexpr uint32_t UNRESOLVED = UINT32_MAX;
+
+    struct Pending {
+        size_t object;
+        Reloc rel;
+    };
+
+    static uint64_t alignUp(uint64_t val, uint64_t to) {
+        return (val + to - 1) & ~(to - 1);
+    }
+
+private:
+    std::vector<Object> m_objects;
+    std::vector<Pending> m_pending;
+    Object m_out;
+};
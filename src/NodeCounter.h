@@ -0,0 +1,118 @@
+#pragma once
+
+#include <variant>
+#include <vector>
+
+#include "Parser.h"
+
+// ast size: every statement and every expression
+class NodeCounter {
+public:
+    size_t count(const NodeProg& prog) {
+        m_nodes = 0;
+        stmts(prog.stmts);
+        return m_nodes;
+    }
+
+    size_t count(const NodeScope* scope) {
+        m_nodes = 0;
+        stmts(scope->stmts);
+        return m_nodes;
+    }
+
+private:
+    void stmts(const std::vector<NodeStmt*>& list) {
+        for (const NodeStmt* stmt : list) {
+            ++m_nodes;
+            std::visit(StmtVisitor{this}, stmt->var);
+        }
+    }
+
+    void expr(const NodeExpr* node) {
+        ++m_nodes;
+        if (auto term = std::get_if<NodeTerm*>(&node->var)) {
+            std::visit(TermVisitor{this}, (*term)->var);
+            return;
+        }
+        std::visit([this](const auto* bin) {
+            expr(bin->lhs);
+            expr(bin->rhs);
+        }, std::get<BinExpr*>(node->var)->var);
+    }
+
+    struct TermVisitor {
+        NodeCounter* counter;
+
+        void operator()(const NodeTermIntLit*) {}
+        void operator()(const NodeTermIdent*) {}
+        void operator()(const NodeTermRead*) {}
+        void operator()(const NodeTermParen* paren) { counter->expr(paren->expr); }
+        void operator()(const NodeTermIndex* index) { counter->expr(index->index); }
+        void operator()(const NodeTermCast* cast) { counter->expr(cast->expr); }
+        void operator()(const NodeTermNot* termNot) { counter->expr(termNot->expr); }
+        void operator()(const NodeTermFuncCall* call) {
+            for (const NodeExpr* arg : call->args) {
+                counter->expr(arg);
+            }
+        }
+    };
+
+    struct StmtVisitor {
+        NodeCounter* counter;
+
+        void operator()(const NodeStmtExit* stmt) { counter->expr(stmt->expr); }
+        void operator()(const NodeStmtPrint* stmt) { counter->expr(stmt->expr); }
+        void operator()(const NodeStmtLet* stmt) { counter->expr(stmt->expr); }
+        void operator()(const NodeStmtAssign* stmt) { counter->expr(stmt->expr); }
+        void operator()(const NodeStmtLetArray* stmt) {
+            if (stmt->count) {
+                counter->expr(stmt->count);
+            }
+        }
+        void operator()(const NodeStmtImport*) {}
+        void operator()(const NodeScope* scope) { counter->stmts(scope->stmts); }
+        void operator()(const NodeStmtWhile* stmt) {
+            counter->expr(stmt->expr);
+            counter->stmts(stmt->scope->stmts);
+        }
+        void operator()(const NodeStmtFor* stmt) {
+            counter->expr(stmt->from);
+            counter->expr(stmt->to);
+            counter->stmts(stmt->scope->stmts);
+        }
+        void operator()(const NodeStmtSpawn* stmt) {
+            for (const NodeExpr* arg : stmt->call->args) {
+                counter->expr(arg);
+            }
+        }
+        void operator()(const NodeStmtJoin*) {}
+        void operator()(const NodeStmtFuncDecl* stmt) { counter->stmts(stmt->scope->stmts); }
+        void operator()(const NodeStmtReturn* stmt) {
+            if (stmt->expr) {
+                counter->expr(stmt->expr.value());
+            }
+        }
+        void operator()(const NodeStmtIndexAssign* stmt) {
+            counter->expr(stmt->index);
+            counter->expr(stmt->expr);
+        }
+        void operator()(const NodeStmtIf* stmt) {
+            counter->expr(stmt->expr);
+            counter->stmts(stmt->scope->stmts);
+            std::optional<NodeIfPred*> pred = stmt->pred;
+            while (pred.has_value()) {
+                if (auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+                    counter->expr((*predElif)->expr);
+                    counter->stmts((*predElif)->scope->stmts);
+                    pred = (*predElif)->pred;
+                }
+                else {
+                    counter->stmts(std::get<NodeIfPredElse*>(pred.value()->var)->scope->stmts);
+                    pred = {};
+                }
+            }
+        }
+    };
+
+    size_t m_nodes = 0;
+};
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Assembler.h"
+#include "Generator.h"
+#include "Hasher.h"
+
+// what compiling a module, or one function of it, produced: enough to link it and
+// report on it again. a module's objects are its units, see Generator::genUnits
+struct CachedModule {
+    std::vector<Object> objects;
+    std::vector<Remark> remarks;
+};
+
+// a function's entry holds its lines counted from its name's, so it still fits
+// once lines above it come or go
+inline void shiftLines(CachedModule& cached, int64_t by) {
+    for (Object& obj : cached.objects) {
+        for (DebugUnit& unit : obj.debug) {
+            for (LineRow& row : unit.rows) {
+                if (row.line != 0) {
+                    row.line = static_cast<uint32_t>(row.line + by);
+                }
+            }
+        }
+    }
+    for (Remark& remark : cached.remarks) {
+        remark.line = static_cast<size_t>(static_cast<int64_t>(remark.line) + by);
+    }
+}
+
+// one file per module in dir, and one per function of it, named after the module's
+// path and the function's name and holding the key it was compiled under. a
+// different key, or anything unreadable, is a miss
+class ObjectCache {
+public:
+    // bumped whenever codegen changes what an unchanged source compiles to
+    static constexpr uint64_t VERSION = 5;
+
+    explicit ObjectCache(std::filesystem::path dir)
+        : m_dir(std::move(dir)) {}
+
+    // the compiler binary itself is part of every key
+    static uint64_t buildId() {
+        return Hasher().add(VERSION).add(__DATE__ " " __TIME__).value();
+    }
+
+    // func names the function's entry, empty the whole module's
+    std::optional<CachedModule> load(const std::filesystem::path& module, std::string_view func, uint64_t key) const {
+        std::ifstream in(entry(module, func), std::ios::binary);
+        if (!in) {
+            return {};
+        }
+        Reader r{std::string(std::istreambuf_iterator<char>(in), {})};
+
+        if (r.u64() != MAGIC || r.u64() != key) {
+            return {};
+        }
+
+        CachedModule cached = r.cached();
+        if (!r.ok || r.pos != r.buf.size()) {
+            return {};
+        }
+        return cached;
+    }
+
+    // written aside and renamed into place, so readers never see half an entry
+    void store(const std::filesystem::path& module, std::string_view func, uint64_t key, const CachedModule& cached) const {
+        Writer w;
+        w.u64(MAGIC);
+        w.u64(key);
+        w.cached(cached);
+
+        std::error_code ec;
+        std::filesystem::create_directories(m_dir, ec);
+
+        std::filesystem::path path = entry(module, func);
+        // unique to this process and thread: two dhads' main threads have the same id
+        std::ostringstream tmpName;
+        tmpName << path.string() << ".tmp" << getpid() << "." << std::this_thread::get_id();
+        std::filesystem::path tmp = tmpName.str();
+        {
+            std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+            if (!file.write(w.out.data(), static_cast<std::streamsize>(w.out.size()))) {
+                return;
+            }
+        }
+        std::filesystem::rename(tmp, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+        }
+    }
+
+    // an entry's encoding, little endian u64s and length prefixed strings, which
+    // the compile server also sends its builds' objects in
+    struct Writer {
+        std::string out;
+
+        void u64(uint64_t val) {
+            for (int i = 0; i < 8; ++i) {
+                out.push_back(static_cast<char>(val >> (i * 8)));
+            }
+        }
+
+        void str(std::string_view s) {
+            u64(s.size());
+            out.append(s);
+        }
+
+        void bytes(const std::vector<uint8_t>& b) {
+            str(std::string_view(reinterpret_cast<const char*>(b.data()), b.size()));
+        }
+
+        void object(const Object& obj) {
+            bytes(obj.text);
+            bytes(obj.rodata);
+            bytes(obj.data);
+            u64(obj.bssSize);
+            u64(obj.entry);
+            u64(obj.symbols.size());
+            for (const Symbol& sym : obj.symbols) {
+                str(sym.name);
+                u64(static_cast<uint64_t>(sym.section));
+                u64(sym.offset);
+                u64(sym.global);
+                u64(sym.func);
+                u64(sym.size);
+            }
+            u64(obj.relocs.size());
+            for (const Reloc& rel : obj.relocs) {
+                u64(rel.offset);
+                u64(rel.symbol);
+                u64(static_cast<uint64_t>(rel.addend));
+            }
+            u64(obj.debug.size());
+            for (const DebugUnit& unit : obj.debug) {
+                str(unit.file);
+                u64(unit.begin);
+                u64(unit.end);
+                u64(unit.rows.size());
+                for (const LineRow& row : unit.rows) {
+                    u64(row.offset);
+                    u64(row.line);
+                    u64(row.col);
+                }
+            }
+        }
+
+        void cached(const CachedModule& cached) {
+            u64(cached.objects.size());
+            for (const Object& obj : cached.objects) {
+                object(obj);
+            }
+            u64(cached.remarks.size());
+            for (const Remark& remark : cached.remarks) {
+                u64(remark.line);
+                str(remark.msg);
+            }
+        }
+    };
+
+    // what Writer wrote. reading past the end clears ok
+    struct Reader {
+        std::string buf;
+        size_t pos = 0;
+        bool ok = true;
+
+        uint64_t u64() {
+            if (buf.size() - pos < 8) {
+                ok = false;
+                return 0;
+            }
+            uint64_t val = 0;
+            for (int i = 0; i < 8; ++i) {
+                val |= static_cast<uint64_t>(static_cast<uint8_t>(buf[pos++])) << (i * 8);
+            }
+            return val;
+        }
+
+        std::string str() {
+            uint64_t len = u64();
+            if (!ok || buf.size() - pos < len) {
+                ok = false;
+                return {};
+            }
+            std::string s = buf.substr(pos, len);
+            pos += len;
+            return s;
+        }
+
+        std::vector<uint8_t> bytes() {
+            std::string s = str();
+            return {s.begin(), s.end()};
+        }
+
+        Object object() {
+            Object obj;
+            obj.text = bytes();
+            obj.rodata = bytes();
+            obj.data = bytes();
+            obj.bssSize = u64();
+            obj.entry = static_cast<uint32_t>(u64());
+
+            for (uint64_t n = u64(); n > 0 && ok; --n) {
+                Symbol sym;
+                sym.name = str();
+                sym.section = static_cast<SectionId>(u64());
+                sym.offset = u64();
+                sym.global = u64() != 0;
+                sym.func = u64() != 0;
+                sym.size = u64();
+                obj.symbols.push_back(std::move(sym));
+            }
+            for (uint64_t n = u64(); n > 0 && ok; --n) {
+                Reloc rel;
+                rel.offset = u64();
+                rel.symbol = static_cast<uint32_t>(u64());
+                rel.addend = static_cast<int64_t>(u64());
+                obj.relocs.push_back(rel);
+            }
+            for (uint64_t n = u64(); n > 0 && ok; --n) {
+                DebugUnit unit;
+                unit.file = str();
+                unit.begin = u64();
+                unit.end = u64();
+                for (uint64_t rows = u64(); rows > 0 && ok; --rows) {
+                    LineRow row;
+                    row.offset = u64();
+                    row.line = static_cast<uint32_t>(u64());
+                    row.col = static_cast<uint32_t>(u64());
+                    unit.rows.push_back(row);
+                }
+                obj.debug.push_back(std::move(unit));
+            }
+            return obj;
+        }
+
+        CachedModule cached() {
+            CachedModule cached;
+            for (uint64_t n = u64(); n > 0 && ok; --n) {
+                cached.objects.push_back(object());
+            }
+            for (uint64_t n = u64(); n > 0 && ok; --n) {
+                Remark remark;
+                remark.line = u64();
+                remark.msg = str();
+                cached.remarks.push_back(std::move(remark));
+            }
+            return cached;
+        }
+    };
+
+private:
+    static constexpr uint64_t MAGIC = 0x3330686361636864; // "dhcach03"
+
+    std::filesystem::path entry(const std::filesystem::path& module, std::string_view func) const {
+        auto name = Hasher().add(std::filesystem::weakly_canonical(module).string()).add(func).value();
+        std::ostringstream file;
+        file << std::hex << name << ".obj";
+        return m_dir / file.str();
+    }
+
+private:
+    std::filesystem::path m_dir;
+};
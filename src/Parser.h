@@ -1,22 +1,26 @@
 #pragma once
 
 #include <optional>
+#include <span>
 #include <variant>
 
 #include "Tokenizer.h"
 #include "ArenaAlloc.h"
+#include "Types.h"
 #include <iostream>
 
 struct NodeScope;
 struct NodeExpr;
 struct NodeFuncParam {
     Token ident;
+    IntType type = IntType::I64;
 };
 
 struct NodeStmtFuncDecl {
     Token ident;
     std::vector<NodeFuncParam*> params;
     NodeScope* scope;
+    std::span<const Token> tokens; // from its name to its closing brace, the parser's
 };
 
 struct NodeTermFuncCall {
@@ -41,14 +45,38 @@ struct NodeTermParen {
     NodeExpr* expr;
 };
 
+struct NodeTermIndex {
+    Token ident;
+    NodeExpr* index;
+};
+
+struct NodeTermRead {
+};
+
+// i32(expr), wraps or extends to type
+struct NodeTermCast {
+    IntType type;
+    NodeExpr* expr;
+};
+
+// !expr, 1 when expr is 0 and 0 otherwise
+struct NodeTermNot {
+    NodeExpr* expr;
+};
+
 struct NodeTerm {
-    std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParen*, NodeTermFuncCall*> var;
+    std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParen*, NodeTermFuncCall*, NodeTermRead*, NodeTermIndex*, NodeTermCast*,
+                 NodeTermNot*> var;
 };
 
 
 struct BinExpr;
 struct NodeExpr {
     std::variant<NodeTerm*, BinExpr*> var;
+    // set by TypeChecker: what the expression computes, and what its user reads
+    // it as, wider where an implicit conversion applies
+    IntType type = IntType::I64;
+    IntType usedAs = IntType::I64;
 };
 
 struct BinExprAdd {
@@ -96,18 +124,48 @@ struct BinExprLsThan {
     NodeExpr* rhs;
 };
 
+// && and ||: 0 or 1, rhs only runs when lhs doesn't decide the result
+struct BinExprAnd {
+    NodeExpr* lhs;
+    NodeExpr* rhs;
+};
+
+struct BinExprOr {
+    NodeExpr* lhs;
+    NodeExpr* rhs;
+};
+
 struct BinExpr {
     std::variant<BinExprAdd*, BinExprSub*, BinExprDiv*, BinExprMult*, BinExprMod*,
-     BinExprEqTo*, BinExprNotEqTo*, BinExprGrThan*, BinExprLsThan*> var;
+     BinExprEqTo*, BinExprNotEqTo*, BinExprGrThan*, BinExprLsThan*, BinExprAnd*, BinExprOr*> var;
 };
 
 struct NodeStmtExit {
     NodeExpr* expr;
 };
 
+struct NodeStmtPrint {
+    NodeExpr* expr;
+};
+
 struct NodeStmtLet {
     Token ident;
     NodeExpr* expr;
+    IntType type = IntType::I64;
+};
+
+// zero initialized, size is an integer literal. any other expression is the
+// count, computed when the statement runs
+struct NodeStmtLetArray {
+    Token ident;
+    Token size;
+    IntType type = IntType::I64; // of the elements
+    NodeExpr* count = nullptr;
+};
+
+// names <module>.dhad next to the importing file
+struct NodeStmtImport {
+    Token module;
 };
 
 struct NodeStmt;
@@ -120,6 +178,8 @@ struct NodeIfPredElif {
     NodeExpr* expr;
     NodeScope* scope;
     std::optional<NodeIfPred*> pred;
+    size_t line;
+    size_t col;
 };
 
 struct NodeIfPredElse {
@@ -134,6 +194,7 @@ struct NodeStmtIf {
     NodeExpr* expr;
     NodeScope* scope;
     std::optional<NodeIfPred*> pred;
+    size_t line;
 };
 
 struct NodeStmtAssign {
@@ -141,13 +202,44 @@ struct NodeStmtAssign {
     NodeExpr* expr;
 };
 
+struct NodeStmtIndexAssign {
+    Token ident;
+    NodeExpr* index;
+    NodeExpr* expr;
+};
+
 struct NodeStmtWhile {
     NodeExpr* expr;
     NodeScope* scope;
 };
 
+// لكل i من from الى to: i takes from, from + 1, ... up to but not including to.
+// both ends are i64 and computed once, before the first iteration. بالتوازي
+// after to spreads the iterations over the program's threads
+struct NodeStmtFor {
+    Token ident;
+    NodeExpr* from;
+    NodeExpr* to;
+    NodeScope* scope;
+    bool parallel = false;
+};
+
+// شغل f(args): the call may run on another thread, its result is dropped. its
+// arguments travel in the runtime's task record, which holds this many
+inline constexpr size_t MAX_SPAWN_ARGS = 4;
+
+struct NodeStmtSpawn {
+    NodeTermFuncCall* call;
+};
+
+// انتظر: until every call the function (or the top level) spawned has returned
+struct NodeStmtJoin {};
+
 struct NodeStmt {
-    std::variant<NodeStmtExit*, NodeStmtLet*, NodeScope*, NodeStmtIf*, NodeStmtAssign*, NodeStmtWhile*, NodeStmtFuncDecl*, NodeStmtReturn*> var;
+    std::variant<NodeStmtExit*, NodeStmtLet*, NodeScope*, NodeStmtIf*, NodeStmtAssign*, NodeStmtWhile*, NodeStmtFuncDecl*, NodeStmtReturn*,
+     NodeStmtPrint*, NodeStmtLetArray*, NodeStmtIndexAssign*, NodeStmtImport*, NodeStmtFor*, NodeStmtSpawn*, NodeStmtJoin*> var;
+    size_t line = 0; // of the statement's first token
+    size_t col = 0;
 };
 
 struct NodeProg {
@@ -173,6 +265,15 @@ public:
             return term;
         }
 
+        else if (tryConsume(TokenType::READ)) {
+            tryConsumeErr(TokenType::OPEN_PAREN, "Expected '('");
+            tryConsumeErr(TokenType::CLOSE_PAREN, "Expected ')'");
+
+            auto term = m_allocator.alloc<NodeTerm>();
+            term->var = m_allocator.alloc<NodeTermRead>();
+            return term;
+        }
+
         else if (tryConsume(TokenType::OPEN_PAREN)) {
             auto expr = parseExpr();
             if (!expr) {
@@ -190,9 +291,44 @@ public:
             return term;
         }
 
+        else if (tryConsume(TokenType::BANG)) {
+            auto termNot = m_allocator.alloc<NodeTermNot>();
+            if (auto operand = parseTerm()) {
+                auto expr = m_allocator.alloc<NodeExpr>();
+                expr->var = operand.value();
+                termNot->expr = expr;
+            }
+            else {
+                std::cerr << "Invalid Expression\n";
+                exit(1);
+            }
+
+            auto term = m_allocator.alloc<NodeTerm>();
+            term->var = termNot;
+            return term;
+        }
+
         else if (peek().has_value() && peek().value().type == TokenType::IDENT && 
                  peek(1).has_value() && peek(1).value().type == TokenType::OPEN_PAREN) {
 
+            if (auto type = parseIntType(peek()->val)) {
+                consume(); consume(); // '('
+                auto termCast = m_allocator.alloc<NodeTermCast>();
+                termCast->type = type.value();
+                if (auto expr = parseExpr()) {
+                    termCast->expr = expr.value();
+                }
+                else {
+                    std::cerr << "Invalid Expression\n";
+                    exit(1);
+                }
+                tryConsumeErr(TokenType::CLOSE_PAREN, "Expected ')'");
+
+                auto term = m_allocator.alloc<NodeTerm>();
+                term->var = termCast;
+                return term;
+            }
+
             auto funcCall = m_allocator.alloc<NodeTermFuncCall>();
             funcCall->ident = consume(); consume(); // '('
 
@@ -218,6 +354,26 @@ public:
             return term;
         }
 
+        else if (peek().has_value() && peek().value().type == TokenType::IDENT &&
+                 peek(1).has_value() && peek(1).value().type == TokenType::OPEN_BRACKET) {
+
+            auto termIndex = m_allocator.alloc<NodeTermIndex>();
+            termIndex->ident = consume(); consume(); // '['
+
+            if (auto expr = parseExpr()) {
+                termIndex->index = expr.value();
+            }
+            else {
+                std::cerr << "Invalid Expression\n";
+                exit(1);
+            }
+            tryConsumeErr(TokenType::CLOSE_BRACKET, "Expected ']'");
+
+            auto term = m_allocator.alloc<NodeTerm>();
+            term->var = termIndex;
+            return term;
+        }
+
         else if (auto ident = tryConsume(TokenType::IDENT)) {
             NodeTermIdent* termIdent = m_allocator.alloc<NodeTermIdent>();
             termIdent->ident = ident.value();
@@ -305,6 +461,18 @@ public:
                 exprLsThan->rhs = rhs.value();
                 binExpr->var = exprLsThan;
             }
+            else if (op.type == TokenType::AMP_AMP) {
+                auto exprAnd = m_allocator.alloc<BinExprAnd>();
+                exprAnd->lhs = lhs;
+                exprAnd->rhs = rhs.value();
+                binExpr->var = exprAnd;
+            }
+            else if (op.type == TokenType::PIPE_PIPE) {
+                auto exprOr = m_allocator.alloc<BinExprOr>();
+                exprOr->lhs = lhs;
+                exprOr->rhs = rhs.value();
+                binExpr->var = exprOr;
+            }
             
             expr->var = binExpr;
             lhs = expr;
@@ -338,6 +506,16 @@ public:
     }
 
     std::optional<NodeStmt*> parseStmt() {
+        std::optional<Token> first = peek();
+        auto stmt = parseStmtBody();
+        if (stmt) {
+            stmt.value()->line = first->line;
+            stmt.value()->col = first->col;
+        }
+        return stmt;
+    }
+
+    std::optional<NodeStmt*> parseStmtBody() {
 
         if (tryConsume(TokenType::EXIT)) {
             
@@ -362,12 +540,72 @@ public:
             return stmt;
         }
 
-        else if (tryConsume(TokenType::LET)) {
+        else if (tryConsume(TokenType::IMPORT)) {
 
-            NodeStmtLet* stmtLet = m_allocator.alloc<NodeStmtLet>();
+            NodeStmtImport* stmtImport = m_allocator.alloc<NodeStmtImport>();
+            stmtImport->module = tryConsumeErr(TokenType::IDENT, "Expected module name").value();
+
+            tryConsumeErr(TokenType::SEMI, "Expected ';'");
+
+            NodeStmt* stmt = m_allocator.alloc<NodeStmt>();
+            stmt->var = stmtImport;
+            return stmt;
+        }
+
+        else if (tryConsume(TokenType::PRINT)) {
+
+            NodeStmtPrint* stmtPrint = m_allocator.alloc<NodeStmtPrint>();
+
+            tryConsumeErr(TokenType::OPEN_PAREN, "Expected '('");
+
+            if (auto expr = parseExpr()) {
+                stmtPrint->expr = expr.value();
+            }
+            else {
+                std::cerr << "Invalid expression" << std::endl;
+                exit(1);
+            }
+
+            tryConsumeErr(TokenType::CLOSE_PAREN, "Expected ')'");
+
+            tryConsumeErr(TokenType::SEMI, "Expected ';'");
+
+            NodeStmt* stmt = m_allocator.alloc<NodeStmt>();
+            stmt->var = stmtPrint;
+            return stmt;
+        }
+
+        else if (tryConsume(TokenType::LET)) {
 
             auto ident = tryConsumeErr(TokenType::IDENT, "Expected an identifier");
+
+            if (tryConsume(TokenType::OPEN_BRACKET)) {
+                auto letArray = m_allocator.alloc<NodeStmtLetArray>();
+                letArray->ident = ident.value();
+                if (peek().has_value() && peek().value().type == TokenType::INT_LIT &&
+                    peek(1).has_value() && peek(1).value().type == TokenType::CLOSE_BRACKET) {
+                    letArray->size = consume();
+                }
+                else if (auto count = parseExpr()) {
+                    letArray->count = count.value();
+                }
+                else {
+                    std::cerr << "Expected array size" << std::endl;
+                    exit(1);
+                }
+
+                tryConsumeErr(TokenType::CLOSE_BRACKET, "Expected ']'");
+                letArray->type = parseAnnotation();
+                tryConsumeErr(TokenType::SEMI, "Expected ';'");
+
+                NodeStmt* stmt = m_allocator.alloc<NodeStmt>();
+                stmt->var = letArray;
+                return stmt;
+            }
+
+            NodeStmtLet* stmtLet = m_allocator.alloc<NodeStmtLet>();
             stmtLet->ident = ident.value();
+            stmtLet->type = parseAnnotation();
 
             tryConsumeErr(TokenType::EQUAL, "Expected '='");
 
@@ -403,16 +641,52 @@ public:
             return stmt;
         }
 
+        else if (peek().has_value() && peek().value().type == TokenType::IDENT &&
+                 peek(1).has_value() && peek(1).value().type == TokenType::OPEN_BRACKET) {
+
+            auto indexAssign = m_allocator.alloc<NodeStmtIndexAssign>();
+            indexAssign->ident = consume(); consume(); // '['
+
+            if (auto index = parseExpr()) {
+                indexAssign->index = index.value();
+            }
+            else {
+                std::cerr << "Invalid Expression\n";
+                exit(1);
+            }
+            tryConsumeErr(TokenType::CLOSE_BRACKET, "Expected ']'");
+            tryConsumeErr(TokenType::EQUAL, "Expected '='");
+
+            if (auto expr = parseExpr()) {
+                indexAssign->expr = expr.value();
+            }
+            else {
+                std::cerr << "Invalid Expression\n";
+                exit(1);
+            }
+            tryConsumeErr(TokenType::SEMI, "Expected ';'");
+
+            NodeStmt* stmt = m_allocator.alloc<NodeStmt>();
+            stmt->var = indexAssign;
+            return stmt;
+        }
+
         else if (peek().has_value() && peek().value().type == TokenType::IDENT && 
                  peek(1).has_value() && peek(1).value().type == TokenType::OPEN_PAREN) {
 
             auto funcDecl = m_allocator.alloc<NodeStmtFuncDecl>();
+            size_t first = m_pos;
             funcDecl->ident = consume(); consume(); // '('
+            if (parseIntType(funcDecl->ident.val)) {
+                std::cerr << "Function named after a type: " << funcDecl->ident.val << "\n";
+                exit(1);
+            }
 
             while (peek().has_value() && peek().value().type != TokenType::CLOSE_PAREN) {
                 auto funcParam = m_allocator.alloc<NodeFuncParam>();
 
                 funcParam->ident = tryConsumeErr(TokenType::IDENT, "Expected identifier").value();
+                funcParam->type = parseAnnotation();
                 if (peek().has_value() && peek().value().type != TokenType::CLOSE_PAREN) {
                     tryConsumeErr(TokenType::COMMA, "Expected ','");
                 }
@@ -428,6 +702,7 @@ public:
                 std::cerr << "Invalid scope\n";
                 exit(1);
             }
+            funcDecl->tokens = std::span<const Token>(m_tokens).subspan(first, m_pos - first);
 
             NodeStmt* stmt = m_allocator.alloc<NodeStmt>();
             stmt->var = funcDecl;
@@ -448,9 +723,10 @@ public:
             }
         }
 
-        else if (tryConsume(TokenType::IF_)) {
+        else if (auto ifToken = tryConsume(TokenType::IF_)) {
             
             NodeStmtIf* stmtIf = m_allocator.alloc<NodeStmtIf>();
+            stmtIf->line = ifToken->line;
 
             tryConsumeErr(TokenType::OPEN_PAREN, "Expected '('");
             
@@ -508,6 +784,69 @@ public:
             return stmt;
         }
 
+        else if (tryConsume(TokenType::FOR)) {
+
+            auto stmtFor = m_allocator.alloc<NodeStmtFor>();
+            stmtFor->ident = tryConsumeErr(TokenType::IDENT, "Expected identifier").value();
+            tryConsumeErr(TokenType::FROM, "Expected 'من'");
+
+            if (auto from = parseExpr()) {
+                stmtFor->from = from.value();
+            }
+            else {
+                std::cerr << "Invalid Expression" << std::endl;
+                exit(1);
+            }
+
+            tryConsumeErr(TokenType::TO, "Expected 'الى'");
+
+            if (auto to = parseExpr()) {
+                stmtFor->to = to.value();
+            }
+            else {
+                std::cerr << "Invalid Expression" << std::endl;
+                exit(1);
+            }
+            stmtFor->parallel = tryConsume(TokenType::PARALLEL).has_value();
+
+            if (auto scope = parseScope()) {
+                stmtFor->scope = scope.value();
+            }
+            else {
+                std::cerr << "Invalid Scope" << std::endl;
+                exit(1);
+            }
+
+            NodeStmt* stmt = m_allocator.alloc<NodeStmt>();
+            stmt->var = stmtFor;
+            return stmt;
+        }
+
+        else if (tryConsume(TokenType::SPAWN)) {
+            auto stmtSpawn = m_allocator.alloc<NodeStmtSpawn>();
+
+            auto term = parseTerm();
+            auto funcCall = term ? std::get_if<NodeTermFuncCall*>(&term.value()->var) : nullptr;
+            if (!funcCall) {
+                std::cerr << "Expected a function call after 'شغل'" << std::endl;
+                exit(1);
+            }
+            stmtSpawn->call = *funcCall;
+            tryConsumeErr(TokenType::SEMI, "Expected ';'");
+
+            NodeStmt* stmt = m_allocator.alloc<NodeStmt>();
+            stmt->var = stmtSpawn;
+            return stmt;
+        }
+
+        else if (tryConsume(TokenType::JOIN)) {
+            tryConsumeErr(TokenType::SEMI, "Expected ';'");
+
+            NodeStmt* stmt = m_allocator.alloc<NodeStmt>();
+            stmt->var = m_allocator.alloc<NodeStmtJoin>();
+            return stmt;
+        }
+
         else if (tryConsume(TokenType::RETURN)) {
             auto stmtRet = m_allocator.alloc<NodeStmtReturn>();
 
@@ -530,9 +869,11 @@ public:
 
     std::optional<NodeIfPred*> parseIfPred() {
 
-        if (tryConsume(TokenType::ELIF)) {
+        if (auto elifToken = tryConsume(TokenType::ELIF)) {
             
             auto ifPredElif = m_allocator.alloc<NodeIfPredElif>();
+            ifPredElif->line = elifToken->line;
+            ifPredElif->col = elifToken->col;
             
             tryConsumeErr(TokenType::OPEN_PAREN, "Expected '('");
             
@@ -600,6 +941,20 @@ public:
 
 private:
 
+    // ": type" after a name, i64 without one
+    IntType parseAnnotation() {
+        if (!tryConsume(TokenType::COLON)) {
+            return IntType::I64;
+        }
+        Token name = tryConsumeErr(TokenType::IDENT, "Expected a type").value();
+        auto type = parseIntType(name.val);
+        if (!type) {
+            std::cerr << "Unknown type: " << name.val << std::endl;
+            exit(1);
+        }
+        return type.value();
+    }
+
     std::optional<Token> peek(unsigned int ahead = 0) const {
 
         if (m_pos + ahead >= m_tokens.size()) {
@@ -638,20 +993,26 @@ private:
         switch(tk) {
             case TokenType::PLUS :
             case TokenType::SUB :
-                return 3;
+                return 5;
             
             case TokenType::MULT :
             case TokenType::DIV :
             case TokenType::MOD :
-                return 4;
+                return 6;
+
+            case TokenType::PIPE_PIPE :
+                return 1;
+
+            case TokenType::AMP_AMP :
+                return 2;
 
             case TokenType::EQEQ :
             case TokenType::BANG_EQ :
-                return 1;
+                return 3;
 
             case TokenType::GR_THAN :
             case TokenType::LS_THAN :
-                return 2;
+                return 4;
 
             default:
                 return -1;
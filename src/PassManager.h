@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Asm.h"
+#include "BlockLayout.h"
+#include "Generator.h"
+
+enum class OptLevel { O0, O1, O2, Os };
+
+// labels something still refers to: a jump, call or rip relative operand, or
+// the entry and globals other modules reach. the rest only split blocks
+class LabelRefs {
+public:
+    explicit LabelRefs(const AsmProg& prog)
+        : m_used(prog.labels.size(), false) {
+        auto use = [this](Label label) {
+            if (label.id < m_used.size()) {
+                m_used[label.id] = true;
+            }
+        };
+        for (const Inst& inst : prog.text) {
+            for (const Operand* op : {&inst.dst, &inst.src}) {
+                if ((op->kind == Operand::Kind::LABEL && inst.op != Op::LABEL) || (op->isMem() && op->ripRel)) {
+                    use(op->label);
+                }
+            }
+        }
+        use(prog.entry);
+        for (Label label : prog.globals) {
+            use(label);
+        }
+    }
+
+    bool used(Label label) const {
+        return label.id >= m_used.size() || m_used[label.id];
+    }
+
+private:
+    std::vector<bool> m_used;
+};
+
+// analyses of the instruction stream, computed on first use and dropped whenever
+// a pass changes the stream
+class Analyses {
+public:
+    explicit Analyses(const AsmProg& prog)
+        : m_prog(prog) {}
+
+    const LabelRefs& labelRefs() {
+        if (!m_labelRefs) {
+            m_labelRefs.emplace(m_prog);
+        }
+        return m_labelRefs.value();
+    }
+
+    void invalidate() {
+        m_labelRefs.reset();
+    }
+
+private:
+    const AsmProg& m_prog;
+    std::optional<LabelRefs> m_labelRefs;
+};
+
+// drops labels nothing refers to, so the passes after see longer blocks and
+// block-layout can drop code that only they kept alive
+inline bool deadLabels(AsmProg& prog, Analyses& analyses) {
+    const LabelRefs& refs = analyses.labelRefs();
+    size_t before = prog.text.size();
+    std::erase_if(prog.text, [&refs](const Inst& inst) {
+        return inst.op == Op::LABEL && !refs.used(inst.dst.label);
+    });
+    return prog.text.size() != before;
+}
+
+inline bool sameOperand(const Operand& a, const Operand& b) {
+    return a.kind == b.kind && a.size == b.size && a.reg == b.reg && a.ripRel == b.ripRel && a.gs == b.gs &&
+           a.hasIndex == b.hasIndex && (!a.hasIndex || (a.index == b.index && a.scale == b.scale)) &&
+           a.val == b.val && (!a.ripRel || a.label.id == b.label.id);
+}
+
+// local rewrites of what the stack machine leaves behind: a load right after a
+// store of the same register to the same qword, "push r; pop s" and "mov r, r".
+// a dword load stays, it is what clears the register's high half for a u32
+inline bool peephole(AsmProg& prog, Analyses& analyses) {
+    const LabelRefs& refs = analyses.labelRefs();
+    std::vector<Inst> out;
+    out.reserve(prog.text.size());
+
+    // the last instruction that runs before this one, through unreferenced labels
+    // and source positions
+    auto prev = [&out, &refs]() -> Inst* {
+        for (auto it = out.rbegin(); it != out.rend(); ++it) {
+            if (it->op == Op::LOC) {
+                continue;
+            }
+            if (it->op != Op::LABEL || refs.used(it->dst.label)) {
+                return it->op == Op::LABEL ? nullptr : &*it;
+            }
+        }
+        return nullptr;
+    };
+    // nothing but source positions between last and this instruction
+    auto adjacent = [&out](const Inst* last) {
+        return std::all_of(out.begin() + (last - out.data()) + 1, out.end(), [](const Inst& inst) { return inst.op == Op::LOC; });
+    };
+
+    bool changed = false;
+    for (const Inst& inst : prog.text) {
+        Inst* last = prev();
+
+        if (inst.op == Op::MOV && inst.dst.isReg() && inst.dst.size == 8 && sameOperand(inst.dst, inst.src)) {
+            changed = true;
+            continue;
+        }
+        if (last && inst.op == Op::MOV && last->op == Op::MOV && inst.dst.isReg() && inst.src.isMem() &&
+            inst.src.size == 8 && sameOperand(last->src, inst.dst) && sameOperand(last->dst, inst.src)) {
+            changed = true;
+            continue;
+        }
+        if (last && inst.op == Op::POP && last->op == Op::PUSH && last->dst.isReg() && adjacent(last)) {
+            Reg from = last->dst.reg;
+            out.erase(out.begin() + (last - out.data()));
+            if (from != inst.dst.reg) {
+                out.push_back({Op::MOV, inst.dst, from});
+            }
+            changed = true;
+            continue;
+        }
+        out.push_back(inst);
+    }
+
+    prog.text = std::move(out);
+    return changed;
+}
+
+inline bool blockLayout(AsmProg& prog, Analyses&) {
+    size_t before = prog.text.size();
+    BlockLayout(prog.text).run();
+    return prog.text.size() != before;
+}
+
+// a pass either picks how codegen lowers a construct, switched by a GenOptions
+// flag, or rewrites the generated instructions afterwards, in registry order
+struct PassInfo {
+    std::string_view name;
+    std::string_view desc;
+    bool o1;
+    bool os;
+    bool GenOptions::*flag;
+    bool (*run)(AsmProg&, Analyses&);
+};
+
+inline constexpr PassInfo PASSES[] = {
+    {"bounds-check-elim", "skip the range check of a[i] under a loop counter that proves it", true, true, &GenOptions::boundsCheckElim, nullptr},
+    {"if-convert", "small conditional assignments become cmov", true, true, &GenOptions::ifConvert, nullptr},
+    {"vectorize", "element-wise loops and sums run two lanes per sse2 step", false, false, &GenOptions::vectorize, nullptr},
+    {"unroll", "copy counted loop bodies, fully for a few constant iterations", false, false, &GenOptions::unroll, nullptr},
+    {"align-loops", "pad loop heads to 16 bytes", false, false, &GenOptions::alignLoops, nullptr},
+    {"dead-labels", "drop labels nothing refers to", false, true, nullptr, deadLabels},
+    {"block-layout", "drop unreachable code and jumps to the next instruction", true, true, nullptr, blockLayout},
+    {"peephole", "forward stores to loads, fold push/pop pairs", false, true, nullptr, peephole},
+};
+
+inline const PassInfo* findPass(std::string_view name) {
+    for (const PassInfo& pass : PASSES) {
+        if (pass.name == name) {
+            return &pass;
+        }
+    }
+    return nullptr;
+}
+
+// how long a pass took and the instruction count going in and coming out
+struct PassStat {
+    std::string_view name;
+    double ms;
+    size_t before;
+    size_t after;
+};
+
+// the passes an -O level selects, minus the disabled ones
+class Pipeline {
+public:
+    Pipeline() : Pipeline(OptLevel::O2, {}) {}
+
+    Pipeline(OptLevel level, const std::vector<std::string>& disabled) {
+        for (const std::string& name : disabled) {
+            if (!findPass(name)) {
+                std::cerr << "Unknown pass: " << name << std::endl;
+                exit(1);
+            }
+        }
+
+        for (const PassInfo& pass : PASSES) {
+            bool on = level == OptLevel::O2 || (level == OptLevel::O1 && pass.o1) || (level == OptLevel::Os && pass.os);
+            if (std::find(disabled.begin(), disabled.end(), pass.name) != disabled.end()) {
+                on = false;
+            }
+            if (pass.flag) {
+                m_gen.*pass.flag = on;
+            }
+            if (on) {
+                m_enabled.push_back(&pass);
+            }
+        }
+    }
+
+    const GenOptions& gen() const {
+        return m_gen;
+    }
+
+    const std::vector<const PassInfo*>& enabled() const {
+        return m_enabled;
+    }
+
+    // runs the enabled instruction passes in order, dumping the program to stderr
+    // after the one named printAfter ("codegen" for before the first)
+    std::vector<PassStat> run(AsmProg& prog, std::string_view printAfter = {}, Trace* trace = nullptr) const {
+        std::vector<PassStat> stats;
+        Analyses analyses(prog);
+
+        if (printAfter == "codegen") {
+            std::cerr << "; after codegen\n" << AsmPrinter(prog).print().str();
+        }
+
+        for (const PassInfo* pass : m_enabled) {
+            if (!pass->run) {
+                continue;
+            }
+            size_t before = prog.text.size();
+            auto start = std::chrono::steady_clock::now();
+            {
+                Trace::Span span(trace, std::string(pass->name), "pass");
+                if (pass->run(prog, analyses)) {
+                    analyses.invalidate();
+                }
+                span.arg("insts_before", before).arg("insts_after", prog.text.size());
+            }
+            std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+            stats.push_back({pass->name, took.count(), before, prog.text.size()});
+
+            if (pass->name == printAfter) {
+                std::cerr << "; after " << pass->name << '\n' << AsmPrinter(prog).print().str();
+            }
+        }
+        return stats;
+    }
+
+private:
+    GenOptions m_gen;
+    std::vector<const PassInfo*> m_enabled;
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "Parser.h"
+
+// where an instrumented build counts: each function's entry, each اذا arm (an
+// اذا without وإلا also counts the runs that take no arm) and each بينما back edge
+// or لكل iteration.
+// ids follow source order, so every build of the same tokens agrees on them
+class ProfileSites {
+public:
+    explicit ProfileSites(const NodeProg& prog) {
+        stmts(prog.stmts);
+    }
+
+    size_t count() const {
+        return m_count;
+    }
+
+    size_t funcEntry(const NodeStmtFuncDecl* funcDecl) const {
+        return m_ids.at(funcDecl);
+    }
+
+    // the first of the arms' ids, which run on: the اذا body, every واذا, the وإلا
+    size_t ifArms(const NodeStmtIf* stmtIf) const {
+        return m_ids.at(stmtIf);
+    }
+
+    size_t backEdge(const NodeStmtWhile* stmtWhile) const {
+        return m_ids.at(stmtWhile);
+    }
+
+    size_t backEdge(const NodeStmtFor* stmtFor) const {
+        return m_ids.at(stmtFor);
+    }
+
+    static size_t armCount(const NodeStmtIf* stmtIf) {
+        size_t arms = 1;
+        std::optional<NodeIfPred*> pred = stmtIf->pred;
+        while (pred.has_value()) {
+            ++arms;
+            auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var);
+            pred = predElif ? (*predElif)->pred : std::nullopt;
+        }
+        // the implicit وإلا at the end of a chain without one
+        if (!endsInElse(stmtIf)) {
+            ++arms;
+        }
+        return arms;
+    }
+
+    static bool endsInElse(const NodeStmtIf* stmtIf) {
+        std::optional<NodeIfPred*> pred = stmtIf->pred;
+        while (pred.has_value()) {
+            auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var);
+            if (!predElif) {
+                return true;
+            }
+            pred = (*predElif)->pred;
+        }
+        return false;
+    }
+
+private:
+    void stmts(const std::vector<NodeStmt*>& list) {
+        for (const NodeStmt* stmt : list) {
+            std::visit(SiteVisitor{this}, stmt->var);
+        }
+    }
+
+    struct SiteVisitor {
+        ProfileSites* sites;
+
+        void operator()(const NodeStmtFuncDecl* funcDecl) {
+            sites->m_ids[funcDecl] = sites->m_count++;
+            sites->stmts(funcDecl->scope->stmts);
+        }
+        void operator()(const NodeStmtIf* stmtIf) {
+            sites->m_ids[stmtIf] = sites->m_count;
+            sites->m_count += armCount(stmtIf);
+
+            sites->stmts(stmtIf->scope->stmts);
+            std::optional<NodeIfPred*> pred = stmtIf->pred;
+            while (pred.has_value()) {
+                if (auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+                    sites->stmts((*predElif)->scope->stmts);
+                    pred = (*predElif)->pred;
+                }
+                else {
+                    sites->stmts(std::get<NodeIfPredElse*>(pred.value()->var)->scope->stmts);
+                    pred = {};
+                }
+            }
+        }
+        void operator()(const NodeStmtWhile* stmtWhile) {
+            sites->m_ids[stmtWhile] = sites->m_count++;
+            sites->stmts(stmtWhile->scope->stmts);
+        }
+        void operator()(const NodeStmtFor* stmtFor) {
+            sites->m_ids[stmtFor] = sites->m_count++;
+            sites->stmts(stmtFor->scope->stmts);
+        }
+        void operator()(const NodeScope* scope) {
+            sites->stmts(scope->stmts);
+        }
+        void operator()(const NodeStmtExit*) {}
+        void operator()(const NodeStmtLet*) {}
+        void operator()(const NodeStmtAssign*) {}
+        void operator()(const NodeStmtReturn*) {}
+        void operator()(const NodeStmtPrint*) {}
+        void operator()(const NodeStmtLetArray*) {}
+        void operator()(const NodeStmtIndexAssign*) {}
+        void operator()(const NodeStmtImport*) {}
+        void operator()(const NodeStmtSpawn*) {}
+        void operator()(const NodeStmtJoin*) {}
+    };
+
+    std::unordered_map<const void*, size_t> m_ids;
+    size_t m_count = 0;
+};
+
+// what an instrumented program writes at exit: MAGIC, then per module its token
+// hash, its number of sites and a count per site, all little endian qwords
+class Profile {
+public:
+    static constexpr uint64_t MAGIC = 0x3146525044414844; // "DHADPRF1"
+
+    static Profile read(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Failed to read profile: " << path << std::endl;
+            exit(1);
+        }
+        std::string bytes{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+        std::vector<uint64_t> qwords(bytes.size() / 8);
+        for (size_t i = 0; i < qwords.size(); ++i) {
+            for (size_t b = 0; b < 8; ++b) {
+                qwords[i] |= static_cast<uint64_t>(static_cast<uint8_t>(bytes[i * 8 + b])) << (b * 8);
+            }
+        }
+        if (bytes.size() % 8 != 0 || qwords.empty() || qwords[0] != MAGIC) {
+            std::cerr << "Not a dhad profile: " << path << std::endl;
+            exit(1);
+        }
+
+        Profile profile;
+        for (size_t pos = 1; pos < qwords.size();) {
+            if (qwords.size() - pos < 2 || qwords.size() - pos - 2 < qwords[pos + 1]) {
+                std::cerr << "Truncated profile: " << path << std::endl;
+                exit(1);
+            }
+            auto first = qwords.begin() + static_cast<std::ptrdiff_t>(pos + 2);
+            profile.m_modules[qwords[pos]] = {first, first + static_cast<std::ptrdiff_t>(qwords[pos + 1])};
+            pos += 2 + qwords[pos + 1];
+        }
+        return profile;
+    }
+
+    // the counts a module with these tokens ran with, null if it wasn't in the run
+    const std::vector<uint64_t>* counts(uint64_t tokenHash, size_t sites) const {
+        auto it = m_modules.find(tokenHash);
+        if (it == m_modules.end() || it->second.size() != sites) {
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+private:
+    std::unordered_map<uint64_t, std::vector<uint64_t>> m_modules;
+};
+
+// a module's counter array, as the main module's runtime writes it out
+struct ProfileModule {
+    std::string symbol;
+    uint64_t tokenHash;
+    size_t sites;
+};
@@ -0,0 +1,559 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <codecvt>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <locale>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Tokenizer.h"
+#include "Parser.h"
+#include "Generator.h"
+#include "PassManager.h"
+#include "Assembler.h"
+#include "Linker.h"
+#include "ObjectCache.h"
+#include "NodeCounter.h"
+#include "Trace.h"
+#include "TypeChecker.h"
+
+inline std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Failed to open file");
+
+    std::ostringstream oss;
+    oss << file.rdbuf();
+    return oss.str();
+}
+
+inline std::u32string utf8ToU32(const std::string& utf8) {
+    std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> conv;
+    return conv.from_bytes(utf8);
+}
+
+// one source file. its nodes live in the parser's arena
+struct Module {
+    std::filesystem::path path;
+    std::string source;
+    std::shared_ptr<Parser> parser;
+    NodeProg prog;
+    std::vector<size_t> imports; // direct ones, indices into Project::modules()
+    uint64_t tokenHash = 0;
+    AsmProg asmProg; // compiled with Project::wholeModules only, for --emit=asm
+    std::vector<PassStat> passStats; // codegen first, then each pass over all units. empty when cached
+    std::vector<Object> objects; // one per unit, see Generator::genUnits
+    std::vector<Remark> remarks;
+    bool cached = false; // every unit reused
+    size_t funcs = 0;
+    size_t reusedFuncs = 0; // of funcs, kept from an earlier build
+};
+
+// what a long running compiler (--serve, --watch) keeps between builds, by canonical
+// path: the parse of every module whose bytes haven't changed, its last objects and
+// those of each of its functions, by path and name
+struct WarmState {
+    struct Parsed {
+        std::string source;
+        std::shared_ptr<Parser> parser;
+        NodeProg prog;
+        uint64_t tokenHash;
+    };
+    struct Compiled {
+        uint64_t key;
+        CachedModule module;
+    };
+
+    std::unordered_map<std::string, Parsed> parsed;
+    std::unordered_map<std::string, Compiled> compiled;
+    std::unordered_map<std::string, Compiled> functions; // the name on line 1
+};
+
+// the main file and every module it imports, transitively. modules only see the
+// signatures of what they import, so each is parsed, generated and assembled on
+// its own thread and the objects meet in a single link at the end
+class Project {
+public:
+    Project(std::filesystem::path mainPath, Pipeline pipeline, unsigned jobs)
+        : m_pipeline(std::move(pipeline)), m_jobs(std::max(jobs, 1u))
+    {
+        m_modules.push_back({ .path = std::move(mainPath) });
+    }
+
+    // reuse the objects of modules compiled before under the same key
+    void useCache(std::filesystem::path dir) {
+        m_cache.emplace(std::move(dir));
+    }
+
+    // dump each compiled module after the named pass, see Pipeline::run
+    void printAfter(std::string pass) {
+        m_printAfter = std::move(pass);
+    }
+
+    // each module compiled as one unit instead of one per function, its code in
+    // asmProg. profile builds always are, site numbers and cold code span the module
+    void wholeModules() {
+        m_whole = true;
+    }
+
+    // copies of a counted loop's body per test, see Generator::genFor
+    void unrollFactor(unsigned factor) {
+        m_unrollFactor = factor;
+    }
+
+    // the main module's runtime exits back into the process that runs it, see Jit.h
+    void hosted() {
+        m_hosted = true;
+    }
+
+    // instrumented build, see Profile. the program writes its counts to out
+    void profileGenerate(std::string out) {
+        m_profileOut = std::move(out);
+    }
+
+    // lowering decisions follow the counts of an instrumented run
+    void profileUse(Profile profile) {
+        m_profile.emplace(std::move(profile));
+    }
+
+    // line tables for the executable's dwarf, see DwarfWriter
+    void debugInfo() {
+        m_debugInfo = true;
+    }
+
+    // a module's source tokenized and parsed, as a warm state keeps it. a syntax
+    // error exits
+    static WarmState::Parsed parseSource(std::string source, Trace* trace = nullptr) {
+        std::optional<Trace::Span> tokenize(std::in_place, trace, "tokenize", "phase");
+        std::u32string contents = utf8ToU32(source);
+        Tokenizer tk(contents, contents.size());
+        auto tokens = tk.tokenize();
+
+        Hasher hash;
+        for (const Token& token : tokens) {
+            hash.add(static_cast<uint64_t>(token.type)).add(token.val).add(token.line).add(token.col);
+        }
+        tokenize->arg("chars", contents.size()).arg("tokens", tokens.size());
+        tokenize.reset();
+
+        Trace::Span parse(trace, "parse", "phase");
+        auto parser = std::make_shared<Parser>(std::move(tokens));
+        auto prog = parser->parseProg();
+        if (!prog.has_value()) {
+            std::cerr << "Invalid program" << std::endl;
+            exit(1);
+        }
+        if (trace) {
+            parse.arg("nodes", NodeCounter().count(prog.value()));
+        }
+        return {std::move(source), std::move(parser), prog.value(), hash.value()};
+    }
+
+    // read from during the parallel phases, updated once each is over
+    void useWarmState(WarmState& warm) {
+        m_warm = &warm;
+    }
+
+    // spans for every module's phases, passes and functions
+    void useTrace(Trace& trace) {
+        m_trace = &trace;
+    }
+
+    // parses breadth first, one parallel wave per import depth
+    void load() {
+        std::unordered_map<std::string, size_t> loaded{{key(m_modules[0].path), 0}};
+
+        size_t done = 0;
+        while (done < m_modules.size()) {
+            size_t end = m_modules.size();
+            parallelFor(end - done, [this, done](size_t i) {
+                parse(m_modules[done + i]);
+            });
+
+            for (size_t i = done; i < end; ++i) {
+                if (m_warm) {
+                    const Module& module = m_modules[i];
+                    m_warm->parsed[key(module.path)] = {module.source, module.parser, module.prog, module.tokenHash};
+                }
+
+                for (const NodeStmt* stmt : m_modules[i].prog.stmts) {
+                    auto stmtImport = std::get_if<NodeStmtImport*>(&stmt->var);
+                    if (!stmtImport) {
+                        continue;
+                    }
+
+                    auto path = m_modules[i].path.parent_path() / ((*stmtImport)->module.val + ".dhad");
+                    auto [it, added] = loaded.insert({key(path), m_modules.size()});
+                    if (added) {
+                        m_modules.push_back({ .path = path });
+                    }
+                    if (it->second == 0) {
+                        std::cerr << "Cannot import the main program: " << path.string() << "\n";
+                        exit(1);
+                    }
+
+                    auto& imports = m_modules[i].imports;
+                    if (std::find(imports.begin(), imports.end(), it->second) == imports.end()) {
+                        imports.push_back(it->second);
+                    }
+                }
+            }
+            done = end;
+        }
+
+        // each module against the signatures it imports, all parsed by now
+        parallelFor(m_modules.size(), [this](size_t i) {
+            const Module& module = m_modules[i];
+            Trace::Span span(m_trace, "check", "phase");
+            span.arg("module", module.path.filename().string());
+            TypeChecker checker(module.prog);
+            for (size_t dep : module.imports) {
+                for (const NodeStmt* stmt : m_modules[dep].prog.stmts) {
+                    if (auto funcDecl = std::get_if<NodeStmtFuncDecl*>(&stmt->var)) {
+                        checker.importFunc(*funcDecl);
+                    }
+                }
+            }
+            checker.check();
+        });
+    }
+
+    void compile() {
+        std::vector<GenOptions> options = genOptions();
+        std::vector<std::vector<std::pair<std::string, WarmState::Compiled>>> compiledFuncs(m_modules.size());
+
+        parallelFor(m_modules.size(), [this, &options, &compiledFuncs](size_t i) {
+            Module& module = m_modules[i];
+            Trace::Span span(m_trace, module.path.filename().string(), "module");
+
+            uint64_t key = cacheKey(module, options[i]);
+            if (m_warm) {
+                auto it = m_warm->compiled.find(Project::key(module.path));
+                if (it != m_warm->compiled.end() && it->second.key == key) {
+                    module.objects = it->second.module.objects;
+                    module.remarks = it->second.module.remarks;
+                    module.cached = true;
+                    span.arg("cached", "warm");
+                    return;
+                }
+            }
+            if (m_cache) {
+                Trace::Span load(m_trace, "cache load", "cache");
+                if (auto cached = m_cache->load(module.path, "", key)) {
+                    module.objects = std::move(cached->objects);
+                    module.remarks = std::move(cached->remarks);
+                    module.cached = true;
+                    span.arg("cached", "disk");
+                    return;
+                }
+            }
+
+            // a function whose own key still matches isn't generated again
+            uint64_t unitsKey = optionsKey(module, options[i]);
+            std::unordered_map<std::string, CachedModule> kept;
+            Generator::Reuse reuse;
+            if (m_cache || m_warm) {
+                reuse = [this, &module, &kept, unitsKey](const NodeStmtFuncDecl* funcDecl, uint64_t funcKey) {
+                    auto found = keptFunc(module, funcDecl->ident.val, Hasher().add(unitsKey).add(funcKey).value());
+                    if (!found) {
+                        return false;
+                    }
+                    shiftLines(*found, static_cast<int64_t>(funcDecl->ident.line) - 1);
+                    kept.insert({funcDecl->ident.val, std::move(*found)});
+                    return true;
+                };
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            std::optional<Trace::Span> codegen(std::in_place, m_trace, "codegen", "phase");
+            Generator gen(module.prog, options[i]);
+            if (m_trace) {
+                gen.useTrace(*m_trace);
+            }
+            for (size_t dep : module.imports) {
+                for (const NodeStmt* stmt : m_modules[dep].prog.stmts) {
+                    if (auto funcDecl = std::get_if<NodeStmtFuncDecl*>(&stmt->var)) {
+                        gen.importFunc(*funcDecl);
+                    }
+                }
+            }
+
+            bool whole = m_whole || !options[i].profileSymbol.empty() || !options[i].profileCounts.empty();
+            std::vector<GenUnit> units;
+            if (whole) {
+                units.push_back({ .prog = i == 0 ? gen.genProg() : gen.genModule(), .remarks = gen.remarks() });
+            }
+            else {
+                units = gen.genUnits(i == 0, std::move(reuse));
+                module.funcs = units.size() - 1;
+            }
+            size_t insts = 0;
+            for (const GenUnit& unit : units) {
+                insts += unit.prog.text.size();
+            }
+            std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+            module.passStats.push_back({"codegen", took.count(), 0, insts});
+            codegen->arg("insts", insts).arg("units", units.size());
+            codegen.reset();
+
+            for (GenUnit& unit : units) {
+                if (unit.reused) {
+                    CachedModule& found = kept.at(unit.name);
+                    module.objects.push_back(std::move(found.objects.front()));
+                    module.remarks.insert(module.remarks.end(), found.remarks.begin(), found.remarks.end());
+                    module.reusedFuncs++;
+                    continue;
+                }
+
+                auto stats = m_pipeline.run(unit.prog, m_printAfter, m_trace);
+                for (const PassStat& stat : stats) {
+                    auto it = std::find_if(module.passStats.begin(), module.passStats.end(),
+                                           [&stat](const PassStat& seen) { return seen.name == stat.name; });
+                    if (it == module.passStats.end()) {
+                        module.passStats.push_back(stat);
+                        continue;
+                    }
+                    it->ms += stat.ms;
+                    it->before += stat.before;
+                    it->after += stat.after;
+                }
+                Object object;
+                {
+                    Trace::Span assemble(m_trace, "assemble", "phase");
+                    object = Assembler(unit.prog).assemble();
+                    assemble.arg("text_bytes", object.text.size()).arg("relocs", object.relocs.size());
+                }
+
+                if (!unit.name.empty() && (m_cache || m_warm)) {
+                    uint64_t funcKey = Hasher().add(unitsKey).add(unit.key).value();
+                    CachedModule entry{{object}, unit.remarks};
+                    shiftLines(entry, 1 - static_cast<int64_t>(unit.line));
+                    if (m_cache) {
+                        Trace::Span store(m_trace, "cache store", "cache");
+                        m_cache->store(module.path, unit.name, funcKey, entry);
+                    }
+                    if (m_warm) {
+                        compiledFuncs[i].push_back({unit.name, {funcKey, std::move(entry)}});
+                    }
+                }
+                module.objects.push_back(std::move(object));
+                module.remarks.insert(module.remarks.end(), unit.remarks.begin(), unit.remarks.end());
+            }
+            if (whole) {
+                module.asmProg = std::move(units.front().prog);
+            }
+            std::stable_sort(module.remarks.begin(), module.remarks.end(),
+                             [](const Remark& a, const Remark& b) { return a.line < b.line; });
+            span.arg("reused_functions", module.reusedFuncs);
+
+            if (m_cache) {
+                Trace::Span store(m_trace, "cache store", "cache");
+                m_cache->store(module.path, "", key, {module.objects, module.remarks});
+            }
+        });
+
+        if (m_warm) {
+            for (size_t i = 0; i < m_modules.size(); ++i) {
+                const Module& module = m_modules[i];
+                m_warm->compiled[key(module.path)] = {cacheKey(module, options[i]), {module.objects, module.remarks}};
+                for (auto& [name, compiled] : compiledFuncs[i]) {
+                    m_warm->functions[key(module.path) + '\n' + name] = std::move(compiled);
+                }
+            }
+        }
+    }
+
+    // extra objects go after the modules' and may bind their externs
+    [[nodiscard]] Object link(std::vector<Object> extra = {}) {
+        Trace::Span span(m_trace, "link", "phase");
+        std::vector<Object> objects;
+        for (Module& module : m_modules) {
+            std::move(module.objects.begin(), module.objects.end(), std::back_inserter(objects));
+        }
+        for (Object& obj : extra) {
+            objects.push_back(std::move(obj));
+        }
+        span.arg("objects", objects.size());
+        Object linked = Linker(std::move(objects)).link();
+        span.arg("text_bytes", linked.text.size()).arg("symbols", linked.symbols.size());
+        return linked;
+    }
+
+    const std::vector<Module>& modules() const {
+        return m_modules;
+    }
+
+private:
+    static std::string key(const std::filesystem::path& path) {
+        return std::filesystem::weakly_canonical(path).string();
+    }
+
+    // the pipeline's choices, plus what differs per module: hosting, profiles and
+    // the file debug info names
+    std::vector<GenOptions> genOptions() const {
+        std::vector<ProfileModule> table;
+        if (!m_profileOut.empty()) {
+            for (const Module& module : m_modules) {
+                char symbol[32];
+                std::snprintf(symbol, sizeof(symbol), "__dhad_prof_%016llx", static_cast<unsigned long long>(module.tokenHash));
+                table.push_back({symbol, module.tokenHash, ProfileSites(module.prog).count()});
+            }
+        }
+
+        std::vector<GenOptions> options(m_modules.size(), m_pipeline.gen());
+        for (size_t i = 0; i < m_modules.size(); ++i) {
+            options[i].hosted = m_hosted && i == 0;
+            options[i].unrollFactor = m_unrollFactor;
+            if (m_debugInfo) {
+                options[i].debugFile = std::filesystem::absolute(m_modules[i].path).lexically_normal().string();
+            }
+            if (!table.empty()) {
+                options[i].profileSymbol = table[i].symbol;
+            }
+            if (!table.empty() && i == 0) {
+                options[i].profileOut = m_profileOut;
+                options[i].profileModules = table;
+            }
+            if (m_profile) {
+                const Module& module = m_modules[i];
+                if (auto counts = m_profile->counts(module.tokenHash, ProfileSites(module.prog).count())) {
+                    options[i].profileCounts = *counts;
+                }
+                else {
+                    std::cerr << module.path.string() << ": not in the profile, compiled without it\n";
+                }
+            }
+        }
+        return options;
+    }
+
+    // a function's unit kept from an earlier build under key, its name on line 1
+    std::optional<CachedModule> keptFunc(const Module& module, const std::string& func, uint64_t key) const {
+        if (m_warm) {
+            auto it = m_warm->functions.find(Project::key(module.path) + '\n' + func);
+            if (it != m_warm->functions.end() && it->second.key == key) {
+                return it->second.module;
+            }
+        }
+        if (m_cache) {
+            return m_cache->load(module.path, func, key);
+        }
+        return {};
+    }
+
+    // a module compiles the same as long as its tokens, the signatures it imports
+    // and its optionsKey don't change
+    uint64_t cacheKey(const Module& module, const GenOptions& options) const {
+        Hasher hash;
+        hash.add(optionsKey(module, options)).add(module.tokenHash);
+        for (size_t dep : module.imports) {
+            for (const NodeStmt* stmt : m_modules[dep].prog.stmts) {
+                if (auto funcDecl = std::get_if<NodeStmtFuncDecl*>(&stmt->var)) {
+                    hash.add((*funcDecl)->ident.val).add((*funcDecl)->params.size());
+                    for (const NodeFuncParam* param : (*funcDecl)->params) {
+                        hash.add(static_cast<uint64_t>(param->type));
+                    }
+                }
+            }
+        }
+        return hash.value();
+    }
+
+    // what every unit of a module compiles under besides its source: whether it is
+    // the main one, the passes, the profile, debug info and the compiler itself.
+    // a function's key adds what Generator::funcKey says it depends on
+    uint64_t optionsKey(const Module& module, const GenOptions& options) const {
+        Hasher hash;
+        hash.add(ObjectCache::buildId())
+            .add(&module == &m_modules.front())
+            .add(m_whole)
+            .add(options.hosted)
+            .add(options.unrollFactor)
+            .add(options.profileSymbol)
+            .add(options.profileOut)
+            .add(options.debugFile);
+        for (const ProfileModule& profiled : options.profileModules) {
+            hash.add(profiled.tokenHash);
+        }
+        for (uint64_t count : options.profileCounts) {
+            hash.add(count);
+        }
+        for (const PassInfo* pass : m_pipeline.enabled()) {
+            hash.add(pass->name);
+        }
+        return hash.value();
+    }
+
+    void parse(Module& module) const {
+        Trace::Span span(m_trace, module.path.filename().string(), "module");
+        if (!std::filesystem::is_regular_file(module.path)) {
+            std::cerr << "Module not found: " << module.path.string() << "\n";
+            exit(1);
+        }
+        {
+            Trace::Span read(m_trace, "read", "phase");
+            module.source = readFile(module.path.string());
+            read.arg("bytes", module.source.size());
+        }
+
+        if (m_warm) {
+            auto it = m_warm->parsed.find(key(module.path));
+            if (it != m_warm->parsed.end() && it->second.source == module.source) {
+                module.parser = it->second.parser;
+                module.prog = it->second.prog;
+                module.tokenHash = it->second.tokenHash;
+                span.arg("parsed", "warm");
+                return;
+            }
+        }
+
+        WarmState::Parsed parsed = parseSource(module.source, m_trace);
+        module.parser = std::move(parsed.parser);
+        module.prog = parsed.prog;
+        module.tokenHash = parsed.tokenHash;
+    }
+
+    // fn(i) for every i < count, spread over up to m_jobs threads
+    template<typename Fn>
+    void parallelFor(size_t count, Fn fn) {
+        std::atomic<size_t> next = 0;
+        auto worker = [&next, &fn, count]() {
+            for (size_t i = next++; i < count; i = next++) {
+                fn(i);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < std::min<size_t>(m_jobs, count); ++t) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+    }
+
+private:
+    Pipeline m_pipeline;
+    std::string m_printAfter;
+    bool m_whole = false;
+    bool m_hosted = false;
+    unsigned m_unrollFactor = 4;
+    std::string m_profileOut;
+    std::optional<Profile> m_profile;
+    bool m_debugInfo = false;
+    unsigned m_jobs;
+    std::optional<ObjectCache> m_cache;
+    WarmState* m_warm = nullptr;
+    Trace* m_trace = nullptr;
+    std::vector<Module> m_modules;
+};
@@ -0,0 +1,1265 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Asm.h"
+#include "Profile.h"
+
+// freestanding support code emitted into every executable. routines take their
+// argument in rdi, return in rax and may clobber every register except rbp/rsp.
+// print_int, read_int and the heap routines leave rbx and r12-r15 alone, so a
+// لكل counter stays in its register across them.
+// each thread has a block, which its gs base points to: its heap and its deque
+// of tasks. parallel loops and spawned calls become tasks that other threads
+// steal, workers are cloned on the first one, one per cpu the program may run on.
+// hosted, the program runs inside the compiler (dhad run) and exiting jumps back
+// to it through an extern instead of making the exit syscall. it then stays on
+// one thread, which runs every task itself
+class Runtime {
+public:
+    static constexpr int64_t BUF_SIZE = 64 * 1024;
+    static constexpr int64_t MAX_ARRAY_LENGTH = int64_t{1} << 28;
+
+    Runtime(AsmProg& prog, bool hosted)
+        : m_prog(prog),
+          m_hosted(hosted),
+          m_exit(label("__dhad_exit")),
+          m_flush(label("__dhad_flush")),
+          m_printInt(label("__dhad_print_int")),
+          m_readInt(label("__dhad_read_int")),
+          m_nextByte(label("__dhad_next_byte")),
+          m_outBuf(label("__dhad_out_buf")),
+          m_outLen(label("__dhad_out_len")),
+          m_inBuf(label("__dhad_in_buf")),
+          m_inPos(label("__dhad_in_pos")),
+          m_inLen(label("__dhad_in_len")),
+          m_digits(label("__dhad_digit_pairs")),
+          m_boundsFail(label("__dhad_bounds_fail")),
+          m_boundsMsg(label("__dhad_bounds_msg")),
+          m_alloc(label("__dhad_alloc")),
+          m_release(label("__dhad_release")),
+          m_sizeMsg(label("__dhad_size_msg")),
+          m_memoryMsg(label("__dhad_memory_msg")),
+          m_init(label("__dhad_init")),
+          m_parallelFor(label("__dhad_parallel_for")),
+          m_spawn(label("__dhad_spawn")),
+          m_join(label("__dhad_join")),
+          m_startWorkers(label("__dhad_start_workers")),
+          m_worker(label("__dhad_worker")),
+          m_runTask(label("__dhad_run_task")),
+          m_pushTask(label("__dhad_push_task")),
+          m_takeTask(label("__dhad_take_task")),
+          m_stealTask(label("__dhad_steal_task")),
+          m_taskCall(label("__dhad_task_call")),
+          m_taskRange(label("__dhad_task_range")),
+          m_blocks(label("__dhad_blocks")),
+          m_workers(label("__dhad_workers")),
+          m_started(label("__dhad_started")),
+          m_workSeq(label("__dhad_work_seq")),
+          m_sleepers(label("__dhad_sleepers")),
+          m_ioLock(label("__dhad_io_lock")),
+          m_hostExit(hosted ? label("__dhad_host_exit") : Label{})
+    {}
+
+    // an instrumented module's counter array, see Profile
+    struct ProfileOut {
+        Label counters;
+        uint64_t tokenHash;
+        size_t sites;
+    };
+
+    // --profile-generate: every way out of the program first writes the counters
+    // to path, relative to the directory the program runs in
+    void writeProfile(std::string path, std::vector<ProfileOut> modules) {
+        m_profilePath = std::move(path);
+        m_profileModules = std::move(modules);
+        m_writeProfile = label("__dhad_write_profile");
+    }
+
+    // flushes stdout, then exits with the status in rdi
+    Label exit() const { return m_exit; }
+    // appends rdi and a newline to the stdout buffer
+    Label printInt() const { return m_printInt; }
+    // next whitespace separated integer from stdin in rax, 0 at eof
+    Label readInt() const { return m_readInt; }
+    // jumped to by a failed array bounds check, doesn't return
+    Label boundsFail() const { return m_boundsFail; }
+    // rdi elements of rsi bytes, zeroed, in rax. rdx is the heap's top before them
+    Label alloc() const { return m_alloc; }
+    // gives back everything allocated since the top in rdi was current. keeps rax
+    Label release() const { return m_release; }
+    // sets up the main thread's block, first thing in _start
+    Label init() const { return m_init; }
+    // runs rdi(lo, hi, rsi) over [rdx, rcx) split into ranges, on every worker,
+    // and returns once all of them have
+    Label parallelFor() const { return m_parallelFor; }
+    // calls rsi with rdx arguments, pushed first to last ending at rcx, as a task
+    // counted in the qword at rdi
+    Label spawn() const { return m_spawn; }
+    // runs and steals tasks until the count at rdi drops to zero
+    Label join() const { return m_join; }
+
+    // what generated code calls, exported by the main module for the others
+    std::vector<Label> entryPoints() const {
+        return {m_exit, m_printInt, m_readInt, m_boundsFail, m_alloc, m_release, m_parallelFor, m_spawn, m_join};
+    }
+
+    void emit(std::vector<Inst>& text) {
+        m_text = &text;
+
+        m_prog.bss.push_back({m_outBuf, BUF_SIZE / 8});
+        m_prog.bss.push_back({m_outLen, 1});
+        m_prog.bss.push_back({m_inBuf, BUF_SIZE / 8});
+        m_prog.bss.push_back({m_inPos, 1});
+        m_prog.bss.push_back({m_inLen, 1});
+        m_prog.rodata.push_back({m_digits, digitPairs()});
+        m_prog.rodata.push_back({m_boundsMsg, packBytes(BOUNDS_MSG)});
+        m_prog.rodata.push_back({m_sizeMsg, packBytes(SIZE_MSG)});
+        m_prog.rodata.push_back({m_memoryMsg, packBytes(MEMORY_MSG)});
+        m_prog.bss.push_back({m_blocks, static_cast<uint64_t>(MAX_WORKERS * BLOCK_SIZE + CACHE_LINE) / 8});
+        m_prog.bss.push_back({m_workers, 1});
+        m_prog.bss.push_back({m_started, 1});
+        m_prog.bss.push_back({m_workSeq, 1});
+        m_prog.bss.push_back({m_sleepers, 1});
+        m_prog.bss.push_back({m_ioLock, 1});
+        if (m_hosted) {
+            m_prog.externs.push_back(m_hostExit);
+        }
+        m_prog.funcs.insert(m_prog.funcs.end(), {m_exit, m_flush, m_printInt, m_nextByte, m_readInt, m_boundsFail, m_alloc, m_release,
+                                                 m_init, m_startWorkers, m_worker, m_runTask, m_pushTask, m_takeTask, m_stealTask,
+                                                 m_join, m_parallelFor, m_taskRange, m_spawn, m_taskCall});
+        if (!m_profilePath.empty()) {
+            m_prog.funcs.push_back(m_writeProfile);
+        }
+
+        emitExit();
+        emitWriteProfile();
+        emitFlush();
+        emitPrintInt();
+        emitNextByte();
+        emitReadInt();
+        emitBoundsFail();
+        emitAlloc();
+        emitRelease();
+        emitInit();
+        emitStartWorkers();
+        emitWorker();
+        emitRunTask();
+        emitPushTask();
+        emitTakeTask();
+        emitStealTask();
+        emitJoin();
+        emitParallelFor();
+        emitTaskRange();
+        emitSpawn();
+        emitTaskCall();
+    }
+
+private:
+    // the other threads may be mid-way through printing, the lock is never given back
+    void emitExit() {
+        bind(m_exit);
+        op(Op::PUSH, Reg::RDI);
+        lockIo();
+        op(Op::CALL, m_flush);
+        if (!m_profilePath.empty()) {
+            op(Op::CALL, m_writeProfile);
+        }
+        op(Op::POP, Reg::RDI);
+        sysExit();
+    }
+
+    // ends the program, every thread of it, with the status in rdi
+    void sysExit() {
+        if (m_hosted) {
+            op(Op::JMP, m_hostExit);
+            return;
+        }
+        op(Op::MOV, Reg::RAX, Imm{231});
+        op(Op::SYSCALL);
+    }
+
+    // write(1, buf, len) until everything is out, errors drop the rest
+    void emitFlush() {
+        Label loop = local();
+        Label done = local();
+
+        bind(m_flush);
+        op(Op::MOV, Reg::RDX, qword(m_outLen));
+        op(Op::LEA, Reg::RSI, qword(m_outBuf));
+        bind(loop);
+        op(Op::TEST, Reg::RDX, Reg::RDX);
+        jcc(Cond::LE, done);
+        op(Op::MOV, Reg::RDI, Imm{1});
+        op(Op::MOV, Reg::RAX, Imm{1});
+        op(Op::SYSCALL);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::LE, done);
+        op(Op::ADD, Reg::RSI, Reg::RAX);
+        op(Op::SUB, Reg::RDX, Reg::RAX);
+        op(Op::JMP, loop);
+        bind(done);
+        op(Op::MOV, qword(m_outLen), Imm{0});
+        op(Op::RET);
+    }
+
+    // digits are counted first so they can be written back to front straight into
+    // the buffer, two at a time from the "00".."99" table, dividing by 100 with a
+    // reciprocal multiply instead of div
+    void emitPrintInt() {
+        Label room = local();
+        Label positive = local();
+        Label count = local();
+        Label counted = local();
+        Label pairs = local();
+        Label tail = local();
+        Label single = local();
+        Label done = local();
+
+        bind(m_printInt);
+        lockIo();
+        op(Op::MOV, Reg::RAX, qword(m_outLen));
+        op(Op::CMP, Reg::RAX, Imm{BUF_SIZE - 32});
+        jcc(Cond::BE, room);
+        op(Op::PUSH, Reg::RDI);
+        op(Op::CALL, m_flush);
+        op(Op::POP, Reg::RDI);
+        bind(room);
+
+        op(Op::LEA, Reg::RSI, qword(m_outBuf));
+        op(Op::ADD, Reg::RSI, qword(m_outLen));
+        op(Op::MOV, Reg::RAX, Reg::RDI);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::NS, positive);
+        op(Op::MOV, mem(1, Reg::RSI), Imm{'-'});
+        op(Op::ADD, Reg::RSI, Imm{1});
+        op(Op::NEG, Reg::RAX);
+        bind(positive);
+
+        // rcx = number of digits in the unsigned magnitude
+        op(Op::MOV, Reg::RCX, Imm{1});
+        op(Op::MOV, Reg::R8, Imm{10});
+        bind(count);
+        op(Op::CMP, Reg::RAX, Reg::R8);
+        jcc(Cond::B, counted);
+        op(Op::ADD, Reg::RCX, Imm{1});
+        op(Op::CMP, Reg::RCX, Imm{20});
+        jcc(Cond::AE, counted);
+        op(Op::LEA, Reg::R8, mem(8, Reg::R8, Reg::R8, 4));
+        op(Op::ADD, Reg::R8, Reg::R8);
+        op(Op::JMP, count);
+        bind(counted);
+
+        op(Op::ADD, Reg::RSI, Reg::RCX);
+        op(Op::MOV, mem(1, Reg::RSI), Imm{'\n'});
+        op(Op::LEA, Reg::RDI, qword(Reg::RSI, 1));
+        op(Op::LEA, Reg::RDX, qword(m_outBuf));
+        op(Op::SUB, Reg::RDI, Reg::RDX);
+        op(Op::MOV, qword(m_outLen), Reg::RDI);
+        op(Op::LEA, Reg::R8, qword(m_digits));
+
+        bind(pairs);
+        op(Op::CMP, Reg::RAX, Imm{100});
+        jcc(Cond::B, tail);
+        op(Op::MOV, Reg::R9, Reg::RAX);
+        op(Op::SHR, Reg::RAX, Imm{2});
+        op(Op::MOV, Reg::RDX, Imm{0x28F5C28F5C28F5C3});
+        op(Op::MUL, Reg::RDX);
+        op(Op::SHR, Reg::RDX, Imm{2});
+        op(Op::LEA, Reg::R10, mem(8, Reg::RDX, Reg::RDX, 4));
+        op(Op::LEA, Reg::R10, mem(8, Reg::R10, Reg::R10, 4));
+        op(Op::SHL, Reg::R10, Imm{2});
+        op(Op::SUB, Reg::R9, Reg::R10);
+        op(Op::MOVZX, Reg::R11, mem(2, Reg::R8, Reg::R9, 2));
+        op(Op::SUB, Reg::RSI, Imm{2});
+        op(Op::MOV, mem(2, Reg::RSI), low16(Reg::R11));
+        op(Op::MOV, Reg::RAX, Reg::RDX);
+        op(Op::JMP, pairs);
+
+        bind(tail);
+        op(Op::CMP, Reg::RAX, Imm{10});
+        jcc(Cond::B, single);
+        op(Op::MOVZX, Reg::R11, mem(2, Reg::R8, Reg::RAX, 2));
+        op(Op::MOV, mem(2, Reg::RSI, -2), low16(Reg::R11));
+        op(Op::JMP, done);
+        bind(single);
+        op(Op::ADD, Reg::RAX, Imm{'0'});
+        op(Op::MOV, mem(1, Reg::RSI, -1), low8(Reg::RAX));
+        bind(done);
+        unlockIo();
+        op(Op::RET);
+    }
+
+    // rax = next stdin byte or -1 at eof, refilling the buffer one read at a time
+    void emitNextByte() {
+        Label have = local();
+        Label eof = local();
+
+        bind(m_nextByte);
+        op(Op::MOV, Reg::RCX, qword(m_inPos));
+        op(Op::CMP, Reg::RCX, qword(m_inLen));
+        jcc(Cond::B, have);
+        op(Op::MOV, Reg::RDI, Imm{0});
+        op(Op::LEA, Reg::RSI, qword(m_inBuf));
+        op(Op::MOV, Reg::RDX, Imm{BUF_SIZE});
+        op(Op::MOV, Reg::RAX, Imm{0});
+        op(Op::SYSCALL);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::LE, eof);
+        op(Op::MOV, qword(m_inLen), Reg::RAX);
+        op(Op::MOV, Reg::RCX, Imm{0});
+        bind(have);
+        op(Op::LEA, Reg::RSI, qword(m_inBuf));
+        op(Op::MOVZX, Reg::RAX, mem(1, Reg::RSI, Reg::RCX, 1));
+        op(Op::ADD, Reg::RCX, Imm{1});
+        op(Op::MOV, qword(m_inPos), Reg::RCX);
+        op(Op::RET);
+        bind(eof);
+        op(Op::MOV, Reg::RAX, Imm{-1});
+        op(Op::RET);
+    }
+
+    // skips anything up to ' ', then an optional '-' and decimal digits. rbx and r12
+    // survive next_byte so they hold the value and the sign, the caller's are saved
+    void emitReadInt() {
+        Label skip = local();
+        Label digits = local();
+        Label loop = local();
+        Label end = local();
+        Label ret = local();
+        Label eof = local();
+
+        bind(m_readInt);
+        op(Op::PUSH, Reg::RBX);
+        op(Op::PUSH, Reg::R12);
+        lockIo();
+        bind(skip);
+        op(Op::CALL, m_nextByte);
+        op(Op::CMP, Reg::RAX, Imm{-1});
+        jcc(Cond::E, eof);
+        op(Op::CMP, Reg::RAX, Imm{' '});
+        jcc(Cond::LE, skip);
+
+        op(Op::MOV, Reg::R12, Imm{0});
+        op(Op::CMP, Reg::RAX, Imm{'-'});
+        jcc(Cond::NE, digits);
+        op(Op::MOV, Reg::R12, Imm{1});
+        op(Op::CALL, m_nextByte);
+        bind(digits);
+        op(Op::MOV, Reg::RBX, Imm{0});
+        bind(loop);
+        op(Op::SUB, Reg::RAX, Imm{'0'});
+        op(Op::CMP, Reg::RAX, Imm{9});
+        jcc(Cond::A, end);
+        op(Op::LEA, Reg::RBX, mem(8, Reg::RBX, Reg::RBX, 4));
+        op(Op::ADD, Reg::RBX, Reg::RBX);
+        op(Op::ADD, Reg::RBX, Reg::RAX);
+        op(Op::CALL, m_nextByte);
+        op(Op::JMP, loop);
+        bind(end);
+        op(Op::MOV, Reg::RAX, Reg::RBX);
+        op(Op::TEST, Reg::R12, Reg::R12);
+        jcc(Cond::E, ret);
+        op(Op::NEG, Reg::RAX);
+        bind(ret);
+        unlockIo();
+        op(Op::POP, Reg::R12);
+        op(Op::POP, Reg::RBX);
+        op(Op::RET);
+        bind(eof);
+        op(Op::MOV, Reg::RAX, Imm{0});
+        op(Op::JMP, ret);
+    }
+
+    void emitBoundsFail() {
+        bind(m_boundsFail);
+        fail(m_boundsMsg, BOUNDS_MSG);
+    }
+
+    // flushes what was printed so far, reports on stderr and exits with 1
+    void fail(Label msg, std::string_view text) {
+        lockIo();
+        op(Op::CALL, m_flush);
+        op(Op::MOV, Reg::RDI, Imm{2});
+        op(Op::LEA, Reg::RSI, qword(msg));
+        op(Op::MOV, Reg::RDX, Imm{static_cast<int64_t>(text.size())});
+        op(Op::MOV, Reg::RAX, Imm{1});
+        op(Op::SYSCALL);
+        if (!m_profilePath.empty()) {
+            op(Op::CALL, m_writeProfile);
+        }
+        op(Op::MOV, Reg::RDI, Imm{1});
+        sysExit();
+    }
+
+    // bump allocation from chunks mmap'd on demand, CHUNK_SIZE or one block's
+    // worth, whichever is larger. each thread has a heap of its own in its block. a chunk starts with a header: the chunk before
+    // it, its own size and what was fresh in the one before. fresh is where the
+    // current chunk's never handed out bytes begin, which are still the kernel's
+    // zero pages, so only reused bytes are cleared. chunks of a huge page or more
+    // are advised to use them
+    void emitAlloc() {
+        Label fit = local();
+        Label same = local();
+        Label partial = local();
+        Label zeroed = local();
+        Label grow = local();
+        Label sized = local();
+        Label small = local();
+        Label tooBig = local();
+        Label noMemory = local();
+
+        bind(m_alloc);
+        op(Op::CMP, Reg::RDI, Imm{MAX_ARRAY_LENGTH});
+        jcc(Cond::A, tooBig);
+        op(Op::IMUL, Reg::RDI, Reg::RSI);
+        op(Op::ADD, Reg::RDI, Imm{7});
+        op(Op::AND, Reg::RDI, Imm{-8});
+        op(Op::MOV, Reg::RAX, gsQword(HEAP_TOP));
+        op(Op::MOV, Reg::R8, Reg::RAX);
+        op(Op::MOV, Reg::RDX, gsQword(HEAP_END));
+        op(Op::SUB, Reg::RDX, Reg::RAX);
+        op(Op::CMP, Reg::RDI, Reg::RDX);
+        jcc(Cond::A, grow);
+
+        // rax the block, rdi its bytes, r8 the top before it
+        bind(fit);
+        op(Op::LEA, Reg::RDX, mem(8, Reg::RAX, Reg::RDI, 1));
+        op(Op::MOV, gsQword(HEAP_TOP), Reg::RDX);
+        op(Op::MOV, Reg::RCX, gsQword(HEAP_FRESH));
+        op(Op::CMP, Reg::RDX, Reg::RCX);
+        jcc(Cond::BE, same);
+        op(Op::MOV, gsQword(HEAP_FRESH), Reg::RDX);
+        bind(same);
+        op(Op::SUB, Reg::RCX, Reg::RAX);
+        jcc(Cond::BE, zeroed);
+        op(Op::CMP, Reg::RCX, Reg::RDI);
+        jcc(Cond::BE, partial);
+        op(Op::MOV, Reg::RCX, Reg::RDI);
+        bind(partial);
+        op(Op::SHR, Reg::RCX, Imm{3});
+        op(Op::MOV, Reg::RSI, Reg::RAX);
+        op(Op::MOV, Reg::RDI, Reg::RAX);
+        op(Op::MOV, Reg::RAX, Imm{0});
+        op(Op::REP_STOSQ);
+        op(Op::MOV, Reg::RAX, Reg::RSI);
+        bind(zeroed);
+        op(Op::MOV, Reg::RDX, Reg::R8);
+        op(Op::RET);
+
+        // mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+        bind(grow);
+        op(Op::PUSH, Reg::R8);
+        op(Op::PUSH, Reg::RDI);
+        op(Op::LEA, Reg::RSI, qword(Reg::RDI, static_cast<int32_t>(CHUNK_HEADER + PAGE_SIZE - 1)));
+        op(Op::AND, Reg::RSI, Imm{-PAGE_SIZE});
+        op(Op::CMP, Reg::RSI, Imm{CHUNK_SIZE});
+        jcc(Cond::AE, sized);
+        op(Op::MOV, Reg::RSI, Imm{CHUNK_SIZE});
+        bind(sized);
+        op(Op::PUSH, Reg::RSI);
+        op(Op::MOV, Reg::RDI, Imm{0});
+        op(Op::MOV, Reg::RDX, Imm{3});
+        op(Op::MOV, Reg::R10, Imm{0x22});
+        op(Op::MOV, Reg::R8, Imm{-1});
+        op(Op::MOV, Reg::R9, Imm{0});
+        op(Op::MOV, Reg::RAX, Imm{9});
+        op(Op::SYSCALL);
+        op(Op::CMP, Reg::RAX, Imm{-4096});
+        jcc(Cond::A, noMemory);
+        op(Op::POP, Reg::RSI);
+
+        // madvise(chunk, size, MADV_HUGEPAGE), a hint whose failure changes nothing
+        op(Op::CMP, Reg::RSI, Imm{HUGE_PAGE_SIZE});
+        jcc(Cond::B, small);
+        op(Op::PUSH, Reg::RAX);
+        op(Op::PUSH, Reg::RSI);
+        op(Op::MOV, Reg::RDI, Reg::RAX);
+        op(Op::MOV, Reg::RDX, Imm{14});
+        op(Op::MOV, Reg::RAX, Imm{28});
+        op(Op::SYSCALL);
+        op(Op::POP, Reg::RSI);
+        op(Op::POP, Reg::RAX);
+        bind(small);
+
+        op(Op::MOV, Reg::RCX, gsQword(HEAP_CHUNK));
+        op(Op::MOV, qword(Reg::RAX), Reg::RCX);
+        op(Op::MOV, qword(Reg::RAX, 8), Reg::RSI);
+        op(Op::MOV, Reg::RCX, gsQword(HEAP_FRESH));
+        op(Op::MOV, qword(Reg::RAX, 16), Reg::RCX);
+        op(Op::MOV, gsQword(HEAP_CHUNK), Reg::RAX);
+        op(Op::LEA, Reg::RCX, mem(8, Reg::RAX, Reg::RSI, 1));
+        op(Op::MOV, gsQword(HEAP_END), Reg::RCX);
+        op(Op::ADD, Reg::RAX, Imm{CHUNK_HEADER});
+        op(Op::MOV, gsQword(HEAP_FRESH), Reg::RAX);
+        op(Op::POP, Reg::RDI);
+        op(Op::POP, Reg::R8);
+        op(Op::JMP, fit);
+
+        bind(tooBig);
+        fail(m_sizeMsg, SIZE_MSG);
+        bind(noMemory);
+        fail(m_memoryMsg, MEMORY_MSG);
+    }
+
+    // chunks the top in rdi isn't in were taken after it, so they are unmapped,
+    // latest first, until the one it points into
+    void emitRelease() {
+        Label loop = local();
+        Label unmap = local();
+        Label empty = local();
+        Label done = local();
+
+        bind(m_release);
+        op(Op::PUSH, Reg::RAX);
+        bind(loop);
+        op(Op::MOV, Reg::RSI, gsQword(HEAP_CHUNK));
+        op(Op::TEST, Reg::RSI, Reg::RSI);
+        jcc(Cond::E, done);
+        op(Op::CMP, Reg::RDI, Reg::RSI);
+        jcc(Cond::BE, unmap);
+        op(Op::CMP, Reg::RDI, gsQword(HEAP_END));
+        jcc(Cond::A, unmap);
+        op(Op::MOV, gsQword(HEAP_TOP), Reg::RDI);
+        op(Op::JMP, done);
+
+        // munmap(chunk, size)
+        bind(unmap);
+        op(Op::PUSH, Reg::RDI);
+        op(Op::MOV, Reg::RDI, Reg::RSI);
+        op(Op::MOV, Reg::RSI, qword(Reg::RDI, 8));
+        op(Op::MOV, Reg::RCX, qword(Reg::RDI));
+        op(Op::MOV, gsQword(HEAP_CHUNK), Reg::RCX);
+        op(Op::MOV, Reg::RCX, qword(Reg::RDI, 16));
+        op(Op::MOV, gsQword(HEAP_FRESH), Reg::RCX);
+        op(Op::MOV, Reg::RAX, Imm{11});
+        op(Op::SYSCALL);
+        op(Op::POP, Reg::RDI);
+        op(Op::MOV, Reg::RSI, gsQword(HEAP_CHUNK));
+        op(Op::TEST, Reg::RSI, Reg::RSI);
+        jcc(Cond::E, empty);
+        op(Op::MOV, Reg::RCX, qword(Reg::RSI, 8));
+        op(Op::ADD, Reg::RCX, Reg::RSI);
+        op(Op::MOV, gsQword(HEAP_END), Reg::RCX);
+        op(Op::JMP, loop);
+        bind(empty);
+        op(Op::MOV, gsQword(HEAP_TOP), Imm{0});
+        op(Op::MOV, gsQword(HEAP_END), Imm{0});
+        bind(done);
+        op(Op::POP, Reg::RAX);
+        op(Op::RET);
+    }
+
+    // the main thread's block is the first one. workers only start with the
+    // first parallel construct, until then this is the only thread
+    void emitInit() {
+        bind(m_init);
+        blocksBase(Reg::RSI);
+        op(Op::MOV, qword(Reg::RSI, BLOCK_SELF), Reg::RSI);
+        op(Op::MOV, qword(m_workers), Imm{1});
+        setGs();
+        op(Op::RET);
+    }
+
+    // one worker per cpu in the affinity mask, up to MAX_WORKERS, counting the
+    // main thread. each gets a block and a stack with a guard page below it,
+    // and finds its block on top of that stack when clone returns there
+    void emitStartWorkers() {
+        Label start = local();
+        Label qwords = local();
+        Label bits = local();
+        Label counted = local();
+        Label fits = local();
+        Label next = local();
+        Label done = local();
+        Label child = local();
+
+        bind(m_startWorkers);
+        op(Op::CMP, qword(m_started), Imm{0});
+        jcc(Cond::E, start);
+        op(Op::RET);
+        bind(start);
+        op(Op::MOV, qword(m_started), Imm{1});
+        if (m_hosted) {
+            op(Op::RET);
+            return;
+        }
+        op(Op::PUSH, Reg::RBP);
+        op(Op::MOV, Reg::RBP, Reg::RSP);
+        op(Op::SUB, Reg::RSP, Imm{128});
+
+        // sched_getaffinity(0, 128, mask), rax is the bytes it wrote
+        op(Op::MOV, Reg::RDI, Imm{0});
+        op(Op::MOV, Reg::RSI, Imm{128});
+        op(Op::MOV, Reg::RDX, Reg::RSP);
+        op(Op::MOV, Reg::RAX, Imm{204});
+        op(Op::SYSCALL);
+        op(Op::MOV, Reg::RCX, Imm{0});
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::LE, counted);
+        op(Op::MOV, Reg::RSI, Reg::RSP);
+        op(Op::LEA, Reg::RDX, mem(8, Reg::RSP, Reg::RAX, 1));
+        bind(qwords);
+        op(Op::CMP, Reg::RSI, Reg::RDX);
+        jcc(Cond::AE, counted);
+        op(Op::MOV, Reg::R8, qword(Reg::RSI));
+        op(Op::ADD, Reg::RSI, Imm{8});
+        bind(bits);
+        op(Op::TEST, Reg::R8, Reg::R8);
+        jcc(Cond::E, qwords);
+        op(Op::LEA, Reg::R9, qword(Reg::R8, -1));
+        op(Op::AND, Reg::R8, Reg::R9);
+        op(Op::ADD, Reg::RCX, Imm{1});
+        op(Op::JMP, bits);
+        bind(counted);
+        op(Op::CMP, Reg::RCX, Imm{1});
+        jcc(Cond::BE, done);
+        op(Op::CMP, Reg::RCX, Imm{MAX_WORKERS});
+        jcc(Cond::BE, fits);
+        op(Op::MOV, Reg::RCX, Imm{MAX_WORKERS});
+        bind(fits);
+        op(Op::MOV, qword(m_workers), Reg::RCX);
+
+        // r12 the next worker's index, r13 how many there are, rbx its block, r14 its stack.
+        // blocks of workers that fail to start stay empty, thieves find nothing there
+        op(Op::MOV, Reg::R13, Reg::RCX);
+        op(Op::MOV, Reg::R12, Imm{1});
+        bind(next);
+        op(Op::CMP, Reg::R12, Reg::R13);
+        jcc(Cond::AE, done);
+        blocksBase(Reg::RBX);
+        imul3(Reg::RAX, Reg::R12, BLOCK_SIZE);
+        op(Op::ADD, Reg::RBX, Reg::RAX);
+        op(Op::MOV, qword(Reg::RBX, BLOCK_SELF), Reg::RBX);
+        op(Op::MOV, qword(Reg::RBX, BLOCK_INDEX), Reg::R12);
+
+        // mmap(0, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0)
+        op(Op::MOV, Reg::RDI, Imm{0});
+        op(Op::MOV, Reg::RSI, Imm{STACK_SIZE});
+        op(Op::MOV, Reg::RDX, Imm{3});
+        op(Op::MOV, Reg::R10, Imm{0x20022});
+        op(Op::MOV, Reg::R8, Imm{-1});
+        op(Op::MOV, Reg::R9, Imm{0});
+        op(Op::MOV, Reg::RAX, Imm{9});
+        op(Op::SYSCALL);
+        op(Op::CMP, Reg::RAX, Imm{-4096});
+        jcc(Cond::A, done);
+        op(Op::MOV, Reg::R14, Reg::RAX);
+        // mprotect(stack, PAGE_SIZE, PROT_NONE)
+        op(Op::MOV, Reg::RDI, Reg::RAX);
+        op(Op::MOV, Reg::RSI, Imm{PAGE_SIZE});
+        op(Op::MOV, Reg::RDX, Imm{0});
+        op(Op::MOV, Reg::RAX, Imm{10});
+        op(Op::SYSCALL);
+
+        // clone(CLONE_FLAGS, stack top, 0, 0, 0)
+        op(Op::LEA, Reg::RSI, qword(Reg::R14, static_cast<int32_t>(STACK_SIZE - 16)));
+        op(Op::MOV, qword(Reg::RSI), Reg::RBX);
+        op(Op::MOV, Reg::RDI, Imm{CLONE_FLAGS});
+        op(Op::MOV, Reg::RDX, Imm{0});
+        op(Op::MOV, Reg::R10, Imm{0});
+        op(Op::MOV, Reg::R8, Imm{0});
+        op(Op::MOV, Reg::RAX, Imm{56});
+        op(Op::SYSCALL);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::E, child);
+        jcc(Cond::S, done);
+        op(Op::ADD, Reg::R12, Imm{1});
+        op(Op::JMP, next);
+        bind(done);
+        op(Op::LEAVE);
+        op(Op::RET);
+
+        bind(child);
+        op(Op::POP, Reg::RSI);
+        setGs();
+        op(Op::JMP, m_worker);
+    }
+
+    // takes its own tasks, then other workers', and sleeps on the work count
+    // when there are none. a push after the count was read changes it, so the
+    // futex doesn't sleep through it
+    void emitWorker() {
+        Label loop = local();
+        Label run = local();
+
+        bind(m_worker);
+        op(Op::SUB, Reg::RSP, Imm{72});
+        bind(loop);
+        op(Op::MOV, Reg::RAX, qword(m_workSeq));
+        op(Op::MOV, qword(Reg::RSP, TASK_SIZE), Reg::RAX);
+        op(Op::MOV, Reg::RDI, Reg::RSP);
+        op(Op::CALL, m_takeTask);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::NE, run);
+        op(Op::MOV, Reg::RDI, Reg::RSP);
+        op(Op::CALL, m_stealTask);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::NE, run);
+
+        // futex(work count, FUTEX_WAIT_PRIVATE, the count seen, no timeout)
+        op(Op::MOV, Reg::RAX, Imm{1});
+        op(Op::LOCK_XADD, qword(m_sleepers), Reg::RAX);
+        op(Op::LEA, Reg::RDI, qword(m_workSeq));
+        op(Op::MOV, Reg::RSI, Imm{FUTEX_WAIT_PRIVATE});
+        op(Op::MOV, Reg::RDX, qword(Reg::RSP, TASK_SIZE));
+        op(Op::MOV, Reg::R10, Imm{0});
+        op(Op::MOV, Reg::RAX, Imm{202});
+        op(Op::SYSCALL);
+        op(Op::MOV, Reg::RAX, Imm{-1});
+        op(Op::LOCK_XADD, qword(m_sleepers), Reg::RAX);
+        op(Op::JMP, loop);
+
+        bind(run);
+        op(Op::MOV, Reg::RDI, Reg::RSP);
+        op(Op::CALL, m_runTask);
+        op(Op::JMP, loop);
+    }
+
+    // the task at rdi stays where it is while its entry runs, then it counts as done
+    void emitRunTask() {
+        bind(m_runTask);
+        op(Op::PUSH, qword(Reg::RDI, TASK_COUNT));
+        op(Op::CALL, qword(Reg::RDI, TASK_ENTRY));
+        op(Op::POP, Reg::RCX);
+        op(Op::MOV, Reg::RAX, Imm{-1});
+        op(Op::LOCK_XADD, qword(Reg::RCX), Reg::RAX);
+        op(Op::RET);
+    }
+
+    // copies the task at rdi to the bottom of this thread's deque and wakes a
+    // sleeping worker for it. a full deque runs the task right away instead
+    void emitPushTask() {
+        Label full = local();
+        Label done = local();
+
+        bind(m_pushTask);
+        op(Op::MOV, Reg::RCX, qword(Reg::RDI, TASK_COUNT));
+        op(Op::MOV, Reg::RAX, Imm{1});
+        op(Op::LOCK_XADD, qword(Reg::RCX), Reg::RAX);
+        op(Op::MOV, Reg::R8, gsQword(BLOCK_SELF));
+        op(Op::MOV, Reg::RAX, qword(Reg::R8, DEQUE_BOTTOM));
+        op(Op::MOV, Reg::RDX, Reg::RAX);
+        op(Op::SUB, Reg::RDX, qword(Reg::R8, DEQUE_TOP));
+        op(Op::CMP, Reg::RDX, Imm{DEQUE_SIZE});
+        jcc(Cond::GE, full);
+        slot(Reg::RDX, Reg::RAX, Reg::R8);
+        copyTask(qword(Reg::RDX, DEQUE_SLOTS), qword(Reg::RDI), Reg::RCX);
+        op(Op::ADD, Reg::RAX, Imm{1});
+        op(Op::MOV, qword(Reg::R8, DEQUE_BOTTOM), Reg::RAX);
+
+        // futex(work count, FUTEX_WAKE_PRIVATE, 1) if anyone sleeps on it
+        op(Op::MOV, Reg::RAX, Imm{1});
+        op(Op::LOCK_XADD, qword(m_workSeq), Reg::RAX);
+        op(Op::CMP, qword(m_sleepers), Imm{0});
+        jcc(Cond::E, done);
+        op(Op::LEA, Reg::RDI, qword(m_workSeq));
+        op(Op::MOV, Reg::RSI, Imm{FUTEX_WAKE_PRIVATE});
+        op(Op::MOV, Reg::RDX, Imm{1});
+        op(Op::MOV, Reg::RAX, Imm{202});
+        op(Op::SYSCALL);
+        bind(done);
+        op(Op::RET);
+        bind(full);
+        op(Op::JMP, m_runTask);
+    }
+
+    // the newest task of this thread's deque into the 64 bytes at rdi, rax 1, or
+    // rax 0 when it is empty. bottom moves first, through a locked xchg so the
+    // top read after it is current; a thief wanting the same last task races
+    // for it on top
+    void emitTakeTask() {
+        Label got = local();
+        Label empty = local();
+        Label lost = local();
+
+        bind(m_takeTask);
+        op(Op::MOV, Reg::R8, gsQword(BLOCK_SELF));
+        op(Op::MOV, Reg::RAX, qword(Reg::R8, DEQUE_BOTTOM));
+        op(Op::SUB, Reg::RAX, Imm{1});
+        op(Op::MOV, Reg::RDX, Reg::RAX);
+        op(Op::XCHG, qword(Reg::R8, DEQUE_BOTTOM), Reg::RDX);
+        op(Op::MOV, Reg::RCX, qword(Reg::R8, DEQUE_TOP));
+        op(Op::CMP, Reg::RCX, Reg::RAX);
+        jcc(Cond::G, empty);
+        slot(Reg::RDX, Reg::RAX, Reg::R8);
+        copyTask(qword(Reg::RDI), qword(Reg::RDX, DEQUE_SLOTS), Reg::R9);
+        op(Op::CMP, Reg::RCX, Reg::RAX);
+        jcc(Cond::NE, got);
+        op(Op::LEA, Reg::RDX, qword(Reg::RCX, 1));
+        op(Op::MOV, Reg::RAX, Reg::RCX);
+        op(Op::LOCK_CMPXCHG, qword(Reg::R8, DEQUE_TOP), Reg::RDX);
+        op(Op::MOV, qword(Reg::R8, DEQUE_BOTTOM), Reg::RDX);
+        jcc(Cond::NE, lost);
+        bind(got);
+        op(Op::MOV, Reg::RAX, Imm{1});
+        op(Op::RET);
+        bind(empty);
+        op(Op::ADD, Reg::RAX, Imm{1});
+        op(Op::MOV, qword(Reg::R8, DEQUE_BOTTOM), Reg::RAX);
+        bind(lost);
+        op(Op::MOV, Reg::RAX, Imm{0});
+        op(Op::RET);
+    }
+
+    // the oldest task of another thread's deque into the 64 bytes at rdi, rax 1,
+    // or rax 0 when none had one to give. each other worker is tried once, from
+    // the next one on. the task is copied before top moves past it, a failed
+    // move means someone else got it
+    void emitStealTask() {
+        Label next = local();
+        Label wrapped = local();
+        Label none = local();
+
+        bind(m_stealTask);
+        op(Op::MOV, Reg::R8, gsQword(BLOCK_SELF));
+        op(Op::MOV, Reg::R9, qword(Reg::R8, BLOCK_INDEX));
+        op(Op::MOV, Reg::R10, qword(m_workers));
+        op(Op::MOV, Reg::R11, Reg::R10);
+        blocksBase(Reg::RSI);
+        bind(next);
+        op(Op::SUB, Reg::R11, Imm{1});
+        jcc(Cond::LE, none);
+        op(Op::ADD, Reg::R9, Imm{1});
+        op(Op::CMP, Reg::R9, Reg::R10);
+        jcc(Cond::B, wrapped);
+        op(Op::MOV, Reg::R9, Imm{0});
+        bind(wrapped);
+        imul3(Reg::RDX, Reg::R9, BLOCK_SIZE);
+        op(Op::ADD, Reg::RDX, Reg::RSI);
+        op(Op::MOV, Reg::RCX, qword(Reg::RDX, DEQUE_TOP));
+        op(Op::CMP, Reg::RCX, qword(Reg::RDX, DEQUE_BOTTOM));
+        jcc(Cond::GE, next);
+        slot(Reg::RAX, Reg::RCX, Reg::RDX);
+        copyTask(qword(Reg::RDI), qword(Reg::RAX, DEQUE_SLOTS), Reg::R8);
+        op(Op::LEA, Reg::R8, qword(Reg::RCX, 1));
+        op(Op::MOV, Reg::RAX, Reg::RCX);
+        op(Op::LOCK_CMPXCHG, qword(Reg::RDX, DEQUE_TOP), Reg::R8);
+        jcc(Cond::NE, next);
+        op(Op::MOV, Reg::RAX, Imm{1});
+        op(Op::RET);
+        bind(none);
+        op(Op::MOV, Reg::RAX, Imm{0});
+        op(Op::RET);
+    }
+
+    // whoever waits for tasks runs them meanwhile: its own first, the ones it
+    // pushed last, then any other thread's
+    void emitJoin() {
+        Label loop = local();
+        Label run = local();
+        Label done = local();
+
+        bind(m_join);
+        op(Op::PUSH, Reg::RBP);
+        op(Op::MOV, Reg::RBP, Reg::RSP);
+        op(Op::PUSH, Reg::RDI);
+        op(Op::SUB, Reg::RSP, Imm{72});
+        bind(loop);
+        op(Op::MOV, Reg::RAX, qword(Reg::RBP, -8));
+        op(Op::CMP, qword(Reg::RAX), Imm{0});
+        jcc(Cond::E, done);
+        op(Op::MOV, Reg::RDI, Reg::RSP);
+        op(Op::CALL, m_takeTask);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::NE, run);
+        op(Op::MOV, Reg::RDI, Reg::RSP);
+        op(Op::CALL, m_stealTask);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::NE, run);
+        op(Op::PAUSE);
+        op(Op::JMP, loop);
+        bind(run);
+        op(Op::MOV, Reg::RDI, Reg::RSP);
+        op(Op::CALL, m_runTask);
+        op(Op::JMP, loop);
+        bind(done);
+        op(Op::LEAVE);
+        op(Op::RET);
+    }
+
+    // the whole range is one task, run here, that splits itself. it stops at a
+    // grain that leaves GRAIN_SPLIT ranges per worker, or not at all with one
+    void emitParallelFor() {
+        Label run = local();
+        Label none = local();
+
+        bind(m_parallelFor);
+        op(Op::CMP, Reg::RDX, Reg::RCX);
+        jcc(Cond::GE, none);
+        op(Op::PUSH, Reg::RBP);
+        op(Op::MOV, Reg::RBP, Reg::RSP);
+        op(Op::SUB, Reg::RSP, Imm{80});
+        op(Op::LEA, Reg::RAX, qword(m_taskRange));
+        op(Op::MOV, qword(Reg::RSP, TASK_ENTRY), Reg::RAX);
+        op(Op::LEA, Reg::RAX, qword(Reg::RSP, TASK_SIZE));
+        op(Op::MOV, qword(Reg::RSP, TASK_COUNT), Reg::RAX);
+        op(Op::MOV, qword(Reg::RSP, TASK_FUNC), Reg::RDI);
+        op(Op::MOV, qword(Reg::RSP, TASK_ENV), Reg::RSI);
+        op(Op::MOV, qword(Reg::RSP, TASK_LO), Reg::RDX);
+        op(Op::MOV, qword(Reg::RSP, TASK_HI), Reg::RCX);
+        op(Op::MOV, qword(Reg::RSP, TASK_SIZE), Imm{1});
+        op(Op::CALL, m_startWorkers);
+
+        op(Op::MOV, Reg::RAX, qword(Reg::RSP, TASK_HI));
+        op(Op::SUB, Reg::RAX, qword(Reg::RSP, TASK_LO));
+        op(Op::MOV, Reg::RCX, qword(m_workers));
+        op(Op::CMP, Reg::RCX, Imm{1});
+        jcc(Cond::E, run);
+        imul3(Reg::RCX, Reg::RCX, GRAIN_SPLIT);
+        op(Op::MOV, Reg::RDX, Imm{0});
+        op(Op::DIV, Reg::RCX);
+        op(Op::CMP, Reg::RAX, Imm{1});
+        jcc(Cond::AE, run);
+        op(Op::MOV, Reg::RAX, Imm{1});
+        bind(run);
+        op(Op::MOV, qword(Reg::RSP, TASK_GRAIN), Reg::RAX);
+        op(Op::MOV, Reg::RDI, Reg::RSP);
+        op(Op::CALL, m_runTask);
+        op(Op::LEA, Reg::RDI, qword(Reg::RSP, TASK_SIZE));
+        op(Op::CALL, m_join);
+        op(Op::LEAVE);
+        bind(none);
+        op(Op::RET);
+    }
+
+    // halves its range while it is above the grain, pushing the upper half for
+    // a thief and keeping the lower, then calls the body on what is left
+    void emitTaskRange() {
+        Label split = local();
+        Label leaf = local();
+
+        bind(m_taskRange);
+        op(Op::PUSH, Reg::RBP);
+        op(Op::MOV, Reg::RBP, Reg::RSP);
+        op(Op::PUSH, Reg::RDI);
+        op(Op::SUB, Reg::RSP, Imm{72});
+        bind(split);
+        op(Op::MOV, Reg::RDI, qword(Reg::RBP, -8));
+        op(Op::MOV, Reg::RAX, qword(Reg::RDI, TASK_HI));
+        op(Op::SUB, Reg::RAX, qword(Reg::RDI, TASK_LO));
+        op(Op::CMP, Reg::RAX, qword(Reg::RDI, TASK_GRAIN));
+        jcc(Cond::BE, leaf);
+        op(Op::SHR, Reg::RAX, Imm{1});
+        op(Op::ADD, Reg::RAX, qword(Reg::RDI, TASK_LO));
+        copyTask(qword(Reg::RSP), qword(Reg::RDI), Reg::RCX);
+        op(Op::MOV, qword(Reg::RSP, TASK_LO), Reg::RAX);
+        op(Op::MOV, qword(Reg::RDI, TASK_HI), Reg::RAX);
+        op(Op::MOV, Reg::RDI, Reg::RSP);
+        op(Op::CALL, m_pushTask);
+        op(Op::JMP, split);
+        bind(leaf);
+        op(Op::MOV, Reg::RAX, qword(Reg::RDI, TASK_FUNC));
+        op(Op::MOV, Reg::RDX, qword(Reg::RDI, TASK_ENV));
+        op(Op::MOV, Reg::RSI, qword(Reg::RDI, TASK_HI));
+        op(Op::MOV, Reg::RDI, qword(Reg::RDI, TASK_LO));
+        op(Op::CALL, Reg::RAX);
+        op(Op::LEAVE);
+        op(Op::RET);
+    }
+
+    // the arguments were pushed first to last, so argument i is argc - 1 - i
+    // qwords above rcx. the task keeps them first to last
+    void emitSpawn() {
+        Label copy = local();
+        Label copied = local();
+
+        bind(m_spawn);
+        op(Op::PUSH, Reg::RBP);
+        op(Op::MOV, Reg::RBP, Reg::RSP);
+        op(Op::SUB, Reg::RSP, Imm{TASK_SIZE});
+        op(Op::LEA, Reg::RAX, qword(m_taskCall));
+        op(Op::MOV, qword(Reg::RSP, TASK_ENTRY), Reg::RAX);
+        op(Op::MOV, qword(Reg::RSP, TASK_COUNT), Reg::RDI);
+        op(Op::MOV, qword(Reg::RSP, TASK_FUNC), Reg::RSI);
+        op(Op::MOV, qword(Reg::RSP, TASK_ARGC), Reg::RDX);
+        op(Op::MOV, Reg::R8, Imm{0});
+        bind(copy);
+        op(Op::CMP, Reg::R8, Reg::RDX);
+        jcc(Cond::AE, copied);
+        op(Op::MOV, Reg::R9, Reg::RDX);
+        op(Op::SUB, Reg::R9, Reg::R8);
+        op(Op::MOV, Reg::R10, mem(8, Reg::RCX, Reg::R9, 8, -8));
+        op(Op::MOV, mem(8, Reg::RSP, Reg::R8, 8, TASK_ARGS), Reg::R10);
+        op(Op::ADD, Reg::R8, Imm{1});
+        op(Op::JMP, copy);
+        bind(copied);
+        op(Op::CALL, m_startWorkers);
+        op(Op::MOV, Reg::RDI, Reg::RSP);
+        op(Op::CALL, m_pushTask);
+        op(Op::LEAVE);
+        op(Op::RET);
+    }
+
+    // pushes the arguments back the way a call does, with rsp 16-byte aligned at it
+    void emitTaskCall() {
+        Label even = local();
+        Label args = local();
+        Label call = local();
+
+        bind(m_taskCall);
+        op(Op::PUSH, Reg::RBP);
+        op(Op::MOV, Reg::RBP, Reg::RSP);
+        op(Op::MOV, Reg::RCX, qword(Reg::RDI, TASK_ARGC));
+        op(Op::AND, Reg::RSP, Imm{-16});
+        op(Op::TEST, Reg::RCX, Imm{1});
+        jcc(Cond::E, even);
+        op(Op::SUB, Reg::RSP, Imm{8});
+        bind(even);
+        op(Op::MOV, Reg::RDX, Imm{0});
+        bind(args);
+        op(Op::CMP, Reg::RDX, Reg::RCX);
+        jcc(Cond::AE, call);
+        op(Op::PUSH, mem(8, Reg::RDI, Reg::RDX, 8, TASK_ARGS));
+        op(Op::ADD, Reg::RDX, Imm{1});
+        op(Op::JMP, args);
+        bind(call);
+        op(Op::CALL, qword(Reg::RDI, TASK_FUNC));
+        op(Op::LEAVE);
+        op(Op::RET);
+    }
+
+    // a test and set lock around the stdio buffers, clobbers rax
+    void lockIo() {
+        Label spin = local();
+        Label held = local();
+        bind(spin);
+        op(Op::MOV, Reg::RAX, Imm{1});
+        op(Op::XCHG, qword(m_ioLock), Reg::RAX);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::E, held);
+        op(Op::PAUSE);
+        op(Op::JMP, spin);
+        bind(held);
+    }
+
+    void unlockIo() {
+        op(Op::MOV, qword(m_ioLock), Imm{0});
+    }
+
+    // arch_prctl(ARCH_SET_GS, block in rsi)
+    void setGs() {
+        op(Op::MOV, Reg::RDI, Imm{ARCH_SET_GS});
+        op(Op::MOV, Reg::RAX, Imm{158});
+        op(Op::SYSCALL);
+    }
+
+    // the blocks start at the first cache line of their bss
+    void blocksBase(Reg reg) {
+        op(Op::LEA, reg, qword(m_blocks));
+        op(Op::ADD, reg, Imm{CACHE_LINE - 1});
+        op(Op::AND, reg, Imm{-CACHE_LINE});
+    }
+
+    // dst = the offset of task index's slot in block, relative to DEQUE_SLOTS
+    void slot(Reg dst, Reg index, Reg block) {
+        op(Op::MOV, dst, index);
+        op(Op::AND, dst, Imm{DEQUE_SIZE - 1});
+        op(Op::SHL, dst, Imm{6});
+        op(Op::ADD, dst, block);
+    }
+
+    void copyTask(Operand dst, Operand src, Reg tmp) {
+        for (int32_t i = 0; i < TASK_SIZE; i += 8) {
+            Operand from = src;
+            Operand to = dst;
+            from.val += i;
+            to.val += i;
+            op(Op::MOV, tmp, from);
+            op(Op::MOV, to, tmp);
+        }
+    }
+
+    // open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644), then the magic and each
+    // module's header and counters. a file that can't be opened is skipped
+    void emitWriteProfile() {
+        if (m_profilePath.empty()) {
+            return;
+        }
+        Label path = local();
+        Label header = local();
+        Label done = local();
+
+        std::string bytes = m_profilePath;
+        bytes.push_back('\0');
+        m_prog.rodata.push_back({path, packBytes(bytes)});
+        std::vector<int64_t> headerData{static_cast<int64_t>(Profile::MAGIC)};
+        for (const ProfileOut& module : m_profileModules) {
+            headerData.push_back(static_cast<int64_t>(module.tokenHash));
+            headerData.push_back(static_cast<int64_t>(module.sites));
+        }
+        m_prog.rodata.push_back({header, headerData});
+
+        auto write = [this](Label buf, int32_t offset, int64_t len) {
+            Operand src = qword(buf);
+            src.val = offset;
+            op(Op::MOV, Reg::RAX, Imm{1});
+            op(Op::MOV, Reg::RDI, Reg::R12);
+            op(Op::LEA, Reg::RSI, src);
+            op(Op::MOV, Reg::RDX, Imm{len});
+            op(Op::SYSCALL);
+        };
+
+        bind(m_writeProfile);
+        op(Op::MOV, Reg::RAX, Imm{2});
+        op(Op::LEA, Reg::RDI, qword(path));
+        op(Op::MOV, Reg::RSI, Imm{0x241});
+        op(Op::MOV, Reg::RDX, Imm{0644});
+        op(Op::SYSCALL);
+        op(Op::TEST, Reg::RAX, Reg::RAX);
+        jcc(Cond::S, done);
+        op(Op::MOV, Reg::R12, Reg::RAX);
+
+        write(header, 0, 8);
+        for (size_t i = 0; i < m_profileModules.size(); ++i) {
+            write(header, static_cast<int32_t>(8 + i * 16), 16);
+            write(m_profileModules[i].counters, 0, static_cast<int64_t>(m_profileModules[i].sites * 8));
+        }
+        op(Op::MOV, Reg::RAX, Imm{3});
+        op(Op::MOV, Reg::RDI, Reg::R12);
+        op(Op::SYSCALL);
+        bind(done);
+        op(Op::RET);
+    }
+
+    // little endian into qwords, zero padded
+    static std::vector<int64_t> packBytes(std::string_view bytes) {
+        std::vector<int64_t> qwords((bytes.size() + 7) / 8, 0);
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            uint64_t c = static_cast<uint8_t>(bytes[i]);
+            qwords[i / 8] = static_cast<int64_t>(static_cast<uint64_t>(qwords[i / 8]) | c << (i % 8 * 8));
+        }
+        return qwords;
+    }
+
+    // "00".."99" back to back
+    static std::vector<int64_t> digitPairs() {
+        std::string pairs;
+        for (int i = 0; i < 100; ++i) {
+            pairs += static_cast<char>('0' + i / 10);
+            pairs += static_cast<char>('0' + i % 10);
+        }
+        return packBytes(pairs);
+    }
+
+    Label label(const std::string& name) {
+        m_prog.labels.push_back(name);
+        return Label{static_cast<uint32_t>(m_prog.labels.size() - 1)};
+    }
+
+    Label local() {
+        return label(".rt" + std::to_string(m_localCount++));
+    }
+
+    void op(Op op, Operand dst = {}, Operand src = {}) {
+        m_text->push_back({op, dst, src});
+    }
+
+    void imul3(Reg dst, Reg src, int64_t imm) {
+        m_text->push_back({Op::IMUL3, dst, src, Cond::O, static_cast<int32_t>(imm)});
+    }
+
+    void jcc(Cond cc, Label target) {
+        m_text->push_back({Op::JCC, target, {}, cc});
+    }
+
+    void bind(Label label) {
+        op(Op::LABEL, label);
+    }
+
+private:
+    static constexpr std::string_view BOUNDS_MSG = "Array index out of range\n";
+    static constexpr std::string_view SIZE_MSG = "Array size out of range\n";
+    static constexpr std::string_view MEMORY_MSG = "Out of memory\n";
+    static constexpr int64_t CHUNK_SIZE = int64_t{1} << 20;
+    static constexpr int64_t CHUNK_HEADER = 32;
+    static constexpr int64_t PAGE_SIZE = 4096;
+    static constexpr int64_t HUGE_PAGE_SIZE = int64_t{2} << 20;
+
+    // a thread's block: itself, its heap, its index, then its deque's top and
+    // bottom on lines of their own, thieves take from the top and the owner
+    // pushes and takes at the bottom, and its ring of DEQUE_SIZE tasks
+    static constexpr int32_t BLOCK_SELF = 0;
+    static constexpr int32_t HEAP_TOP = 8;
+    static constexpr int32_t HEAP_END = 16;
+    static constexpr int32_t HEAP_FRESH = 24;
+    static constexpr int32_t HEAP_CHUNK = 32;
+    static constexpr int32_t BLOCK_INDEX = 40;
+    static constexpr int32_t DEQUE_TOP = 64;
+    static constexpr int32_t DEQUE_BOTTOM = 128;
+    static constexpr int32_t DEQUE_SLOTS = 192;
+    static constexpr int64_t DEQUE_SIZE = 256;
+    static constexpr int64_t CACHE_LINE = 64;
+    // a task: its entry, called with rdi at the task, the count it is in, then
+    // the entry's data. the task a spawn makes holds the function, its argument
+    // count and the arguments, a range holds the body, its captures, lo, hi and
+    // the size below which it stops splitting
+    static constexpr int32_t TASK_SIZE = 64;
+    static constexpr int32_t TASK_ENTRY = 0;
+    static constexpr int32_t TASK_COUNT = 8;
+    static constexpr int32_t TASK_FUNC = 16;
+    static constexpr int32_t TASK_ARGC = 24;
+    static constexpr int32_t TASK_ARGS = 32;
+    static constexpr int32_t TASK_ENV = 24;
+    static constexpr int32_t TASK_LO = 32;
+    static constexpr int32_t TASK_HI = 40;
+    static constexpr int32_t TASK_GRAIN = 48;
+    static_assert(TASK_ARGS + MAX_SPAWN_ARGS * 8 <= TASK_SIZE, "a spawned call's arguments fit in its task");
+    static constexpr int64_t BLOCK_SIZE = DEQUE_SLOTS + DEQUE_SIZE * TASK_SIZE;
+    static constexpr int64_t MAX_WORKERS = 64;
+    // ranges per worker a parallel loop is cut into, at least
+    static constexpr int64_t GRAIN_SPLIT = 8;
+    static constexpr int64_t STACK_SIZE = int64_t{8} << 20;
+    // CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM
+    static constexpr int64_t CLONE_FLAGS = 0x50F00;
+    static constexpr int64_t ARCH_SET_GS = 0x1001;
+    static constexpr int64_t FUTEX_WAIT_PRIVATE = 128;
+    static constexpr int64_t FUTEX_WAKE_PRIVATE = 129;
+
+    AsmProg& m_prog;
+    bool m_hosted;
+    std::vector<Inst>* m_text = nullptr;
+    size_t m_localCount = 0;
+
+    Label m_exit;
+    Label m_flush;
+    Label m_printInt;
+    Label m_readInt;
+    Label m_nextByte;
+    Label m_outBuf;
+    Label m_outLen;
+    Label m_inBuf;
+    Label m_inPos;
+    Label m_inLen;
+    Label m_digits;
+    Label m_boundsFail;
+    Label m_boundsMsg;
+    Label m_alloc;
+    Label m_release;
+    Label m_sizeMsg;
+    Label m_memoryMsg;
+    Label m_init;
+    Label m_parallelFor;
+    Label m_spawn;
+    Label m_join;
+    Label m_startWorkers;
+    Label m_worker;
+    Label m_runTask;
+    Label m_pushTask;
+    Label m_takeTask;
+    Label m_stealTask;
+    Label m_taskCall;
+    Label m_taskRange;
+    Label m_blocks;
+    Label m_workers;
+    Label m_started;
+    Label m_workSeq;
+    Label m_sleepers;
+    Label m_ioLock;
+    Label m_hostExit;
+    Label m_writeProfile;
+    std::string m_profilePath;
+    std::vector<ProfileOut> m_profileModules;
+};
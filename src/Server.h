@@ -0,0 +1,368 @@
+#pragma once
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Driver.h"
+
+// --serve=<path> and --connect=<path>, or a per user default
+inline std::string socketPath(const std::string& mode) {
+    auto eq = mode.find('=');
+    if (eq != std::string::npos) {
+        return mode.substr(eq + 1);
+    }
+    return "/tmp/dhad-" + std::to_string(getuid()) + ".sock";
+}
+
+inline bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline std::string readAll(int fd) {
+    std::string out;
+    char buf[4096];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return out;
+        }
+        out.append(buf, static_cast<size_t>(n));
+    }
+}
+
+// the keys of what a warm state holds, taken before a build so that what the build
+// adds to it can be told apart
+struct WarmMarks {
+    explicit WarmMarks(const WarmState& warm) {
+        for (const auto& [path, parsed] : warm.parsed) {
+            this->parsed[path] = parsed.parser.get();
+        }
+        for (const auto& [path, entry] : warm.compiled) {
+            compiled[path] = entry.key;
+        }
+        for (const auto& [name, entry] : warm.functions) {
+            functions[name] = entry.key;
+        }
+    }
+
+    std::unordered_map<std::string, const Parser*> parsed;
+    std::unordered_map<std::string, uint64_t> compiled;
+    std::unordered_map<std::string, uint64_t> functions;
+};
+
+// what a build in a forked child added to the warm state it started from, for the
+// parent to keep: the source of every module it parsed anew, then every module's
+// and function's objects it compiled anew
+inline std::string warmDelta(const WarmState& warm, const WarmMarks& before) {
+    ObjectCache::Writer w;
+
+    std::vector<const std::pair<const std::string, WarmState::Parsed>*> parsed;
+    for (const auto& entry : warm.parsed) {
+        auto it = before.parsed.find(entry.first);
+        if (it == before.parsed.end() || it->second != entry.second.parser.get()) {
+            parsed.push_back(&entry);
+        }
+    }
+    w.u64(parsed.size());
+    for (const auto* entry : parsed) {
+        w.str(entry->first);
+        w.str(entry->second.source);
+    }
+
+    auto compiled = [&w](const std::unordered_map<std::string, WarmState::Compiled>& now,
+                         const std::unordered_map<std::string, uint64_t>& keys) {
+        std::vector<const std::pair<const std::string, WarmState::Compiled>*> added;
+        for (const auto& entry : now) {
+            auto it = keys.find(entry.first);
+            if (it == keys.end() || it->second != entry.second.key) {
+                added.push_back(&entry);
+            }
+        }
+        w.u64(added.size());
+        for (const auto* entry : added) {
+            w.str(entry->first);
+            w.u64(entry->second.key);
+            w.cached(entry->second.module);
+        }
+    };
+    compiled(warm.compiled, before.compiled);
+    compiled(warm.functions, before.functions);
+    return std::move(w.out);
+}
+
+// the parent's side of warmDelta. only what the child built is parsed here, sources
+// it already parsed without an error, and nothing is compiled again. a delta cut
+// short, by a build that exited, changes nothing
+inline void applyWarmDelta(std::string delta, WarmState& warm) {
+    ObjectCache::Reader r{std::move(delta)};
+
+    std::vector<std::pair<std::string, std::string>> sources;
+    for (uint64_t n = r.u64(); n > 0 && r.ok; --n) {
+        std::string path = r.str();
+        sources.push_back({std::move(path), r.str()});
+    }
+    auto compiled = [&r]() {
+        std::vector<std::pair<std::string, WarmState::Compiled>> entries;
+        for (uint64_t n = r.u64(); n > 0 && r.ok; --n) {
+            std::string name = r.str();
+            uint64_t key = r.u64();
+            entries.push_back({std::move(name), {key, r.cached()}});
+        }
+        return entries;
+    };
+    auto modules = compiled();
+    auto functions = compiled();
+    if (!r.ok || r.pos != r.buf.size()) {
+        return;
+    }
+
+    for (auto& [path, source] : sources) {
+        auto it = warm.parsed.find(path);
+        if (it == warm.parsed.end() || it->second.source != source) {
+            warm.parsed[path] = Project::parseSource(std::move(source));
+        }
+    }
+    for (auto& [path, entry] : modules) {
+        warm.compiled[path] = std::move(entry);
+    }
+    for (auto& [name, entry] : functions) {
+        warm.functions[name] = std::move(entry);
+    }
+}
+
+// builds in a forked child so an error's exit() only ends that build. the child
+// starts from the parent's warm state, output goes to fd when it's not -1. what the
+// build adds to the warm state comes back as a warmDelta
+inline int buildIsolated(const std::string& cwd, const std::vector<std::string>& args, int fd, WarmState& warm,
+                         std::string& delta) {
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        std::cerr << "pipe failed: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork failed: " << std::strerror(errno) << "\n";
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        return 1;
+    }
+    if (pid == 0) {
+        close(pipeFds[0]);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+        }
+        if (chdir(cwd.c_str()) != 0) {
+            std::cerr << "No such directory: " << cwd << "\n";
+            exit(1);
+        }
+        WarmMarks before(warm);
+        int status = build(parseArgs(args), &warm);
+        std::string added = warmDelta(warm, before);
+        writeAll(pipeFds[1], added.data(), added.size());
+        exit(status);
+    }
+
+    close(pipeFds[1]);
+    delta = readAll(pipeFds[0]);
+    close(pipeFds[0]);
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+inline bool socketAddr(const std::string& path, sockaddr_un& addr) {
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long: " << path << "\n";
+        return false;
+    }
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// a request is the client's cwd then its arguments, each nul terminated. the reply
+// is the build's output followed by a nul and the exit status byte
+class Server {
+public:
+    explicit Server(std::string path)
+        : m_path(std::move(path)) {}
+
+    int run() {
+        sockaddr_un addr;
+        if (!socketAddr(m_path, addr)) {
+            return 1;
+        }
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(m_path.c_str());
+        if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+            std::cerr << "Cannot listen on " << m_path << ": " << std::strerror(errno) << "\n";
+            return 1;
+        }
+        std::cerr << "serving on " << m_path << "\n";
+
+        for (;;) {
+            int conn = accept(fd, nullptr, nullptr);
+            if (conn < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "accept failed: " << std::strerror(errno) << "\n";
+                return 1;
+            }
+            serve(conn);
+        }
+    }
+
+private:
+    void serve(int conn) {
+        std::string request = readAll(conn);
+        std::vector<std::string> parts;
+        for (size_t pos = 0; pos < request.size();) {
+            size_t end = request.find('\0', pos);
+            if (end == std::string::npos) {
+                break;
+            }
+            parts.push_back(request.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        if (parts.empty()) {
+            close(conn);
+            return;
+        }
+
+        std::string cwd = parts.front();
+        std::vector<std::string> args(parts.begin() + 1, parts.end());
+        std::string delta;
+        int status = buildIsolated(cwd, args, conn, m_warm, delta);
+
+        const char tail[2] = {'\0', static_cast<char>(status)};
+        writeAll(conn, tail, sizeof(tail));
+        close(conn);
+
+        // after the reply, the client isn't kept waiting for it
+        applyWarmDelta(std::move(delta), m_warm);
+    }
+
+private:
+    std::string m_path;
+    WarmState m_warm;
+};
+
+inline int connectAndBuild(const std::string& path, const std::vector<std::string>& args) {
+    sockaddr_un addr;
+    if (!socketAddr(path, addr)) {
+        return 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "No compile server on " << path << "\n";
+        return 1;
+    }
+
+    std::string request = std::filesystem::current_path().string();
+    request.push_back('\0');
+    for (const std::string& arg : args) {
+        request += arg;
+        request.push_back('\0');
+    }
+    if (!writeAll(fd, request.data(), request.size())) {
+        std::cerr << "Failed to send to " << path << "\n";
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    std::string reply = readAll(fd);
+    close(fd);
+    if (reply.size() < 2 || reply[reply.size() - 2] != '\0') {
+        std::cerr << "Compile server closed the connection\n";
+        return 1;
+    }
+    writeAll(STDERR_FILENO, reply.data(), reply.size() - 2);
+    return static_cast<uint8_t>(reply.back());
+}
+
+// blocks until a .dhad file in one of dirs is written, created, moved in or removed,
+// then waits for the burst of events an editor's save makes to settle
+inline void waitForChange(const std::set<std::string>& dirs) {
+    int fd = inotify_init1(IN_CLOEXEC);
+    for (const std::string& dir : dirs) {
+        inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    }
+
+    alignas(inotify_event) char buf[4096];
+    bool changed = false;
+    while (!changed) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        for (ssize_t pos = 0; pos < n;) {
+            auto event = reinterpret_cast<const inotify_event*>(buf + pos);
+            if (event->len > 0 && std::string_view(event->name).ends_with(".dhad")) {
+                changed = true;
+            }
+            pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        }
+    }
+
+    pollfd pfd{fd, POLLIN, 0};
+    while (poll(&pfd, 1, 50) > 0 && read(fd, buf, sizeof(buf)) > 0) {}
+    close(fd);
+}
+
+// rebuilds whenever a module of the program changes, warm between builds
+inline int watch(const std::vector<std::string>& args) {
+    BuildOptions options = parseArgs(args);
+    std::string cwd = std::filesystem::current_path().string();
+    WarmState warm;
+
+    for (;;) {
+        std::string delta;
+        int status = buildIsolated(cwd, args, -1, warm, delta);
+        applyWarmDelta(std::move(delta), warm);
+        std::cerr << (status == 0 ? "built " : "build failed: ") << options.fileName << ", watching for changes\n";
+
+        std::set<std::string> dirs{std::filesystem::absolute(options.fileName).parent_path().string()};
+        for (const auto& [path, parsed] : warm.parsed) {
+            dirs.insert(std::filesystem::path(path).parent_path().string());
+        }
+        waitForChange(dirs);
+    }
+}
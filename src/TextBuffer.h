@@ -0,0 +1,136 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// append-only text built in fixed chunks, nothing is moved once written
+class TextBuffer {
+public:
+    explicit TextBuffer(size_t chunkSize = 64 * 1024)
+        : m_chunkSize(chunkSize) {}
+
+    TextBuffer(TextBuffer&& other) noexcept
+        : m_chunkSize(other.m_chunkSize), m_chunks(std::move(other.m_chunks)) {
+        other.m_chunks.clear();
+    }
+
+    TextBuffer(const TextBuffer& other) = delete;
+
+    TextBuffer& operator=(const TextBuffer& other) = delete;
+
+    ~TextBuffer() {
+        for (auto& chunk : m_chunks) {
+            free(chunk.data);
+        }
+    }
+
+    TextBuffer& operator<<(std::string_view str) {
+        std::memcpy(reserve(str.size()), str.data(), str.size());
+        m_chunks.back().used += str.size();
+        return *this;
+    }
+
+    TextBuffer& operator<<(char c) {
+        *reserve(1) = c;
+        m_chunks.back().used++;
+        return *this;
+    }
+
+    TextBuffer& operator<<(int64_t val) {
+        return number(val);
+    }
+
+    TextBuffer& operator<<(uint64_t val) {
+        return number(val);
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& chunk : m_chunks) {
+            total += chunk.used;
+        }
+        return total;
+    }
+
+    [[nodiscard]] std::string str() const {
+        std::string out;
+        out.reserve(size());
+        for (const auto& chunk : m_chunks) {
+            out.append(chunk.data, chunk.used);
+        }
+        return out;
+    }
+
+    // every chunk goes out in one writev, retried only on short writes
+    bool writeFile(const std::string& path) const {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        std::vector<iovec> iov;
+        iov.reserve(m_chunks.size());
+        for (const auto& chunk : m_chunks) {
+            iov.push_back({chunk.data, chunk.used});
+        }
+
+        size_t first = 0;
+        while (first < iov.size()) {
+            int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+            ssize_t written = writev(fd, iov.data() + first, count);
+            if (written < 0) {
+                close(fd);
+                return false;
+            }
+
+            auto left = static_cast<size_t>(written);
+            while (first < iov.size() && left >= iov[first].iov_len) {
+                left -= iov[first].iov_len;
+                first++;
+            }
+            if (left > 0) {
+                iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+                iov[first].iov_len -= left;
+            }
+        }
+
+        return close(fd) == 0;
+    }
+
+private:
+    struct Chunk {
+        char* data;
+        size_t used;
+        size_t cap;
+    };
+
+    template<typename T>
+    TextBuffer& number(T val) {
+        char* at = reserve(20);
+        auto res = std::to_chars(at, at + 20, val);
+        m_chunks.back().used += static_cast<size_t>(res.ptr - at);
+        return *this;
+    }
+
+    char* reserve(size_t bytes) {
+        if (m_chunks.empty() || m_chunks.back().cap - m_chunks.back().used < bytes) {
+            size_t cap = bytes > m_chunkSize ? bytes : m_chunkSize;
+            m_chunks.push_back({static_cast<char*>(malloc(cap)), 0, cap});
+        }
+        return m_chunks.back().data + m_chunks.back().used;
+    }
+
+private:
+    size_t m_chunkSize;
+    std::vector<Chunk> m_chunks;
+};
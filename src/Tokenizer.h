@@ -1,5 +1,6 @@
 #pragma once
 
+#include <charconv>
 #include <string>
 #include <vector>
 #include <cstring>
@@ -18,6 +19,8 @@ enum class TokenType {
     CLOSE_PAREN,
     OPEN_CURLY,
     CLOSE_CURLY,
+    OPEN_BRACKET,
+    CLOSE_BRACKET,
     IDENT,
     LET,
     RETURN,
@@ -32,15 +35,30 @@ enum class TokenType {
     ELIF,
     ELSE_,
     WHILE,
+    FOR,
+    FROM,
+    TO,
     BANG,
     BANG_EQ,
     GR_THAN,
-    LS_THAN
+    LS_THAN,
+    PRINT,
+    READ,
+    IMPORT,
+    COLON,
+    AMP_AMP,
+    PIPE_PIPE,
+    PARALLEL,
+    SPAWN,
+    JOIN
 };
 
 struct Token {
     TokenType type;
     std::string val;
+    size_t line = 0; // 1 based
+    size_t col = 0;  // 1 based, in characters
+    int64_t intVal = 0; // an INT_LIT's value
 };
 
 
@@ -57,9 +75,14 @@ public:
 
         std::u32string buffer;
         while(peek().has_value()) {
+            size_t start = m_pos;
             char32_t curr = consume();
 
             if (isAsciiSpace(curr)) {
+                if (curr == U'\n') {
+                    m_line++;
+                    m_lineStart = m_pos;
+                }
                 continue;
             }
 
@@ -87,9 +110,36 @@ public:
                 else if (buffer == U"بينما") {
                     tokens.push_back({TokenType::WHILE});
                 }
+                else if (buffer == U"لكل") {
+                    tokens.push_back({TokenType::FOR});
+                }
+                else if (buffer == U"من") {
+                    tokens.push_back({TokenType::FROM});
+                }
+                else if (buffer == U"الى") {
+                    tokens.push_back({TokenType::TO});
+                }
+                else if (buffer == U"بالتوازي") {
+                    tokens.push_back({TokenType::PARALLEL});
+                }
+                else if (buffer == U"شغل") {
+                    tokens.push_back({TokenType::SPAWN});
+                }
+                else if (buffer == U"انتظر") {
+                    tokens.push_back({TokenType::JOIN});
+                }
                 else if (buffer == U"ارجع") {
                     tokens.push_back({TokenType::RETURN});
                 }
+                else if (buffer == U"اطبع") {
+                    tokens.push_back({TokenType::PRINT});
+                }
+                else if (buffer == U"اقرأ") {
+                    tokens.push_back({TokenType::READ});
+                }
+                else if (buffer == U"استورد") {
+                    tokens.push_back({TokenType::IMPORT});
+                }
                 else {
                     tokens.push_back({TokenType::IDENT, to_utf8(buffer)});
                 }
@@ -102,7 +152,13 @@ public:
                     buffer.push_back(consume());
                 }
 
-                tokens.push_back({TokenType::INT_LIT, to_utf8(buffer)});
+                std::string digits = to_utf8(buffer);
+                int64_t value = 0;
+                if (std::from_chars(digits.data(), digits.data() + digits.size(), value).ec != std::errc()) {
+                    std::cerr << "Integer literal out of range" << std::endl;
+                    exit(1);
+                }
+                tokens.push_back({TokenType::INT_LIT, std::move(digits), 0, 0, value});
                 buffer.clear();
             }
 
@@ -135,6 +191,14 @@ public:
                 tokens.push_back({TokenType::CLOSE_CURLY});
             }
 
+            else if (curr == '[') {
+                tokens.push_back({TokenType::OPEN_BRACKET});
+            }
+
+            else if (curr == ']') {
+                tokens.push_back({TokenType::CLOSE_BRACKET});
+            }
+
             else if (curr == '+') {
                 tokens.push_back({TokenType::PLUS});
             }
@@ -176,11 +240,23 @@ public:
                 tokens.push_back({TokenType::COMMA});
             }
 
+            else if (curr == ':') {
+                tokens.push_back({TokenType::COLON});
+            }
+
+            else if ((curr == '&' || curr == '|') && peek() && peek().value() == curr) {
+                consume();
+                tokens.push_back({curr == '&' ? TokenType::AMP_AMP : TokenType::PIPE_PIPE});
+            }
+
             else {
                 std::cerr << "Invalid Syntax" << std::endl;
                 exit(1);
             }
 
+            tokens.back().line = m_line;
+            tokens.back().col = start - m_lineStart + 1;
+
         }
 
         return tokens;
@@ -231,5 +307,7 @@ private:
     std::u32string m_src;
     size_t m_srcLen;
     size_t m_pos = 0;
+    size_t m_line = 1;
+    size_t m_lineStart = 0;
 };
 
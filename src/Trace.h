@@ -0,0 +1,148 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "TextBuffer.h"
+
+// a timeline of the compiler's phases in chrome's trace event format, for
+// chrome://tracing or ui.perfetto.dev. spans are recorded from any thread, each
+// on its own row, with counts of what the phase worked on as args
+class Trace {
+    struct Event {
+        std::string name;
+        std::string_view cat;
+        std::chrono::steady_clock::time_point begin;
+        std::chrono::steady_clock::time_point end;
+        size_t tid = 0;
+        std::vector<std::pair<std::string, std::string>> args; // values already json
+    };
+
+public:
+    Trace()
+        : m_start(std::chrono::steady_clock::now()) {}
+
+    // times its own lifetime as one complete event. null trace, nothing recorded
+    class Span {
+    public:
+        Span(Trace* trace, std::string name, std::string_view cat)
+            : m_trace(trace)
+        {
+            if (m_trace) {
+                m_event.name = std::move(name);
+                m_event.cat = cat;
+                m_event.begin = std::chrono::steady_clock::now();
+            }
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        ~Span() {
+            if (m_trace) {
+                m_event.end = std::chrono::steady_clock::now();
+                m_trace->record(std::move(m_event));
+            }
+        }
+
+        Span& arg(std::string_view key, uint64_t val) {
+            if (m_trace) {
+                m_event.args.push_back({std::string(key), std::to_string(val)});
+            }
+            return *this;
+        }
+
+        Span& arg(std::string_view key, std::string_view val) {
+            if (m_trace) {
+                m_event.args.push_back({std::string(key), quote(val)});
+            }
+            return *this;
+        }
+
+    private:
+        Trace* m_trace;
+        Event m_event;
+    };
+
+    bool write(const std::string& path) const {
+        std::lock_guard lock(m_mutex);
+        TextBuffer out;
+        auto pid = static_cast<uint64_t>(getpid());
+
+        out << "{\"traceEvents\": [\n";
+        for (size_t tid = 0; tid < m_threads.size(); ++tid) {
+            out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"tid\": " << static_cast<uint64_t>(tid)
+                << ", \"args\": {\"name\": " << quote(tid == 0 ? "main" : "worker " + std::to_string(tid)) << "}},\n";
+        }
+        for (size_t i = 0; i < m_events.size(); ++i) {
+            const Event& event = m_events[i];
+            out << "{\"name\": " << quote(event.name) << ", \"cat\": " << quote(event.cat) << ", \"ph\": \"X\", \"ts\": "
+                << micros(event.begin) << ", \"dur\": " << micros(event.end) - micros(event.begin)
+                << ", \"pid\": " << pid << ", \"tid\": " << static_cast<uint64_t>(event.tid) << ", \"args\": {";
+            for (size_t a = 0; a < event.args.size(); ++a) {
+                out << (a == 0 ? "" : ", ") << quote(event.args[a].first) << ": " << event.args[a].second;
+            }
+            out << "}}" << (i + 1 == m_events.size() ? "\n" : ",\n");
+        }
+        out << "], \"displayTimeUnit\": \"ms\"}\n";
+        return out.writeFile(path);
+    }
+
+private:
+    // threads are numbered as they first record, the one that made the trace is 0
+    void record(Event event) {
+        std::lock_guard lock(m_mutex);
+        if (m_threads.empty()) {
+            m_threads.push_back(m_owner);
+        }
+        std::thread::id self = std::this_thread::get_id();
+        size_t tid = 0;
+        while (tid < m_threads.size() && m_threads[tid] != self) {
+            ++tid;
+        }
+        if (tid == m_threads.size()) {
+            m_threads.push_back(self);
+        }
+        event.tid = tid;
+        m_events.push_back(std::move(event));
+    }
+
+    uint64_t micros(std::chrono::steady_clock::time_point at) const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(at - m_start).count());
+    }
+
+    static std::string quote(std::string_view str) {
+        std::string out = "\"";
+        for (char c : str) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                char esc[8];
+                std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+                out += esc;
+            }
+            else {
+                out += c;
+            }
+        }
+        return out + '"';
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+    std::thread::id m_owner = std::this_thread::get_id();
+    mutable std::mutex m_mutex;
+    std::vector<Event> m_events;
+    std::vector<std::thread::id> m_threads;
+};
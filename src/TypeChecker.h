@@ -0,0 +1,341 @@
+#pragma once
+
+#include <iostream>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Parser.h"
+
+// gives every expression its IntType before generation. literals, comparisons and
+// logical operators have no type of their own and take the one their use asks for, a binary
+// expression's operands meet at the wider of their types, and values only convert
+// implicitly to types that hold all of them, see widens. everything else takes a
+// cast. names the generator can't resolve are left for it to report
+class TypeChecker {
+public:
+    explicit TypeChecker(NodeProg prog)
+        : m_prog(std::move(prog)) {}
+
+    void importFunc(const NodeStmtFuncDecl* funcDecl) {
+        m_funcs.insert({funcDecl->ident.val, funcDecl});
+    }
+
+    // only writes the types into the nodes, so checking a tree again is harmless
+    void check() {
+        stmts(m_prog.stmts);
+    }
+
+private:
+    void stmts(const std::vector<NodeStmt*>& list) {
+        for (const NodeStmt* stmt : list) {
+            m_line = stmt->line;
+            std::visit(StmtVisitor{this}, stmt->var);
+        }
+    }
+
+    void scope(const NodeScope* scope) {
+        m_vars.push_back({});
+        stmts(scope->stmts);
+        m_vars.pop_back();
+    }
+
+    struct StmtVisitor {
+        TypeChecker* checker;
+
+        void operator()(const NodeStmtExit* stmtExit) { checker->coerce(stmtExit->expr, IntType::I64); }
+        void operator()(const NodeStmtPrint* stmtPrint) { checker->coerce(stmtPrint->expr, IntType::I64); }
+        void operator()(const NodeStmtLet* stmtLet) {
+            checker->coerce(stmtLet->expr, stmtLet->type);
+            checker->m_vars.back()[stmtLet->ident.val] = stmtLet->type;
+        }
+        void operator()(const NodeStmtLetArray* letArray) {
+            if (letArray->count) {
+                checker->coerce(letArray->count, IntType::I64);
+            }
+            checker->m_vars.back()[letArray->ident.val] = letArray->type;
+        }
+        void operator()(const NodeStmtAssign* stmtAssign) {
+            checker->shared(stmtAssign->ident.val);
+            checker->coerce(stmtAssign->expr, checker->varType(stmtAssign->ident.val));
+        }
+        void operator()(const NodeStmtIndexAssign* indexAssign) {
+            checker->index(indexAssign->index);
+            checker->coerce(indexAssign->expr, checker->varType(indexAssign->ident.val));
+        }
+        void operator()(const NodeStmtReturn* stmtRet) {
+            if (checker->m_parallel) {
+                std::cerr << "Return inside a parallel loop on line " << checker->m_line << "\n";
+                exit(1);
+            }
+            if (stmtRet->expr) {
+                checker->coerce(stmtRet->expr.value(), IntType::I64);
+            }
+        }
+        void operator()(const NodeScope* stmtScope) { checker->scope(stmtScope); }
+        void operator()(const NodeStmtImport*) {}
+        void operator()(const NodeStmtFuncDecl* funcDecl) {
+            checker->m_funcs.insert({funcDecl->ident.val, funcDecl});
+            checker->m_vars.push_back({});
+            for (const NodeFuncParam* param : funcDecl->params) {
+                checker->m_vars.back()[param->ident.val] = param->type;
+            }
+            size_t parallel = std::exchange(checker->m_parallel, 0);
+            checker->scope(funcDecl->scope);
+            checker->m_parallel = parallel;
+            checker->m_vars.pop_back();
+        }
+        void operator()(const NodeStmtWhile* stmtWhile) {
+            checker->cond(stmtWhile->expr);
+            checker->scope(stmtWhile->scope);
+        }
+        void operator()(const NodeStmtFor* stmtFor) {
+            checker->coerce(stmtFor->from, IntType::I64);
+            checker->coerce(stmtFor->to, IntType::I64);
+            size_t parallel = checker->m_parallel;
+            if (stmtFor->parallel) {
+                checker->m_parallel = checker->m_vars.size();
+            }
+            checker->m_vars.push_back({{stmtFor->ident.val, IntType::I64}});
+            checker->scope(stmtFor->scope);
+            checker->m_vars.pop_back();
+            checker->m_parallel = parallel;
+        }
+        void operator()(const NodeStmtSpawn* stmtSpawn) {
+            if (stmtSpawn->call->args.size() > MAX_SPAWN_ARGS) {
+                std::cerr << "At most " << MAX_SPAWN_ARGS << " arguments in a spawned call on line " << checker->m_line << "\n";
+                exit(1);
+            }
+            checker->call(stmtSpawn->call);
+        }
+        void operator()(const NodeStmtJoin*) {}
+        void operator()(const NodeStmtIf* stmtIf) {
+            checker->cond(stmtIf->expr);
+            checker->scope(stmtIf->scope);
+            std::optional<NodeIfPred*> pred = stmtIf->pred;
+            while (pred.has_value()) {
+                if (auto predElif = std::get_if<NodeIfPredElif*>(&pred.value()->var)) {
+                    checker->m_line = (*predElif)->line;
+                    checker->cond((*predElif)->expr);
+                    checker->scope((*predElif)->scope);
+                    pred = (*predElif)->pred;
+                }
+                else {
+                    checker->scope(std::get<NodeIfPredElse*>(pred.value()->var)->scope);
+                    pred = {};
+                }
+            }
+        }
+    };
+
+    // unknown names and arrays used as values are i64 here, the generator rejects them
+    IntType varType(const std::string& name) const {
+        for (auto it = m_vars.rbegin(); it != m_vars.rend(); ++it) {
+            if (auto found = it->find(name); found != it->end()) {
+                return found->second;
+            }
+        }
+        return IntType::I64;
+    }
+
+    // a parallel loop's iterations each get a copy of the enclosing function's
+    // variables, so only the loop's own and global ones can be assigned in it
+    void shared(const std::string& name) const {
+        for (size_t level = m_vars.size(); level-- > 1;) {
+            if (m_vars[level].contains(name)) {
+                if (level < m_parallel) {
+                    std::cerr << "Cannot assign to " << name << " on line " << m_line
+                              << " inside a parallel loop, each iteration has its own copy\n";
+                    exit(1);
+                }
+                return;
+            }
+        }
+    }
+
+    void call(const NodeTermFuncCall* funcCall) {
+        auto it = m_funcs.find(funcCall->ident.val);
+        for (size_t i = 0; i < funcCall->args.size(); ++i) {
+            bool known = it != m_funcs.end() && i < it->second->params.size();
+            coerce(funcCall->args[i], known ? it->second->params[i]->type : IntType::I64);
+        }
+    }
+
+    // the type expr computes, empty while it's still free to take its context's
+    std::optional<IntType> synth(NodeExpr* expr) {
+        std::optional<IntType> type;
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            type = std::visit(TermVisitor{this}, (*term)->var);
+        }
+        else {
+            type = std::visit(BinVisitor{this}, std::get<BinExpr*>(expr->var)->var);
+        }
+        if (type) {
+            expr->type = expr->usedAs = type.value();
+        }
+        return type;
+    }
+
+    struct TermVisitor {
+        TypeChecker* checker;
+
+        std::optional<IntType> operator()(const NodeTermIntLit*) { return {}; }
+        std::optional<IntType> operator()(const NodeTermRead*) { return IntType::I64; }
+        std::optional<IntType> operator()(const NodeTermIdent* ident) { return checker->varType(ident->ident.val); }
+        std::optional<IntType> operator()(const NodeTermParen* paren) { return checker->synth(paren->expr); }
+        std::optional<IntType> operator()(const NodeTermIndex* index) {
+            checker->index(index->index);
+            return checker->varType(index->ident.val);
+        }
+        std::optional<IntType> operator()(const NodeTermCast* cast) {
+            if (!checker->synth(cast->expr)) {
+                checker->settle(cast->expr, IntType::I64);
+            }
+            return cast->type;
+        }
+        std::optional<IntType> operator()(const NodeTermNot* termNot) {
+            checker->cond(termNot->expr);
+            return {};
+        }
+        std::optional<IntType> operator()(const NodeTermFuncCall* funcCall) {
+            checker->call(funcCall);
+            return IntType::I64;
+        }
+    };
+
+    struct BinVisitor {
+        TypeChecker* checker;
+
+        std::optional<IntType> operator()(const BinExprAdd* bin) { return checker->arith(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprSub* bin) { return checker->arith(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprMult* bin) { return checker->arith(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprDiv* bin) { return checker->arith(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprMod* bin) { return checker->arith(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprEqTo* bin) { return checker->compare(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprNotEqTo* bin) { return checker->compare(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprGrThan* bin) { return checker->compare(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprLsThan* bin) { return checker->compare(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprAnd* bin) { return checker->logical(bin->lhs, bin->rhs); }
+        std::optional<IntType> operator()(const BinExprOr* bin) { return checker->logical(bin->lhs, bin->rhs); }
+    };
+
+    // free as long as both operands are
+    std::optional<IntType> arith(NodeExpr* lhs, NodeExpr* rhs) {
+        auto lhsType = synth(lhs);
+        auto rhsType = synth(rhs);
+        if (!lhsType && !rhsType) {
+            return {};
+        }
+        return unify(lhs, lhsType, rhs, rhsType);
+    }
+
+    // 0 or 1, which any type holds. the operands are settled here, i64 if both are free
+    std::optional<IntType> compare(NodeExpr* lhs, NodeExpr* rhs) {
+        auto lhsType = synth(lhs);
+        auto rhsType = synth(rhs);
+        if (!lhsType && !rhsType) {
+            settle(lhs, IntType::I64);
+            settle(rhs, IntType::I64);
+            return {};
+        }
+        unify(lhs, lhsType, rhs, rhsType);
+        return {};
+    }
+
+    // 0 or 1 as well, each operand is a condition of its own type
+    std::optional<IntType> logical(NodeExpr* lhs, NodeExpr* rhs) {
+        cond(lhs);
+        cond(rhs);
+        return {};
+    }
+
+    IntType unify(NodeExpr* lhs, std::optional<IntType> lhsType, NodeExpr* rhs, std::optional<IntType> rhsType) {
+        if (!lhsType) {
+            settle(lhs, rhsType.value());
+            return rhsType.value();
+        }
+        if (!rhsType) {
+            settle(rhs, lhsType.value());
+            return lhsType.value();
+        }
+        if (widens(lhsType.value(), rhsType.value())) {
+            lhs->usedAs = rhsType.value();
+            return rhsType.value();
+        }
+        if (widens(rhsType.value(), lhsType.value())) {
+            rhs->usedAs = lhsType.value();
+            return lhsType.value();
+        }
+        std::cerr << "Type mismatch on line " << m_line << ": " << typeName(lhsType.value()) << " and "
+                  << typeName(rhsType.value()) << ", cast one of them\n";
+        exit(1);
+    }
+
+    // gives a free expression its type, literals have to fit it
+    void settle(NodeExpr* expr, IntType type) {
+        expr->type = expr->usedAs = type;
+        if (auto term = std::get_if<NodeTerm*>(&expr->var)) {
+            if (auto intLit = std::get_if<NodeTermIntLit*>(&(*term)->var)) {
+                if (!fitsType(type, (*intLit)->int_lit.intVal)) {
+                    std::cerr << "Literal " << (*intLit)->int_lit.val << " on line " << m_line
+                              << " doesn't fit in " << typeName(type) << "\n";
+                    exit(1);
+                }
+            }
+            else if (auto paren = std::get_if<NodeTermParen*>(&(*term)->var)) {
+                settle((*paren)->expr, type);
+            }
+            return;
+        }
+        std::visit([this, type](auto* bin) {
+            using T = std::remove_pointer_t<decltype(bin)>;
+            constexpr bool isBool = std::is_same_v<T, BinExprEqTo> || std::is_same_v<T, BinExprNotEqTo> ||
+                                    std::is_same_v<T, BinExprGrThan> || std::is_same_v<T, BinExprLsThan> ||
+                                    std::is_same_v<T, BinExprAnd> || std::is_same_v<T, BinExprOr>;
+            if constexpr (!isBool) {
+                settle(bin->lhs, type);
+                settle(bin->rhs, type);
+            }
+        }, std::get<BinExpr*>(expr->var)->var);
+    }
+
+    void coerce(NodeExpr* expr, IntType to) {
+        auto type = synth(expr);
+        if (!type) {
+            settle(expr, to);
+            return;
+        }
+        if (!widens(type.value(), to)) {
+            std::cerr << "Cannot convert " << typeName(type.value()) << " to " << typeName(to) << " on line " << m_line
+                      << " implicitly, use " << typeName(to) << "(...)\n";
+            exit(1);
+        }
+        expr->usedAs = to;
+    }
+
+    // any type indexes, as its 64 bit value. negative ones fail the bounds check
+    void index(NodeExpr* expr) {
+        if (!synth(expr)) {
+            settle(expr, IntType::I64);
+        }
+        expr->usedAs = IntType::I64;
+    }
+
+    // a condition is tested against zero in its own type
+    void cond(NodeExpr* expr) {
+        if (!synth(expr)) {
+            settle(expr, IntType::I64);
+        }
+    }
+
+private:
+    NodeProg m_prog;
+    std::vector<std::unordered_map<std::string, IntType>> m_vars{1}; // arrays by element type
+    std::unordered_map<std::string, const NodeStmtFuncDecl*> m_funcs;
+    size_t m_line = 0;
+    size_t m_parallel = 0; // levels of m_vars outside the innermost parallel loop body, 0 outside one
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// the integer types an annotation or a cast names. untyped code is i64. values
+// are held as their 64 bit sign or zero extension, so a u64 above INT64_MAX is
+// a negative int64_t with the same bits
+enum class IntType : uint8_t { I8, I16, I32, I64, U8, U16, U32, U64 };
+
+inline std::optional<IntType> parseIntType(std::string_view name) {
+    static constexpr std::string_view names[] = {"i8", "i16", "i32", "i64", "u8", "u16", "u32", "u64"};
+    for (uint8_t i = 0; i < 8; ++i) {
+        if (names[i] == name) {
+            return static_cast<IntType>(i);
+        }
+    }
+    return {};
+}
+
+inline std::string_view typeName(IntType type) {
+    static constexpr std::string_view names[] = {"i8", "i16", "i32", "i64", "u8", "u16", "u32", "u64"};
+    return names[static_cast<uint8_t>(type)];
+}
+
+// bytes
+inline uint8_t typeSize(IntType type) {
+    return static_cast<uint8_t>(1 << (static_cast<uint8_t>(type) & 3));
+}
+
+inline bool isSigned(IntType type) {
+    return static_cast<uint8_t>(type) < 4;
+}
+
+// every value of from is a value of to
+inline bool widens(IntType from, IntType to) {
+    if (isSigned(from) == isSigned(to)) {
+        return typeSize(from) <= typeSize(to);
+    }
+    return !isSigned(from) && typeSize(from) < typeSize(to);
+}
+
+// val's low typeSize(type) bytes as a type, extended back to 64 bits
+inline int64_t wrapTo(IntType type, int64_t val) {
+    int shift = 64 - typeSize(type) * 8;
+    if (isSigned(type)) {
+        return static_cast<int64_t>(static_cast<uint64_t>(val) << shift) >> shift;
+    }
+    return static_cast<int64_t>(static_cast<uint64_t>(val) << shift >> shift);
+}
+
+// a literal is written as a non-negative int64_t
+inline bool fitsType(IntType type, int64_t val) {
+    return wrapTo(type, val) == val;
+}
+
+inline bool lessThan(IntType type, int64_t a, int64_t b) {
+    return isSigned(type) ? a < b : static_cast<uint64_t>(a) < static_cast<uint64_t>(b);
+}
+
+// a / b or a % b as the hardware computes them for type: i8 and i16 divide in
+// 32 bits and wrap, i32 and i64 trap on MIN / -1. empty for what traps
+inline std::optional<int64_t> divideAs(IntType type, int64_t a, int64_t b, bool mod) {
+    if (b == 0) {
+        return {};
+    }
+    if (!isSigned(type)) {
+        auto ua = static_cast<uint64_t>(a);
+        auto ub = static_cast<uint64_t>(b);
+        return static_cast<int64_t>(mod ? ua % ub : ua / ub);
+    }
+    if (b == -1 && typeSize(type) >= 4 && a == wrapTo(type, int64_t{1} << (typeSize(type) * 8 - 1))) {
+        return {};
+    }
+    if (b == -1) {
+        return mod ? 0 : wrapTo(type, static_cast<int64_t>(0 - static_cast<uint64_t>(a)));
+    }
+    return mod ? a % b : a / b;
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <vector>
+
+#include "Bytecode.h"
+
+// runs a BcProgram with threaded dispatch: every handler ends in its own jump
+// through the label table (a GNU extension, like the rest of the build needs g++).
+// output, input and failures behave like the native runtime's, down to the signal
+// a division by zero dies of
+class Vm {
+public:
+    static constexpr size_t STACK_REGS = size_t{1} << 20;
+
+    explicit Vm(BcProgram prog)
+        : m_prog(std::move(prog)), m_stack(STACK_REGS), m_globals(m_prog.globals, 0) {}
+
+    // the program's exit status
+    int run() {
+        static const void* const DISPATCH[] = {
+            &&MOVI, &&LOADK, &&MOV, &&LOADG, &&STOREG,
+            &&ADD, &&SUB, &&MUL, &&DIV, &&MOD, &&EQ, &&NE, &&LT, &&GT, &&ADDI, &&MULI,
+            &&SEXT, &&ZEXT, &&DIVU, &&MODU, &&DIV32, &&MOD32, &&LTU, &&GTU,
+            &&JMP, &&JZ, &&JNZ, &&JEQ, &&JNE, &&JLT, &&JGE, &&JGT, &&JLE,
+            &&JEQI, &&JNEI, &&JLTI, &&JGEI, &&JGTI, &&JLEI,
+            &&LOADX, &&STOREX, &&GLOADX, &&GSTOREX, &&ZERO,
+            &&ALLOC, &&HLOADX, &&HSTOREX, &&RELEASE,
+            &&CALL, &&RET, &&PRINT, &&READ, &&EXIT,
+        };
+        static_assert(std::size(DISPATCH) == static_cast<size_t>(Bc::EXIT) + 1);
+
+        const int64_t* consts = m_prog.consts.data();
+        int64_t* globals = m_globals.data();
+        int64_t* stackEnd = m_stack.data() + m_stack.size();
+
+        const int32_t* code = m_prog.funcs[0].code.data();
+        const int32_t* ip = code;
+        int64_t* r = m_stack.data();
+        if (m_prog.funcs[0].frameSize > m_stack.size()) {
+            overflow();
+        }
+
+#define NEXT goto *DISPATCH[*ip]
+#define WRAP(op) static_cast<int64_t>(static_cast<uint64_t>(r[ip[2]]) op static_cast<uint64_t>(r[ip[3]]))
+#define BRANCH(cond) ip = (cond) ? code + ip[3] : ip + 4; NEXT
+
+        NEXT;
+
+    MOVI:    r[ip[1]] = ip[2]; ip += 3; NEXT;
+    LOADK:   r[ip[1]] = consts[ip[2]]; ip += 3; NEXT;
+    MOV:     r[ip[1]] = r[ip[2]]; ip += 3; NEXT;
+    LOADG:   r[ip[1]] = globals[ip[2]]; ip += 3; NEXT;
+    STOREG:  globals[ip[1]] = r[ip[2]]; ip += 3; NEXT;
+
+    ADD:     r[ip[1]] = WRAP(+); ip += 4; NEXT;
+    SUB:     r[ip[1]] = WRAP(-); ip += 4; NEXT;
+    MUL:     r[ip[1]] = WRAP(*); ip += 4; NEXT;
+    DIV:     checkDiv(r[ip[2]], r[ip[3]]); r[ip[1]] = r[ip[2]] / r[ip[3]]; ip += 4; NEXT;
+    MOD:     checkDiv(r[ip[2]], r[ip[3]]); r[ip[1]] = r[ip[2]] % r[ip[3]]; ip += 4; NEXT;
+    EQ:      r[ip[1]] = r[ip[2]] == r[ip[3]]; ip += 4; NEXT;
+    NE:      r[ip[1]] = r[ip[2]] != r[ip[3]]; ip += 4; NEXT;
+    LT:      r[ip[1]] = r[ip[2]] < r[ip[3]]; ip += 4; NEXT;
+    GT:      r[ip[1]] = r[ip[2]] > r[ip[3]]; ip += 4; NEXT;
+    ADDI:    r[ip[1]] = static_cast<int64_t>(static_cast<uint64_t>(r[ip[2]]) + static_cast<uint64_t>(int64_t{ip[3]})); ip += 4; NEXT;
+    MULI:    r[ip[1]] = static_cast<int64_t>(static_cast<uint64_t>(r[ip[2]]) * static_cast<uint64_t>(int64_t{ip[3]})); ip += 4; NEXT;
+    SEXT:    r[ip[1]] = static_cast<int64_t>(static_cast<uint64_t>(r[ip[1]]) << ip[2]) >> ip[2]; ip += 3; NEXT;
+    ZEXT:    r[ip[1]] = static_cast<int64_t>(static_cast<uint64_t>(r[ip[1]]) << ip[2] >> ip[2]); ip += 3; NEXT;
+    DIVU:    checkDiv(0, r[ip[3]]); r[ip[1]] = static_cast<int64_t>(static_cast<uint64_t>(r[ip[2]]) / static_cast<uint64_t>(r[ip[3]])); ip += 4; NEXT;
+    MODU:    checkDiv(0, r[ip[3]]); r[ip[1]] = static_cast<int64_t>(static_cast<uint64_t>(r[ip[2]]) % static_cast<uint64_t>(r[ip[3]])); ip += 4; NEXT;
+    DIV32:   checkDiv32(r[ip[2]], r[ip[3]]); r[ip[1]] = r[ip[2]] / r[ip[3]]; ip += 4; NEXT;
+    MOD32:   checkDiv32(r[ip[2]], r[ip[3]]); r[ip[1]] = r[ip[2]] % r[ip[3]]; ip += 4; NEXT;
+    LTU:     r[ip[1]] = static_cast<uint64_t>(r[ip[2]]) < static_cast<uint64_t>(r[ip[3]]); ip += 4; NEXT;
+    GTU:     r[ip[1]] = static_cast<uint64_t>(r[ip[2]]) > static_cast<uint64_t>(r[ip[3]]); ip += 4; NEXT;
+
+    JMP:     ip = code + ip[1]; NEXT;
+    JZ:      ip = r[ip[1]] == 0 ? code + ip[2] : ip + 3; NEXT;
+    JNZ:     ip = r[ip[1]] != 0 ? code + ip[2] : ip + 3; NEXT;
+    JEQ:     BRANCH(r[ip[1]] == r[ip[2]]);
+    JNE:     BRANCH(r[ip[1]] != r[ip[2]]);
+    JLT:     BRANCH(r[ip[1]] < r[ip[2]]);
+    JGE:     BRANCH(r[ip[1]] >= r[ip[2]]);
+    JGT:     BRANCH(r[ip[1]] > r[ip[2]]);
+    JLE:     BRANCH(r[ip[1]] <= r[ip[2]]);
+    JEQI:    BRANCH(r[ip[1]] == ip[2]);
+    JNEI:    BRANCH(r[ip[1]] != ip[2]);
+    JLTI:    BRANCH(r[ip[1]] < ip[2]);
+    JGEI:    BRANCH(r[ip[1]] >= ip[2]);
+    JGTI:    BRANCH(r[ip[1]] > ip[2]);
+    JLEI:    BRANCH(r[ip[1]] <= ip[2]);
+
+    LOADX:
+        if (static_cast<uint64_t>(r[ip[3]]) >= static_cast<uint64_t>(ip[4])) return boundsFail();
+        r[ip[1]] = r[ip[2] + r[ip[3]]]; ip += 5; NEXT;
+    STOREX:
+        if (static_cast<uint64_t>(r[ip[2]]) >= static_cast<uint64_t>(ip[4])) return boundsFail();
+        r[ip[1] + r[ip[2]]] = r[ip[3]]; ip += 5; NEXT;
+    GLOADX:
+        if (static_cast<uint64_t>(r[ip[3]]) >= static_cast<uint64_t>(ip[4])) return boundsFail();
+        r[ip[1]] = globals[ip[2] + r[ip[3]]]; ip += 5; NEXT;
+    GSTOREX:
+        if (static_cast<uint64_t>(r[ip[2]]) >= static_cast<uint64_t>(ip[4])) return boundsFail();
+        globals[ip[1] + r[ip[2]]] = r[ip[3]]; ip += 5; NEXT;
+    ZERO:
+        std::memset(r + ip[1], 0, static_cast<size_t>(ip[2]) * sizeof(int64_t)); ip += 3; NEXT;
+
+    ALLOC:
+        if (static_cast<uint64_t>(r[ip[2]]) > MAX_ARRAY_LENGTH) return fail(SIZE_MSG);
+        r[ip[1] + 2] = static_cast<int64_t>(m_heapTop);
+        r[ip[1] + 1] = r[ip[2]];
+        if (!alloc(static_cast<size_t>(r[ip[2]]), r[ip[1]])) return fail(MEMORY_MSG);
+        ip += 3; NEXT;
+    HLOADX:
+        if (static_cast<uint64_t>(r[ip[3]]) >= static_cast<uint64_t>(r[ip[2] + 1])) return boundsFail();
+        r[ip[1]] = m_heap[static_cast<size_t>(r[ip[2]] + r[ip[3]])]; ip += 4; NEXT;
+    HSTOREX:
+        if (static_cast<uint64_t>(r[ip[2]]) >= static_cast<uint64_t>(r[ip[1] + 1])) return boundsFail();
+        m_heap[static_cast<size_t>(r[ip[1]] + r[ip[2]])] = r[ip[3]]; ip += 4; NEXT;
+    RELEASE:
+        m_heapTop = static_cast<size_t>(r[ip[1]]); ip += 2; NEXT;
+
+    // the args are already where the callee's frame starts
+    CALL: {
+        const BcFunction& callee = m_prog.funcs[ip[2]];
+        int64_t* calleeRegs = r + ip[3];
+        if (stackEnd - calleeRegs < static_cast<ptrdiff_t>(callee.frameSize)) {
+            overflow();
+        }
+        m_frames.push_back({code, ip + 4, r, ip[1]});
+        code = callee.code.data();
+        ip = code;
+        r = calleeRegs;
+        NEXT;
+    }
+    RET: {
+        int64_t val = r[ip[1]];
+        const Frame& frame = m_frames.back();
+        code = frame.code;
+        ip = frame.ret;
+        r = frame.regs;
+        r[frame.dst] = val;
+        m_frames.pop_back();
+        NEXT;
+    }
+
+    PRINT:   print(r[ip[1]]); ip += 2; NEXT;
+    READ:    r[ip[1]] = readInt(); ip += 2; NEXT;
+    EXIT:
+        flush();
+        return static_cast<int>(r[ip[1]] & 0xFF);
+
+#undef NEXT
+#undef WRAP
+#undef BRANCH
+    }
+
+private:
+    static constexpr size_t BUF_SIZE = 64 * 1024;
+    static constexpr std::string_view BOUNDS_MSG = "Array index out of range\n";
+    static constexpr std::string_view SIZE_MSG = "Array size out of range\n";
+    static constexpr std::string_view MEMORY_MSG = "Out of memory\n";
+    static constexpr uint64_t MAX_ARRAY_LENGTH = uint64_t{1} << 28;
+
+    struct Frame {
+        const int32_t* code;
+        const int32_t* ret;
+        int64_t* regs;
+        int32_t dst;
+    };
+
+    // the native code traps in idiv, without flushing, and so does this
+    static void checkDiv(int64_t a, int64_t b) {
+        if (b == 0 || (a == INT64_MIN && b == -1)) {
+            std::signal(SIGFPE, SIG_DFL);
+            std::raise(SIGFPE);
+        }
+    }
+
+    static void checkDiv32(int64_t a, int64_t b) {
+        checkDiv(a == INT32_MIN ? INT64_MIN : a, b);
+    }
+
+    [[noreturn]] static void overflow() {
+        std::signal(SIGSEGV, SIG_DFL);
+        std::raise(SIGSEGV);
+        _exit(1);
+    }
+
+    int boundsFail() {
+        return fail(BOUNDS_MSG);
+    }
+
+    int fail(std::string_view msg) {
+        flush();
+        writeAll(STDERR_FILENO, msg.data(), msg.size());
+        return 1;
+    }
+
+    // n zeroed elements at the heap's top, their index in block. what was never
+    // handed out is still zero
+    bool alloc(size_t n, int64_t& block) {
+        size_t top = m_heapTop + n;
+        size_t reused = std::min(top, m_heap.size());
+        if (top > m_heap.size()) {
+            try {
+                m_heap.resize(std::max(top, m_heap.size() * 2));
+            }
+            catch (const std::bad_alloc&) {
+                return false;
+            }
+        }
+        if (reused > m_heapTop) {
+            std::fill(m_heap.begin() + static_cast<ptrdiff_t>(m_heapTop), m_heap.begin() + static_cast<ptrdiff_t>(reused), 0);
+        }
+        block = static_cast<int64_t>(m_heapTop);
+        m_heapTop = top;
+        return true;
+    }
+
+    void print(int64_t val) {
+        if (m_outLen > BUF_SIZE - 32) {
+            flush();
+        }
+        char digits[20];
+        size_t n = 0;
+        uint64_t mag = val < 0 ? 0 - static_cast<uint64_t>(val) : static_cast<uint64_t>(val);
+        do {
+            digits[n++] = static_cast<char>('0' + mag % 10);
+            mag /= 10;
+        } while (mag > 0);
+
+        if (val < 0) {
+            m_out[m_outLen++] = '-';
+        }
+        while (n > 0) {
+            m_out[m_outLen++] = digits[--n];
+        }
+        m_out[m_outLen++] = '\n';
+    }
+
+    void flush() {
+        writeAll(STDOUT_FILENO, m_out, m_outLen);
+        m_outLen = 0;
+    }
+
+    static void writeAll(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = write(fd, data, len);
+            if (n <= 0) {
+                return;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+    }
+
+    // -1 at eof
+    int nextByte() {
+        if (m_inPos >= m_inLen) {
+            ssize_t n = read(STDIN_FILENO, m_in, BUF_SIZE);
+            if (n <= 0) {
+                return -1;
+            }
+            m_inLen = static_cast<size_t>(n);
+            m_inPos = 0;
+        }
+        return static_cast<uint8_t>(m_in[m_inPos++]);
+    }
+
+    // skips anything up to ' ', then an optional '-' and decimal digits. the byte
+    // after the digits is consumed, 0 at eof
+    int64_t readInt() {
+        int c;
+        do {
+            c = nextByte();
+            if (c == -1) {
+                return 0;
+            }
+        } while (c <= ' ');
+
+        bool negative = c == '-';
+        if (negative) {
+            c = nextByte();
+        }
+        uint64_t val = 0;
+        while (static_cast<uint64_t>(c - '0') <= 9) {
+            val = val * 10 + static_cast<uint64_t>(c - '0');
+            c = nextByte();
+        }
+        return static_cast<int64_t>(negative ? 0 - val : val);
+    }
+
+private:
+    BcProgram m_prog;
+    std::vector<int64_t> m_stack;
+    std::vector<int64_t> m_globals;
+    std::vector<Frame> m_frames;
+    std::vector<int64_t> m_heap;
+    size_t m_heapTop = 0;
+
+    char m_out[BUF_SIZE];
+    size_t m_outLen = 0;
+    char m_in[BUF_SIZE];
+    size_t m_inLen = 0;
+    size_t m_inPos = 0;
+};
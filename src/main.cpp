@@ -1,14 +1,9 @@
 #include <iostream>
-#include <sstream>
-#include <fstream>
-#include <locale>
-#include <codecvt>
+#include <string>
+#include <vector>
 
-#include "Tokenizer.h"
-#include "Parser.h"
-#include "Generator.h"
-
-std::u32string readUtf8FileToU32(const std::string& path);
+#include "Driver.h"
+#include "Server.h"
 
 int main(int argc, char* argv[]) {
 
@@ -17,44 +12,21 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    std::string fileName = argv[1];
-
-    std::u32string contents = readUtf8FileToU32(fileName);
-
-    Tokenizer tk(contents, contents.size());
-    auto tokens = tk.tokenize(); 
-
-    Parser p(std::move(tokens));
-    auto prog = p.parseProg();
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::string mode = args.front();
 
-    if (!prog.has_value()) {
-        std::cerr << "Invalid program" << std::endl;
-        exit(1);
+    if (mode == "--serve" || mode.starts_with("--serve=")) {
+        return Server(socketPath(mode)).run();
     }
-
-
-    {
-        Generator g(prog.value());
-        std::ofstream file("out.asm");
-        file << g.genProg();
+    if (mode == "--connect" || mode.starts_with("--connect=")) {
+        return connectAndBuild(socketPath(mode), {args.begin() + 1, args.end()});
+    }
+    if (mode == "run") {
+        return run(parseArgs({args.begin() + 1, args.end()}));
+    }
+    if (mode == "--watch") {
+        return watch({args.begin() + 1, args.end()});
     }
 
-    system("nasm -felf64 out.asm");
-    system("ld out.o -o out");
-
-    return 0;
-}
-
-
-std::u32string readUtf8FileToU32(const std::string& path) {
-    std::ifstream file(path, std::ios::binary);
-    if (!file)
-        throw std::runtime_error("Failed to open file");
-
-    std::ostringstream oss;
-    oss << file.rdbuf();
-    std::string utf8 = oss.str();
-
-    std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> conv;
-    return conv.from_bytes(utf8);
+    return build(parseArgs(args));
 }
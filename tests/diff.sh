@@ -0,0 +1,50 @@
+#!/bin/bash
+# builds every tests/*.dhad at each optimization level and runs it, and runs it
+# with `dhad run` and `dhad run --vm` too. every way, the output followed by
+# "exit <status>" must be what <name>.out holds. input comes from <name>.in when
+# there is one
+cd "$(dirname "$0")/.." || exit 1
+dhad=${DHAD:-./dhad}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+failed=0
+for src in tests/*.dhad; do
+    name=$(basename "$src" .dhad)
+    input=tests/$name.in
+    [ -f "$input" ] || input=/dev/null
+    expected=tests/$name.out
+    if [ ! -f "$expected" ]; then
+        echo "FAIL $name: no $expected"
+        failed=1
+        continue
+    fi
+
+    ways=()
+    for level in -O0 -O1 -O2 -Os; do
+        if ! "$dhad" "$src" -o "$work/$name$level" "$level" --no-cache; then
+            echo "FAIL $name: $level doesn't compile"
+            failed=1
+            continue 2
+        fi
+        "$work/$name$level" < "$input" > "$work/$name$level.out" 2>&1
+        echo "exit $?" >> "$work/$name$level.out"
+        ways+=("$level")
+    done
+    "$dhad" run "$src" --no-cache < "$input" > "$work/$name-run.out" 2>&1
+    echo "exit $?" >> "$work/$name-run.out"
+    "$dhad" run --vm "$src" --no-cache < "$input" > "$work/$name-vm.out" 2>&1
+    echo "exit $?" >> "$work/$name-vm.out"
+    ways+=(-run -vm)
+
+    for way in "${ways[@]}"; do
+        if ! diff -q "$expected" "$work/$name$way.out" > /dev/null; then
+            echo "FAIL $name: ${way#-} differs from $expected"
+            diff "$expected" "$work/$name$way.out" | head -5
+            failed=1
+        fi
+    done
+done
+
+[ $failed -eq 0 ] && echo "all pass"
+exit $failed